@@ -0,0 +1,167 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "message.h"
+#include "mem.h"
+#include "callgraph.h"
+
+// ************************************************************************
+// 
+// ************************************************************************
+#define CG_SLOTS_MIN		1024
+
+void callgraph_init(struct callgraph *cg)
+{
+	MEM_INIT(cg->node, cg->nnode);
+	
+	cg->slot = NULL;
+	cg->nslot = 0;
+	
+	cg->chains = 0;
+	cg->frames = 0;
+}
+
+void callgraph_clear(struct callgraph *cg)
+{
+	MEM_CLEAR(cg->node, cg->nnode);
+	
+	free(cg->slot);
+	cg->slot = NULL;
+	cg->nslot = 0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static inline uint64_t cg_hash(uint64_t parent, const struct cg_frame *f)
+{
+	uint64_t h = parent * 0x9e3779b97f4a7c15;
+	
+	h ^= f->dso + 0x632be59bd9b4e019 + (h << 6) + (h >> 2);
+	h ^= f->insn + 0x8cb92ba72f3d8dd7 + (h << 6) + (h >> 2);
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9;
+	h ^= h >> 32;
+	
+	return h;
+}
+
+static int cg_rehash(struct callgraph *cg)
+{
+	size_t n = (cg->nslot) ? 2 * cg->nslot : CG_SLOTS_MIN;
+	uint64_t *slot = calloc(n, sizeof(uint64_t));
+	
+	if (slot == NULL) {
+		ERROR("calloc(%zd slots): %s\n", n, strerror(errno));
+		return -1;
+	}
+	
+	for (size_t id = 1; id < cg->nnode; id++) {
+		struct cg_node *x = &cg->node[id];
+		size_t s = cg_hash(x->parent, &x->frame) & (n - 1);
+		
+		while (slot[s])
+			s = (s + 1) & (n - 1);
+		
+		slot[s] = id + 1;
+	}
+	
+	free(cg->slot);
+	cg->slot = slot;
+	cg->nslot = n;
+	
+	return 0;
+}
+
+// child of parent for frame f, created if needed; (uint64_t)-1 on error
+static uint64_t cg_child(struct callgraph *cg, uint64_t parent,
+	const struct cg_frame *f)
+{
+	if (2 * cg->nnode >= cg->nslot) {
+		if (cg_rehash(cg))
+			return (uint64_t)-1;
+	}
+	
+	size_t mask = cg->nslot - 1;
+	size_t s = cg_hash(parent, f) & mask;
+	
+	while (cg->slot[s]) {
+		uint64_t id = cg->slot[s] - 1;
+		struct cg_node *x = &cg->node[id];
+		
+		if ((x->parent == parent) && (x->frame.dso == f->dso)
+		&&  (x->frame.insn == f->insn))
+			return id;
+		
+		s = (s + 1) & mask;
+	}
+	
+	uint64_t id = cg->nnode;
+	
+	if (MEM_RESIZE(cg->node, cg->nnode, id + 1))
+		return (uint64_t)-1;
+	
+	cg->node[id].parent = parent;
+	cg->node[id].frame = *f;
+	cg->node[id].count = 0;
+	cg->node[id].self = 0;
+	
+	cg->slot[s] = id + 1;
+	
+	return id;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int callgraph_add(struct callgraph *cg, const struct cg_frame *frame,
+	size_t nf, uint64_t n)
+{
+	uint64_t id = CG_ROOT;
+	
+	// root, created with the first chain
+	if (cg->nnode == 0) {
+		if (MEM_RESIZE(cg->node, cg->nnode, 1))
+			return -1;
+		
+		cg->node[CG_ROOT].parent = CG_ROOT;
+		cg->node[CG_ROOT].frame.dso = CG_UNKNOWN;
+		cg->node[CG_ROOT].frame.insn = CG_UNKNOWN;
+		cg->node[CG_ROOT].count = 0;
+		cg->node[CG_ROOT].self = 0;
+	}
+	
+	cg->node[CG_ROOT].count += n;
+	
+	for (size_t k = 0; k < nf; k++) {
+		id = cg_child(cg, id, &frame[k]);
+		
+		if (id == (uint64_t)-1)
+			return -1;
+		
+		cg->node[id].count += n;
+	}
+	
+	cg->node[id].self += n;
+	
+	cg->chains += n;
+	cg->frames += nf;
+	
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+#include <stddef.h>
+#include <stdint.h>
+
+// ************************************************************************
+// Call chains, as a trie of frames from the sampled insn outwards (callee
+// first). Nodes are hash-consed on (parent, dso, insn), so that chains
+// share their common prefixes, and memory grows with distinct chains, not
+// with samples.
+// ************************************************************************
+#define CG_ROOT			0
+#define CG_UNKNOWN		((uint64_t)-1)
+
+// dso id and insn index (CG_UNKNOWN if not resolved)
+struct cg_frame {
+	uint64_t dso, insn;
+};
+
+struct cg_node {
+	uint64_t parent;
+	struct cg_frame frame;
+	
+	// samples whose chain starts with, or is exactly, this path
+	uint64_t count, self;
+};
+
+struct callgraph {
+	struct cg_node *node;
+	size_t nnode;
+	
+	// open addressing, node id + 1 per slot (0: empty)
+	uint64_t *slot;
+	size_t nslot;
+	
+	// stats
+	uint64_t chains, frames;
+};
+
+void callgraph_init(struct callgraph *cg);
+void callgraph_clear(struct callgraph *cg);
+
+// n samples of the chain of nf frames, the sampled insn first
+int  callgraph_add(struct callgraph *cg, const struct cg_frame *frame,
+	size_t nf, uint64_t n);
+
+#endif
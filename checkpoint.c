@@ -0,0 +1,366 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "message.h"
+#include "mem.h"
+#include "tally.h"
+#include "checkpoint.h"
+
+// ************************************************************************
+// File: magic, then the input id (length and bytes); then segments, each
+// a header followed by a saved tally (see tally_save()). A segment cut
+// short (the process died while writing it) is dropped on resume.
+// ************************************************************************
+#define CHECKPOINT_MAGIC	0x3130504b43465048ULL	// "HPFCKP01"
+#define CHECKPOINT_SEGMENT	0x544e454d47455348ULL	// "HSEGMENT"
+
+struct checkpoint_segment {
+	uint64_t magic;
+	uint64_t size;
+	uint64_t pos;
+	uint64_t lines, parsed;
+	uint64_t time0;
+	uint64_t complete;
+};
+
+static uint64_t checkpoint_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int checkpoint_write(struct checkpoint *c, const void *b, size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(c->fd, b, n);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ERROR("%s: write(): %s\n", c->path, strerror(errno));
+			return -1;
+		}
+
+		b = (const uint8_t *)b + w;
+		n -= w;
+	}
+
+	return 0;
+}
+
+// 1 if read entirely, 0 at the end of the file (or short of n bytes)
+static int checkpoint_read(struct checkpoint *c, uint64_t offs,
+	void *b, size_t n)
+{
+	while (n > 0) {
+		ssize_t r = pread(c->fd, b, n, offs);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ERROR("%s: read(): %s\n", c->path, strerror(errno));
+			return -1;
+		}
+
+		if (r == 0)
+			return 0;
+
+		b = (uint8_t *)b + r;
+		n -= r;
+		offs += r;
+	}
+
+	return 1;
+}
+
+static int checkpoint_reset(struct checkpoint *c)
+{
+	tally_clear(&c->tally);
+
+	if (tally_init(&c->tally))
+		return -1;
+
+	c->tally.primary = c->prog->event[0];
+	c->tally.prog = c->prog;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static int checkpoint_create(struct checkpoint *c, const char *id)
+{
+	uint64_t h[2] = { CHECKPOINT_MAGIC, strlen(id) };
+
+	if (checkpoint_write(c, h, sizeof(h))
+	||  checkpoint_write(c, id, h[1]))
+		return -1;
+
+	return 0;
+}
+
+static int checkpoint_resume(struct checkpoint *c, const char *id)
+{
+	uint64_t h[2];
+	size_t n = strlen(id);
+
+	int r = checkpoint_read(c, 0, h, sizeof(h));
+
+	if ((r > 0) && (h[0] != CHECKPOINT_MAGIC))
+		r = 0;
+
+	if (r == 0)
+		ERROR("%s: not a checkpoint file\n", c->path);
+
+	if (r <= 0)
+		return -1;
+
+	if ((h[1] == n) && MEM_RESIZE(c->buf, c->nbuf, n))
+		return -1;
+
+	if ((h[1] != n) || (checkpoint_read(c, sizeof(h), c->buf, n) <= 0)
+	||  (memcmp(c->buf, id, n) != 0)) {
+		ERROR("%s: checkpoint of another input, or other options\n",
+			c->path);
+		return -1;
+	}
+
+	// the last complete segment gives the position
+	uint64_t offs = sizeof(h) + n;
+	struct checkpoint_segment s;
+
+	while (1) {
+		r = checkpoint_read(c, offs, &s, sizeof(s));
+
+		if (r < 0)
+			return -1;
+
+		if ((r == 0) || (s.magic != CHECKPOINT_SEGMENT))
+			break;
+
+		// the payload is complete if its last byte is there
+		uint8_t last;
+
+		if (s.size > 0) {
+			r = checkpoint_read(c, offs + sizeof(s) + s.size - 1,
+				&last, 1);
+
+			if (r < 0)
+				return -1;
+
+			if (r == 0)
+				break;
+		}
+
+		offs += sizeof(s) + s.size;
+
+		c->pos = s.pos;
+		c->lines = s.lines;
+		c->parsed = s.parsed;
+		c->complete = (s.complete != 0);
+		c->segments++;
+
+		if ((s.time0 != PROG_TIME_NONE)
+		&&  (c->prog->time0 == PROG_TIME_NONE))
+			c->prog->time0 = s.time0;
+	}
+
+	if ((ftruncate(c->fd, offs) != 0) || (lseek(c->fd, offs, SEEK_SET) < 0)) {
+		ERROR("%s: %s\n", c->path, strerror(errno));
+		return -1;
+	}
+
+	if (c->complete)
+		MESSAGE("  resuming: %zd checkpoints, input read entirely\n",
+			c->segments);
+	else
+		MESSAGE("  resuming: %zd checkpoints, from position %lu\n",
+			c->segments, c->pos);
+
+	return 0;
+}
+
+int checkpoint_open(struct checkpoint *c, char *path, int resume,
+	const char *id, struct prog *p)
+{
+	c->path = path;
+	c->prog = p;
+	c->pos = 0;
+	c->lines = 0;
+	c->parsed = 0;
+	c->complete = 0;
+	c->segments = 0;
+	c->ticks = 0;
+	c->due = checkpoint_clock() + (uint64_t)CHECKPOINT_SECS * 1000000000;
+	c->pending = 0;
+
+	c->fd = -1;
+
+	MEM_INIT(c->buf, c->nbuf);
+
+	if (tally_init(&c->tally)) {
+		checkpoint_close(c);
+		return -1;
+	}
+
+	c->tally.primary = p->event[0];
+	c->tally.prog = p;
+
+	int flags = O_RDWR | O_CLOEXEC | ((resume) ? 0 : O_CREAT | O_TRUNC);
+
+	c->fd = open(path, flags, 0644);
+
+	if (c->fd < 0) {
+		ERROR("%s: %s\n", path, strerror(errno));
+		checkpoint_close(c);
+		return -1;
+	}
+
+	int r = (resume) ? checkpoint_resume(c, id) : checkpoint_create(c, id);
+
+	if (r)
+		checkpoint_close(c);
+
+	return r;
+}
+
+void checkpoint_close(struct checkpoint *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+
+	c->fd = -1;
+
+	tally_clear(&c->tally);
+	MEM_CLEAR(c->buf, c->nbuf);
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int checkpoint_due(struct checkpoint *c)
+{
+	if (c->pending)
+		return 1;
+
+	if ((++c->ticks % CHECKPOINT_TICKS) != 0)
+		return 0;
+
+	c->pending = (checkpoint_clock() >= c->due);
+
+	return c->pending;
+}
+
+int checkpoint_save(struct checkpoint *c, uint64_t pos, size_t lines,
+	size_t parsed, int complete)
+{
+	struct checkpoint_segment s;
+
+	c->nbuf = 0;
+
+	if (tally_save(&c->tally, &c->buf, &c->nbuf))
+		return -1;
+
+	s.magic = CHECKPOINT_SEGMENT;
+	s.size = c->nbuf;
+	s.pos = pos;
+	s.lines = lines;
+	s.parsed = parsed;
+	s.time0 = c->prog->time0;
+	s.complete = complete;
+
+	if (checkpoint_write(c, &s, sizeof(s))
+	||  checkpoint_write(c, c->buf, c->nbuf))
+		return -1;
+
+	if (fdatasync(c->fd) != 0) {
+		ERROR("%s: fdatasync(): %s\n", c->path, strerror(errno));
+		return -1;
+	}
+
+	c->pos = pos;
+	c->lines = lines;
+	c->parsed = parsed;
+	c->complete = complete;
+	c->segments++;
+
+	c->pending = 0;
+	c->due = checkpoint_clock() + (uint64_t)CHECKPOINT_SECS * 1000000000;
+
+	if (!complete)
+		MESSAGE("  [checkpoint %zd: position %lu]\n", c->segments, pos);
+
+	return checkpoint_reset(c);
+}
+
+// ************************************************************************
+// The tallies are replayed in order, each after its mmaps and task events,
+// so that samples see the address spaces as of the end of their segment
+// (as with time slices, see trace.c)
+// ************************************************************************
+int checkpoint_replay(struct checkpoint *c)
+{
+	struct prog *p = c->prog;
+	uint64_t offs = 2 * sizeof(uint64_t);
+	uint64_t n;
+
+	if (checkpoint_read(c, sizeof(uint64_t), &n, sizeof(n)) <= 0)
+		return -1;
+
+	offs += n;
+
+	for (size_t k = 0; k < c->segments; k++) {
+		struct checkpoint_segment s;
+
+		if ((checkpoint_read(c, offs, &s, sizeof(s)) <= 0)
+		||  MEM_RESIZE(c->buf, c->nbuf, s.size))
+			return -1;
+
+		if ((s.size > 0) && (checkpoint_read(c, offs + sizeof(s),
+				c->buf, s.size) <= 0))
+			return -1;
+
+		offs += sizeof(s) + s.size;
+
+		if (checkpoint_reset(c))
+			return -1;
+
+		if (tally_load(&c->tally, c->buf, s.size)) {
+			ERROR("%s: corrupt checkpoint %zd\n", c->path, k + 1);
+			return -1;
+		}
+
+		if (tally_spaces(&c->tally, p, 0, (uint64_t)-1)
+		||  tally_replay(&c->tally, p))
+			return -1;
+	}
+
+	return checkpoint_reset(c);
+}
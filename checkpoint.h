@@ -0,0 +1,75 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "prog.h"
+#include "tally.h"
+
+// ************************************************************************
+// Checkpoints of a trace load: the events read are tallied rather than
+// resolved, and every CHECKPOINT_SECS seconds the tally is appended to the
+// checkpoint file with the input position (lines of perf script output, or
+// perf.data record offset), then emptied. Once the input is read, the
+// saved tallies are replayed in order. A resumed load goes on from the
+// last position saved, or only replays if the input was read entirely.
+// ************************************************************************
+#define CHECKPOINT_SECS		60
+
+// clock looked at every so many checkpoint_due() calls
+#define CHECKPOINT_TICKS	1024
+
+struct checkpoint {
+	char *path;
+	int fd;
+
+	// events since the last save; their timeline buckets are those of
+	// prog, whose origin is saved too
+	struct tally tally;
+	struct prog *prog;
+
+	// last save: input position and trace stats, and whether the input
+	// was read entirely
+	uint64_t pos;
+	size_t lines, parsed;
+	int complete;
+	size_t segments;
+
+	uint64_t ticks, due;
+	int pending;
+
+	uint8_t *buf;
+	size_t nbuf;
+};
+
+// new checkpoint file, or resumed one (whose input id must match)
+int  checkpoint_open(struct checkpoint *c, char *path, int resume,
+	const char *id, struct prog *p);
+void checkpoint_close(struct checkpoint *c);
+
+// 1 once a save is due (see CHECKPOINT_SECS)
+int  checkpoint_due(struct checkpoint *c);
+
+// appends the tally, then empties it
+int  checkpoint_save(struct checkpoint *c, uint64_t pos, size_t lines,
+	size_t parsed, int complete);
+
+// replays every saved tally into the prog
+int  checkpoint_replay(struct checkpoint *c);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include "message.h"
+#include "diag.h"
+
+struct diag_cat {
+	const char *name;
+	uint64_t count;
+	int nexample;
+	char example[DIAG_EXAMPLES][DIAG_LEN];
+};
+
+static struct diag_cat diag_cat[DIAGS] = {
+	[DIAG_SAMPLE_NO_MMAP]  = { .name = "sample ip without mmap" },
+	[DIAG_SAMPLE_MISMATCH] = { .name = "sample dso mismatch" },
+	[DIAG_BRANCH_NO_MMAP]  = { .name = "branch ip without mmap" },
+	[DIAG_BRANCH_MISMATCH] = { .name = "branch dso mismatch" },
+	[DIAG_SYM_FALLBACK]    = { .name = "fallback symbol lookup" },
+	[DIAG_FOFFS_MISS]      = { .name = "file offset outside code" },
+};
+
+int diag_verbose = 0;
+
+// ************************************************************************
+//
+// ************************************************************************
+static void diag_v(int cat, uint64_t n, const char *format, va_list ap)
+{
+	struct diag_cat *c = &diag_cat[cat];
+
+	c->count += n;
+
+	if (diag_verbose > 0) {
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		return;
+	}
+
+	if (c->nexample >= DIAG_EXAMPLES)
+		return;
+
+	vsnprintf(c->example[c->nexample++], DIAG_LEN, format, ap);
+}
+
+void diag(int cat, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	diag_v(cat, 1, format, ap);
+	va_end(ap);
+}
+
+void diag_n(int cat, uint64_t n, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	diag_v(cat, n, format, ap);
+	va_end(ap);
+}
+
+static uint64_t diag_total(void)
+{
+	uint64_t total = 0;
+
+	for (int k = 0; k < DIAGS; k++)
+		total += diag_cat[k].count;
+
+	return total;
+}
+
+void diag_report(void)
+{
+	if (diag_total() == 0)
+		return;
+
+	MESSAGE("  unresolved:\n");
+
+	for (int k = 0; k < DIAGS; k++) {
+		struct diag_cat *c = &diag_cat[k];
+
+		if (c->count == 0)
+			continue;
+
+		MESSAGE("    %-26s %12lu\n", c->name, c->count);
+
+		if (diag_verbose > 0)
+			continue;
+
+		for (int e = 0; e < c->nexample; e++)
+			MESSAGE("        %s\n", c->example[e]);
+	}
+
+	if (diag_verbose == 0)
+		MESSAGE("  (-v 1 prints each of them)\n");
+}
@@ -0,0 +1,53 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef DIAG_H
+#define DIAG_H
+#include <stdint.h>
+
+// ************************************************************************
+// Per-event diagnostics (addresses that do not resolve cleanly), counted
+// by category. By default, only the first few of each category are kept,
+// and printed with the counts by diag_report(); at verbosity 1 or more
+// (-v), each is printed as it happens.
+// ************************************************************************
+enum {
+	DIAG_SAMPLE_NO_MMAP = 0,
+	DIAG_SAMPLE_MISMATCH,
+	DIAG_BRANCH_NO_MMAP,
+	DIAG_BRANCH_MISMATCH,
+	DIAG_SYM_FALLBACK,
+	DIAG_FOFFS_MISS,
+	DIAGS
+};
+
+// examples kept per category, and their length
+#define DIAG_EXAMPLES		3
+#define DIAG_LEN		160
+
+extern int diag_verbose;
+
+// one event, or n of them alike: samples gathered by ip are resolved once
+// for all of them (see prog.h)
+void diag(int cat, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+void diag_n(int cat, uint64_t n, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+// prints the counts and examples, if any
+void diag_report(void);
+
+#endif
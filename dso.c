@@ -15,16 +15,26 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #define _GNU_SOURCE
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <elf.h>
 #include "message.h"
+#include "diag.h"
 #include "mem.h"
 #include "pipe.h"
+#include "reader.h"
 #include "token.h"
+#include "jit.h"
 #include "dso.h"
 
+// load messages, unless left to the caller
+#define DSO_MESSAGE(dso, ...)	\
+	do { if (!(dso)->quiet) MESSAGE(__VA_ARGS__); } while (0)
+
 
 // ************************************************************************
 // 
@@ -34,6 +44,10 @@ int dso_init(struct dso *dso, char *path)
 	strncpy(dso->path, path, sizeof(dso->path) - 1);
 	dso->path[sizeof(dso->path) - 1] = 0;
 	
+	dso->jitdump = NULL;
+	dso->quiet = 0;
+	dso->placeholders = 0;
+	
 	MEM_INIT(dso->insn, dso->ninsn);
 	MEM_INIT(dso->sym, dso->nsym);
 	MEM_INIT(dso->func, dso->nfunc);
@@ -50,6 +64,22 @@ int dso_init(struct dso *dso, char *path)
 	dso->unspec = 0;
 	dso->orphans = 0;
 	
+	for (int e = 0; e < DSO_EVENTS; e++) {
+		dso->insn_ev[e] = NULL;
+		dso->sym_ev[e] = NULL;
+		dso->func_ev[e] = NULL;
+		dso->file_ev[e] = NULL;
+		dso->period[e] = 0;
+	}
+	
+	dso->updates = 0;
+	
+	sparse_init(&dso->tid_hits);
+	sparse_init(&dso->cpu_hits);
+	sparse_init(&dso->time_hits);
+	sparse_init(&dso->mem_id);
+	MEM_INIT(dso->mem, dso->nmem);
+	
 	if (r)
 		dso_clear(dso);
 	
@@ -71,6 +101,23 @@ void dso_clear(struct dso *dso)
 	map_clear(&dso->sym_id);
 	map_clear(&dso->func_id);
 	map_clear(&dso->file_id);
+	
+	sparse_clear(&dso->tid_hits);
+	sparse_clear(&dso->cpu_hits);
+	sparse_clear(&dso->time_hits);
+	sparse_clear(&dso->mem_id);
+	MEM_CLEAR(dso->mem, dso->nmem);
+	
+	for (int e = 0; e < DSO_EVENTS; e++) {
+		free(dso->insn_ev[e]);
+		free(dso->sym_ev[e]);
+		free(dso->func_ev[e]);
+		free(dso->file_ev[e]);
+		dso->insn_ev[e] = NULL;
+		dso->sym_ev[e] = NULL;
+		dso->func_ev[e] = NULL;
+		dso->file_ev[e] = NULL;
+	}
 }
 
 
@@ -84,8 +131,36 @@ struct state {
 	uint32_t line;
 	uint32_t disc;
 	int ready;
+	
+	// JIT code image, and the piece of code of the last insn
+	struct jit *jit;
+	size_t code;
+	
+	// kernel symbol, and its first objdump block: address and file
+	// offset, and count of blocks seen (same name symbols may follow)
+	struct ksym *ksym;
+	uint64_t kaddr, kfoffs;
+	int kblock;
 };
 
+static void dso_state_init(struct state *s)
+{
+	s->sym_id = (uint64_t)-1;
+	s->func_id = (uint64_t)-1;
+	s->file_id = (uint64_t)-1;
+	s->line = 0;
+	s->disc = 0;
+	s->ready = 0;
+	
+	s->jit = NULL;
+	s->code = JIT_NONE;
+	
+	s->ksym = NULL;
+	s->kaddr = 0;
+	s->kfoffs = 0;
+	s->kblock = 0;
+}
+
 // ************************************************************************
 // 
 // ************************************************************************
@@ -110,6 +185,7 @@ static int dso_set_sym(struct dso *dso, struct state *s,
 	dso->sym[k].insn = dso->ninsn;
 	dso->sym[k].hits = 0;
 	dso->sym[k].multiple = 0;
+	dso->sym[k].size = 0;
 
 	if (found) {
 		//DEBUG("\t=== %s: duplicate symbol: %s (%ld and %ld)\n",
@@ -254,7 +330,7 @@ static int dso_parse_sym(struct dso *dso, struct state *s, char *b, size_t l)
 		return 0;
 	
 	char *e;
-	uint64_t addr = hexparse(b, &e);
+	uint64_t addr = hexparse_padded(b, &e);
 	
 	if (e == b)
 		return 0;
@@ -274,7 +350,7 @@ static int dso_parse_sym(struct dso *dso, struct state *s, char *b, size_t l)
 	
 	char *g;
 	
-	uint64_t foffs = hexparse(e + 18, &g);
+	uint64_t foffs = hexparse_padded(e + 18, &g);
 	
 	if ((g[0] != ')') || (g[1] != ':') || (g[2] != 0))
 		return 0;
@@ -337,7 +413,7 @@ static int dso_parse_file(struct dso *dso, struct state *s, char *b, size_t l)
 		if (memcmp(b + offs - 15, " (discriminator ", 16) != 0)
 			return -1;
 		
-		disc = decparse(b + offs + 1, NULL);
+		disc = decparse_padded(b + offs + 1, NULL);
 		
 		offs -= 16;
 	}
@@ -348,7 +424,7 @@ static int dso_parse_file(struct dso *dso, struct state *s, char *b, size_t l)
 	if ((offs == 0) || (b[offs] != ':'))
 		return 0;
 	
-	uint64_t line = decparse(b + offs + 1, NULL);
+	uint64_t line = decparse_padded(b + offs + 1, NULL);
 	
 	b[offs] = 0;
 	
@@ -404,7 +480,7 @@ static uint64_t dso_parse_target(char *b, size_t l)
 	char *oh = ot + 17;
 	
 	char *e;
-	uint64_t foffs = hexparse(oh, &e);
+	uint64_t foffs = hexparse_padded(oh, &e);
 	
 	if ((e[0] != ')') || (e[1] != 0))
 		return DSO_INSN_NONE;
@@ -424,7 +500,7 @@ static int dso_parse_insn(struct dso *dso, struct state *s, char *b, size_t l)
 		a++;
 	
 	char *e;
-	uint64_t addr = hexparse(a, &e);
+	uint64_t addr = hexparse_padded(a, &e);
 	
 	if ((e == a) || (*e != ':'))
 		return 0;
@@ -536,7 +612,36 @@ static size_t dso_locate_foffs(struct dso *dso, uint64_t foffs,
 }
 
 // ************************************************************************
-static size_t dso_locate_sym(struct dso *dso, char *sym, uint64_t offs)
+// Symbols without code: the placeholder insn of the symbol spanning foffs
+// ************************************************************************
+static size_t dso_locate_placeholder(struct dso *dso, uint64_t foffs)
+{
+	size_t lo = 0;
+	size_t hi = dso->ninsn;
+	
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		
+		if (dso->insn[mid].foffs <= foffs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	if (lo == 0)
+		return DSO_INSN_NONE;
+	
+	struct insn *x = &dso->insn[lo - 1];
+	
+	if ((x->count != 0) || (foffs >= x->foffs + dso->sym[x->sym_id].size))
+		return DSO_INSN_NONE;
+	
+	return lo - 1;
+}
+
+// ************************************************************************
+static size_t dso_locate_sym(struct dso *dso, char *sym, uint64_t offs,
+	uint64_t calls)
 {
 	uint64_t k;
 	int found;
@@ -586,7 +691,7 @@ static size_t dso_locate_sym(struct dso *dso, char *sym, uint64_t offs)
 	
 	size_t i = dso_locate_foffs(dso, foffs, i0, i1);
 	
-	DEBUG("\t=== %s: fallback sym lookup %s+0x%lx: insn %zd %s.\n",
+	diag_n(DIAG_SYM_FALLBACK, calls, "%s: %s+0x%lx: insn %zd %s",
 		dso->path, sym, offs,
 		(i != DSO_INSN_NONE) ? i : 0,
 		(i != DSO_INSN_NONE) ? "succeeded" : "failed");
@@ -622,116 +727,338 @@ static void dso_resolve_targets(struct dso *dso)
 		}
 	}
 	
-	MESSAGE("      targ: %9zd / %9zd\n", resolved, targets);
+	DSO_MESSAGE(dso, "      targ: %9zd / %9zd\n", resolved, targets);
 }
 
 // ************************************************************************
-// 
+// JIT code image (see jit_image()): insns are at image offsets, each piece
+// of code starting a symbol, and its padding skipped
 // ************************************************************************
-int dso_load(struct dso *dso)
+static int dso_parse_jit(struct dso *dso, struct state *s, char *b, size_t l)
 {
-	if (dso->path[0] == '[')
+	(void)l;
+	
+	char *a = b;
+	
+	while ((*a == ' ') || (*a == '\t'))
+		a++;
+	
+	char *e;
+	uint64_t offs = hexparse_padded(a, &e);
+	
+	if (e == a)
 		return 0;
 	
-	size_t len = strlen(dso->path);
+	// image symbol, e.g. "0000000000000000 <.data> (File Offset: 0x0):"
+	if ((e[0] == ' ') && (e[1] == '<')) {
+		s->ready = 1;
+		return 0;
+	}
 	
-	if ((len > 3) && (memcmp(dso->path + len - 3, ".xz", 3) == 0))
+	if (*e != ':')
 		return 0;
 	
-	char *argv[5];
-	int k = 0;
+	size_t k = jit_at(s->jit, offs);
 	
-	argv[k++] = "objdump";
-	argv[k++] = "-dlwF";
-	argv[k++] = "-Mintel";
-	argv[k++] = dso->path;
-	argv[k++] = NULL;
+	if (k == JIT_NONE) {
+		s->ready = 1;
+		return 0;
+	}
+	
+	if (k != s->code) {
+		struct jit_code *c = &s->jit->code[k];
+		
+		if (dso_set_sym(dso, s, c->addr, c->offs, c->name))
+			return -1;
+		
+		dso->sym[s->sym_id].size = c->size;
+		s->code = k;
+	}
+	
+	return 0;
+}
+
+// ************************************************************************
+// Kernel symbol (objdump --disassemble=SYMBOL): only the first block is
+// kept, and only up to the next kallsyms symbol. The symbol is set at its
+// first insn, at its kallsyms address.
+// ************************************************************************
+static int dso_parse_kernel(struct dso *dso, struct state *s, char *b,
+	size_t l)
+{
+	(void)l;
+	
+	if (s->kblock > 1) {
+		s->ready = 1;
+		return 0;
+	}
+	
+	char *a = b;
+	
+	while ((*a == ' ') || (*a == '\t'))
+		a++;
+	
+	char *e;
+	uint64_t addr = hexparse_padded(a, &e);
+	
+	if (e == a)
+		return 0;
+	
+	if ((e[0] == ' ') && (e[1] == '<')) {
+		char *f = strstr(e, "> (File Offset: 0x");
+		
+		s->ready = 1;
+		
+		if ((s->kblock++ > 0) || (f == NULL)) {
+			s->kblock = 2;
+			return 0;
+		}
+		
+		s->kaddr = addr;
+		s->kfoffs = hexparse_padded(f + 18, &f);
+		
+		return 0;
+	}
+	
+	if ((*e != ':') || (s->kblock != 1))
+		return 0;
+	
+	if (addr - s->kaddr >= s->ksym->size) {
+		s->ready = 1;
+		return 0;
+	}
+	
+	if (s->sym_id != (uint64_t)-1)
+		return 0;
+	
+	if (dso_set_sym(dso, s, s->ksym->addr, s->kaddr, s->ksym->name))
+		return -1;
+	
+	dso->sym[s->sym_id].size = s->ksym->size;
+	
+	return 0;
+}
+
+// ************************************************************************
+// Code not disassembled where it runs (JIT, kernel): insns and symbols are
+// moved to their addresses (as file offsets), and so are branch targets,
+// also in the disassembly, where objdump printed them last ("0xADDRESS"
+// for raw code, "ADDRESS <symbol+offset>" otherwise)
+// ************************************************************************
+static int dso_set_target(struct dso *dso, struct insn *x, uint64_t addr)
+{
+	char *d = x->disasm;
+	char *sym = NULL;
+	
+	for (char *c = strstr(d, " <"); c; c = strstr(c + 1, " <"))
+		sym = c;
+	
+	size_t end = (sym) ? (size_t)(sym - d) : strlen(d);
+	size_t start = end;
+	
+	while ((start > 0) && (d[start - 1] != ' '))
+		start--;
+	
+	char *h = d + start;
+	int prefix = (h[0] == '0') && (h[1] == 'x');
+	
+	hexparse(h + 2 * prefix, &h);
+	
+	if ((start == end) || (h != d + end))
+		return 0;
+	
+	char buff[256];
+	
+	snprintf(buff, sizeof(buff), "%.*s%s%lx%s", (int)start, d,
+		(prefix) ? "0x" : "", addr, (sym) ? sym : "");
+	
+	char *store = obstack_dup(&dso->disasm, buff);
+	
+	if (store == NULL)
+		return -1;
+	
+	x->disasm = store;
+	
+	return 0;
+}
+
+static int dso_jit_addr(struct dso *dso, struct jit *j)
+{
+	for (size_t i = 0; i < dso->ninsn; i++) {
+		struct insn *x = &dso->insn[i];
+		uint64_t t = x->target_insn;
+		
+		x->addr = x->foffs;
+		
+		if (t == DSO_INSN_NONE)
+			continue;
+		
+		size_t k = jit_at(j, t);
+		
+		if (k == JIT_NONE) {
+			x->target_insn = DSO_INSN_NONE;
+			continue;
+		}
+		
+		x->target_insn = j->code[k].addr + (t - j->code[k].offs);
+		
+		if (dso_set_target(dso, x, x->target_insn))
+			return -1;
+	}
+	
+	for (size_t k = 0; k < dso->nsym; k++)
+		dso->sym[k].addr = dso->sym[k].foffs;
+	
+	return 0;
+}
+
+// kernel symbol, insns from i0 on; only branches within it are kept
+static int dso_kernel_addr(struct dso *dso, struct state *s, size_t i0)
+{
+	for (size_t i = i0; i < dso->ninsn; i++) {
+		struct insn *x = &dso->insn[i];
+		uint64_t t = x->target_insn;
+		
+		x->addr = x->foffs;
+		
+		if (t == DSO_INSN_NONE)
+			continue;
+		
+		if ((t < s->kfoffs) || (t - s->kfoffs >= s->ksym->size)) {
+			x->target_insn = DSO_INSN_NONE;
+			continue;
+		}
+		
+		x->target_insn = s->ksym->addr + (t - s->kfoffs);
+		
+		if (dso_set_target(dso, x, x->target_insn))
+			return -1;
+	}
+	
+	dso->sym[s->sym_id].addr = dso->sym[s->sym_id].foffs;
 	
+	return 0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int dso_objdump(struct dso *dso, char **argv, struct state *s)
+{
 	int fd = pipe_in(argv);
 	
 	if (fd < 0)
 		return -1;
 	
-	FILE *f = fdopen(fd, "r");
+	struct reader rd;
 	
-	if (!f) {
-		ERROR("fdopen(pipefd): %s\n", strerror(errno));
+	if (reader_open(&rd, fd)) {
 		close(fd);
 		return -1;
 	}
 	
-	MESSAGE("    %s:\n", dso->path);
-	
-	char buff[4096];
 	int r = -1;
 	
-	struct state s;
-	
-	s.sym_id = (uint64_t)-1;
-	s.func_id = (uint64_t)-1;
-	s.file_id = (uint64_t)-1;
-	s.line = 0;
-	s.disc = 0;
-	
 	while (1) {
 		if ((dso->ninsn > 0) && ((dso->ninsn & 0x7ffff) == 0))
-			MESSAGE("      [insn: %6zd k]\n", dso->ninsn >> 10);
+			DSO_MESSAGE(dso, "      [insn: %6zd k]\n",
+				dso->ninsn >> 10);
 		
-		if (fgets(buff, sizeof(buff), f) != buff) {
-			if (ferror(f)) {
-				ERROR("fgets(): %s\n", strerror(errno));
-				break;
-			}
-			
-			r = 0;
+		char *buff;
+		size_t len;
+		int rl = reader_line(&rd, &buff, &len);
+		
+		if (rl <= 0) {
+			r = rl;
 			break;
 		}
 		
-		size_t len = strlen(buff);
+		s->ready = 0;
 		
-		if ((len > 0) && (buff[len - 1] == '\n')) {
-			len--;
-			buff[len] = 0;
-		}
+		if (s->jit && dso_parse_jit(dso, s, buff, len))
+			break;
 		
-		s.ready = 0;
+		if (s->ksym && dso_parse_kernel(dso, s, buff, len))
+			break;
 		
-		if (dso_parse_file(dso, &s, buff, len))
+		if (s->ready)
+			continue;
+		
+		if (dso_parse_file(dso, s, buff, len))
 			break;
 
-		if (s.ready)
+		if (s->ready)
 			continue;
 		
-		if (dso_parse_insn(dso, &s, buff, len))
+		if (dso_parse_insn(dso, s, buff, len))
 			break;
 		
-		if (s.ready)
+		if (s->ready)
 			continue;
 		
-		if (dso_parse_func(dso, &s, buff, len))
+		if (dso_parse_func(dso, s, buff, len))
 			break;
 		
-		if (s.ready)
+		if (s->ready)
 			continue;
 		
-		if (dso_parse_sym(dso, &s, buff, len))
+		if (dso_parse_sym(dso, s, buff, len))
 			break;
 		
-		if (s.ready)
+		if (s->ready)
 			continue;
 		
-		if (dso_parse_misc(dso, &s, buff, len))
+		if (dso_parse_misc(dso, s, buff, len))
 			break;
 		
-		if (s.ready)
+		if (s->ready)
 			continue;
 		
 		ERROR("Unknown objdump entry: %s\n", buff);
 	}
 	
-	fclose(f);
+	reader_close(&rd);
 	
-	MESSAGE("      insn: %9zd\n", dso->ninsn);
+	return r;
+}
+
+// ************************************************************************
+// JIT code: disassembled from an image of the jitdump code; or, without
+// one, a placeholder insn per perf map symbol, that takes all its hits
+// ************************************************************************
+static int dso_jit_code(struct dso *dso, struct jit *j)
+{
+	char path[] = "/tmp/hperf-jit-XXXXXX";
+	int fd = mkstemp(path);
+	
+	if (fd < 0) {
+		ERROR("%s: mkstemp(): %s\n", path, strerror(errno));
+		return -1;
+	}
+	
+	int r = jit_image(j, fd);
+	
+	close(fd);
+	
+	if (r == 0) {
+		char *argv[] = { "objdump", "-DwF", "-b", "binary",
+			"-m", (char *)jit_arch(j), "-Mintel", path, NULL };
+		struct state s;
+		
+		dso_state_init(&s);
+		s.jit = j;
+		
+		DSO_MESSAGE(dso, "    %s:\n", dso->path);
+		
+		r = dso_objdump(dso, argv, &s);
+		
+		DSO_MESSAGE(dso, "      insn: %9zd\n", dso->ninsn);
+	}
+	
+	unlink(path);
+	
+	if (r == 0)
+		r = dso_jit_addr(dso, j);
 	
 	if (r == 0)
 		dso_resolve_targets(dso);
@@ -739,116 +1066,677 @@ int dso_load(struct dso *dso)
 	return r;
 }
 
+static int dso_placeholder(struct dso *dso, struct state *s,
+	uint64_t addr, uint64_t size, char *name, char *disasm)
+{
+	uint8_t bin[15];
+	
+	memset(bin, 0, sizeof(bin));
+	
+	if (dso_set_sym(dso, s, addr, addr, name)
+	||  dso_set_insn(dso, s, addr, 0, bin, disasm, DSO_INSN_NONE))
+		return -1;
+	
+	dso->sym[s->sym_id].size = size;
+	dso->placeholders++;
+	
+	return 0;
+}
+
+static int dso_jit_syms(struct dso *dso, struct jit *j)
+{
+	struct state s;
+	
+	dso_state_init(&s);
+	
+	DSO_MESSAGE(dso, "    %s:\n", dso->path);
+	
+	for (size_t k = 0; k < j->ncode; k++) {
+		struct jit_code *c = &j->code[k];
+		
+		if (dso_placeholder(dso, &s, c->addr, c->size, c->name,
+				"(JIT code)"))
+			return -1;
+	}
+	
+	DSO_MESSAGE(dso, "      syms: %9zd (no code)\n", dso->nsym);
+	
+	return 0;
+}
+
+static int dso_load_jit(struct dso *dso)
+{
+	struct jit j;
+	int r = -1;
+	
+	jit_init(&j);
+	
+	if (dso->jitdump)
+		r = jit_read_dump(&j, dso->jitdump);
+	
+	if ((r == 0) && jit_arch(&j)) {
+		r = dso_jit_code(dso, &j);
+	} else {
+		// a jitdump of another architecture still has symbols
+		if (r || (j.ncode == 0)) {
+			jit_clear(&j);
+			r = jit_read_map(&j, dso->path);
+		}
+		
+		if (r == 0)
+			r = dso_jit_syms(dso, &j);
+	}
+	
+	jit_clear(&j);
+	
+	return r;
+}
+
+// ************************************************************************
+// Kernel code: one objdump run per hot symbol, placed at its kallsyms
+// address (1 if it could not be disassembled)
+// ************************************************************************
+static int dso_kernel_code(struct dso *dso, char *image, struct ksym *ksym)
+{
+	char only[1024];
+	
+	snprintf(only, sizeof(only), "--disassemble=%s", ksym->name);
+	
+	char *argv[] = { "objdump", "-dlwF", "-Mintel", only, image, NULL };
+	struct state s;
+	size_t i0 = dso->ninsn;
+	
+	dso_state_init(&s);
+	s.ksym = ksym;
+	
+	if (dso_objdump(dso, argv, &s)) {
+		dso->ninsn = i0;
+		return -1;
+	}
+	
+	if (s.sym_id == (uint64_t)-1) {
+		dso->ninsn = i0;
+		return 1;
+	}
+	
+	return dso_kernel_addr(dso, &s, i0);
+}
+
+int dso_load_kernel(struct dso *dso, struct kernel *k, size_t m)
+{
+	char tmp[] = "/tmp/hperf-kernel-XXXXXX";
+	char *image = NULL;
+	
+	for (size_t i = 0; i < k->nsym; i++) {
+		if (k->sym[i].hot && (k->sym[i].module == m)) {
+			image = kernel_image(k, m, tmp);
+			break;
+		}
+	}
+	
+	DSO_MESSAGE(dso, "    %s:\n", dso->path);
+	
+	struct state s;
+	size_t code = 0;
+	int r = 0;
+	
+	dso_state_init(&s);
+	
+	for (size_t i = 0; (r == 0) && (i < k->nsym); i++) {
+		struct ksym *ksym = &k->sym[i];
+		
+		if ((ksym->module != m) || (ksym->samples == 0))
+			continue;
+		
+		if (ksym->hot && image) {
+			r = dso_kernel_code(dso, image, ksym);
+			
+			if (r == 0) {
+				code++;
+				continue;
+			}
+			
+			DEBUG("\t=== %s: %s not disassembled\n",
+				dso->path, ksym->name);
+		}
+		
+		r = dso_placeholder(dso, &s, ksym->addr, ksym->size,
+			ksym->name, "(kernel code)");
+	}
+	
+	if (image == tmp)
+		unlink(tmp);
+	
+	DSO_MESSAGE(dso, "      syms: %9zd (%zd disassembled, from %s)\n",
+		dso->nsym, code, (image) ? image : "-");
+	
+	if (r)
+		return -1;
+	
+	dso_resolve_targets(dso);
+	
+	return 0;
+}
+
 // ************************************************************************
 // 
 // ************************************************************************
-static void dso_hit_insn(struct dso *dso, uint64_t i)
+static int dso_skipped(struct dso *dso)
+{
+	if (dso->path[0] == '[')
+		return 1;
+	
+	size_t len = strlen(dso->path);
+	
+	return (len > 3) && (memcmp(dso->path + len - 3, ".xz", 3) == 0);
+}
+
+int dso_loadable(struct dso *dso)
+{
+	uint64_t pid;
+	
+	if (dso_skipped(dso))
+		return 0;
+	
+	if (jit_map_pid(dso->path, &pid) == 0)
+		return dso->jitdump != NULL;
+	
+	return access(dso->path, R_OK) == 0;
+}
+
+int dso_load(struct dso *dso)
 {
-	dso->samples++;
-	dso->insn[i].hits++;
+	if (dso_skipped(dso))
+		return 0;
 	
+	uint64_t pid;
+	
+	if (jit_map_pid(dso->path, &pid) == 0)
+		return dso_load_jit(dso);
+	
+	char *argv[5];
+	int k = 0;
+	
+	argv[k++] = "objdump";
+	argv[k++] = "-dlwF";
+	argv[k++] = "-Mintel";
+	argv[k++] = dso->path;
+	argv[k++] = NULL;
+	
+	struct state s;
+	
+	dso_state_init(&s);
+	
+	DSO_MESSAGE(dso, "    %s:\n", dso->path);
+	
+	int r = dso_objdump(dso, argv, &s);
+	
+	DSO_MESSAGE(dso, "      insn: %9zd\n", dso->ninsn);
+	
+	if (r == 0)
+		dso_resolve_targets(dso);
+	
+	return r;
+}
+
+// ************************************************************************
+// Build-id: the GNU_BUILD_ID note of the ELF file, found in its PT_NOTE
+// segments. Files of another byte order are not looked at.
+// ************************************************************************
+#define DSO_NOTES_MAX		((size_t)1 << 16)
+
+static int dso_build_id_note(const uint8_t *b, size_t len, size_t align,
+	char *hex)
+{
+	size_t k = 0;
+	
+	while (k + sizeof(Elf64_Nhdr) <= len) {
+		Elf64_Nhdr nh;
+		
+		memcpy(&nh, b + k, sizeof(nh));
+		k += sizeof(nh);
+		
+		size_t name = (nh.n_namesz + align - 1) & ~(align - 1);
+		size_t desc = (nh.n_descsz + align - 1) & ~(align - 1);
+		
+		if ((name > len - k) || (desc > len - k - name))
+			return -1;
+		
+		if ((nh.n_type == NT_GNU_BUILD_ID) && (nh.n_namesz == 4)
+		&&  (memcmp(b + k, "GNU", 4) == 0) && (nh.n_descsz > 0)) {
+			size_t n = (nh.n_descsz < DSO_BUILD_ID)
+				? nh.n_descsz : DSO_BUILD_ID;
+			
+			for (size_t i = 0; i < n; i++)
+				sprintf(hex + 2 * i, "%02x", b[k + name + i]);
+			
+			return 0;
+		}
+		
+		k += name + desc;
+	}
+	
+	return -1;
+}
+
+int dso_build_id(const char *path, char *hex)
+{
+	static const uint16_t order = 1;
+	int native = (*(const uint8_t *)&order == 1)
+		? ELFDATA2LSB : ELFDATA2MSB;
+	
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	
+	if (fd < 0)
+		return -1;
+	
+	// headers of either class, read as such
+	uint8_t h[sizeof(Elf64_Ehdr)];
+	Elf64_Ehdr eh;
+	Elf32_Ehdr eh32;
+	
+	if ((pread(fd, h, sizeof(h), 0) < (ssize_t)sizeof(Elf32_Ehdr))
+	||  (memcmp(h, ELFMAG, SELFMAG) != 0)
+	||  (h[EI_DATA] != native)) {
+		close(fd);
+		return -1;
+	}
+	
+	int wide = (h[EI_CLASS] == ELFCLASS64);
+	
+	memcpy(&eh, h, sizeof(eh));
+	memcpy(&eh32, h, sizeof(eh32));
+	
+	uint64_t phoff = (wide) ? eh.e_phoff : eh32.e_phoff;
+	size_t phnum = (wide) ? eh.e_phnum : eh32.e_phnum;
+	size_t phsize = (wide) ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	uint8_t *notes = NULL;
+	int r = -1;
+	
+	for (size_t k = 0; (r != 0) && (k < phnum); k++) {
+		uint8_t b[sizeof(Elf64_Phdr)];
+		Elf64_Phdr ph;
+		Elf32_Phdr ph32;
+		
+		if (pread(fd, b, phsize, phoff + k * phsize) != (ssize_t)phsize)
+			break;
+		
+		memcpy(&ph, b, sizeof(ph));
+		memcpy(&ph32, b, sizeof(ph32));
+		
+		uint64_t type = (wide) ? ph.p_type : ph32.p_type;
+		uint64_t offs = (wide) ? ph.p_offset : ph32.p_offset;
+		uint64_t size = (wide) ? ph.p_filesz : ph32.p_filesz;
+		uint64_t align = (wide) ? ph.p_align : ph32.p_align;
+		
+		if ((type != PT_NOTE) || (size > DSO_NOTES_MAX))
+			continue;
+		
+		if ((notes == NULL) && ((notes = malloc(DSO_NOTES_MAX)) == NULL))
+			break;
+		
+		if (pread(fd, notes, size, offs) != (ssize_t)size)
+			continue;
+		
+		r = dso_build_id_note(notes, size, (align == 8) ? 8 : 4, hex);
+	}
+	
+	free(notes);
+	close(fd);
+	
+	return r;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static uint64_t *dso_column(size_t n)
+{
+	uint64_t *c = calloc((n > 0) ? n : 1, sizeof(uint64_t));
+	
+	if (c == NULL)
+		ERROR("calloc(%zd): %s\n", n, strerror(errno));
+	
+	return c;
+}
+
+// allocate the columns of event ev, once the dso is loaded
+static int dso_event(struct dso *dso, int ev)
+{
+	if (dso->insn_ev[ev])
+		return 0;
+	
+	dso->insn_ev[ev] = dso_column(dso->ninsn);
+	dso->sym_ev[ev] = dso_column(dso->nsym);
+	dso->func_ev[ev] = dso_column(dso->nfunc);
+	dso->file_ev[ev] = dso_column(dso->nfile);
+	
+	if (dso->insn_ev[ev] && dso->sym_ev[ev]
+	&&  dso->func_ev[ev] && dso->file_ev[ev])
+		return 0;
+	
+	free(dso->insn_ev[ev]);
+	free(dso->sym_ev[ev]);
+	free(dso->func_ev[ev]);
+	free(dso->file_ev[ev]);
+	dso->insn_ev[ev] = NULL;
+	dso->sym_ev[ev] = NULL;
+	dso->func_ev[ev] = NULL;
+	dso->file_ev[ev] = NULL;
+	return -1;
+}
+
+// ************************************************************************
+// Data accesses. The memory level is that of perf_mem_data_src: its level
+// number if set, or else its legacy level bits, on a hit.
+// ************************************************************************
+#define MEM_LVL_HIT		0x02
+#define MEM_LVL_L1		0x08
+#define MEM_LVL_LFB		0x10
+#define MEM_LVL_L2		0x20
+#define MEM_LVL_L3		0x40
+#define MEM_LVL_LOC_RAM		0x80
+#define MEM_LVL_REMOTE		0xf00
+
+#define MEM_LVLNUM_L1		0x01
+#define MEM_LVLNUM_L2		0x02
+#define MEM_LVLNUM_L3		0x03
+#define MEM_LVLNUM_L4		0x04
+#define MEM_LVLNUM_LFB		0x0c
+#define MEM_LVLNUM_RAM		0x0d
+#define MEM_LVLNUM_PMEM		0x0e
+
+static int dso_mem_level(uint64_t data_src)
+{
+	uint64_t lvl = (data_src >> 5) & 0x3fff;
+	uint64_t num = (data_src >> 33) & 0xf;
+	int remote = (data_src >> 37) & 1;
+	
+	switch (num) {
+	case MEM_LVLNUM_L1:
+	case MEM_LVLNUM_LFB:
+		return DSO_MEM_L1;
+	case MEM_LVLNUM_L2:
+		return DSO_MEM_L2;
+	case MEM_LVLNUM_L3:
+	case MEM_LVLNUM_L4:
+		return (remote) ? DSO_MEM_REMOTE : DSO_MEM_LLC;
+	case MEM_LVLNUM_RAM:
+	case MEM_LVLNUM_PMEM:
+		return (remote) ? DSO_MEM_REMOTE : DSO_MEM_DRAM;
+	}
+	
+	if (!(lvl & MEM_LVL_HIT))
+		return DSO_MEM_OTHER;
+	
+	if (lvl & MEM_LVL_REMOTE)
+		return DSO_MEM_REMOTE;
+	if (lvl & MEM_LVL_LOC_RAM)
+		return DSO_MEM_DRAM;
+	if (lvl & MEM_LVL_L3)
+		return DSO_MEM_LLC;
+	if (lvl & MEM_LVL_L2)
+		return DSO_MEM_L2;
+	if (lvl & (MEM_LVL_L1 | MEM_LVL_LFB))
+		return DSO_MEM_L1;
+	
+	return DSO_MEM_OTHER;
+}
+
+struct insn_mem *dso_mem(struct dso *dso, size_t i)
+{
+	uint64_t id = sparse_get(&dso->mem_id, i);
+	
+	return (id) ? &dso->mem[id - 1] : NULL;
+}
+
+// space-saving: a new line replaces the least touched one, and inherits
+// its count
+static void dso_mem_line(struct insn_mem *im, uint64_t line, uint64_t n)
+{
+	int min = 0;
+	
+	for (int k = 0; k < DSO_MEM_LINES; k++) {
+		if ((im->line_count[k] == 0) || (im->line[k] == line)) {
+			im->line[k] = line;
+			im->line_count[k] += n;
+			return;
+		}
+		
+		if (im->line_count[k] < im->line_count[min])
+			min = k;
+	}
+	
+	im->line[min] = line;
+	im->line_count[min] += n;
+}
+
+// out of memory: the access is only missing from the insn
+static void dso_hit_mem(struct dso *dso, uint64_t i, uint64_t n,
+	const struct dso_mem *mem)
+{
+	struct insn_mem *im = dso_mem(dso, i);
+	
+	if (im == NULL) {
+		size_t k = dso->nmem;
+		
+		if (MEM_RESIZE(dso->mem, dso->nmem, k + 1))
+			return;
+		
+		if (sparse_add(&dso->mem_id, i, k + 1)) {
+			dso->nmem = k;
+			return;
+		}
+		
+		im = &dso->mem[k];
+		memset(im, 0, sizeof(struct insn_mem));
+	}
+	
+	im->samples += n;
+	im->weight += mem->weight;
+	
+	if (mem->data_src)
+		im->level[dso_mem_level(mem->data_src)] += n;
+	
+	if (mem->addr)
+		dso_mem_line(im, mem->addr / DSO_MEM_LINE, n);
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static void dso_hit_insn(struct dso *dso, uint64_t i,
+	int ev, uint64_t n, uint64_t period, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, const struct dso_mem *mem)
+{
 	uint64_t sym_id = dso->insn[i].sym_id;
 	uint64_t func_id = dso->insn[i].func_id;
 	uint64_t file_id = dso->insn[i].file_id;
 	
+	dso->updates += n;
+	dso->period[ev] += period;
+	
+	if (mem)
+		dso_hit_mem(dso, i, n, mem);
+	
+	if (dso_event(dso, ev) == 0) {
+		dso->insn_ev[ev][i] += period;
+		
+		if (sym_id != (uint64_t)-1)
+			dso->sym_ev[ev][sym_id] += period;
+		if (func_id != (uint64_t)-1)
+			dso->func_ev[ev][func_id] += period;
+		if (file_id != (uint64_t)-1)
+			dso->file_ev[ev][file_id] += period;
+	}
+	
+	if (ev != 0)
+		return;
+	
+	dso->samples += n;
+	dso->insn[i].hits += n;
+	
 	if (sym_id != (uint64_t)-1)
-		dso->sym[sym_id].hits++;
+		dso->sym[sym_id].hits += n;
 	if (func_id != (uint64_t)-1)
-		dso->func[func_id].hits++;
+		dso->func[func_id].hits += n;
 	if (file_id != (uint64_t)-1)
-		dso->file[file_id].hits++;
+		dso->file[file_id].hits += n;
+	
+	// out of memory: the sample is only missing from the breakdown
+	if (tid != DSO_TASK_NONE)
+		sparse_add(&dso->tid_hits, (i << 32) | (uint32_t)tid, n);
+	if (cpu != DSO_TASK_NONE)
+		sparse_add(&dso->cpu_hits, (i << 32) | (uint32_t)cpu, n);
+	if (bucket != DSO_BUCKET_NONE)
+		sparse_add(&dso->time_hits, (i << 32) | (uint32_t)bucket, n);
+}
+
+static void dso_hit_orphan(struct dso *dso,
+	int ev, uint64_t n, uint64_t period)
+{
+	dso->updates += n;
+	dso->period[ev] += period;
+	
+	if (ev != 0)
+		return;
+	
+	dso->samples += n;
+	dso->orphans += n;
 }
 
 // ************************************************************************
-int dso_hit_foffs(struct dso *dso, uint64_t foffs, char *sym, uint64_t offs)
+int dso_hit_foffs(struct dso *dso, uint64_t foffs, char *sym, uint64_t offs,
+	int ev, uint64_t n, uint64_t period, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, const struct dso_mem *mem, uint64_t calls)
 {
 	if (dso->ninsn < 1) {
-		dso->samples++;
-		dso->orphans++;
+		dso_hit_orphan(dso, ev, n, period);
 		return -1;
 	}
 	
 	size_t i = dso_locate_foffs(dso, foffs, 0, dso->ninsn - 1);
+	
+	if ((i == DSO_INSN_NONE) && dso->placeholders)
+		i = dso_locate_placeholder(dso, foffs);
 
 	if (i == DSO_INSN_NONE) {
-		DEBUG("\t=== %s: %s+0x%lx: miss foffs 0x%lx, "
-			"not in [0x%lx 0x%lx]\n",
+		diag_n(DIAG_FOFFS_MISS, calls, "%s: %s+0x%lx: foffs 0x%lx, "
+			"not in [0x%lx 0x%lx]",
 			dso->path, (sym) ? sym : "[unknown]", offs,
 			foffs,
 			dso->insn[0].foffs,
 			dso->insn[dso->ninsn - 1].foffs);
-		dso->samples++;
-		dso->orphans++;
+		dso_hit_orphan(dso, ev, n, period);
 		return -1;
 	}
 
-	dso_hit_insn(dso, i);
+	dso_hit_insn(dso, i, ev, n, period, tid, cpu, bucket, mem);
 	
 	//DEBUG("\t%zd:%lx: %ld hits\n", k0, a0, dso->insn[k0].hits);
 	return 0;
 }
 
 // ************************************************************************
-int dso_hit_sym(struct dso *dso, char *sym, uint64_t offs)
+int dso_hit_sym(struct dso *dso, char *sym, uint64_t offs,
+	int ev, uint64_t n, uint64_t period, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, const struct dso_mem *mem, uint64_t calls)
 {
 	if (dso->ninsn < 1) {
-		dso->samples++;
-		dso->orphans++;
+		dso_hit_orphan(dso, ev, n, period);
 		return -1;
 	}
 
-	size_t i = dso_locate_sym(dso, sym, offs);
+	size_t i = dso_locate_sym(dso, sym, offs, calls);
 	
 	if (i == DSO_INSN_NONE) {
-		dso->samples++;
-		dso->orphans++;
+		dso_hit_orphan(dso, ev, n, period);
 		return -1;
 	}
 	
-	dso_hit_insn(dso, i);
+	dso_hit_insn(dso, i, ev, n, period, tid, cpu, bucket, mem);
 	
 	return 0;
 }
 
 // ************************************************************************
-void dso_hit_dso(struct dso *dso)
+void dso_hit_dso(struct dso *dso, int ev, uint64_t n, uint64_t period)
 {
-	dso->samples++;
-	dso->unspec++;
+	dso->updates += n;
+	dso->period[ev] += period;
+	
+	if (ev != 0)
+		return;
+	
+	dso->samples += n;
+	dso->unspec += n;
 }
 
 // ************************************************************************
 // 
 // ************************************************************************
-int  dso_branch(
-	struct dso *pre_dso, uint64_t pre_foffs,
-	struct dso *src_dso, uint64_t src_foffs,
-	struct dso *dst_dso, uint64_t dst_foffs,
-	int miss, uint64_t cycles)
+size_t dso_locate(struct dso *dso, uint64_t foffs, size_t i0)
 {
-	if ((src_foffs == (uint64_t)-1)
-	||  (src_dso == NULL)
-	||  (src_dso->ninsn < 1))
-		return 0;
+	if ((foffs == (uint64_t)-1) || (dso->ninsn < 1))
+		return DSO_INSN_NONE;
 	
-	// source
-	size_t src_i = dso_locate_foffs(src_dso, src_foffs,
-			0, src_dso->ninsn - 1);
+	if (i0 >= dso->ninsn)
+		return DSO_INSN_ORPHAN;
 	
+	size_t i = dso_locate_foffs(dso, foffs, i0, dso->ninsn - 1);
+	
+	return (i != DSO_INSN_NONE) ? i : DSO_INSN_ORPHAN;
+}
+
+size_t dso_locate_within(struct dso *dso, uint64_t foffs)
+{
+	size_t i0 = 0;
+	size_t i1 = dso->ninsn;
+	
+	if ((i1 < 1) || (foffs < dso->insn[0].foffs))
+		return DSO_INSN_ORPHAN;
+	
+	// last insn at or before foffs
+	while (i1 > i0 + 1) {
+		size_t im = (i0 + i1) / 2;
+		
+		if (dso->insn[im].foffs <= foffs)
+			i0 = im;
+		else
+			i1 = im;
+	}
+	
+	if (foffs - dso->insn[i0].foffs >= sizeof(dso->insn[i0].bin))
+		return DSO_INSN_ORPHAN;
+	
+	return i0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int  dso_branch_insn(
+	struct dso *pre_dso, size_t pre_i,
+	struct dso *src_dso, size_t src_i,
+	struct dso *dst_dso, size_t dst_i,
+	int miss, uint64_t cycles, uint64_t n)
+{
+	// source
 	if (src_i == DSO_INSN_NONE)
+		return 0;
+	
+	if (src_i == DSO_INSN_ORPHAN)
 		return -1;
 	
 	struct insn *src = &src_dso->insn[src_i];
 
-	src->branches++;
-	src->misses += (miss != 0);
+	src_dso->updates += n;
+	src->branches += n;
+	src->misses += (miss != 0) ? n : 0;
 	
 	// destination
-	if ((dst_foffs != (uint64_t)-1) && (dst_dso == src_dso)) {
-		size_t dst_i = dso_locate_foffs(dst_dso, dst_foffs,
-			0, dst_dso->ninsn - 1);
-		
-		if (dst_i == DSO_INSN_NONE)
+	if ((dst_i != DSO_INSN_NONE) && (dst_dso == src_dso)) {
+		if (dst_i == DSO_INSN_ORPHAN)
 			return -1;
 		
 		struct insn *dst = &dst_dso->insn[dst_i];
@@ -860,28 +1748,25 @@ int  dso_branch(
 			dst->flags |= INSN_SOURCES_MORE;
 		}
 		
-		dst->landings++;
+		dst->landings += n;
 	}
 	
 	// previous
-	if ((pre_foffs != (uint64_t)-1) && (pre_dso == src_dso)) {
-		size_t pre_i = dso_locate_foffs(pre_dso, pre_foffs,
-			0, pre_dso->ninsn - 1);
-
-		if (pre_i == DSO_INSN_NONE)
+	if ((pre_i != DSO_INSN_NONE) && (pre_dso == src_dso)) {
+		if (pre_i == DSO_INSN_ORPHAN)
 			return -1;
 		
 		// save span
 		for (uint64_t j = 0; j < INSN_SPANS; j++) {
 			if (src->span[j].count == 0) {
 				src->span[j].start_i = pre_i;
-				src->span[j].count = 1;
+				src->span[j].count = n;
 				src->span[j].cycles = cycles;
 				break;
 			}
 			
 			if (src->span[j].start_i == pre_i) {
-				src->span[j].count++;
+				src->span[j].count += n;
 				src->span[j].cycles += cycles;
 				break;
 			}
@@ -890,13 +1775,37 @@ int  dso_branch(
 		// count throughs
 		if ((pre_i < src_i) && (pre_i + INSN_THROUGH_MAX >= src_i)) {
 			for (size_t i = pre_i; i <= src_i; i++) {
-				src_dso->insn[i].throughs++;
+				src_dso->insn[i].throughs += n;
 			}
 		}
 	}
 
 	return 0;
+}
+
+int  dso_branch(
+	struct dso *pre_dso, uint64_t pre_foffs,
+	struct dso *src_dso, uint64_t src_foffs,
+	struct dso *dst_dso, uint64_t dst_foffs,
+	int miss, uint64_t cycles, uint64_t n)
+{
+	if (src_dso == NULL)
+		return 0;
+	
+	size_t src_i = dso_locate(src_dso, src_foffs, 0);
+	size_t dst_i = DSO_INSN_NONE;
+	size_t pre_i = DSO_INSN_NONE;
+	
+	if ((src_i != DSO_INSN_NONE) && (src_i != DSO_INSN_ORPHAN)) {
+		if (dst_dso == src_dso)
+			dst_i = dso_locate(dst_dso, dst_foffs, 0);
+		
+		if (pre_dso == src_dso)
+			pre_i = dso_locate(pre_dso, pre_foffs, 0);
+	}
 	
+	return dso_branch_insn(pre_dso, pre_i, src_dso, src_i,
+		dst_dso, dst_i, miss, cycles, n);
 }
 
 
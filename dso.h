@@ -20,13 +20,19 @@
 #include <stdint.h>
 #include "mem.h"
 #include "map.h"
+#include "sparse.h"
+#include "kernel.h"
 
 // special values
 #define DSO_INSN_NONE		((size_t)-1)
+#define DSO_INSN_ORPHAN		((size_t)-2)
 #define DSO_SYM_NONE		((uint64_t)-1)
 
 #define INSN_THROUGH_MAX	256
 
+// sampled events; event 0 is the one counted as 'hits' (samples)
+#define DSO_EVENTS		8
+
 #define INSN_SPANS		2
 struct span {
 	size_t start_i;
@@ -70,12 +76,45 @@ struct insn {
 	uint64_t _padding;
 };
 
+// memory levels of the data accesses (perf mem), and most touched cache
+// lines kept per insn
+#define DSO_MEM_L1		0
+#define DSO_MEM_L2		1
+#define DSO_MEM_LLC		2
+#define DSO_MEM_DRAM		3
+#define DSO_MEM_REMOTE		4
+#define DSO_MEM_OTHER		5
+#define DSO_MEM_LEVELS		6
+
+#define DSO_MEM_LINE		64
+#define DSO_MEM_LINES		8
+
+// data access of samples: address (0 if unknown), data source
+// (PERF_MEM_* fields, 0 if unknown) and latency weight (their total)
+struct dso_mem {
+	uint64_t addr;
+	uint64_t data_src;
+	uint64_t weight;
+};
+
+// data accesses of an insn, whatever the event; lines are kept by
+// space-saving, so that their counts are upper bounds once all are taken
+struct insn_mem {
+	uint64_t samples, weight;
+	uint64_t level[DSO_MEM_LEVELS];
+	uint64_t line[DSO_MEM_LINES];
+	uint64_t line_count[DSO_MEM_LINES];
+};
+
 struct symbol {
 	char *name;
 	uint64_t foffs, addr;
 	size_t insn;
 	uint64_t hits;
 	int multiple;
+	
+	// JIT and kernel symbols only, 0 otherwise
+	uint64_t size;
 };
 
 struct source_func {
@@ -95,6 +134,16 @@ struct source_file {
 struct dso {
 	char path[1024];
 	
+	// jitdump of the process, if a perf map (set before dso_load())
+	char *jitdump;
+	
+	// load messages left to the caller (background loads)
+	int quiet;
+	
+	// symbols without code (JIT, kernel) get a placeholder insn each,
+	// that takes the samples of the whole symbol
+	size_t placeholders;
+	
 	struct insn *insn;
 	size_t ninsn;
 	
@@ -114,20 +163,85 @@ struct dso {
 	struct map file_id;
 	
 	size_t samples, unspec, orphans;
+	
+	// period totals per event: one column per array (insn, sym, func,
+	// file), only allocated once the event is sampled in this dso
+	uint64_t *insn_ev[DSO_EVENTS];
+	uint64_t *sym_ev[DSO_EVENTS];
+	uint64_t *func_ev[DSO_EVENTS];
+	uint64_t *file_ev[DSO_EVENTS];
+	uint64_t period[DSO_EVENTS];
+	
+	// count of sample and branch updates, to tell changed dsos apart
+	uint64_t updates;
+	
+	// samples by (insn << 32 | tid), by (insn << 32 | cpu), and by
+	// (insn << 32 | timeline bucket)
+	struct sparse tid_hits;
+	struct sparse cpu_hits;
+	struct sparse time_hits;
+	
+	// data accesses: mem[(mem_id of insn) - 1]
+	struct sparse mem_id;
+	struct insn_mem *mem;
+	size_t nmem;
 };
 
 int  dso_init(struct dso *dso, char *path);
 void dso_clear(struct dso *dso);
 
 int  dso_load(struct dso *dso);
-int  dso_hit_foffs(struct dso *dso, uint64_t foffs, char *sym, uint64_t offs);
-int  dso_hit_sym(struct dso *dso, char *sym, uint64_t offs);
-void dso_hit_dso(struct dso *dso);
 
+// ELF build-id of the file at path, as hex (2 * DSO_BUILD_ID + 1 bytes,
+// longer ids being truncated); -1 if none
+#define DSO_BUILD_ID		20
+
+int  dso_build_id(const char *path, char *hex);
+
+// whether dso_load() has code to disassemble, from a file that is there
+// (otherwise, it has nothing to do, or fails right away)
+int  dso_loadable(struct dso *dso);
+
+// kernel module m (see kernel.h): hot symbols are disassembled, other
+// sampled ones get a placeholder
+int  dso_load_kernel(struct dso *dso, struct kernel *k, size_t m);
+
+// n samples of event ev, period being their total, taken by thread tid
+// on cpu (DSO_TASK_NONE if unknown), in a timeline bucket (DSO_BUCKET_NONE
+// if none), with their data access mem if recorded (NULL otherwise); calls
+// is how many were recorded, for the diagnostics (see diag_n())
+#define DSO_TASK_NONE		((uint64_t)-1)
+#define DSO_BUCKET_NONE		((uint64_t)-1)
+
+int  dso_hit_foffs(struct dso *dso, uint64_t foffs, char *sym, uint64_t offs,
+	int ev, uint64_t n, uint64_t period, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, const struct dso_mem *mem, uint64_t calls);
+int  dso_hit_sym(struct dso *dso, char *sym, uint64_t offs,
+	int ev, uint64_t n, uint64_t period, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, const struct dso_mem *mem, uint64_t calls);
+void dso_hit_dso(struct dso *dso, int ev, uint64_t n, uint64_t period);
+
+// data accesses of insn i, NULL if none
+struct insn_mem *dso_mem(struct dso *dso, size_t i);
+
+// index of the insn at foffs, searching from insn i0 on; DSO_INSN_NONE if
+// foffs is unknown (-1), DSO_INSN_ORPHAN if no insn is there
+size_t dso_locate(struct dso *dso, uint64_t foffs, size_t i0);
+
+// index of the insn that spans foffs (e.g. a call, from its return address
+// minus one); DSO_INSN_ORPHAN if none
+size_t dso_locate_within(struct dso *dso, uint64_t foffs);
+
+// n branches, cycles being their total
+int  dso_branch_insn(
+	struct dso *pre_dso, size_t pre_i,
+	struct dso *src_dso, size_t src_i,
+	struct dso *dst_dso, size_t dst_i,
+	int miss, uint64_t cycles, uint64_t n);
 int  dso_branch(
 	struct dso *pre_dso, uint64_t pre_foffs,
 	struct dso *src_dso, uint64_t src_foffs,
 	struct dso *dst_dso, uint64_t dst_foffs,
-	int miss, uint64_t cycles);
+	int miss, uint64_t cycles, uint64_t n);
 
 #endif
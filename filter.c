@@ -0,0 +1,350 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "message.h"
+#include "mem.h"
+#include "filter.h"
+
+// ************************************************************************
+//
+// ************************************************************************
+void filter_init(struct filter *f)
+{
+	f->pid = NULL;
+	f->tid = NULL;
+	f->comm = NULL;
+	f->time = NULL;
+	f->dsos = NULL;
+	f->sample_rate = NULL;
+	f->max_samples = NULL;
+
+	MEM_INIT(f->pids, f->npids);
+	MEM_INIT(f->tids, f->ntids);
+	MEM_INIT(f->comms, f->ncomms);
+	MEM_INIT(f->dso, f->ndso);
+
+	f->t0 = 0;
+	f->t1 = (uint64_t)-1;
+
+	f->rate = 1.0;
+	f->keep = (uint64_t)-1;
+	f->max = 0;
+
+	obstack_init(&f->strings);
+}
+
+void filter_clear(struct filter *f)
+{
+	MEM_CLEAR(f->pids, f->npids);
+	MEM_CLEAR(f->tids, f->ntids);
+	MEM_CLEAR(f->comms, f->ncomms);
+	MEM_CLEAR(f->dso, f->ndso);
+
+	obstack_clear(&f->strings);
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static int filter_split(struct filter *f, char *s, char ***list, size_t *n)
+{
+	char *c = obstack_dup(&f->strings, s);
+
+	if (c == NULL)
+		return -1;
+
+	while (1) {
+		char *e = strchr(c, ',');
+
+		if (e)
+			*e = 0;
+
+		if (*c) {
+			size_t k = *n;
+
+			if (MEM_RESIZE(*list, *n, k + 1))
+				return -1;
+
+			(*list)[k] = c;
+		}
+
+		if (e == NULL)
+			break;
+
+		c = e + 1;
+	}
+
+	return 0;
+}
+
+static int filter_ids(struct filter *f, char *s, uint64_t **list, size_t *n)
+{
+	char **w;
+	size_t nw;
+
+	MEM_INIT(w, nw);
+
+	int r = filter_split(f, s, &w, &nw);
+
+	for (size_t k = 0; (r == 0) && (k < nw); k++) {
+		char *e;
+		uint64_t id = strtoul(w[k], &e, 10);
+
+		if ((e == w[k]) || (*e != 0)) {
+			ERROR("%s: could not parse id\n", w[k]);
+			r = -1;
+			break;
+		}
+
+		size_t j = *n;
+
+		r = MEM_RESIZE(*list, *n, j + 1);
+
+		if (r == 0)
+			(*list)[j] = id;
+	}
+
+	MEM_CLEAR(w, nw);
+
+	return r;
+}
+
+// seconds, with up to 9 decimals, as printed by perf script
+static int filter_ns(char *s, char *end, uint64_t *ns)
+{
+	uint64_t sec = 0, frac = 0;
+	int digits = 0;
+	char *c = s;
+
+	for (; (c < end) && (*c >= '0') && (*c <= '9'); c++)
+		sec = sec * 10 + (*c - '0');
+
+	if ((c < end) && (*c == '.')) {
+		for (c++; (c < end) && (*c >= '0') && (*c <= '9'); c++) {
+			if (digits < 9) {
+				frac = frac * 10 + (*c - '0');
+				digits++;
+			}
+		}
+	}
+
+	if ((c == s) || (c != end))
+		return -1;
+
+	for (; digits < 9; digits++)
+		frac *= 10;
+
+	*ns = sec * 1000000000 + frac;
+
+	return 0;
+}
+
+static int filter_parse_time(struct filter *f)
+{
+	char *s = f->time;
+	char *comma = strchr(s, ',');
+
+	if (comma == NULL)
+		goto fail;
+
+	char *end = comma + strlen(comma);
+
+	if ((comma > s) && filter_ns(s, comma, &f->t0))
+		goto fail;
+
+	if ((end > comma + 1) && filter_ns(comma + 1, end, &f->t1))
+		goto fail;
+
+	if (f->t1 < f->t0)
+		goto fail;
+
+	return 0;
+
+fail:
+	ERROR("%s: time range expected as 'start,stop' (in seconds)\n", s);
+	return -1;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+void filter_rate(struct filter *f, double rate)
+{
+	if (rate >= 1.0) {
+		f->rate = 1.0;
+		f->keep = (uint64_t)-1;
+		return;
+	}
+
+	f->rate = rate;
+	f->keep = (uint64_t)(rate * 18446744073709551616.0);
+}
+
+static int filter_parse_rate(struct filter *f)
+{
+	char *e;
+	double rate = strtod(f->sample_rate, &e);
+
+	if ((e == f->sample_rate) || (*e != 0) || !(rate > 0.0)
+	||  (rate > 1.0)) {
+		ERROR("%s: sample rate expected in (0, 1]\n", f->sample_rate);
+		return -1;
+	}
+
+	filter_rate(f, rate);
+
+	return 0;
+}
+
+static int filter_parse_max(struct filter *f)
+{
+	char *e;
+
+	f->max = strtoul(f->max_samples, &e, 10);
+
+	if ((e == f->max_samples) || (*e != 0) || (f->max == 0)) {
+		ERROR("%s: could not parse sample count\n", f->max_samples);
+		return -1;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int filter_parse(struct filter *f)
+{
+	int r = 0;
+
+	if (f->pid)
+		r |= filter_ids(f, f->pid, &f->pids, &f->npids);
+	if (f->tid)
+		r |= filter_ids(f, f->tid, &f->tids, &f->ntids);
+	if (f->comm)
+		r |= filter_split(f, f->comm, &f->comms, &f->ncomms);
+	if (f->dsos)
+		r |= filter_split(f, f->dsos, &f->dso, &f->ndso);
+	if (f->time)
+		r |= filter_parse_time(f);
+	if (f->sample_rate)
+		r |= filter_parse_rate(f);
+	if (f->max_samples)
+		r |= filter_parse_max(f);
+
+	return r;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static int filter_id(uint64_t *list, size_t n, uint64_t id)
+{
+	for (size_t k = 0; k < n; k++) {
+		if (list[k] == id)
+			return 1;
+	}
+
+	return 0;
+}
+
+int filter_pid(struct filter *f, uint64_t pid)
+{
+	if ((f == NULL) || (f->npids == 0))
+		return 1;
+
+	return filter_id(f->pids, f->npids, pid);
+}
+
+int filter_task(struct filter *f, uint64_t pid, uint64_t tid)
+{
+	if (!filter_pid(f, pid))
+		return 0;
+
+	if (f && f->ntids && !filter_id(f->tids, f->ntids, tid))
+		return 0;
+
+	return 1;
+}
+
+int filter_comm(struct filter *f, const char *comm)
+{
+	if ((f == NULL) || (f->ncomms == 0))
+		return 1;
+
+	for (size_t k = 0; k < f->ncomms; k++) {
+		if (strcmp(f->comms[k], comm) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+int filter_time(struct filter *f, uint64_t time)
+{
+	if (f == NULL)
+		return 1;
+
+	return (time >= f->t0) && (time <= f->t1);
+}
+
+// by full path or by file name, as perf does
+int filter_dso(struct filter *f, const char *path)
+{
+	if ((f == NULL) || (f->ndso == 0))
+		return 1;
+
+	const char *name = strrchr(path, '/');
+	name = (name) ? name + 1 : path;
+
+	for (size_t k = 0; k < f->ndso; k++) {
+		if ((strcmp(f->dso[k], path) == 0)
+		||  (strcmp(f->dso[k], name) == 0))
+			return 1;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+// Deterministic downsampling: a sample is kept if the hash of its pid,
+// time and ip falls below the threshold. Time is taken in us, as printed
+// by perf script, so that both readers keep the same samples.
+// ************************************************************************
+static inline uint64_t filter_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111eb;
+	x ^= x >> 31;
+
+	return x;
+}
+
+int filter_sample(struct filter *f, uint64_t pid, uint64_t time, uint64_t ip)
+{
+	if ((f == NULL) || (f->keep == (uint64_t)-1))
+		return 1;
+
+	uint64_t h = filter_mix(pid + 0x9e3779b97f4a7c15);
+	h = filter_mix(h ^ (time / 1000));
+	h = filter_mix(h ^ ip);
+
+	return h < f->keep;
+}
@@ -0,0 +1,70 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef FILTER_H
+#define FILTER_H
+#include <stddef.h>
+#include <stdint.h>
+#include "mem.h"
+
+// ************************************************************************
+// Sample selection. The options are kept as given, so that they can be
+// passed on to perf script (--pid, --tid, --comms, --time, --dsos), and
+// parsed for the native reader and for prog_require().
+// ************************************************************************
+struct filter {
+	// options, NULL if not set
+	char *pid, *tid, *comm, *time, *dsos;
+	
+	// downsampling options (not passed on to perf script)
+	char *sample_rate, *max_samples;
+
+	uint64_t *pids;
+	size_t npids;
+	uint64_t *tids;
+	size_t ntids;
+
+	char **comms;
+	size_t ncomms;
+	char **dso;
+	size_t ndso;
+
+	// time window [t0, t1], in ns
+	uint64_t t0, t1;
+	
+	// fraction of the samples kept, and hash threshold for keeping one
+	double rate;
+	uint64_t keep;
+	uint64_t max;
+
+	struct obstack strings;
+};
+
+void filter_init(struct filter *f);
+void filter_clear(struct filter *f);
+
+int filter_parse(struct filter *f);
+void filter_rate(struct filter *f, double rate);
+
+// each returns 1 if selected; a NULL filter selects everything
+int filter_pid(struct filter *f, uint64_t pid);
+int filter_task(struct filter *f, uint64_t pid, uint64_t tid);
+int filter_comm(struct filter *f, const char *comm);
+int filter_time(struct filter *f, uint64_t time);
+int filter_dso(struct filter *f, const char *path);
+int filter_sample(struct filter *f, uint64_t pid, uint64_t time, uint64_t ip);
+
+#endif
@@ -221,6 +221,152 @@ function anchor(parent, callback)
 	return h;
 }
 
+// ************************************************************************
+// Metrics: samples (hits), the period total of one event (ev[k]), or the
+// ratio of two events (e.g. instructions / cycles)
+// ************************************************************************
+function metric_event(obj, k)
+{
+	if (k < 0)
+		return obj.hits;
+	if ((!('ev' in obj)) || (k >= obj.ev.length))
+		return 0;
+	return obj.ev[k];
+}
+
+function metric_value(obj)
+{
+	let m = ui_state.metric;
+	let v = metric_event(obj, m.num);
+	
+	if (m.den < 0)
+		return v;
+	
+	let d = metric_event(obj, m.den);
+	
+	return (d > 0) ? v / d : 0;
+}
+
+function metric_total()
+{
+	let m = ui_state.metric;
+	
+	return (m.num < 0) ? prog.samples : prog.event[m.num].period;
+}
+
+function metric_label()
+{
+	let m = ui_state.metric;
+	
+	if (m.num < 0)
+		return 'samples';
+	if (m.den < 0)
+		return prog.event[m.num].name;
+	return prog.event[m.num].name + ' / ' + prog.event[m.den].name;
+}
+
+function metric_text(obj)
+{
+	if (ui_state.metric.den >= 0)
+		return metric_value(obj).toFixed(3);
+	
+	// downsampled: estimate for the whole trace
+	if (meta.rate < 1)
+		return Math.round(metric_value(obj) / meta.rate);
+	
+	return metric_value(obj);
+}
+
+function metric_pct(obj)
+{
+	let total = metric_total();
+	
+	if ((ui_state.metric.den >= 0) || (total === 0))
+		return '';
+	
+	return (100.0 * metric_value(obj) / total).toFixed(2);
+}
+
+// list, ordered by the current metric (ratios: by their denominator)
+function metric_sort(list)
+{
+	let m = ui_state.metric;
+	
+	if ((m.num < 0) && (m.den < 0))
+		return list;
+	
+	let k = (m.den < 0) ? m.num : m.den;
+	let sorted = list.slice();
+	
+	sorted.sort(function(a, b) {
+		return metric_event(b, k) - metric_event(a, k);
+	});
+	
+	return sorted;
+}
+
+function metric_select(parent)
+{
+	let s = el(parent, 'select');
+	let opts = [ { num: -1, den: -1 } ];
+	
+	for (let a = 0; a < prog.event.length; a++)
+		opts.push({ num: a, den: -1 });
+	
+	for (let a = 0; a < prog.event.length; a++) {
+		for (let b = 0; b < prog.event.length; b++) {
+			if (a !== b)
+				opts.push({ num: a, den: b });
+		}
+	}
+	
+	let cur = ui_state.metric;
+	
+	for (let k = 0; k < opts.length; k++) {
+		ui_state.metric = opts[k];
+		
+		let o = el(s, 'option', metric_label());
+		o.value = k;
+		
+		if ((opts[k].num === cur.num) && (opts[k].den === cur.den))
+			o.selected = true;
+	}
+	
+	ui_state.metric = cur;
+	
+	s.onchange = function() { metric_set(opts[s.value]); }
+	
+	return s;
+}
+
+function metric_set(metric)
+{
+	ui_state.metric = metric;
+	
+	if (ui_state.cur_mode !== 'code') {
+		mode_set(ui_state.cur_mode);
+		return;
+	}
+	
+	// force a reload of the current block
+	let pane = global_code;
+	let sel = pane.isel_loc;
+	let loc = { found: true, dso_id: pane.dso_id,
+		block: pane.block_id, i: -1 };
+	
+	code_save();
+	
+	if (pane.block_id !== -1) {
+		pane.block_id = -1;
+		code_insn_load(pane, loc);
+	}
+	
+	code_restore();
+	
+	if (sel.found)
+		code_insn_select(pane, sel);
+}
+
 // ************************************************************************
 // 
 // ************************************************************************
@@ -263,10 +409,167 @@ function nav_build(active)
 		fill = false;
 	}
 	
+	if (prog.event.length > 1) {
+		let sp = el(el(nav, 'span'), 'span', 'metric: ');
+		metric_select(sp);
+	}
+	
 	return nav;
 }
 
 
+// ************************************************************************
+// Call graph: inclusive % and call sites [ dso, insn, sym, foffs, count ]
+// ************************************************************************
+function callgraph_pct(count)
+{
+	if (prog.samples === 0)
+		return '';
+	
+	return (100.0 * count / prog.samples).toFixed(2);
+}
+
+function callgraph_site(c)
+{
+	let dso = prog.dso[c[0]];
+	
+	if (c[2] >= 0) {
+		let sym = dso.sym[c[2]];
+		return sym.name + '+0x' + (c[3] - sym.foffs).toString(16);
+	}
+	
+	return dso.path.split('/').pop() + '@0x' + c[3].toString(16);
+}
+
+function callgraph_callers(obj)
+{
+	let s = [];
+	
+	for (let k = 0; k < obj.callers.length; k++) {
+		let c = obj.callers[k];
+		s.push(callgraph_site(c) + ' (' + callgraph_pct(c[4]) + '%)');
+	}
+	
+	return s.join(', ');
+}
+
+// ************************************************************************
+// Thread and cpu breakdown: [ count, [ id, hits ], ... ], busiest first.
+// The imbalance is the busiest share over an even share.
+// ************************************************************************
+function spread_text(sp, hits)
+{
+	if ((sp[0] === 0) || (hits === 0))
+		return '';
+	
+	let top = sp[1][1] / hits;
+	
+	return sp[0] + ', top ' + (100.0 * top).toFixed(0) + '% ('
+		+ sp[1][0] + '), ' + (top * sp[0]).toFixed(1) + 'x even';
+}
+
+// ************************************************************************
+// Data accesses (perf mem): { samples, weight, level: [ ... ], line:
+// [ [ address, samples ], ... ] }, levels in DSO_MEM_* order, drawn as a
+// bar of mem_max samples split by level
+// ************************************************************************
+let mem_levels = [ 'L1', 'L2', 'LLC', 'DRAM', 'remote', 'other' ];
+
+function mem_level(mem)
+{
+	let level = mem.level.slice();
+	let total = level.reduce((a, b) => a + b, 0);
+	
+	// only addresses or weights recorded
+	if (total < mem.samples)
+		level[mem_levels.length - 1] += mem.samples - total;
+	
+	return level;
+}
+
+function mem_text(mem)
+{
+	let level = mem_level(mem);
+	let s = [ ];
+	
+	for (let l = 0; l < level.length; l++) {
+		if (level[l] > 0)
+			s.push(mem_levels[l] + ' ' + (100.0 * level[l]
+				/ mem.samples).toFixed(1) + '%');
+	}
+	
+	return s.join(', ');
+}
+
+function mem_bar(parent, mem, mem_max)
+{
+	let level = mem_level(mem);
+	let bar = el(parent, 'span', null, 'mem-bar');
+	
+	bar.title = mem_text(mem);
+	
+	for (let l = 0; l < level.length; l++) {
+		if (level[l] === 0)
+			continue;
+		
+		let seg = el(bar, 'span', null, 'mem-' + l);
+		seg.style.width = (2.0 * level[l] / mem_max) + 'em';
+		seg.style.height = '0.75em';
+	}
+}
+
+// ************************************************************************
+// Timelines: [ bucket gap, count, ... ] over meta.nbucket buckets, drawn
+// as a sparkline of at most timeline_cells cells (of the mean bucket
+// count), scaled to its maximum
+// ************************************************************************
+let timeline_cells = 40;
+let timeline_bars = '\u2581\u2582\u2583\u2584\u2585\u2586\u2587\u2588';
+
+function timeline_text(obj)
+{
+	if ((obj.time === undefined) || (meta.nbucket === 0))
+		return '';
+	
+	let n = Math.min(meta.nbucket, timeline_cells);
+	let cell = new Array(n).fill(0);
+	let width = new Array(n).fill(0);
+	let b = 0;
+	let max = 0;
+	
+	for (let k = 0; k < meta.nbucket; k++)
+		width[Math.floor(k * n / meta.nbucket)]++;
+	
+	for (let k = 0; k < obj.time.length; k += 2) {
+		b += obj.time[k];
+		
+		let c = Math.floor(b * n / meta.nbucket);
+		cell[c] += obj.time[k + 1] / width[c];
+		max = Math.max(max, cell[c]);
+	}
+	
+	let s = '';
+	
+	for (let c = 0; c < n; c++) {
+		if (cell[c] === 0)
+			s += ' ';
+		else
+			s += timeline_bars[Math.min(7,
+				Math.floor(8 * cell[c] / max))];
+	}
+	
+	return s;
+}
+
+function timeline_label()
+{
+	let n = Math.min(meta.nbucket, timeline_cells);
+	let ms = meta.bucket * meta.nbucket / n;
+	
+	return 'timeline (' + ((ms < 1000) ? ms.toPrecision(3) + ' ms'
+		: (ms / 1000).toPrecision(3) + ' s') + ' per cell)';
+}
+
 // ************************************************************************
 // 
 // ************************************************************************
@@ -275,34 +578,62 @@ function hotspots_list(parent, max)
 	let table = el(parent, 'table');
 	
 	let h = el(table, 'tr');
-	el(h, 'th', 'samples');
+	el(h, 'th', metric_label());
 	el(h, 'th', '%');
+	if (meta.rate < 1)
+		el(h, 'th', '\u00b1 (95%)');
 	el(h, 'th', 'DSO', 'left');
 	el(h, 'th', 'offset');
 	el(h, 'th', 'block');
 	el(h, 'th', 'symbol', 'left');
 	el(h, 'th', 'function', 'left');
+	if (meta.callgraph) {
+		el(h, 'th', 'incl %');
+		el(h, 'th', 'callers', 'left');
+	}
+	if (meta.tid)
+		el(h, 'th', 'threads', 'left');
+	if (meta.cpu)
+		el(h, 'th', 'cpus', 'left');
+	if (meta.nbucket > 1)
+		el(h, 'th', timeline_label(), 'left');
 	
-	for (let i = 0; i < meta.hot.length; i++) {
+	let hot = metric_sort(meta.hot);
+	
+	for (let i = 0; i < hot.length; i++) {
 		if (i === max)
 			break;
 		
 		let r = el(table, 'tr');
 		
-		el(r, 'td', meta.hot[i].hits);
-		el(r, 'td',
-			(100.0 * meta.hot[i].hits / prog.samples).toFixed(2));
+		el(r, 'td', metric_text(hot[i]));
+		el(r, 'td', metric_pct(hot[i]));
+		
+		// relative error of the sample count
+		if (meta.rate < 1)
+			el(r, 'td', (hot[i].est > 0) ? (100.0 * hot[i].err
+				/ hot[i].est).toFixed(1) + '%' : '');
 		
-		let dso = prog.dso[meta.hot[i].dso];
+		let dso = prog.dso[hot[i].dso];
 		el(r, 'td', dso.path, 'left');
 
-		let loc = insn_locate(meta.hot[i].dso, meta.hot[i].ic);
+		let loc = insn_locate(hot[i].dso, hot[i].ic);
 		let insn = insn_info(loc);
 		
 		el(r, 'td', insn.foffs.toString(16));
 		el(r, 'td', insn.block);
 		el(r, 'td', insn.sym_str, 'left');
 		el(r, 'td', insn.func_str, 'left');
+		if (meta.callgraph) {
+			el(r, 'td', callgraph_pct(hot[i].incl));
+			el(r, 'td', callgraph_callers(hot[i]), 'left');
+		}
+		if (meta.tid)
+			el(r, 'td', spread_text(hot[i].tid, hot[i].hits), 'left');
+		if (meta.cpu)
+			el(r, 'td', spread_text(hot[i].cpu, hot[i].hits), 'left');
+		if (meta.nbucket > 1)
+			el(r, 'td', timeline_text(hot[i]), 'left timeline');
 
 		if (loc.found) {
 			r.classList.add('clickable');
@@ -326,31 +657,44 @@ function symbols_list(parent, max)
 	let table = el(parent, 'table');
 	
 	let h = el(table, 'tr');
-	el(h, 'th', 'samples');
+	el(h, 'th', metric_label());
 	el(h, 'th', '%');
 	el(h, 'th', 'DSO', 'left');
 	el(h, 'th', 'block');
 	el(h, 'th', 'symbol', 'left');
+	if (meta.callgraph) {
+		el(h, 'th', 'incl %');
+		el(h, 'th', 'callers', 'left');
+	}
+	if (meta.nbucket > 1)
+		el(h, 'th', timeline_label(), 'left');
 	
-	for (let i = 0; i < meta.sym.length; i++) {
+	let top = metric_sort(meta.sym);
+	
+	for (let i = 0; i < top.length; i++) {
 		if (i === max)
 			break;
 		
 		let r = el(table, 'tr');
 		
-		el(r, 'td', meta.sym[i].hits);
-		el(r, 'td',
-			(100.0 * meta.sym[i].hits / prog.samples).toFixed(2));
+		el(r, 'td', metric_text(top[i]));
+		el(r, 'td', metric_pct(top[i]));
 		
-		let dso = prog.dso[meta.sym[i].dso];
-		let sym = dso.sym[meta.sym[i].idx];
-		let loc = insn_locate_sym(meta.sym[i].dso, meta.sym[i].idx);
+		let dso = prog.dso[top[i].dso];
+		let sym = dso.sym[top[i].idx];
+		let loc = insn_locate_sym(top[i].dso, top[i].idx);
 		
 		el(r, 'td', dso.path, 'left');
 		el(r, 'td', loc.block);
 		el(r, 'td', sym.name + ((sym.multiple !== 0)
 			? '@0x' + sym.addr.toString(16) : ''),
 			'left');
+		if (meta.callgraph) {
+			el(r, 'td', callgraph_pct(top[i].incl));
+			el(r, 'td', callgraph_callers(top[i]), 'left');
+		}
+		if (meta.nbucket > 1)
+			el(r, 'td', timeline_text(top[i]), 'left timeline');
 		
 		if (loc.found) {
 			r.classList.add('clickable');
@@ -374,23 +718,24 @@ function functions_list(parent, max)
 	let table = el(parent, 'table');
 	
 	let h = el(table, 'tr');
-	el(h, 'th', 'samples');
+	el(h, 'th', metric_label());
 	el(h, 'th', '%');
 	el(h, 'th', 'DSO', 'left');
 	el(h, 'th', 'function', 'left');
 	
-	for (let i = 0; i < meta.func.length; i++) {
+	let top = metric_sort(meta.func);
+	
+	for (let i = 0; i < top.length; i++) {
 		if (i === max)
 			break;
 		
 		let r = el(table, 'tr');
 		
-		el(r, 'td', meta.func[i].hits);
-		el(r, 'td',
-			(100.0 * meta.func[i].hits / prog.samples).toFixed(2));
+		el(r, 'td', metric_text(top[i]));
+		el(r, 'td', metric_pct(top[i]));
 		
-		let dso = prog.dso[meta.func[i].dso];
-		let func = dso.func[meta.func[i].idx];
+		let dso = prog.dso[top[i].dso];
+		let func = dso.func[top[i].idx];
 
 		el(r, 'td', dso.path, 'left');
 		el(r, 'td', func.name + '()', 'left');
@@ -456,6 +801,10 @@ function overview_build()
 {
 	let main = el(document.body, 'main');
 	
+	if (meta.rate < 1)
+		el(main, 'p', 'Downsampled: ' + (100.0 * meta.rate).toPrecision(3)
+			+ '% of the samples were read; counts are estimates.');
+	
 	// ****************************************************************
 	el(anchor(el(main, 'h1'), function() { mode_set('hotspots'); }),
 		'span', 'Hotspots');
@@ -478,7 +827,7 @@ function overview_build()
 	let dso_table = el(main, 'table');
 	
 	let dso_h = el(dso_table, 'tr');
-	el(dso_h, 'th', 'samples');
+	el(dso_h, 'th', metric_label());
 	el(dso_h, 'th', '%');
 	el(dso_h, 'th', 'path', 'left');
 	el(dso_h, 'th', 'insn');
@@ -486,11 +835,10 @@ function overview_build()
 	
 	for (let i = 0; i < prog.dso.length; i++) {
 		let r = el(dso_table, 'tr');
+		let m = { hits: prog.dso[i].samples, ev: prog.dso[i].period };
 		
-		el(r, 'td', prog.dso[i].samples);
-		el(r, 'td',
-			(100.0 * prog.dso[i].samples
-			/ prog.samples).toFixed(2));
+		el(r, 'td', metric_text(m));
+		el(r, 'td', metric_pct(m));
 		el(r, 'td', prog.dso[i].path, 'left');
 		el(r, 'td', prog.dso[i].ninsn);
 		el(r, 'td', prog.dso[i].block.length);
@@ -688,11 +1036,14 @@ function code_insn_load(pane, loc)
 	let table = pane.icol.table;
 	sub_clear(table);
 	
-	// compute max hits
+	// compute max hits, and max data access samples
 	let hits_max = 0;
+	let mem_max = 0;
 	for (let k = 0; k < insn.length; k++) {
-		if (insn[k].hits > hits_max)
-			hits_max = insn[k].hits;
+		if (metric_value(insn[k]) > hits_max)
+			hits_max = metric_value(insn[k]);
+		if (insn[k].mem && (insn[k].mem.samples > mem_max))
+			mem_max = insn[k].mem.samples;
 	}
 
 	// build rows
@@ -725,6 +1076,8 @@ function code_insn_load(pane, loc)
 			
 			el(lr, 'td');
 			el(lr, 'td');
+			if (mem_max > 0)
+				el(lr, 'td');
 			lc = el(lr, 'td', cur_sym_str + ':', 'sym');
 			lc.colSpan = 2;
 			
@@ -732,6 +1085,8 @@ function code_insn_load(pane, loc)
 				let er = el(table, 'tr');
 				el(er, 'td');
 				el(er, 'td');
+				if (mem_max > 0)
+					el(er, 'td');
 				el(er, 'td');
 				el(er, 'td', '[... +0x'
 					+ (insn[i].foffs - cur_sym_foffs)
@@ -744,10 +1099,11 @@ function code_insn_load(pane, loc)
 		let r = el(table, 'tr', null, 'insn');
 		
 		// hits
-		let hits = insn[i].hits;
+		let hits = metric_value(insn[i]);
 		
 		if (hits > 0) {
-			el(r, 'td', (100.0 * hits / prog.samples).toFixed(2),
+			el(r, 'td', (ui_state.metric.den >= 0)
+				? metric_text(insn[i]) : metric_pct(insn[i]),
 				'hits');
 		} else if (insn[i].flags & INSN_HOTSPOT) {
 			el(r, 'td', '|', 'hits');
@@ -765,6 +1121,14 @@ function code_insn_load(pane, loc)
 			bar.style.height = '0.75em';
 		}
 		
+		// memory levels
+		if (mem_max > 0) {
+			let mem_cell = el(r, 'td', null, 'left');
+			
+			if (insn[i].mem)
+				mem_bar(mem_cell, insn[i].mem, mem_max);
+		}
+		
 		// symbol offset
 		if ((cur_sym_id !== -1) && (insn[i].flags & INSN_TARGET)) {
 			el(r, 'td', '+0x' +
@@ -829,6 +1193,28 @@ function code_insn_load(pane, loc)
 		el(r4, 'td', insn[i].landings);
 		el(r4, 'td', frac_lt);
 		
+		if (insn[i].mem) {
+			let mem = insn[i].mem;
+			let rm = el(dt, 'tr');
+			el(rm, 'td', '\u25a4 accesses:');
+			el(rm, 'td', mem.samples);
+			el(rm, 'td', mem_text(mem));
+			let rw = el(dt, 'tr');
+			el(rw, 'td', '\u25a4 latency:');
+			el(rw, 'td', mem.weight);
+			el(rw, 'td', 'average: '
+				+ (mem.weight / mem.samples).toFixed(1));
+			
+			for (let j = 0; j < mem.line.length; j++) {
+				let rl = el(dt, 'tr');
+				el(rl, 'td', (j === 0) ? '\u25a4 lines:' : '');
+				el(rl, 'td', '0x' + mem.line[j][0].toString(16));
+				el(rl, 'td', mem.line[j][1] + ' ('
+					+ (100.0 * mem.line[j][1] / mem.samples)
+						.toFixed(2) + '%)');
+			}
+		}
+		
 		let dt2 = el(dd, 'table');
 		
 		let r5 = el(dt2, 'tr');
@@ -1182,7 +1568,8 @@ var global_code = {};
 
 var ui_state = {
 	cur_mode: '',
-	mode: []
+	mode: [],
+	metric: { num: -1, den: -1 }
 }
 
 function code_prebuild()
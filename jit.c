@@ -0,0 +1,455 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "message.h"
+#include "mem.h"
+#include "reader.h"
+#include "token.h"
+#include "jit.h"
+
+// ************************************************************************
+// jitdump layout (see tools/perf/util/jitdump.h)
+// ************************************************************************
+#define JIT_MAGIC		0x4a695444
+#define JIT_HEADER_SIZE		40
+#define JIT_RECORD_SIZE		16
+
+#define JIT_CODE_LOAD		0
+#define JIT_CODE_MOVE		1
+
+#define JIT_EM_386		3
+#define JIT_EM_X86_64		62
+
+// nops after each piece of code: longer than any x86 insn
+#define JIT_PAD			16
+
+static inline uint64_t rd64(const uint8_t *b)
+{
+	uint64_t v;
+	memcpy(&v, b, sizeof(v));
+	return v;
+}
+
+static inline uint32_t rd32(const uint8_t *b)
+{
+	uint32_t v;
+	memcpy(&v, b, sizeof(v));
+	return v;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int jit_map_pid(const char *path, uint64_t *pid)
+{
+	if (strncmp(path, "/tmp/perf-", 10) != 0)
+		return -1;
+
+	char *e;
+
+	*pid = strtoul(path + 10, &e, 10);
+
+	if ((e == path + 10) || (strcmp(e, ".map") != 0))
+		return -1;
+
+	return 0;
+}
+
+int jit_anon(const char *path)
+{
+	return (strcmp(path, "//anon") == 0)
+		|| (strncmp(path, "/dev/zero", 9) == 0)
+		|| (strncmp(path, "/anon_hugepage", 14) == 0);
+}
+
+int jit_dump_of(const char *path, uint64_t pid)
+{
+	char name[32];
+	const char *base = strrchr(path, '/');
+
+	base = (base) ? base + 1 : path;
+
+	snprintf(name, sizeof(name), "jit-%lu.dump", pid);
+
+	return strcmp(base, name) == 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+void jit_init(struct jit *j)
+{
+	j->path = NULL;
+	j->base = NULL;
+	j->size = 0;
+	j->machine = 0;
+
+	MEM_INIT(j->code, j->ncode);
+	obstack_init(&j->names);
+}
+
+void jit_clear(struct jit *j)
+{
+	if (j->base)
+		munmap(j->base, j->size);
+
+	MEM_CLEAR(j->code, j->ncode);
+	obstack_clear(&j->names);
+
+	jit_init(j);
+}
+
+static struct jit_code *jit_add(struct jit *j, uint64_t addr, uint64_t size,
+	char *name)
+{
+	size_t k = j->ncode;
+	char *store = obstack_dup(&j->names, name);
+
+	if ((store == NULL) || MEM_RESIZE(j->code, j->ncode, k + 1))
+		return NULL;
+
+	struct jit_code *c = &j->code[k];
+
+	c->addr = addr;
+	c->size = size;
+	c->name = store;
+	c->bin = NULL;
+	c->offs = 0;
+	c->seq = k;
+	c->index = 0;
+
+	return c;
+}
+
+// ************************************************************************
+// Code may be freed and its addresses reused: at the same address, the
+// last code loaded is kept; otherwise, of overlapping code, the lowest.
+// ************************************************************************
+static int jit_cmp_code(const void *va, const void *vb)
+{
+	const struct jit_code *a = va;
+	const struct jit_code *b = vb;
+
+	if (a->addr != b->addr)
+		return (a->addr < b->addr) ? -1 : 1;
+	if (a->seq != b->seq)
+		return (a->seq > b->seq) ? -1 : 1;
+	return 0;
+}
+
+static void jit_sort(struct jit *j)
+{
+	qsort(j->code, j->ncode, sizeof(struct jit_code), jit_cmp_code);
+
+	size_t n = 0;
+	uint64_t end = 0;
+
+	for (size_t k = 0; k < j->ncode; k++) {
+		struct jit_code *c = &j->code[k];
+
+		if ((c->size == 0) || ((n > 0) && (c->addr < end)))
+			continue;
+
+		j->code[n++] = *c;
+		end = c->addr + c->size;
+	}
+
+	j->ncode = n;
+}
+
+// ************************************************************************
+// perf map: "START SIZE name" lines, in hex
+// ************************************************************************
+int jit_read_map(struct jit *j, char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct reader rd;
+
+	if (reader_open(&rd, fd)) {
+		close(fd);
+		return -1;
+	}
+
+	j->path = path;
+
+	int r;
+
+	while (1) {
+		char *b, *e;
+		size_t len;
+
+		r = reader_line(&rd, &b, &len);
+
+		if (r <= 0)
+			break;
+
+		if ((b[0] == '0') && (b[1] == 'x'))
+			b += 2;
+
+		uint64_t addr = hexparse_padded(b, &e);
+
+		if ((e == b) || (*e != ' '))
+			continue;
+
+		b = e + 1;
+
+		if ((b[0] == '0') && (b[1] == 'x'))
+			b += 2;
+
+		uint64_t size = hexparse_padded(b, &e);
+
+		if ((e == b) || (*e != ' '))
+			continue;
+
+		if (jit_add(j, addr, size, e + 1) == NULL) {
+			r = -1;
+			break;
+		}
+	}
+
+	reader_close(&rd);
+
+	jit_sort(j);
+
+	return r;
+}
+
+// ************************************************************************
+// jitdump: header, then records; code load records hold the code bytes,
+// code move records refer to them by index. The file may be truncated
+// mid-record if the process was still running.
+// ************************************************************************
+static struct jit_code *jit_index(struct jit *j, uint64_t index)
+{
+	for (size_t k = j->ncode; k > 0; k--) {
+		if (j->code[k - 1].index == index)
+			return &j->code[k - 1];
+	}
+
+	return NULL;
+}
+
+static int jit_load(struct jit *j, const uint8_t *rec, size_t size)
+{
+	if (size <= 56)
+		return 0;
+
+	const char *name = (const char *)rec + 56;
+	const char *end = memchr(name, 0, size - 56);
+
+	if (end == NULL)
+		return 0;
+
+	uint64_t code_size = rd64(rec + 40);
+	size_t bin = end + 1 - (const char *)rec;
+
+	if (code_size > size - bin)
+		return 0;
+
+	struct jit_code *c = jit_add(j, rd64(rec + 32), code_size,
+		(char *)name);
+
+	if (c == NULL)
+		return -1;
+
+	c->bin = rec + bin;
+	c->index = rd64(rec + 48);
+
+	return 0;
+}
+
+static int jit_move(struct jit *j, const uint8_t *rec, size_t size)
+{
+	if (size < 64)
+		return 0;
+
+	struct jit_code *c = jit_index(j, rd64(rec + 56));
+
+	if (c == NULL)
+		return 0;
+
+	size_t k = c - j->code;
+
+	c = jit_add(j, rd64(rec + 40), j->code[k].size, j->code[k].name);
+
+	if (c == NULL)
+		return -1;
+
+	c->bin = j->code[k].bin;
+	c->index = j->code[k].index;
+
+	return 0;
+}
+
+int jit_read_dump(struct jit *j, char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+	||  (st.st_size < JIT_HEADER_SIZE)) {
+		ERROR("%s: not a jitdump file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED) {
+		ERROR("%s: mmap(): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	j->path = path;
+	j->base = base;
+	j->size = st.st_size;
+
+	const uint8_t *h = j->base;
+	size_t offs = rd32(h + 8);
+
+	if ((rd32(h) != JIT_MAGIC) || (offs < JIT_HEADER_SIZE)) {
+		ERROR("%s: bad jitdump header (cross-endian?)\n", path);
+		return -1;
+	}
+
+	j->machine = rd32(h + 12);
+
+	while (offs + JIT_RECORD_SIZE <= j->size) {
+		const uint8_t *rec = j->base + offs;
+		uint32_t id = rd32(rec);
+		size_t size = rd32(rec + 4);
+
+		if ((size < JIT_RECORD_SIZE) || (size > j->size - offs))
+			break;
+
+		int r = 0;
+
+		if (id == JIT_CODE_LOAD)
+			r = jit_load(j, rec, size);
+		else if (id == JIT_CODE_MOVE)
+			r = jit_move(j, rec, size);
+
+		if (r)
+			return -1;
+
+		offs += size;
+	}
+
+	jit_sort(j);
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+const char *jit_arch(struct jit *j)
+{
+	if (j->base == NULL)
+		return NULL;
+
+	if (j->machine == JIT_EM_X86_64)
+		return "i386:x86-64";
+	if (j->machine == JIT_EM_386)
+		return "i386";
+
+	return NULL;
+}
+
+static int jit_write(int fd, const void *b, size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(fd, b, n);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ERROR("write(): %s\n", strerror(errno));
+			return -1;
+		}
+
+		b = (const uint8_t *)b + w;
+		n -= w;
+	}
+
+	return 0;
+}
+
+int jit_image(struct jit *j, int fd)
+{
+	uint8_t pad[JIT_PAD];
+	uint64_t offs = 0;
+
+	memset(pad, 0x90, sizeof(pad));
+
+	for (size_t k = 0; k < j->ncode; k++) {
+		struct jit_code *c = &j->code[k];
+
+		if (jit_write(fd, c->bin, c->size)
+		||  jit_write(fd, pad, sizeof(pad)))
+			return -1;
+
+		c->offs = offs;
+		offs += c->size + sizeof(pad);
+	}
+
+	return 0;
+}
+
+size_t jit_at(struct jit *j, uint64_t offs)
+{
+	size_t lo = 0;
+	size_t hi = j->ncode;
+
+	// first code after offs
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (j->code[mid].offs <= offs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo == 0) || (offs >= j->code[lo - 1].offs + j->code[lo - 1].size))
+		return JIT_NONE;
+
+	return lo - 1;
+}
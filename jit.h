@@ -0,0 +1,85 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef JIT_H
+#define JIT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "mem.h"
+
+// ************************************************************************
+// JIT code of a process: symbols from /tmp/perf-PID.map, or symbols and
+// code bytes from a jitdump (jit-PID.dump, see perf's jitdump spec). Perf
+// names anonymous executable mappings after the perf map, and so do we:
+// their file offsets are then virtual addresses.
+// ************************************************************************
+#define JIT_NONE		((size_t)-1)
+
+struct jit_code {
+	uint64_t addr, size;
+	char *name;
+
+	// code bytes (jitdump only, NULL otherwise), and their offset in
+	// the image written by jit_image()
+	const uint8_t *bin;
+	uint64_t offs;
+
+	// load order, and jitdump code index
+	size_t seq;
+	uint64_t index;
+};
+
+struct jit {
+	char *path;
+
+	// mapped jitdump
+	uint8_t *base;
+	size_t size;
+	uint32_t machine;
+
+	// sorted by address, without overlaps
+	struct jit_code *code;
+	size_t ncode;
+
+	struct obstack names;
+};
+
+// pid of a perf map path (/tmp/perf-PID.map); -1 if not one
+int  jit_map_pid(const char *path, uint64_t *pid);
+
+// anonymous memory, as perf tells it
+int  jit_anon(const char *path);
+
+// jitdump file name of pid (jit-PID.dump)
+int  jit_dump_of(const char *path, uint64_t pid);
+
+void jit_init(struct jit *j);
+void jit_clear(struct jit *j);
+
+int  jit_read_map(struct jit *j, char *path);
+int  jit_read_dump(struct jit *j, char *path);
+
+// objdump -m architecture of the code, NULL if it cannot be disassembled
+const char *jit_arch(struct jit *j);
+
+// write the code to fd, each piece followed by a padding of nops, so
+// that objdump resynchronizes at the next one
+int  jit_image(struct jit *j, int fd);
+
+// code at image offset offs, JIT_NONE if in padding
+size_t jit_at(struct jit *j, uint64_t offs);
+
+#endif
@@ -0,0 +1,588 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <sys/utsname.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "message.h"
+#include "mem.h"
+#include "pipe.h"
+#include "reader.h"
+#include "token.h"
+#include "kernel.h"
+
+// size of the last symbol of a module (kallsyms has no sizes)
+#define KERNEL_SIZE_LAST	4096
+
+// ************************************************************************
+//
+// ************************************************************************
+void kernel_init(struct kernel *k)
+{
+	k->kallsyms = "/proc/kallsyms";
+	k->vmlinux = NULL;
+	k->modules = NULL;
+
+	k->loaded = 0;
+	k->ready = 0;
+
+	k->reloc = NULL;
+	k->reloc_addr = 0;
+	k->text = 0;
+	k->stext = 0;
+
+	MEM_INIT(k->sym, k->nsym);
+	MEM_INIT(k->module, k->nmodule);
+	obstack_init(&k->names);
+}
+
+void kernel_clear(struct kernel *k)
+{
+	MEM_CLEAR(k->sym, k->nsym);
+	MEM_CLEAR(k->module, k->nmodule);
+	obstack_clear(&k->names);
+
+	k->loaded = 0;
+	k->ready = 0;
+
+	k->reloc = NULL;
+	k->text = 0;
+	k->stext = 0;
+}
+
+// ************************************************************************
+// kallsyms: "ADDRESS TYPE NAME", then "\t[MODULE]" for module symbols
+// ************************************************************************
+static size_t kernel_add_module(struct kernel *k, char *name)
+{
+	size_t m = k->nmodule;
+
+	if ((m > 0) && (strcmp(k->module[m - 1].name, name) == 0))
+		return m - 1;
+
+	for (size_t j = 0; j < m; j++) {
+		if (strcmp(k->module[j].name, name) == 0)
+			return j;
+	}
+
+	char *store = obstack_dup(&k->names, name);
+
+	if ((store == NULL) || MEM_RESIZE(k->module, k->nmodule, m + 1))
+		return KERNEL_NONE;
+
+	k->module[m].name = store;
+	k->module[m].object = "";
+
+	return m;
+}
+
+static int kernel_add(struct kernel *k, uint64_t addr, char *name,
+	size_t module)
+{
+	size_t n = k->nsym;
+	char *store = obstack_dup(&k->names, name);
+
+	if ((store == NULL) || MEM_RESIZE(k->sym, k->nsym, n + 1))
+		return -1;
+
+	struct ksym *s = &k->sym[n];
+
+	s->addr = addr;
+	s->size = 0;
+	s->name = store;
+	s->module = module;
+	s->hits = 0;
+	s->samples = 0;
+	s->hot = 0;
+	s->seq = n;
+
+	return 0;
+}
+
+static size_t kernel_underscores(const char *name)
+{
+	size_t n = 0;
+
+	while (name[n] == '_')
+		n++;
+
+	return n;
+}
+
+static int kernel_cmp_sym(const void *va, const void *vb)
+{
+	const struct ksym *a = va;
+	const struct ksym *b = vb;
+
+	if (a->addr != b->addr)
+		return (a->addr < b->addr) ? -1 : 1;
+
+	size_t ua = kernel_underscores(a->name);
+	size_t ub = kernel_underscores(b->name);
+
+	if (ua != ub)
+		return (ua < ub) ? -1 : 1;
+	if (a->seq != b->seq)
+		return (a->seq < b->seq) ? -1 : 1;
+	return 0;
+}
+
+// by address; of aliases, the first listed is kept, after those with less
+// leading underscores (e.g. not _text)
+static void kernel_sort(struct kernel *k)
+{
+	qsort(k->sym, k->nsym, sizeof(struct ksym), kernel_cmp_sym);
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < k->nsym; i++) {
+		if ((n > 0) && (k->sym[n - 1].addr == k->sym[i].addr))
+			continue;
+
+		k->sym[n++] = k->sym[i];
+	}
+
+	k->nsym = n;
+
+	for (size_t i = 0; i < n; i++) {
+		struct ksym *s = &k->sym[i];
+
+		if ((i + 1 < n) && (s[1].module == s->module))
+			s->size = s[1].addr - s->addr;
+		else
+			s->size = KERNEL_SIZE_LAST;
+	}
+}
+
+static int kernel_read(struct kernel *k)
+{
+	int fd = open(k->kallsyms, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		ERROR("%s: %s\n", k->kallsyms, strerror(errno));
+		return -1;
+	}
+
+	struct reader rd;
+
+	if (reader_open(&rd, fd)) {
+		close(fd);
+		return -1;
+	}
+
+	if (kernel_add_module(k, KERNEL_DSO) == KERNEL_NONE) {
+		reader_close(&rd);
+		return -1;
+	}
+
+	int r;
+	size_t hidden = 0;
+
+	while (1) {
+		char *b, *e;
+		size_t len;
+
+		r = reader_line(&rd, &b, &len);
+
+		if (r <= 0)
+			break;
+
+		uint64_t addr = hexparse_padded(b, &e);
+
+		if ((e == b) || (e[0] != ' ') || (e[1] == 0) || (e[2] != ' '))
+			continue;
+
+		// text symbols only
+		char type = e[1] | 0x20;
+
+		if ((type != 't') && (type != 'w'))
+			continue;
+
+		if (addr == 0) {
+			hidden++;
+			continue;
+		}
+
+		char *name = e + 3;
+		char *tab = strchr(name, '\t');
+		size_t m = 0;
+
+		if (tab) {
+			*tab = 0;
+			m = kernel_add_module(k, tab + 1);
+		} else if (strcmp(name, "_text") == 0) {
+			k->text = addr;
+		} else if (strcmp(name, "_stext") == 0) {
+			k->stext = addr;
+		}
+
+		if ((m == KERNEL_NONE) || kernel_add(k, addr, name, m)) {
+			r = -1;
+			break;
+		}
+	}
+
+	reader_close(&rd);
+
+	if (r)
+		return -1;
+
+	if ((k->nsym == 0) && hidden) {
+		ERROR("%s: addresses hidden (see kptr_restrict)\n",
+			k->kallsyms);
+		return -1;
+	}
+
+	kernel_sort(k);
+
+	return 0;
+}
+
+// ************************************************************************
+// kallsyms are read on this host, maybe of another kernel, or of another
+// boot of it (KASLR): the relocation symbol of the recorded kernel map
+// must be where the recording had it
+// ************************************************************************
+static int kernel_check(struct kernel *k)
+{
+	uint64_t addr;
+
+	if (k->reloc == NULL)
+		return 0;
+
+	if (strcmp(k->reloc, "_text") == 0)
+		addr = k->text;
+	else if (strcmp(k->reloc, "_stext") == 0)
+		addr = k->stext;
+	else
+		return 0;
+
+	// not listed: not checked
+	if ((addr == 0) || (addr == k->reloc_addr))
+		return 0;
+
+	ERROR("Warning: %s: %s at 0x%lx, recorded at 0x%lx (another kernel "
+		"or boot): kernel samples left unspecified\n",
+		k->kallsyms, k->reloc, addr, k->reloc_addr);
+
+	return -1;
+}
+
+int kernel_load(struct kernel *k)
+{
+	if (k->loaded == 0) {
+		if (kernel_read(k)) {
+			ERROR("Warning: no kernel symbols (--kallsyms)\n");
+			k->loaded = -1;
+		} else if (kernel_check(k)) {
+			k->loaded = -1;
+		} else {
+			MESSAGE("  kernel: %zd symbols, %zd modules\n",
+				k->nsym, k->nmodule - 1);
+			k->loaded = 1;
+		}
+	}
+
+	return (k->loaded > 0) ? 0 : -1;
+}
+
+int kernel_map(const char *path)
+{
+	return strncmp(path, KERNEL_DSO, strlen(KERNEL_DSO)) == 0;
+}
+
+void kernel_reloc(struct kernel *k, const char *path, uint64_t addr)
+{
+	// the first map (the one perf synthesizes) only
+	if (k->reloc)
+		return;
+
+	k->reloc = obstack_dup(&k->names, path + strlen(KERNEL_DSO));
+	k->reloc_addr = addr;
+
+	if ((k->loaded > 0) && kernel_check(k))
+		k->loaded = -1;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+size_t kernel_at(struct kernel *k, uint64_t addr)
+{
+	size_t lo = 0;
+	size_t hi = k->nsym;
+
+	// first symbol after addr
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (k->sym[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo == 0) || (addr >= k->sym[lo - 1].addr + k->sym[lo - 1].size))
+		return KERNEL_NONE;
+
+	return lo - 1;
+}
+
+size_t kernel_module(struct kernel *k, const char *dso)
+{
+	if (dso[0] != '[')
+		return KERNEL_NONE;
+
+	for (size_t m = 0; m < k->nmodule; m++) {
+		if (strcmp(k->module[m].name, dso) == 0)
+			return m;
+	}
+
+	return KERNEL_NONE;
+}
+
+// ************************************************************************
+// Hot symbols: by decreasing samples, until they cover KERNEL_HOT_SHARE of
+// the kernel samples, KERNEL_HOT of them at most
+// ************************************************************************
+static int kernel_cmp_hits(const void *va, const void *vb)
+{
+	const struct ksym *a = *(const struct ksym * const *)va;
+	const struct ksym *b = *(const struct ksym * const *)vb;
+
+	if (a->hits != b->hits)
+		return (a->hits > b->hits) ? -1 : 1;
+	if (a->addr != b->addr)
+		return (a->addr < b->addr) ? -1 : 1;
+	return 0;
+}
+
+void kernel_hot(struct kernel *k)
+{
+	struct ksym **by_hits = malloc((k->nsym + 1) * sizeof(struct ksym *));
+
+	if (by_hits == NULL)
+		return;
+
+	size_t n = 0;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < k->nsym; i++) {
+		if (k->sym[i].hits == 0)
+			continue;
+
+		by_hits[n++] = &k->sym[i];
+		total += k->sym[i].hits;
+	}
+
+	qsort(by_hits, n, sizeof(struct ksym *), kernel_cmp_hits);
+
+	uint64_t sum = 0;
+
+	for (size_t i = 0; (i < n) && (i < KERNEL_HOT); i++) {
+		if (sum >= KERNEL_HOT_SHARE * total)
+			break;
+
+		by_hits[i]->hot = 1;
+		sum += by_hits[i]->hits;
+	}
+
+	free(by_hits);
+}
+
+// ************************************************************************
+// Module object files: modules.dep lines are "PATH: DEPENDENCIES", PATH
+// relative to the module directory; the module name is the file name up
+// to ".ko", with '-' read as '_'
+// ************************************************************************
+static void kernel_deps(struct kernel *k)
+{
+	char dir[512], path[1024];
+	struct utsname u;
+
+	if (k->modules) {
+		snprintf(dir, sizeof(dir), "%s", k->modules);
+	} else {
+		if (uname(&u))
+			u.release[0] = 0;
+
+		snprintf(dir, sizeof(dir), "/lib/modules/%s", u.release);
+	}
+
+	for (size_t m = 1; m < k->nmodule; m++)
+		k->module[m].object = NULL;
+
+	snprintf(path, sizeof(path), "%s/modules.dep", dir);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		DEBUG("\t=== %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	struct reader rd;
+
+	if (reader_open(&rd, fd)) {
+		close(fd);
+		return;
+	}
+
+	while (1) {
+		char *b;
+		size_t len;
+
+		if (reader_line(&rd, &b, &len) <= 0)
+			break;
+
+		char *colon = strchr(b, ':');
+
+		if (colon == NULL)
+			continue;
+
+		*colon = 0;
+
+		char *base = strrchr(b, '/');
+		char name[256];
+
+		base = (base) ? base + 1 : b;
+
+		char *ko = strstr(base, ".ko");
+		size_t n = (ko) ? (size_t)(ko - base) : strlen(base);
+
+		if (n + 3 > sizeof(name))
+			continue;
+
+		name[0] = '[';
+
+		for (size_t j = 0; j < n; j++)
+			name[j + 1] = (base[j] == '-') ? '_' : base[j];
+
+		name[n + 1] = ']';
+		name[n + 2] = 0;
+
+		size_t m = kernel_module(k, name);
+
+		if ((m == KERNEL_NONE) || (m == 0))
+			continue;
+
+		snprintf(path, sizeof(path), "%s%s%s",
+			(b[0] == '/') ? "" : dir, (b[0] == '/') ? "" : "/", b);
+
+		k->module[m].object = obstack_dup(&k->names, path);
+	}
+
+	reader_close(&rd);
+}
+
+// decompressor of a compressed module (NULL: none), and its flag
+static char *kernel_decompressor(const char *path, char **flag)
+{
+	size_t len = strlen(path);
+
+	if ((len > 3) && (strcmp(path + len - 3, ".gz") == 0)) {
+		*flag = "-dc";
+		return "gzip";
+	}
+
+	if ((len > 4) && (strcmp(path + len - 4, ".zst") == 0)) {
+		*flag = "-dcq";
+		return "zstd";
+	}
+
+	if ((len > 3) && (strcmp(path + len - 3, ".xz") == 0)) {
+		*flag = "-dc";
+		return "xz";
+	}
+
+	return NULL;
+}
+
+static int kernel_unzip(char **argv, char *tmp)
+{
+	pid_t child;
+	int in = pipe_in_child(argv, -1, &child);
+
+	if (in < 0)
+		return -1;
+
+	int out = mkstemp(tmp);
+
+	if (out < 0) {
+		ERROR("%s: mkstemp(): %s\n", tmp, strerror(errno));
+		close(in);
+		pipe_wait(child, argv[0]);
+		return -1;
+	}
+
+	char buff[65536];
+	ssize_t n;
+	int r = 0;
+
+	while ((n = read(in, buff, sizeof(buff))) != 0) {
+		if ((n < 0) && (errno == EINTR))
+			continue;
+
+		if ((n < 0) || (write(out, buff, n) != n)) {
+			ERROR("%s: %s\n", argv[2], strerror(errno));
+			r = -1;
+			break;
+		}
+	}
+
+	close(in);
+	close(out);
+
+	// a truncated or corrupt object still ends the output
+	if (pipe_wait(child, argv[0]))
+		r = -1;
+
+	if (r)
+		unlink(tmp);
+
+	return r;
+}
+
+char *kernel_image(struct kernel *k, size_t m, char *tmp)
+{
+	if ((m > 0) && k->module[m].object && (k->module[m].object[0] == 0))
+		kernel_deps(k);
+
+	char *path = (m == 0) ? k->vmlinux : k->module[m].object;
+
+	if (path == NULL)
+		return NULL;
+
+	char *argv[4];
+
+	argv[0] = kernel_decompressor(path, &argv[1]);
+
+	if (argv[0] == NULL)
+		return path;
+
+	argv[2] = path;
+	argv[3] = NULL;
+
+	if (kernel_unzip(argv, tmp))
+		return NULL;
+
+	return tmp;
+}
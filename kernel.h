@@ -0,0 +1,114 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef KERNEL_H
+#define KERNEL_H
+#include <stddef.h>
+#include <stdint.h>
+#include "mem.h"
+
+// ************************************************************************
+// Kernel code: text symbols from kallsyms, by address. The kernel proper
+// is the dso "[kernel.kallsyms]", and each module the dso "[module]", as
+// perf names them. Only the most sampled symbols are disassembled, from
+// vmlinux or from the module object files (see modules.dep); the other
+// sampled symbols are kept whole.
+// ************************************************************************
+#define KERNEL_NONE		((size_t)-1)
+#define KERNEL_DSO		"[kernel.kallsyms]"
+
+// most symbols disassembled, and share of the kernel samples they cover
+#define KERNEL_HOT		32
+#define KERNEL_HOT_SHARE	0.95
+
+struct ksym {
+	uint64_t addr, size;
+	char *name;
+	size_t module;
+
+	// samples (of event 0, and of any event), and whether to disassemble
+	// (see kernel_hot())
+	uint64_t hits, samples;
+	int hot;
+
+	// kallsyms order
+	size_t seq;
+};
+
+struct kmodule {
+	// dso name, and object file ("" if not looked up yet, NULL if none)
+	char *name;
+	char *object;
+};
+
+struct kernel {
+	// kallsyms file, vmlinux (NULL: none), and module directory, with
+	// modules.dep (NULL: /lib/modules/RELEASE)
+	char *kallsyms;
+	char *vmlinux;
+	char *modules;
+
+	// kallsyms read: 0 not yet, 1 done, -1 failed
+	int loaded;
+
+	// hot symbols marked (no more samples wait for them)
+	int ready;
+
+	// kernel map of the recording, named after its relocation symbol
+	// ("[kernel.kallsyms]_text": reloc "_text", NULL if none), at
+	// reloc_addr; kallsyms addresses of _text and _stext
+	char *reloc;
+	uint64_t reloc_addr;
+	uint64_t text, stext;
+
+	// sorted by address, without aliases
+	struct ksym *sym;
+	size_t nsym;
+
+	// module 0 is the kernel proper
+	struct kmodule *module;
+	size_t nmodule;
+
+	struct obstack names;
+};
+
+void kernel_init(struct kernel *k);
+void kernel_clear(struct kernel *k);
+
+// reads kallsyms (once); -1 if unavailable, or not of the kernel recorded
+int  kernel_load(struct kernel *k);
+
+// whether path is the kernel map of a recording ("[kernel.kallsyms]_text")
+int  kernel_map(const char *path);
+
+// kernel map recorded: kallsyms must have its relocation symbol at addr
+// (the map offset), else kernel samples are left unspecified
+void kernel_reloc(struct kernel *k, const char *path, uint64_t addr);
+
+// text symbol spanning addr, KERNEL_NONE if none
+size_t kernel_at(struct kernel *k, uint64_t addr);
+
+// module of a dso name, KERNEL_NONE if not a kernel dso
+size_t kernel_module(struct kernel *k, const char *dso);
+
+// marks the most sampled symbols as hot
+void kernel_hot(struct kernel *k);
+
+// object file of module m to disassemble, written decompressed to tmp
+// (a mkstemp() template) if needed; NULL if none
+char *kernel_image(struct kernel *k, size_t m, char *tmp);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "message.h"
+#include "mem.h"
+#include "loader.h"
+
+// ************************************************************************
+//
+// ************************************************************************
+int loader_init(struct loader *l)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	l->nthread = 0;
+	l->max = (cpus < 1) ? 1 : (cpus > LOADER_THREADS) ? LOADER_THREADS
+		: (int)cpus;
+
+	MEM_INIT(l->job, l->njob);
+	l->next = 0;
+	l->first = 0;
+	l->nopen = 0;
+	l->ndone = 0;
+	l->quit = 0;
+
+	if (pthread_mutex_init(&l->lock, NULL)
+	||  pthread_cond_init(&l->work, NULL)
+	||  pthread_cond_init(&l->done, NULL)) {
+		ERROR("loader: pthread init failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void loader_clear(struct loader *l)
+{
+	pthread_mutex_lock(&l->lock);
+	l->quit = 1;
+	pthread_cond_broadcast(&l->work);
+	pthread_mutex_unlock(&l->lock);
+
+	for (int k = 0; k < l->nthread; k++)
+		pthread_join(l->thread[k], NULL);
+
+	MEM_CLEAR(l->job, l->njob);
+
+	pthread_cond_destroy(&l->done);
+	pthread_cond_destroy(&l->work);
+	pthread_mutex_destroy(&l->lock);
+}
+
+// ************************************************************************
+// Threads take the jobs in order, and wait for more
+// ************************************************************************
+static void *loader_run(void *arg)
+{
+	struct loader *l = arg;
+
+	pthread_mutex_lock(&l->lock);
+
+	while (1) {
+		while (!l->quit && (l->next == l->njob))
+			pthread_cond_wait(&l->work, &l->lock);
+
+		if (l->quit)
+			break;
+
+		size_t k = l->next++;
+		struct dso *dso = l->job[k].dso;
+
+		l->job[k].state = LOADER_RUNNING;
+
+		pthread_mutex_unlock(&l->lock);
+
+		int r = dso_load(dso);
+
+		pthread_mutex_lock(&l->lock);
+
+		l->job[k].r = r;
+		l->job[k].state = LOADER_DONE;
+		l->ndone++;
+
+		pthread_cond_broadcast(&l->done);
+	}
+
+	pthread_mutex_unlock(&l->lock);
+
+	return NULL;
+}
+
+int loader_start(struct loader *l, struct dso *dso, size_t id)
+{
+	int r = 0;
+
+	pthread_mutex_lock(&l->lock);
+
+	if ((l->nthread < l->max)
+	&&  (pthread_create(&l->thread[l->nthread], NULL, loader_run, l) == 0))
+		l->nthread++;
+
+	size_t k = l->njob;
+
+	if (l->nthread == 0) {
+		ERROR("loader: pthread_create() failed\n");
+		r = -1;
+	} else if (MEM_RESIZE(l->job, l->njob, k + 1)) {
+		r = -1;
+	} else {
+		l->job[k].dso = dso;
+		l->job[k].id = id;
+		l->job[k].state = LOADER_QUEUED;
+		l->job[k].r = 0;
+		l->nopen++;
+
+		pthread_cond_signal(&l->work);
+	}
+
+	pthread_mutex_unlock(&l->lock);
+
+	return r;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int loader_done(struct loader *l, int wait, struct dso **dso, size_t *id,
+	int *r)
+{
+	pthread_mutex_lock(&l->lock);
+
+	while (wait && (l->ndone == 0) && (l->nopen > 0))
+		pthread_cond_wait(&l->done, &l->lock);
+
+	if (l->ndone == 0) {
+		pthread_mutex_unlock(&l->lock);
+		return 0;
+	}
+
+	for (size_t k = l->first; k < l->njob; k++) {
+		struct loader_job *j = &l->job[k];
+
+		if (j->state != LOADER_DONE)
+			continue;
+
+		*dso = j->dso;
+		*id = j->id;
+		*r = j->r;
+
+		j->state = LOADER_TAKEN;
+		l->ndone--;
+		l->nopen--;
+		break;
+	}
+
+	while ((l->first < l->njob)
+	&&     (l->job[l->first].state == LOADER_TAKEN))
+		l->first++;
+
+	pthread_mutex_unlock(&l->lock);
+
+	return 1;
+}
@@ -0,0 +1,74 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef LOADER_H
+#define LOADER_H
+#include <stddef.h>
+#include <pthread.h>
+#include "dso.h"
+
+// ************************************************************************
+// Background dso loads: dso_load() runs on a pool of threads (started as
+// needed, up to one per cpu and LOADER_THREADS), while the trace is still
+// being read. Each load is on a dso of its own, that only the caller
+// touches once it is done.
+// ************************************************************************
+#define LOADER_THREADS		8
+
+#define LOADER_QUEUED		0
+#define LOADER_RUNNING		1
+#define LOADER_DONE		2
+#define LOADER_TAKEN		3
+
+struct loader_job {
+	struct dso *dso;
+	size_t id;
+	int state;
+	int r;
+};
+
+struct loader {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+
+	pthread_t thread[LOADER_THREADS];
+	int nthread, max;
+
+	// jobs in the order given; the first not started yet, the first not
+	// taken back yet, and how many are not taken back, of which done
+	struct loader_job *job;
+	size_t njob;
+	size_t next, first;
+	size_t nopen, ndone;
+
+	int quit;
+};
+
+int  loader_init(struct loader *l);
+
+// waits for the loads under way, then stops the threads; loads not
+// started yet are dropped (their dsos remain the caller's)
+void loader_clear(struct loader *l);
+
+// loads dso in the background, id being the caller's name for it
+int  loader_start(struct loader *l, struct dso *dso, size_t id);
+
+// a load done (1), with dso_load()'s result in *r; 0 if none is, or if
+// none is left to wait for (wait)
+int  loader_done(struct loader *l, int wait, struct dso **dso, size_t *id,
+	int *r);
+
+#endif
@@ -18,11 +18,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "message.h"
+#include "diag.h"
+#include "filter.h"
 #include "prog.h"
+#include "kernel.h"
 #include "trace.h"
 #include "meta.h"
 #include "dump.h"
 #include "output.h"
+#include "serialize.h"
 #include "main.h"
 
 // ************************************************************************
@@ -37,23 +41,78 @@ struct param_info {
 
 enum param_id {
 	PARAM_INPUT,
+	PARAM_SCRIPT,
+	PARAM_READER,
+	PARAM_JOBS,
+	PARAM_EVENT,
+	PARAM_KALLSYMS,
+	PARAM_VMLINUX,
+	PARAM_KMODULES,
+	PARAM_PID,
+	PARAM_TID,
+	PARAM_COMM,
+	PARAM_TIME,
+	PARAM_DSOS,
+	PARAM_SAMPLE_RATE,
+	PARAM_MAX_SAMPLES,
+	PARAM_LIVE,
+	PARAM_CHECKPOINT,
+	PARAM_RESUME,
 	PARAM_OUTPUT,
 	PARAM_SAMPLE_THRESHOLD,
 	PARAM_HOTSPOT_THRESHOLD,
 	PARAM_HOTSPOT_CONTEXT,
 	PARAM_DUMP_CONTEXT,
+	PARAM_BUCKET,
 	PARAM_THEME,
+	PARAM_VERBOSE,
 	NPARAMS,
 };
 
 static struct param_info param[NPARAMS] = {
 { "-i", "file", "input file, produced by perf-record", "perf.data" },
+{ "-S", "file", "replay perf-script output instead ('-': stdin; "
+	"may be gzip/zstd/xz/bzip2-compressed, the tool being installed)",
+	NULL },
+{ "-r", "reader", "'native' or 'script' (perf-script) trace reader",
+	"native" },
+{ "-j", "n", "run n perf-script time slices in parallel (implies -r script)",
+	"1" },
+{ "-e", "event", "event counted as samples; others are period-weighted",
+	"cycles" },
+{ "--kallsyms", "file", "kernel symbols ('-': none, kernel samples are not "
+	"resolved)", "/proc/kallsyms" },
+{ "--vmlinux", "file", "kernel image, to disassemble hot kernel code from",
+	NULL },
+{ "--kmodules", "dir", "kernel modules, with modules.dep, to disassemble hot "
+	"module code from", "/lib/modules/RELEASE" },
+{ "--pid", "pid,...", "only samples of these processes", NULL },
+{ "--tid", "tid,...", "only samples of these threads", NULL },
+{ "--comm", "comm,...", "only samples of threads with these names", NULL },
+{ "--time", "start,stop", "only samples in this time range (seconds)",
+	NULL },
+{ "--dsos", "dso,...", "only samples in, and disassembly of, these DSOs",
+	NULL },
+{ "--sample-rate", "r", "read a fraction r of the samples, and scale counts "
+	"up", NULL },
+{ "--max-samples", "n", "read about n samples at most (from the perf.data "
+	"sample count)", NULL },
+{ "--live", "secs", "stream input (e.g. '-S -' or '-i -'), and update the "
+	"output every secs seconds (kernel samples are not resolved)", NULL },
+{ "--checkpoint", "file", "save the progress of the trace load to file "
+	"every minute", NULL },
+{ "--resume", "file", "resume the trace load saved to file by --checkpoint "
+	"(and keep saving to it)", NULL },
 { "-o", "file", "output file", "report.html" },
 { "-s", "count[%%]", "minimum number of samples per insn", "1" },
 { "-t", "count[%%]", "minimum total number of samples per hotspot", "2" },
 { "-c", "n", "merge hotspots separated by up to n insn", "5" },
 { "-d", "n", "output n insn before and after hotspots", "100" },
+{ "--bucket", "ms", "timeline bucket width ('auto': about 100 buckets; "
+	"0: no timeline)", "auto" },
 { "-T", "theme", "'dark', 'light' or css file path", "light" },
+{ "-v", "level", "unresolved addresses: 0 counts and a few examples, "
+	"1 each of them", "0" },
 };
 
 // ************************************************************************
@@ -67,9 +126,13 @@ static void help_message(void)
 		"\n");
 	
 	for (int p = 0; p < NPARAMS; p++) {
-		MESSAGE("  %-4s %-10s   %s (default: %s)\n",
-			param[p].flag, param[p].arg_name,
-			param[p].description, param[p].def_val);
+		MESSAGE("  %-13s %-10s   %s", param[p].flag,
+			param[p].arg_name, param[p].description);
+		
+		if (param[p].def_val)
+			MESSAGE(" (default: %s)", param[p].def_val);
+		
+		MESSAGE("\n");
 	}
 	
 	MESSAGE("\n");
@@ -153,51 +216,229 @@ static int pcs(char *str, uint64_t *dst, uint64_t total)
 	return 0;
 }
 
+// ms, or 'auto'; set in ns
+static int pcb(char *str, uint64_t *bucket)
+{
+	if (strcmp(str, "auto") == 0) {
+		*bucket = PROG_BUCKET_AUTO;
+		return 0;
+	}
+	
+	char *e;
+	uint64_t ms = strtoul(str, &e, 10);
+	
+	if ((e == str) || (*e != 0)) {
+		ERROR("%s: could not parse bucket width\n", str);
+		return -1;
+	}
+	
+	*bucket = ms * 1000000;
+	
+	return 0;
+}
+
+static int pcr(char *str, int *native)
+{
+	if (strcmp(str, "native") == 0) {
+		*native = 1;
+	} else if (strcmp(str, "script") == 0) {
+		*native = 0;
+	} else {
+		ERROR("%s: unknown trace reader\n", str);
+		return -1;
+	}
+	
+	return 0;
+}
+
+// ************************************************************************
+// Analysis and output, of the final trace or of a live snapshot
+// ************************************************************************
+struct report {
+	char **val;
+	struct prog *p;
+	struct meta *m;
+	struct filter *f;
+	
+	// live mode only, NULL otherwise
+	struct scache *c;
+};
+
+static int report(struct report *rp)
+{
+	char **val = rp->val;
+	struct prog *p = rp->p;
+	struct meta *m = rp->m;
+	
+	m->sample_rate = rp->f->rate;
+	
+	uint64_t samples = meta_scaled(m, p->samples);
+	int r = 0;
+	
+	r |= pcs(val[PARAM_SAMPLE_THRESHOLD],
+		&m->sample_threshold_hits, samples);
+	r |= pcs(val[PARAM_HOTSPOT_THRESHOLD],
+		&m->hotspot_threshold_hits, samples);
+	r |= pci(val[PARAM_HOTSPOT_CONTEXT],
+		&m->hotspot_context_insn);
+	r |= pci(val[PARAM_DUMP_CONTEXT],
+		&m->dump_context_insn);
+	
+	if (r)
+		return r;
+	
+	r |= meta_run(m, p);
+	
+	if (r)
+		return r;
+	
+	//dump(m, p);
+	
+	if (rp->c)
+		return output_snapshot(m, p, val[PARAM_OUTPUT],
+			val[PARAM_THEME], rp->c);
+	
+	return output(m, p, val[PARAM_OUTPUT], val[PARAM_THEME], NULL);
+}
+
+static int report_snapshot(void *ctx)
+{
+	struct report *rp = ctx;
+	
+	if (prog_kernel(rp->p) || prog_sync(rp->p))
+		return -1;
+	
+	if (rp->p->samples == 0)
+		return 0;
+	
+	MESSAGE("Snapshot (samples: %ld):\n", rp->p->samples);
+	
+	return report(rp);
+}
+
 // ************************************************************************
 // 
 // ************************************************************************
 static int run(char **val)
 {
+	struct trace trace;
 	struct prog prog;
 	struct meta meta;
+	struct filter filter;
+	struct scache cache;
+	struct kernel kernel;
 	
-	prog_init(&prog);
+	trace_init(&trace);
+	int r = prog_init(&prog);
+	kernel_init(&kernel);
 	meta_init(&meta);
+	filter_init(&filter);
+	scache_init(&cache);
+	
+	struct report rp = { val, &prog, &meta, &filter, NULL };
+	
+	trace.path = val[PARAM_INPUT];
+	trace.script = val[PARAM_SCRIPT];
+	trace.checkpoint = val[PARAM_CHECKPOINT];
 	
-	int r = trace_load(&prog, val[PARAM_INPUT]);
+	if (val[PARAM_RESUME]) {
+		trace.checkpoint = val[PARAM_RESUME];
+		trace.resume = 1;
+	}
+	
+	filter.pid = val[PARAM_PID];
+	filter.tid = val[PARAM_TID];
+	filter.comm = val[PARAM_COMM];
+	filter.time = val[PARAM_TIME];
+	filter.dsos = val[PARAM_DSOS];
+	filter.sample_rate = val[PARAM_SAMPLE_RATE];
+	filter.max_samples = val[PARAM_MAX_SAMPLES];
+	
+	trace.filter = &filter;
+	prog.filter = &filter;
+	
+	if (strcmp(val[PARAM_KALLSYMS], "-") != 0) {
+		kernel.kallsyms = val[PARAM_KALLSYMS];
+		kernel.vmlinux = val[PARAM_VMLINUX];
+		
+		if (val[PARAM_KMODULES] != param[PARAM_KMODULES].def_val)
+			kernel.modules = val[PARAM_KMODULES];
+		
+		prog.kernel = &kernel;
+	}
+	
+	uint64_t jobs, verbose;
+	
+	r |= filter_parse(&filter);
+	r |= pcr(val[PARAM_READER], &trace.native);
+	r |= pci(val[PARAM_JOBS], &jobs);
+	r |= pci(val[PARAM_VERBOSE], &verbose);
+	r |= pcb(val[PARAM_BUCKET], &prog.bucket);
+	
+	if (val[PARAM_LIVE])
+		r |= pci(val[PARAM_LIVE], &trace.live);
 	
 	if (r)
 		goto clear;
 	
-	if (prog.samples == 0) {
-		ERROR("No samples read.\n");
+	if (val[PARAM_LIVE]) {
+		if ((trace.live < 1) || (strcmp(val[PARAM_OUTPUT], "-") == 0)) {
+			ERROR("--live: period (s) and output file expected\n");
+			r = -1;
+			goto clear;
+		}
+		
+		if (trace.checkpoint) {
+			ERROR("--live: no checkpoints\n");
+			r = -1;
+			goto clear;
+		}
+		
+		// the hot kernel code is only known once: kernel samples
+		// are left unresolved, rather than orphaned after a snapshot
+		if ((val[PARAM_KALLSYMS] != param[PARAM_KALLSYMS].def_val)
+		&& (strcmp(val[PARAM_KALLSYMS], "-") != 0)) {
+			ERROR("--live: no kernel symbols (--kallsyms)\n");
+			r = -1;
+			goto clear;
+		}
+		
+		prog.kernel = NULL;
+		
+		rp.c = &cache;
+		trace.snapshot = report_snapshot;
+		trace.snapshot_ctx = &rp;
+	}
+	
+	if ((jobs < 1) || (jobs > 1024)) {
+		ERROR("%s: bad number of jobs\n", val[PARAM_JOBS]);
 		r = -1;
 		goto clear;
 	}
 	
-	r |= pcs(val[PARAM_SAMPLE_THRESHOLD],
-		&meta.sample_threshold_hits, prog.samples);
-	r |= pcs(val[PARAM_HOTSPOT_THRESHOLD],
-		&meta.hotspot_threshold_hits, prog.samples);
-	r |= pci(val[PARAM_HOTSPOT_CONTEXT],
-		&meta.hotspot_context_insn);
-	r |= pci(val[PARAM_DUMP_CONTEXT],
-		&meta.dump_context_insn);
+	trace.jobs = jobs;
+	prog.event[0] = val[PARAM_EVENT];
+	diag_verbose = verbose;
+	
+	r = trace_load(&trace, &prog);
 	
 	if (r)
 		goto clear;
 	
-	r |= meta_run(&meta, &prog);
-	
-	if (r) goto clear;
-	
-	//dump(&meta, &prog);
+	if (prog.samples == 0) {
+		ERROR("No samples read.\n");
+		r = -1;
+		goto clear;
+	}
 	
-	r = output(&meta, &prog, val[PARAM_OUTPUT], val[PARAM_THEME]);
+	r = report(&rp);
 
 clear:	
 	prog_clear(&prog);
+	kernel_clear(&kernel);
 	meta_clear(&meta);
+	filter_clear(&filter);
+	scache_clear(&cache);
 
 	return r;
 }
@@ -130,12 +130,11 @@ static int map_prepare(struct map *map)
 	
 	//DEBUG("entries (%ld) > max (%ld / %zd)\n",
 	//	map->entries, map->entries_max, map->size);
-	map_debug_stats(map);
-	map_debug_full(map);
+	//map_debug_stats(map);
 	
 	struct map tmp;
-	if (map_init_internal(&tmp,
-			map->bits, map->bits_add, map->entries_max_per1024))
+	if (map_init_internal(&tmp, map->bits + map->bits_add,
+			map->bits_add, map->entries_max_per1024))
 		return -1;
 	
 	
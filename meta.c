@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <math.h>
 #include "message.h"
 #include "prog.h"
 #include "meta.h"
@@ -29,9 +30,23 @@
 void meta_init(struct meta *m)
 {
 	MEM_INIT(m->hot, m->nhot);
+	MEM_INIT(m->seen, m->nseen);
+	MEM_INIT(m->gen, m->ngen);
+	MEM_INIT(m->tick, m->ntick);
 	
 	m->sym = NULL;
 	m->func = NULL;
+	m->callgraph = 0;
+	m->tid = 0;
+	m->cpu = 0;
+	m->bucket = 0;
+	m->nbucket = 0;
+	
+	m->sample_rate = 1.0;
+	m->run_sample_threshold_hits = 0;
+	m->run_hotspot_threshold_hits = 0;
+	
+	m->nevent = 1;
 	
 	m->sample_threshold_hits = 1;
 	m->hotspot_threshold_hits = 2;
@@ -42,19 +57,42 @@ void meta_init(struct meta *m)
 void meta_clear(struct meta *m)
 {
 	MEM_CLEAR(m->hot, m->nhot);
+	MEM_CLEAR(m->seen, m->nseen);
+	MEM_CLEAR(m->gen, m->ngen);
+	MEM_CLEAR(m->tick, m->ntick);
 	free(m->sym);
 	free(m->func);
 }
 
+// ************************************************************************
+// Downsampled traces: the hits kept follow a binomial law of parameter
+// sample_rate, whence the estimate of the whole trace and its error
+// ************************************************************************
+uint64_t meta_scaled(struct meta *m, uint64_t hits)
+{
+	if (m->sample_rate >= 1.0)
+		return hits;
+	
+	return (uint64_t)(hits / m->sample_rate + 0.5);
+}
+
+static uint64_t meta_error(struct meta *m, uint64_t hits)
+{
+	double r = m->sample_rate;
+	
+	if (r >= 1.0)
+		return 0;
+	
+	return (uint64_t)(1.96 * sqrt(hits * (1.0 - r)) / r + 0.5);
+}
+
 // ************************************************************************
 // 
 // ************************************************************************
 static int meta_hotspot(struct meta *m, struct prog *p, uint64_t t,
 	uint64_t i0, uint64_t i1, uint64_t hits, uint64_t center)
 {
-	(void)p;
-	
-	if (hits < m->hotspot_threshold_hits)
+	if (meta_scaled(m, hits) < m->hotspot_threshold_hits)
 		return 0;
 	
 	size_t hid = m->nhot;
@@ -67,6 +105,18 @@ static int meta_hotspot(struct meta *m, struct prog *p, uint64_t t,
 	m->hot[hid].i1 = i1;
 	m->hot[hid].ic = i0 + (center / hits);
 	m->hot[hid].hits = hits;
+	m->hot[hid].est = meta_scaled(m, hits);
+	m->hot[hid].err = meta_error(m, hits);
+	
+	for (int e = 0; e < DSO_EVENTS; e++) {
+		uint64_t *col = p->dso[t].insn_ev[e];
+		uint64_t sum = 0;
+		
+		for (uint64_t i = i0; col && (i <= i1); i++)
+			sum += col[i];
+		
+		m->hot[hid].ev[e] = sum;
+	}
 	
 	return 0;
 }
@@ -106,7 +156,7 @@ static int meta_run_dso(struct meta *m, struct prog *p, uint64_t t)
 	uint64_t h_i0, h_i1, h_hits, h_center, h_sym;
 	
 	for (uint64_t i = 0; i < ninsn; i++) {
-		if (insn[i].hits >= m->sample_threshold_hits) {
+		if (meta_scaled(m, insn[i].hits) >= m->sample_threshold_hits) {
 			if (!h_on) {
 				h_sym = insn[i].sym_id;
 				h_i0 = i;
@@ -203,11 +253,20 @@ static int dso_cmp_hot(const void *va, const void *vb)
 }
 
 // ************************************************************************
+static void meta_ev(struct topref *tr, uint64_t **col, size_t i)
+{
+	for (int e = 0; e < DSO_EVENTS; e++)
+		tr->ev[e] = (col[e]) ? col[e][i] : 0;
+}
+
 static int meta_sort(struct meta *m, struct prog *p)
 {
 	size_t nsym = 0;
 	size_t nfunc = 0;
 	
+	free(m->sym);
+	free(m->func);
+	
 	for (uint64_t t = 0; t < p->ndso; t++) {
 		nsym += p->dso[t].nsym;
 		nfunc += p->dso[t].nfunc;
@@ -231,6 +290,7 @@ static int meta_sort(struct meta *m, struct prog *p)
 			sym[s].dso = t;
 			sym[s].idx = i;
 			sym[s].hits = p->dso[t].sym[i].hits;
+			meta_ev(&sym[s], p->dso[t].sym_ev, i);
 			s++;
 		}
 	}
@@ -242,6 +302,7 @@ static int meta_sort(struct meta *m, struct prog *p)
 			func[f].dso = t;
 			func[f].idx = i;
 			func[f].hits = p->dso[t].func[i].hits;
+			meta_ev(&func[f], p->dso[t].func_ev, i);
 			f++;
 		}
 	}
@@ -253,20 +314,620 @@ static int meta_sort(struct meta *m, struct prog *p)
 	return 0;
 }
 
+// ************************************************************************
+// Call graph: inclusive counts, and top call sites. Both walk the trie
+// once per node, so that the cost follows the number of distinct chains.
+// ************************************************************************
+#define META_NONE		((size_t)-1)
+
+struct meta_pair {
+	size_t target;
+	uint64_t dso, insn;
+	uint64_t count;
+};
+
+static int meta_cmp_pair(const void *va, const void *vb)
+{
+	const struct meta_pair *a = va;
+	const struct meta_pair *b = vb;
+	
+	if (a->target != b->target)
+		return (a->target < b->target) ? -1 : 1;
+	if (a->dso != b->dso)
+		return (a->dso < b->dso) ? -1 : 1;
+	if (a->insn != b->insn)
+		return (a->insn < b->insn) ? -1 : 1;
+	return 0;
+}
+
+// hotspot insn ranges, ordered by (dso, i0)
+struct meta_span {
+	uint64_t dso, i0, i1;
+	size_t hot;
+};
+
+static int meta_cmp_span(const void *va, const void *vb)
+{
+	const struct meta_span *a = va;
+	const struct meta_span *b = vb;
+	
+	if (a->dso != b->dso)
+		return (a->dso < b->dso) ? -1 : 1;
+	if (a->i0 != b->i0)
+		return (a->i0 < b->i0) ? -1 : 1;
+	return 0;
+}
+
+// hotspot spanning insn i of dso t
+static int meta_spans(struct meta *m, struct meta_span **span, size_t *n)
+{
+	if (MEM_RESIZE(*span, *n, m->nhot))
+		return -1;
+	
+	for (size_t h = 0; h < m->nhot; h++) {
+		(*span)[h].dso = m->hot[h].dso;
+		(*span)[h].i0 = m->hot[h].i0;
+		(*span)[h].i1 = m->hot[h].i1;
+		(*span)[h].hot = h;
+	}
+	
+	qsort(*span, *n, sizeof(struct meta_span), meta_cmp_span);
+	
+	return 0;
+}
+
+// position in m->sym of symbol i of dso t: pos[base[t] + i]
+static int meta_sym_pos(struct meta *m, struct prog *p,
+	size_t **base, size_t *nbase, size_t **pos, size_t *npos)
+{
+	if (MEM_RESIZE(*base, *nbase, p->ndso + 1)
+	||  MEM_RESIZE(*pos, *npos, m->nsym))
+		return -1;
+	
+	(*base)[0] = 0;
+	for (size_t t = 0; t < p->ndso; t++)
+		(*base)[t + 1] = (*base)[t] + p->dso[t].nsym;
+	
+	for (size_t s = 0; s < m->nsym; s++)
+		(*pos)[(*base)[m->sym[s].dso] + m->sym[s].idx] = s;
+	
+	return 0;
+}
+
+static size_t meta_hot_at(struct meta_span *span, size_t n,
+	uint64_t t, uint64_t i)
+{
+	size_t lo = 0;
+	size_t hi = n;
+	
+	// first span after (t, i)
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		
+		if ((span[mid].dso < t)
+		||  ((span[mid].dso == t) && (span[mid].i0 <= i)))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	if ((lo == 0) || (span[lo - 1].dso != t) || (i > span[lo - 1].i1))
+		return META_NONE;
+	
+	return span[lo - 1].hot;
+}
+
+static void meta_caller(struct caller *c, struct prog *p,
+	struct meta_pair *pr)
+{
+	int k = META_CALLERS;
+	
+	while ((k > 0) && (c[k - 1].count < pr->count)) {
+		if (k < META_CALLERS)
+			c[k] = c[k - 1];
+		k--;
+	}
+	
+	if (k >= META_CALLERS)
+		return;
+	
+	struct insn *in = &p->dso[pr->dso].insn[pr->insn];
+	
+	c[k].dso = pr->dso;
+	c[k].insn = pr->insn;
+	c[k].sym = in->sym_id;
+	c[k].foffs = in->foffs;
+	c[k].count = pr->count;
+}
+
+static int meta_callgraph(struct meta *m, struct prog *p)
+{
+	struct callgraph *cg = &p->cg;
+	
+	for (size_t h = 0; h < m->nhot; h++) {
+		m->hot[h].incl = 0;
+		for (int k = 0; k < META_CALLERS; k++)
+			m->hot[h].caller[k].count = 0;
+	}
+	
+	for (size_t s = 0; s < m->nsym; s++) {
+		m->sym[s].incl = 0;
+		for (int k = 0; k < META_CALLERS; k++)
+			m->sym[s].caller[k].count = 0;
+	}
+	
+	m->callgraph = (cg->nnode > 1);
+	
+	if (!m->callgraph)
+		return 0;
+	
+	size_t *base, *pos, *node_sym, *node_hot;
+	uint64_t *stamp;
+	struct meta_span *span;
+	struct meta_pair *pair;
+	size_t nbase, npos, nspan, nnode_sym, nnode_hot, nstamp, npair;
+	
+	MEM_INIT(base, nbase);
+	MEM_INIT(pos, npos);
+	MEM_INIT(span, nspan);
+	MEM_INIT(node_sym, nnode_sym);
+	MEM_INIT(node_hot, nnode_hot);
+	MEM_INIT(stamp, nstamp);
+	MEM_INIT(pair, npair);
+	
+	int r = -1;
+	
+	if (meta_sym_pos(m, p, &base, &nbase, &pos, &npos)
+	||  meta_spans(m, &span, &nspan)
+	||  MEM_RESIZE(node_sym, nnode_sym, cg->nnode)
+	||  MEM_RESIZE(node_hot, nnode_hot, cg->nnode)
+	||  MEM_RESIZE(stamp, nstamp, m->nsym + m->nhot))
+		goto clear;
+	
+	// symbol and hotspot of each frame
+	for (size_t x = 0; x < cg->nnode; x++) {
+		struct cg_frame *f = &cg->node[x].frame;
+		
+		node_sym[x] = META_NONE;
+		node_hot[x] = META_NONE;
+		
+		if ((x == CG_ROOT) || (f->insn == CG_UNKNOWN))
+			continue;
+		
+		uint64_t sym_id = p->dso[f->dso].insn[f->insn].sym_id;
+		
+		if (sym_id < p->dso[f->dso].nsym)
+			node_sym[x] = pos[base[f->dso] + sym_id];
+		
+		node_hot[x] = meta_hot_at(span, nspan, f->dso, f->insn);
+	}
+	
+	// inclusive counts: each symbol and hotspot once per chain
+	for (size_t s = 0; s < nstamp; s++)
+		stamp[s] = 0;
+	
+	for (size_t x = 1; x < cg->nnode; x++) {
+		uint64_t self = cg->node[x].self;
+		
+		if (self == 0)
+			continue;
+		
+		for (size_t y = x; y != CG_ROOT; y = cg->node[y].parent) {
+			size_t s = node_sym[y];
+			size_t h = node_hot[y];
+			
+			if ((s != META_NONE) && (stamp[s] != x)) {
+				stamp[s] = x;
+				m->sym[s].incl += self;
+			}
+			
+			if ((h != META_NONE) && (stamp[m->nsym + h] != x)) {
+				stamp[m->nsym + h] = x;
+				m->hot[h].incl += self;
+			}
+		}
+	}
+	
+	// call sites: caller frames whose callee lies in another symbol, or
+	// in another hotspot
+	for (size_t x = 1; x < cg->nnode; x++) {
+		size_t q = cg->node[x].parent;
+		struct cg_frame *f = &cg->node[x].frame;
+		
+		if ((q == CG_ROOT) || (f->insn == CG_UNKNOWN))
+			continue;
+		
+		size_t target[2] = { META_NONE, META_NONE };
+		
+		if ((node_sym[q] != META_NONE) && (node_sym[q] != node_sym[x]))
+			target[0] = node_sym[q];
+		if ((node_hot[q] != META_NONE) && (node_hot[q] != node_hot[x]))
+			target[1] = m->nsym + node_hot[q];
+		
+		for (int k = 0; k < 2; k++) {
+			if (target[k] == META_NONE)
+				continue;
+			
+			size_t j = npair;
+			
+			if (MEM_RESIZE(pair, npair, j + 1))
+				goto clear;
+			
+			pair[j].target = target[k];
+			pair[j].dso = f->dso;
+			pair[j].insn = f->insn;
+			pair[j].count = cg->node[x].count;
+		}
+	}
+	
+	qsort(pair, npair, sizeof(struct meta_pair), meta_cmp_pair);
+	
+	for (size_t j = 0; j < npair; ) {
+		struct meta_pair sum = pair[j];
+		
+		for (j++; (j < npair) && (meta_cmp_pair(&pair[j], &sum) == 0);
+				j++)
+			sum.count += pair[j].count;
+		
+		if (sum.target < m->nsym)
+			meta_caller(m->sym[sum.target].caller, p, &sum);
+		else
+			meta_caller(m->hot[sum.target - m->nsym].caller, p,
+				&sum);
+	}
+	
+	r = 0;
+	
+clear:
+	MEM_CLEAR(base, nbase);
+	MEM_CLEAR(pos, npos);
+	MEM_CLEAR(span, nspan);
+	MEM_CLEAR(node_sym, nnode_sym);
+	MEM_CLEAR(node_hot, nnode_hot);
+	MEM_CLEAR(stamp, nstamp);
+	MEM_CLEAR(pair, npair);
+	
+	return r;
+}
+
+// ************************************************************************
+// Thread and cpu breakdown of the hotspots, from the sparse per insn
+// counts of each dso: their size follows the distinct (insn, id) pairs.
+// ************************************************************************
+struct meta_share {
+	size_t hot;
+	uint64_t id, count;
+};
+
+static int meta_cmp_share(const void *va, const void *vb)
+{
+	const struct meta_share *a = va;
+	const struct meta_share *b = vb;
+	
+	if (a->hot != b->hot)
+		return (a->hot < b->hot) ? -1 : 1;
+	if (a->id != b->id)
+		return (a->id < b->id) ? -1 : 1;
+	return 0;
+}
+
+static void meta_share(struct spread *sp, struct meta_share *sh)
+{
+	int k = META_SHARES;
+	
+	sp->n++;
+	
+	while ((k > 0) && (sp->top[k - 1].count < sh->count)) {
+		if (k < META_SHARES)
+			sp->top[k] = sp->top[k - 1];
+		k--;
+	}
+	
+	if (k >= META_SHARES)
+		return;
+	
+	sp->top[k].id = sh->id;
+	sp->top[k].count = sh->count;
+}
+
+static int meta_spread(struct meta *m, struct prog *p,
+	struct meta_span *span, size_t nspan, int cpu)
+{
+	struct meta_share *sh;
+	size_t nsh;
+	int any = 0;
+	
+	MEM_INIT(sh, nsh);
+	
+	for (size_t h = 0; h < m->nhot; h++) {
+		struct spread *sp = (cpu) ? &m->hot[h].cpu : &m->hot[h].tid;
+		
+		sp->n = 0;
+		for (int k = 0; k < META_SHARES; k++)
+			sp->top[k].count = 0;
+	}
+	
+	for (size_t t = 0; t < p->ndso; t++) {
+		struct sparse *s = (cpu)
+			? &p->dso[t].cpu_hits : &p->dso[t].tid_hits;
+		
+		any |= (s->n > 0);
+		
+		for (size_t k = 0; k < s->nslot; k++) {
+			if (s->slot[k].count == 0)
+				continue;
+			
+			uint64_t i = s->slot[k].key >> 32;
+			size_t h = meta_hot_at(span, nspan, t, i);
+			
+			if (h == META_NONE)
+				continue;
+			
+			size_t j = nsh;
+			
+			if (MEM_RESIZE(sh, nsh, j + 1)) {
+				MEM_CLEAR(sh, nsh);
+				return -1;
+			}
+			
+			sh[j].hot = h;
+			sh[j].id = (uint32_t)s->slot[k].key;
+			sh[j].count = s->slot[k].count;
+		}
+	}
+	
+	qsort(sh, nsh, sizeof(struct meta_share), meta_cmp_share);
+	
+	for (size_t j = 0; j < nsh; ) {
+		struct meta_share sum = sh[j];
+		
+		for (j++; (j < nsh) && (meta_cmp_share(&sh[j], &sum) == 0);
+				j++)
+			sum.count += sh[j].count;
+		
+		meta_share((cpu) ? &m->hot[sum.hot].cpu : &m->hot[sum.hot].tid,
+			&sum);
+	}
+	
+	MEM_CLEAR(sh, nsh);
+	
+	if (cpu)
+		m->cpu = any;
+	else
+		m->tid = any;
+	
+	return 0;
+}
+
+static int meta_spreads(struct meta *m, struct prog *p)
+{
+	struct meta_span *span;
+	size_t nspan;
+	
+	MEM_INIT(span, nspan);
+	
+	int r = meta_spans(m, &span, &nspan);
+	
+	if (r == 0)
+		r = meta_spread(m, p, span, nspan, 0);
+	if (r == 0)
+		r = meta_spread(m, p, span, nspan, 1);
+	
+	MEM_CLEAR(span, nspan);
+	
+	return r;
+}
+
+// ************************************************************************
+// Timelines of the hotspots and symbols, from the sparse per insn counts
+// of each dso. Only the non-empty buckets are kept, in bucket order.
+// ************************************************************************
+struct meta_tick {
+	size_t target;
+	uint64_t bucket, count;
+};
+
+static int meta_cmp_tick(const void *va, const void *vb)
+{
+	const struct meta_tick *a = va;
+	const struct meta_tick *b = vb;
+	
+	if (a->target != b->target)
+		return (a->target < b->target) ? -1 : 1;
+	if (a->bucket != b->bucket)
+		return (a->bucket < b->bucket) ? -1 : 1;
+	return 0;
+}
+
+static int meta_timeline(struct meta *m, struct prog *p)
+{
+	for (size_t h = 0; h < m->nhot; h++) {
+		m->hot[h].tick0 = 0;
+		m->hot[h].ntick = 0;
+	}
+	
+	for (size_t s = 0; s < m->nsym; s++) {
+		m->sym[s].tick0 = 0;
+		m->sym[s].ntick = 0;
+	}
+	
+	m->bucket = p->bucket;
+	m->nbucket = 0;
+	
+	if (MEM_RESIZE(m->tick, m->ntick, 0))
+		return -1;
+	
+	if (p->bucket == 0)
+		return 0;
+	
+	size_t *base, *pos;
+	struct meta_span *span;
+	struct meta_tick *tk;
+	size_t nbase, npos, nspan, ntk;
+	
+	MEM_INIT(base, nbase);
+	MEM_INIT(pos, npos);
+	MEM_INIT(span, nspan);
+	MEM_INIT(tk, ntk);
+	
+	int r = -1;
+	
+	if (meta_sym_pos(m, p, &base, &nbase, &pos, &npos)
+	||  meta_spans(m, &span, &nspan))
+		goto clear;
+	
+	for (size_t t = 0; t < p->ndso; t++) {
+		struct sparse *s = &p->dso[t].time_hits;
+		
+		for (size_t k = 0; k < s->nslot; k++) {
+			if (s->slot[k].count == 0)
+				continue;
+			
+			uint64_t i = s->slot[k].key >> 32;
+			uint64_t b = (uint32_t)s->slot[k].key;
+			uint64_t sym_id = p->dso[t].insn[i].sym_id;
+			
+			size_t target[2] = { META_NONE, META_NONE };
+			size_t h = meta_hot_at(span, nspan, t, i);
+			
+			if (sym_id < p->dso[t].nsym)
+				target[0] = pos[base[t] + sym_id];
+			if (h != META_NONE)
+				target[1] = m->nsym + h;
+			
+			if (b >= m->nbucket)
+				m->nbucket = b + 1;
+			
+			for (int x = 0; x < 2; x++) {
+				if (target[x] == META_NONE)
+					continue;
+				
+				size_t j = ntk;
+				
+				if (MEM_RESIZE(tk, ntk, j + 1))
+					goto clear;
+				
+				tk[j].target = target[x];
+				tk[j].bucket = b;
+				tk[j].count = s->slot[k].count;
+			}
+		}
+	}
+	
+	qsort(tk, ntk, sizeof(struct meta_tick), meta_cmp_tick);
+	
+	for (size_t j = 0; j < ntk; ) {
+		struct meta_tick sum = tk[j];
+		
+		for (j++; (j < ntk) && (meta_cmp_tick(&tk[j], &sum) == 0); j++)
+			sum.count += tk[j].count;
+		
+		size_t k = m->ntick;
+		
+		if (MEM_RESIZE(m->tick, m->ntick, k + 1))
+			goto clear;
+		
+		m->tick[k].bucket = sum.bucket;
+		m->tick[k].count = sum.count;
+		
+		size_t *tick0, *ntick;
+		
+		if (sum.target < m->nsym) {
+			tick0 = &m->sym[sum.target].tick0;
+			ntick = &m->sym[sum.target].ntick;
+		} else {
+			tick0 = &m->hot[sum.target - m->nsym].tick0;
+			ntick = &m->hot[sum.target - m->nsym].ntick;
+		}
+		
+		if (*ntick == 0)
+			*tick0 = k;
+		(*ntick)++;
+	}
+	
+	r = 0;
+	
+clear:
+	MEM_CLEAR(base, nbase);
+	MEM_CLEAR(pos, npos);
+	MEM_CLEAR(span, nspan);
+	MEM_CLEAR(tk, ntk);
+	
+	return r;
+}
+
 
 // ************************************************************************
 // 
 // ************************************************************************
+static void meta_reset_dso(struct meta *m, struct prog *p, uint64_t t)
+{
+	struct dso *dso = &p->dso[t];
+	size_t k = 0;
+	
+	for (size_t hid = 0; hid < m->nhot; hid++) {
+		if (m->hot[hid].dso != t)
+			m->hot[k++] = m->hot[hid];
+	}
+	
+	m->nhot = k;
+	
+	for (size_t i = 0; i < dso->ninsn; i++)
+		dso->insn[i].flags &= ~(INSN_DUMP | INSN_HOTSPOT | INSN_CENTER);
+	
+	for (size_t i = 0; i < dso->nfile; i++)
+		dso->file[i].flags &= ~SOURCE_FILE_DUMP;
+}
+
 int meta_run(struct meta *m, struct prog *p)
 {
+	m->nevent = p->nevent;
+	
+	// thresholds given in % follow the sample count: then redo all
+	int all = (m->sample_threshold_hits != m->run_sample_threshold_hits)
+		|| (m->hotspot_threshold_hits != m->run_hotspot_threshold_hits);
+	
+	m->run_sample_threshold_hits = m->sample_threshold_hits;
+	m->run_hotspot_threshold_hits = m->hotspot_threshold_hits;
+	
+	size_t n0 = m->nseen;
+	
+	if (MEM_RESIZE(m->seen, m->nseen, p->ndso)
+	||  MEM_RESIZE(m->gen, m->ngen, p->ndso))
+		return -1;
+	
+	for (size_t t = n0; t < p->ndso; t++) {
+		m->seen[t] = 0;
+		m->gen[t] = 0;
+	}
+	
 	for (uint64_t t = 0; t < p->ndso; t++) {
+		if ((m->gen[t] > 0) && !all
+		&&  (m->seen[t] == p->dso[t].updates))
+			continue;
+		
+		if (m->gen[t] > 0)
+			meta_reset_dso(m, p, t);
+		
 		if (meta_run_dso(m, p, t))
 			return -1;
+		
+		m->seen[t] = p->dso[t].updates;
+		m->gen[t]++;
 	}
 	
 	if (meta_sort(m, p))
 		return -1;
 	
+	if (meta_callgraph(m, p))
+		return -1;
+	
+	if (meta_spreads(m, p))
+		return -1;
+	
+	if (meta_timeline(m, p))
+		return -1;
+	
 	return 0;
 }
 
@@ -21,19 +21,69 @@
 #include "prog.h"
 
 
+// call site, by its call insn
+#define META_CALLERS		4
+
+struct caller {
+	uint64_t dso, insn;
+	uint64_t sym, foffs;
+	uint64_t count;
+};
+
+// hits by thread, or by cpu: how many of them, and the busiest
+#define META_SHARES		4
+
+struct share {
+	uint64_t id, count;
+};
+
+struct spread {
+	uint64_t n;
+	struct share top[META_SHARES];
+};
+
+// samples in one timeline bucket
+struct tick {
+	uint64_t bucket, count;
+};
+
 struct hotspot {
 	uint64_t dso;
 	uint64_t i0, i1, ic;
 	uint64_t hits;
+	uint64_t ev[DSO_EVENTS];
+	
+	// downsampled: estimated hits of the whole trace, and half-width
+	// of their 95% confidence interval
+	uint64_t est, err;
+	
+	// call graph: samples with the hotspot anywhere in their chain, and
+	// the main call sites into it
+	uint64_t incl;
+	struct caller caller[META_CALLERS];
+	
+	// samples by thread and by cpu, if known
+	struct spread tid, cpu;
+	
+	// timeline: the non-empty buckets, meta.tick[tick0 .. tick0 + ntick - 1]
+	size_t tick0, ntick;
 };
 
 struct topref {
 	uint64_t dso;
 	size_t idx;
 	uint64_t hits;
+	uint64_t ev[DSO_EVENTS];
+	
+	// call graph and timeline (symbols only), as for hotspots
+	uint64_t incl;
+	struct caller caller[META_CALLERS];
+	size_t tick0, ntick;
 };
 
 struct meta {
+	size_t nevent;
+	
 	struct hotspot *hot;
 	size_t nhot;
 	
@@ -43,7 +93,29 @@ struct meta {
 	struct topref *func;
 	size_t nfunc;
 	
-	// options
+	// set if the samples had call chains, thread or cpu ids
+	int callgraph;
+	int tid, cpu;
+	
+	// timeline bucket width (ns, 0: none) and count, and the buckets of
+	// the hotspots and symbols
+	uint64_t bucket, nbucket;
+	struct tick *tick;
+	size_t ntick;
+	
+	// per dso: updates as of its last analysis, and generation, bumped
+	// at each analysis (meta_run() only redoes the dsos that changed)
+	uint64_t *seen;
+	size_t nseen;
+	uint64_t *gen;
+	size_t ngen;
+	
+	// thresholds of the last run
+	uint64_t run_sample_threshold_hits;
+	uint64_t run_hotspot_threshold_hits;
+	
+	// options (thresholds in hits of the whole trace)
+	double sample_rate;
 	uint64_t sample_threshold_hits;
 	uint64_t hotspot_threshold_hits;
 	uint64_t hotspot_context_insn;
@@ -54,5 +126,6 @@ void meta_init(struct meta *m);
 void meta_clear(struct meta *m);
 
 int meta_run(struct meta *m, struct prog *p);
+uint64_t meta_scaled(struct meta *m, uint64_t hits);
 
 #endif
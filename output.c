@@ -15,7 +15,9 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include "message.h"
 #include "files.h"
@@ -43,7 +45,8 @@ static int output_file(struct sout *f, int id)
 // ************************************************************************
 // 
 // ************************************************************************
-int output(struct meta *m, struct prog *p, char *out_path, char *theme)
+int output(struct meta *m, struct prog *p, char *out_path, char *theme,
+	struct scache *c)
 {
 	struct sout stf;
 	struct sout *f = &stf;
@@ -88,7 +91,7 @@ int output(struct meta *m, struct prog *p, char *out_path, char *theme)
 	r |= output_file(f, FILE_APP_JS);
 
 	r |= serialize_const(f);
-	r |= serialize_prog(f, p);
+	r |= serialize_prog(f, p, c, m->gen);
 	r |= serialize_meta(f, m);
 
 	ser(f,
@@ -104,6 +107,38 @@ int output(struct meta *m, struct prog *p, char *out_path, char *theme)
 	return r;
 }
 
+// ************************************************************************
+// 
+// ************************************************************************
+int output_snapshot(struct meta *m, struct prog *p, char *out_path,
+	char *theme, struct scache *c)
+{
+	size_t len = strlen(out_path);
+	char *tmp = malloc(len + 5);
+	
+	if (tmp == NULL) {
+		ERROR("malloc(): %s\n", strerror(errno));
+		return -1;
+	}
+	
+	memcpy(tmp, out_path, len);
+	memcpy(tmp + len, ".tmp", 5);
+	
+	int r = output(m, p, tmp, theme, c);
+	
+	if (r) {
+		unlink(tmp);
+	} else if (rename(tmp, out_path)) {
+		ERROR("rename(%s, %s): %s\n", tmp, out_path, strerror(errno));
+		unlink(tmp);
+		r = -1;
+	}
+	
+	free(tmp);
+	
+	return r;
+}
+
 
 // ************************************************************************
 // 
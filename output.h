@@ -18,8 +18,15 @@
 #define OUTPUT_H
 #include "prog.h"
 #include "meta.h"
+#include "serialize.h"
 
-int output(struct meta *m, struct prog *p, char *out_path, char *theme);
+// c: serialized dsos to reuse, or NULL
+int output(struct meta *m, struct prog *p, char *out_path, char *theme,
+	struct scache *c);
+
+// written to out_path.tmp, then renamed over out_path
+int output_snapshot(struct meta *m, struct prog *p, char *out_path,
+	char *theme, struct scache *c);
 
 
 #endif
@@ -0,0 +1,1339 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "message.h"
+#include "mem.h"
+#include "prog.h"
+#include "tally.h"
+#include "checkpoint.h"
+#include "perfdata.h"
+
+// ************************************************************************
+// perf.data layout (see tools/perf/util/header.h and linux/perf_event.h)
+// ************************************************************************
+#define PD_MAGIC		"PERFILE2"
+#define PD_HEADER_SIZE		104
+#define PD_FEAT_EVENT_DESC	12
+#define PD_FEAT_SAMPLE_TIME	21
+#define PD_FEAT_COMPRESSED	27
+
+#define PD_TYPE_HARDWARE	0
+#define PD_TYPE_SOFTWARE	1
+#define PD_TYPE_RAW		4
+
+#define PD_RECORD_MMAP		1
+#define PD_RECORD_COMM		3
+#define PD_RECORD_EXIT		4
+#define PD_RECORD_FORK		7
+#define PD_RECORD_SAMPLE	9
+#define PD_RECORD_MMAP2		10
+#define PD_RECORD_FINISHED_ROUND	68
+#define PD_RECORD_AUXTRACE	71
+
+#define PD_MISC_CPUMODE_MASK	7
+#define PD_MISC_KERNEL		1
+#define PD_MISC_COMM_EXEC	(1 << 13)
+
+// perf mem fields
+#define PD_SAMPLE_MEM		(PD_SAMPLE_ADDR | PD_SAMPLE_WEIGHT \
+				| PD_SAMPLE_DATA_SRC | PD_SAMPLE_WEIGHT_STRUCT)
+
+// call chain markers are above this
+#define PD_CONTEXT_MAX		((uint64_t)-4095)
+
+#define PD_FORMAT_TOTAL_TIME_ENABLED	(1 << 0)
+#define PD_FORMAT_TOTAL_TIME_RUNNING	(1 << 1)
+#define PD_FORMAT_ID			(1 << 2)
+#define PD_FORMAT_GROUP			(1 << 3)
+#define PD_FORMAT_LOST			(1 << 4)
+
+#define PD_ATTR_FLAG_FREQ		((uint64_t)1 << 10)
+#define PD_ATTR_FLAG_SAMPLE_ID_ALL	((uint64_t)1 << 18)
+#define PD_BRANCH_HW_INDEX		((uint64_t)1 << 17)
+
+#define PD_BRANCH_MISPRED	1
+#define PD_BRANCH_CYCLES(flags)	(((flags) >> 4) & 0xffff)
+#define PD_BRANCH_SIZE		24
+
+static const char *perfdata_hw_name[] = {
+	"cycles", "instructions", "cache-references", "cache-misses",
+	"branches", "branch-misses", "bus-cycles",
+	"stalled-cycles-frontend", "stalled-cycles-backend", "ref-cycles"
+};
+
+static const char *perfdata_sw_name[] = {
+	"cpu-clock", "task-clock", "page-faults", "context-switches",
+	"cpu-migrations", "minor-faults", "major-faults"
+};
+
+#define PD_NAMES(t)		(sizeof(t) / sizeof(t[0]))
+
+#define PD_KERNEL_DSO		"[kernel.kallsyms]"
+#define PD_UNKNOWN_DSO		"[unknown]"
+
+// ************************************************************************
+//
+// ************************************************************************
+static inline uint64_t rd64(const uint8_t *b)
+{
+	uint64_t v;
+	memcpy(&v, b, sizeof(v));
+	return v;
+}
+
+static inline uint32_t rd32(const uint8_t *b)
+{
+	uint32_t v;
+	memcpy(&v, b, sizeof(v));
+	return v;
+}
+
+static inline uint16_t rd16(const uint8_t *b)
+{
+	uint16_t v;
+	memcpy(&v, b, sizeof(v));
+	return v;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static int perfdata_cmp_id(const void *va, const void *vb)
+{
+	uint64_t a = ((struct perfdata_id *)va)->id;
+	uint64_t b = ((struct perfdata_id *)vb)->id;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+// ************************************************************************
+static int perfdata_range(struct perfdata *pd, uint64_t offset, uint64_t size)
+{
+	if ((offset > pd->size) || (size > pd->size - offset)) {
+		ERROR("%s: section [0x%lx +0x%lx] past end of file\n",
+			pd->path, offset, size);
+		return -1;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+static int perfdata_read_attrs(struct perfdata *pd, uint64_t attr_size,
+	uint64_t offset, uint64_t size)
+{
+	if (attr_size <= 16) {
+		ERROR("%s: bad attr size %lu\n", pd->path, attr_size);
+		return -1;
+	}
+
+	if (perfdata_range(pd, offset, size))
+		return -1;
+
+	size_t n = size / attr_size;
+	uint64_t asz = attr_size - 16;
+
+	if (MEM_RESIZE(pd->attr, pd->nattr, n))
+		return -1;
+
+	for (size_t a = 0; a < n; a++) {
+		const uint8_t *b = pd->base + offset + a * attr_size;
+		struct perfdata_attr *x = &pd->attr[a];
+
+		x->type = rd32(b + 0);
+		x->config = rd64(b + 8);
+		x->sample_period = rd64(b + 16);
+		x->sample_type = rd64(b + 24);
+		x->read_format = rd64(b + 32);
+		x->freq = (rd64(b + 40) & PD_ATTR_FLAG_FREQ) != 0;
+		x->sample_id_all = (rd64(b + 40) & PD_ATTR_FLAG_SAMPLE_ID_ALL) != 0;
+		x->branch_sample_type = (asz >= 80) ? rd64(b + 72) : 0;
+		x->sample_regs_user = (asz >= 88) ? rd64(b + 80) : 0;
+		x->sample_stack_user = (asz >= 92) ? rd32(b + 88) : 0;
+		x->sample_regs_intr = (asz >= 104) ? rd64(b + 96) : 0;
+
+		// perf's own name, if any, comes later from the event_desc
+		// feature; until then, a name from type and config
+		uint64_t c = x->config & 0xffffffff;
+		
+		if ((x->type == PD_TYPE_HARDWARE)
+		&&  (c < PD_NAMES(perfdata_hw_name)))
+			snprintf(x->name, sizeof(x->name), "%s",
+				perfdata_hw_name[c]);
+		else if ((x->type == PD_TYPE_SOFTWARE)
+		     &&  (c < PD_NAMES(perfdata_sw_name)))
+			snprintf(x->name, sizeof(x->name), "%s",
+				perfdata_sw_name[c]);
+		else if (x->type == PD_TYPE_RAW)
+			snprintf(x->name, sizeof(x->name), "r%lx", x->config);
+		else
+			snprintf(x->name, sizeof(x->name), "event%u:0x%lx",
+				x->type, x->config);
+		
+		x->event = -1;
+
+		// ids
+		uint64_t ids_offset = rd64(b + asz);
+		uint64_t ids_size = rd64(b + asz + 8);
+
+		if (perfdata_range(pd, ids_offset, ids_size))
+			return -1;
+
+		size_t k = pd->nid;
+		size_t nids = ids_size / 8;
+
+		if (MEM_RESIZE(pd->id, pd->nid, k + nids))
+			return -1;
+
+		for (size_t i = 0; i < nids; i++) {
+			pd->id[k + i].id = rd64(pd->base + ids_offset + 8 * i);
+			pd->id[k + i].attr = a;
+		}
+	}
+
+	qsort(pd->id, pd->nid, sizeof(struct perfdata_id), perfdata_cmp_id);
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int perfdata_open(struct perfdata *pd, char *path)
+{
+	pd->path = path;
+	pd->base = NULL;
+	pd->size = 0;
+
+	MEM_INIT(pd->attr, pd->nattr);
+	MEM_INIT(pd->id, pd->nid);
+	MEM_INIT(pd->branch, pd->nbranch);
+	MEM_INIT(pd->comm_tid, pd->ncomm_tid);
+	MEM_INIT(pd->chain, pd->nchain);
+	MEM_INIT(pd->event, pd->nevent);
+	pd->event_next = 0;
+	MEM_INIT(pd->round, pd->nround);
+	pd->round_flush = 0;
+	pd->round_max = 0;
+
+	pd->data_offset = 0;
+	pd->data_size = 0;
+	pd->features = 0;
+
+	pd->ck = NULL;
+
+	pd->records = 0;
+	pd->samples = 0;
+	pd->ignored = 0;
+
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		ERROR("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st)) {
+		ERROR("%s: fstat(): %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode) || (st.st_size < PD_HEADER_SIZE)) {
+		ERROR("%s: not a perf.data file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED) {
+		ERROR("%s: mmap(): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	pd->base = base;
+	pd->size = st.st_size;
+
+	madvise(pd->base, pd->size, MADV_SEQUENTIAL);
+
+	const uint8_t *h = pd->base;
+
+	if (memcmp(h, PD_MAGIC, 8) != 0) {
+		ERROR("%s: bad magic (cross-endian perf.data?)\n", path);
+		goto fail;
+	}
+
+	if (rd64(h + 8) != PD_HEADER_SIZE) {
+		ERROR("%s: header size %lu (pipe-mode perf.data?)\n",
+			path, rd64(h + 8));
+		goto fail;
+	}
+
+	pd->features = rd64(h + 72);
+
+	if (pd->features & ((uint64_t)1 << PD_FEAT_COMPRESSED)) {
+		ERROR("%s: compressed records\n", path);
+		goto fail;
+	}
+
+	if (perfdata_read_attrs(pd, rd64(h + 16), rd64(h + 24), rd64(h + 32)))
+		goto fail;
+
+	if (pd->nattr < 1) {
+		ERROR("%s: no event attributes\n", path);
+		goto fail;
+	}
+
+	pd->data_offset = rd64(h + 40);
+	pd->data_size = rd64(h + 48);
+
+	if (perfdata_range(pd, pd->data_offset, pd->data_size))
+		goto fail;
+
+	return 0;
+
+fail:
+	perfdata_close(pd);
+	return -1;
+}
+
+void perfdata_close(struct perfdata *pd)
+{
+	if (pd->base)
+		munmap(pd->base, pd->size);
+
+	pd->base = NULL;
+	pd->size = 0;
+
+	MEM_CLEAR(pd->attr, pd->nattr);
+	MEM_CLEAR(pd->id, pd->nid);
+	MEM_CLEAR(pd->branch, pd->nbranch);
+	MEM_CLEAR(pd->comm_tid, pd->ncomm_tid);
+	MEM_CLEAR(pd->chain, pd->nchain);
+	MEM_CLEAR(pd->event, pd->nevent);
+	MEM_CLEAR(pd->round, pd->nround);
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static size_t perfdata_attr_of(struct perfdata *pd,
+	const uint8_t *b, size_t size)
+{
+	if (pd->nattr == 1)
+		return 0;
+
+	// the id position is the same for all attrs of a file
+	uint64_t st = pd->attr[0].sample_type;
+	size_t o;
+
+	if (st & PD_SAMPLE_IDENTIFIER) {
+		o = 0;
+	} else if (st & PD_SAMPLE_ID) {
+		o = 8 * (((st & PD_SAMPLE_IP) != 0) + ((st & PD_SAMPLE_TID) != 0)
+			+ ((st & PD_SAMPLE_TIME) != 0)
+			+ ((st & PD_SAMPLE_ADDR) != 0));
+	} else {
+		return 0;
+	}
+
+	if (o + 8 > size)
+		return 0;
+
+	struct perfdata_id key;
+	key.id = rd64(b + o);
+
+	struct perfdata_id *r = bsearch(&key, pd->id, pd->nid,
+		sizeof(struct perfdata_id), perfdata_cmp_id);
+
+	return (r) ? r->attr : 0;
+}
+
+// ************************************************************************
+static size_t perfdata_read_size(uint64_t fmt, const uint8_t *b, size_t avail)
+{
+	size_t vsz = 8 + 8 * (((fmt & PD_FORMAT_ID) != 0)
+		+ ((fmt & PD_FORMAT_LOST) != 0));
+	size_t hsz = 8 * (((fmt & PD_FORMAT_TOTAL_TIME_ENABLED) != 0)
+		+ ((fmt & PD_FORMAT_TOTAL_TIME_RUNNING) != 0));
+
+	if (!(fmt & PD_FORMAT_GROUP))
+		return hsz + vsz;
+
+	if (avail < 8)
+		return (size_t)-1;
+
+	return 8 + hsz + rd64(b) * vsz;
+}
+
+// ************************************************************************
+static int perfdata_parse_sample(struct perfdata *pd,
+	const uint8_t *rec, size_t size, struct perfdata_sample *s)
+{
+	const uint8_t *b = rec + 8;
+	size_t n = size - 8;
+	size_t o = 0;
+
+	s->attr = perfdata_attr_of(pd, b, n);
+	s->misc = rd16(rec + 4);
+
+	struct perfdata_attr *a = &pd->attr[s->attr];
+	uint64_t st = a->sample_type;
+
+	s->pid = s->tid = 0;
+	s->cpu = 0;
+	s->ip = 0;
+	s->time = 0;
+	s->period = (a->freq || (a->sample_period == 0)) ? 1 : a->sample_period;
+	s->nchain = 0;
+	s->chain = NULL;
+	s->nbr = 0;
+	s->br = NULL;
+	s->addr = 0;
+	s->weight = 0;
+	s->data_src = 0;
+
+#define NEED(k)	do { if (o + (k) > n) return -1; } while (0)
+
+	if (st & PD_SAMPLE_IDENTIFIER) {
+		NEED(8);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_IP) {
+		NEED(8);
+		s->ip = rd64(b + o);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_TID) {
+		NEED(8);
+		s->pid = rd32(b + o);
+		s->tid = rd32(b + o + 4);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_TIME) {
+		NEED(8);
+		s->time = rd64(b + o);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_ADDR) {
+		NEED(8);
+		s->addr = rd64(b + o);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_ID) {
+		NEED(8);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_STREAM_ID) {
+		NEED(8);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_CPU) {
+		NEED(8);
+		s->cpu = rd32(b + o);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_PERIOD) {
+		NEED(8);
+		s->period = rd64(b + o);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_READ) {
+		size_t k = perfdata_read_size(a->read_format, b + o, n - o);
+
+		if (k == (size_t)-1)
+			return -1;
+		NEED(k);
+		o += k;
+	}
+
+	if (st & PD_SAMPLE_CALLCHAIN) {
+		NEED(8);
+		uint64_t nr = rd64(b + o);
+		o += 8;
+
+		if (nr > (n - o) / 8)
+			return -1;
+
+		s->nchain = nr;
+		s->chain = b + o;
+		o += 8 * nr;
+	}
+
+	if (st & PD_SAMPLE_RAW) {
+		NEED(4);
+		uint32_t k = rd32(b + o);
+		NEED(4 + (size_t)k);
+		o += 4 + k;
+
+		// raw data is padded so that the next field is u64-aligned
+		o = (o + 7) & ~(size_t)7;
+	}
+
+	if (st & PD_SAMPLE_BRANCH_STACK) {
+		NEED(8);
+		uint64_t nr = rd64(b + o);
+		o += 8;
+
+		if (a->branch_sample_type & PD_BRANCH_HW_INDEX) {
+			NEED(8);
+			o += 8;
+		}
+
+		if (nr > (n - o) / PD_BRANCH_SIZE)
+			return -1;
+
+		s->nbr = nr;
+		s->br = b + o;
+		o += nr * PD_BRANCH_SIZE;
+	}
+
+	if (st & PD_SAMPLE_REGS_USER) {
+		NEED(8);
+		uint64_t abi = rd64(b + o);
+		o += 8;
+
+		if (abi) {
+			size_t k = 8 * __builtin_popcountll(a->sample_regs_user);
+			NEED(k);
+			o += k;
+		}
+	}
+
+	if (st & PD_SAMPLE_STACK_USER) {
+		NEED(8);
+		uint64_t k = rd64(b + o);
+		o += 8;
+
+		if (k > n - o)
+			return -1;
+		o += k;
+
+		// dynamic size
+		if (k) {
+			NEED(8);
+			o += 8;
+		}
+	}
+
+	// the weight struct has the latency in its low 32 bits
+	if (st & (PD_SAMPLE_WEIGHT | PD_SAMPLE_WEIGHT_STRUCT)) {
+		NEED(8);
+		s->weight = (st & PD_SAMPLE_WEIGHT)
+			? rd64(b + o) : rd32(b + o);
+		o += 8;
+	}
+
+	if (st & PD_SAMPLE_DATA_SRC) {
+		NEED(8);
+		s->data_src = rd64(b + o);
+		o += 8;
+	}
+
+#undef NEED
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static void perfdata_branch(const struct perfdata_sample *s, uint64_t k,
+	struct perfdata_branch *br)
+{
+	const uint8_t *b = s->br + k * PD_BRANCH_SIZE;
+
+	br->from = rd64(b);
+	br->to = rd64(b + 8);
+	br->flags = rd64(b + 16);
+}
+
+// ************************************************************************
+// path of the dso at ip, and its path id (-1 if not mapped) if path
+static char *perfdata_dso(struct prog *p, uint64_t pid, uint64_t ip,
+	int kernel, int *path)
+{
+	int k;
+
+	if (prog_translate_path(p, pid, ip, &k, NULL) != 0)
+		k = -1;
+
+	if (path)
+		*path = k;
+
+	if (k >= 0)
+		return p->path[k].path;
+
+	return (kernel) ? PD_KERNEL_DSO : PD_UNKNOWN_DSO;
+}
+
+// ************************************************************************
+static int perfdata_mmap(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	struct prog *p = ctx;
+	uint32_t type = rd32(rec);
+	size_t name = (type == PD_RECORD_MMAP2) ? 72 : 40;
+
+	if (size <= name) {
+		ERROR("%s: short mmap record\n", pd->path);
+		return -1;
+	}
+
+	uint32_t pid = rd32(rec + 8);
+	uint64_t start = rd64(rec + 16);
+	uint64_t length = rd64(rec + 24);
+	uint64_t offset = rd64(rec + 32);
+
+	const char *path = (const char *)rec + name;
+
+	if (memchr(path, 0, size - name) == NULL) {
+		ERROR("%s: unterminated mmap path\n", pd->path);
+		return -1;
+	}
+
+	// kernel maps (pid -1) and swapper are resolved by name; the kernel
+	// map still locates kallsyms
+	if ((pid == 0) || (pid == (uint32_t)-1))
+		return (kernel_map(path))
+			? prog_mmap(p, pid, start, length, (char *)path, offset)
+			: 0;
+
+	// address spaces are per process: only --pid applies
+	if (!filter_pid(p->filter, pid))
+		return 0;
+
+	return prog_mmap(p, pid, start, length, (char *)path, offset);
+}
+
+// ************************************************************************
+static int perfdata_fork(struct perfdata *pd, struct prog *p,
+	const uint8_t *rec, size_t size)
+{
+	if (size < 24) {
+		ERROR("%s: short fork record\n", pd->path);
+		return -1;
+	}
+
+	return prog_fork(p, rd32(rec + 12), rd32(rec + 8));
+}
+
+static void perfdata_exec(struct prog *p, const uint8_t *rec, size_t size)
+{
+	if ((size >= 16) && (rd16(rec + 4) & PD_MISC_COMM_EXEC))
+		prog_exec(p, rd32(rec + 8));
+}
+
+// threads exit too: only the process exit ends its address space
+static void perfdata_exit(struct prog *p, const uint8_t *rec, size_t size)
+{
+	if ((size >= 24) && (rd32(rec + 8) == rd32(rec + 16)))
+		prog_exit(p, rd32(rec + 8));
+}
+
+// ************************************************************************
+// Address spaces: the mmaps and task events (see perfdata_events()) of
+// times before the given one, each applied before the first sample with a
+// later time. Checkpoints apply them all before the samples, and no exit,
+// since their tallies are replayed once the input is read (as time slices
+// keep the processes that exit, see trace.c).
+// ************************************************************************
+static int perfdata_spaces(struct perfdata *pd, struct prog *p,
+	uint64_t time)
+{
+	for (; pd->event_next < pd->nevent; pd->event_next++) {
+		struct perfdata_event *e = &pd->event[pd->event_next];
+		const uint8_t *rec = pd->base + e->offs;
+		size_t size = rd16(rec + 6);
+		int r = 0;
+
+		// untimed events come first, and precede every sample
+		if ((e->time >= time) && (e->time != 0))
+			break;
+
+		switch (rd32(rec)) {
+		case PD_RECORD_FORK:
+			r = perfdata_fork(pd, p, rec, size);
+			break;
+		case PD_RECORD_COMM:
+			perfdata_exec(p, rec, size);
+			break;
+		case PD_RECORD_EXIT:
+			if (pd->ck == NULL)
+				perfdata_exit(p, rec, size);
+			break;
+		default:
+			r = perfdata_mmap(pd, p, rec, size);
+			break;
+		}
+
+		if (r)
+			return -1;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+static int perfdata_comm(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	struct prog *p = ctx;
+
+	if ((size <= 16) || (memchr(rec + 16, 0, size - 16) == NULL)) {
+		ERROR("%s: malformed comm record\n", pd->path);
+		return 0;
+	}
+
+	if (!filter_comm(p->filter, (const char *)rec + 16))
+		return 0;
+
+	size_t k = pd->ncomm_tid;
+
+	if (MEM_RESIZE(pd->comm_tid, pd->ncomm_tid, k + 1))
+		return -1;
+
+	pd->comm_tid[k] = rd32(rec + 12);
+
+	return 0;
+}
+
+static int perfdata_cmp_u64(const void *va, const void *vb)
+{
+	uint64_t a = *(const uint64_t *)va;
+	uint64_t b = *(const uint64_t *)vb;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+// --pid, --tid, --comms and --time of the filter
+static int perfdata_select(struct perfdata *pd, struct filter *f,
+	struct perfdata_sample *s)
+{
+	if (f == NULL)
+		return 1;
+
+	if (!filter_task(f, s->pid, s->tid))
+		return 0;
+
+	if (f->time && !filter_time(f, s->time))
+		return 0;
+
+	if (f->ncomms == 0)
+		return 1;
+
+	uint64_t tid = s->tid;
+
+	return bsearch(&tid, pd->comm_tid, pd->ncomm_tid, sizeof(uint64_t),
+		perfdata_cmp_u64) != NULL;
+}
+
+// ************************************************************************
+// Call chain, without the PERF_CONTEXT_* markers that separate its kernel
+// and user parts
+// ************************************************************************
+static int perfdata_callchain(struct perfdata *pd, struct prog *p,
+	const struct perfdata_sample *s)
+{
+	if (MEM_RESIZE(pd->chain, pd->nchain, s->nchain))
+		return -1;
+
+	size_t n = 0;
+
+	for (uint64_t k = 0; k < s->nchain; k++) {
+		uint64_t ip = rd64(s->chain + 8 * k);
+
+		if (ip < PD_CONTEXT_MAX)
+			pd->chain[n++] = ip;
+	}
+
+	if (pd->ck)
+		return tally_chain(&pd->ck->tally, s->pid, pd->chain, n);
+
+	return prog_callchain(p, s->pid, pd->chain, n, 1);
+}
+
+// ************************************************************************
+// Checkpoints: the sample is tallied, and its branch stack as branches
+// from the previous one, oldest first (as prog_branch_batch() does)
+// ************************************************************************
+static int perfdata_tally(struct perfdata *pd, struct prog *p,
+	const struct perfdata_sample *s, int ev, char *dso,
+	uint64_t tid, uint64_t cpu, const struct dso_mem *mem)
+{
+	struct tally *ta = &pd->ck->tally;
+
+	if (tally_sample(ta, s->pid, tid, cpu, prog_bucket(p, s->time),
+			s->ip, dso, NULL, 0, p->event[ev], 1, s->period, mem))
+		return -1;
+
+	pd->samples++;
+
+	if (ev != 0)
+		return 0;
+
+	if (s->nchain && perfdata_callchain(pd, p, s))
+		return -1;
+
+	char *pre_dso = NULL;
+	uint64_t pre_ip = 0;
+
+	for (uint64_t k = s->nbr; k-- > 0; ) {
+		struct perfdata_branch br;
+
+		perfdata_branch(s, k, &br);
+
+		char *src_dso = perfdata_dso(p, s->pid, br.from,
+			(int64_t)br.from < 0, NULL);
+		char *dst_dso = perfdata_dso(p, s->pid, br.to,
+			(int64_t)br.to < 0, NULL);
+
+		if (pre_dso && tally_branch(ta, s->pid, pre_ip, pre_dso,
+				br.from, src_dso, br.to, dst_dso,
+				(br.flags & PD_BRANCH_MISPRED) != 0,
+				PD_BRANCH_CYCLES(br.flags)))
+			return -1;
+
+		pre_dso = dst_dso;
+		pre_ip = br.to;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+static int perfdata_sample(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	struct prog *p = ctx;
+	struct perfdata_sample s;
+
+	if (perfdata_parse_sample(pd, rec, size, &s)) {
+		ERROR("%s: malformed sample record\n", pd->path);
+		pd->ignored++;
+		return 0;
+	}
+
+	if (perfdata_spaces(pd, p, s.time))
+		return -1;
+
+	int ev = pd->attr[s.attr].event;
+
+	if ((ev < 0) || !perfdata_select(pd, p->filter, &s)
+	||  !filter_sample(p->filter, s.pid, s.time, s.ip)) {
+		pd->ignored++;
+		return 0;
+	}
+
+	int kernel = ((s.misc & PD_MISC_CPUMODE_MASK) == PD_MISC_KERNEL);
+	int path;
+	char *dso = perfdata_dso(p, s.pid, s.ip, kernel, &path);
+
+	if (!filter_dso(p->filter, dso)) {
+		pd->ignored++;
+		return 0;
+	}
+
+	uint64_t st = pd->attr[s.attr].sample_type;
+	uint64_t tid = (st & PD_SAMPLE_TID) ? s.tid : DSO_TASK_NONE;
+	uint64_t cpu = (st & PD_SAMPLE_CPU) ? s.cpu : DSO_TASK_NONE;
+
+	struct dso_mem mem = { s.addr, s.data_src, s.weight };
+
+	if (pd->ck)
+		return perfdata_tally(pd, p, &s, ev, dso, tid, cpu,
+			(st & PD_SAMPLE_MEM) ? &mem : NULL);
+
+	if (prog_sample(p, s.pid, tid, cpu, prog_bucket(p, s.time),
+			s.ip, dso, path, NULL, 0, ev, 1, s.period,
+			(st & PD_SAMPLE_MEM) ? &mem : NULL))
+		return -1;
+
+	pd->samples++;
+
+	// branch stacks and call chains are only taken from the primary event
+	if (ev != 0)
+		return 0;
+
+	if (s.nchain && perfdata_callchain(pd, p, &s))
+		return -1;
+
+	// branch stack, most recent first (see prog_branch_batch())
+	if (MEM_RESIZE(pd->branch, pd->nbranch, s.nbr))
+		return -1;
+
+	for (uint64_t k = 0; k < s.nbr; k++) {
+		struct perfdata_branch br;
+		struct pbranch *b = &pd->branch[k];
+
+		perfdata_branch(&s, k, &br);
+
+		b->src_ip = br.from;
+		b->src_dso = perfdata_dso(p, s.pid, br.from,
+			(int64_t)br.from < 0, &b->src_path);
+		b->dst_ip = br.to;
+		b->dst_dso = perfdata_dso(p, s.pid, br.to,
+			(int64_t)br.to < 0, &b->dst_path);
+		b->miss = (br.flags & PD_BRANCH_MISPRED) != 0;
+		b->cycles = PD_BRANCH_CYCLES(br.flags);
+	}
+
+	if (prog_branch_batch(p, s.pid, pd->branch, s.nbr, 1))
+		return -1;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+typedef int (*perfdata_fn)(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size);
+
+// the sample pass (with progress) goes on from the last checkpoint, and
+// saves new ones
+static int perfdata_pass(struct perfdata *pd, void *ctx,
+	uint32_t type0, uint32_t type1, perfdata_fn fn, int progress)
+{
+	uint64_t offs = pd->data_offset;
+	uint64_t end = pd->data_offset + pd->data_size;
+	struct checkpoint *ck = (progress) ? pd->ck : NULL;
+
+	if (ck && (ck->pos > offs))
+		offs = ck->pos;
+
+	while (offs + 8 <= end) {
+		const uint8_t *rec = pd->base + offs;
+		uint32_t type = rd32(rec);
+		uint16_t size = rd16(rec + 6);
+
+		if ((size < 8) || (offs + size > end)) {
+			ERROR("%s: truncated record at 0x%lx\n",
+				pd->path, offs);
+			break;
+		}
+
+		offs += size;
+
+		// auxtrace payload follows its record
+		if (type == PD_RECORD_AUXTRACE) {
+			if ((size < 16) || (rd64(rec + 8) > end - offs)) {
+				ERROR("%s: truncated auxtrace at 0x%lx\n",
+					pd->path, offs - size);
+				break;
+			}
+
+			offs += rd64(rec + 8);
+			continue;
+		}
+
+		if ((type != type0) && (type != type1))
+			continue;
+
+		if (progress) {
+			if ((pd->samples > 0) && ((pd->samples & 0xffff) == 0))
+				MESSAGE("  [samples: %6zd k]\n",
+					pd->samples >> 10);
+			pd->records++;
+		}
+
+		if (fn(pd, ctx, rec, size))
+			return -1;
+
+		if (ck && checkpoint_due(ck)
+		&&  checkpoint_save(ck, offs, pd->records, pd->samples, 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static int perfdata_feature(struct perfdata *pd, int feat,
+	const uint8_t **b, uint64_t *size)
+{
+	if (!(pd->features & ((uint64_t)1 << feat)))
+		return -1;
+
+	// one section per feature bit set, in bit order, after the data
+	uint64_t k = __builtin_popcountll(pd->features
+		& (((uint64_t)1 << feat) - 1));
+	uint64_t o = pd->data_offset + pd->data_size + 16 * k;
+
+	if (perfdata_range(pd, o, 16))
+		return -1;
+
+	uint64_t offset = rd64(pd->base + o);
+	*size = rd64(pd->base + o + 8);
+
+	if (perfdata_range(pd, offset, *size))
+		return -1;
+
+	*b = pd->base + offset;
+
+	return 0;
+}
+
+// ************************************************************************
+static void perfdata_event_desc(struct perfdata *pd)
+{
+	const uint8_t *b;
+	uint64_t size;
+
+	if (perfdata_feature(pd, PD_FEAT_EVENT_DESC, &b, &size)
+	||  (size < 8))
+		return;
+
+	// u32 nr, u32 attr_size, then per event: attr, u32 nr_ids,
+	// string (u32 len, data), u64 ids[nr_ids]
+	uint32_t nr = rd32(b);
+	uint64_t attr_size = rd32(b + 4);
+	uint64_t o = 8;
+
+	for (uint32_t e = 0; e < nr; e++) {
+		if (o + attr_size + 8 > size)
+			return;
+
+		o += attr_size;
+
+		uint32_t nr_ids = rd32(b + o);
+		uint32_t len = rd32(b + o + 4);
+		o += 8;
+
+		if ((o + len > size) || ((size - o - len) / 8 < nr_ids))
+			return;
+
+		const char *name = (const char *)b + o;
+		o += len;
+
+		// events are matched by their first id, or by position
+		size_t a = e;
+
+		if (nr_ids > 0) {
+			struct perfdata_id key;
+			key.id = rd64(b + o);
+
+			struct perfdata_id *r = bsearch(&key, pd->id, pd->nid,
+				sizeof(struct perfdata_id), perfdata_cmp_id);
+
+			if (r)
+				a = r->attr;
+		}
+
+		o += 8 * (uint64_t)nr_ids;
+
+		if ((a < pd->nattr) && (len > 0) && memchr(name, 0, len))
+			snprintf(pd->attr[a].name, sizeof(pd->attr[a].name),
+				"%s", name);
+	}
+}
+
+// ************************************************************************
+static int perfdata_time(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	uint64_t *range = ctx;
+	struct perfdata_sample s;
+
+	if (perfdata_parse_sample(pd, rec, size, &s) || (s.time == 0))
+		return 0;
+
+	if (s.time < range[0])
+		range[0] = s.time;
+	if (s.time > range[1])
+		range[1] = s.time;
+
+	return 0;
+}
+
+// ************************************************************************
+static int perfdata_count(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	(void)pd;
+	(void)rec;
+	(void)size;
+
+	(*(uint64_t *)ctx)++;
+
+	return 0;
+}
+
+int perfdata_sample_count(struct perfdata *pd, uint64_t *n)
+{
+	*n = 0;
+
+	return perfdata_pass(pd, n, PD_RECORD_SAMPLE, PD_RECORD_SAMPLE,
+		perfdata_count, 0);
+}
+
+// ************************************************************************
+uint64_t perfdata_sample_type(struct perfdata *pd)
+{
+	uint64_t type = (uint64_t)-1;
+
+	for (size_t k = 0; k < pd->nattr; k++)
+		type &= pd->attr[k].sample_type;
+
+	return type;
+}
+
+// ************************************************************************
+int perfdata_time_range(struct perfdata *pd, uint64_t *t0, uint64_t *t1)
+{
+	const uint8_t *b;
+	uint64_t size;
+
+	if ((perfdata_feature(pd, PD_FEAT_SAMPLE_TIME, &b, &size) == 0)
+	&&  (size >= 16)) {
+		*t0 = rd64(b);
+		*t1 = rd64(b + 8);
+		return 0;
+	}
+
+	// older perf: scan the samples
+	uint64_t range[2] = { (uint64_t)-1, 0 };
+
+	if (perfdata_pass(pd, range, PD_RECORD_SAMPLE, PD_RECORD_SAMPLE,
+			perfdata_time, 0))
+		return -1;
+
+	if (range[0] > range[1])
+		return -1;
+
+	*t0 = range[0];
+	*t1 = range[1];
+
+	return 0;
+}
+
+// ************************************************************************
+// Mmaps and task events, sorted by time: record order is per-cpu buffer
+// order, and a fork must precede the mmaps of its child
+// ************************************************************************
+// from the sample_id trailer of non-sample records; 0 if not recorded
+static uint64_t perfdata_record_time(struct perfdata *pd,
+	const uint8_t *rec, size_t size)
+{
+	struct perfdata_attr *a = &pd->attr[0];
+	uint64_t st = a->sample_type;
+
+	if (!a->sample_id_all || !(st & PD_SAMPLE_TIME))
+		return 0;
+
+	// time, then id, stream_id, cpu and identifier, at the end
+	size_t o = 8 * (1 + ((st & PD_SAMPLE_ID) != 0)
+		+ ((st & PD_SAMPLE_STREAM_ID) != 0)
+		+ ((st & PD_SAMPLE_CPU) != 0)
+		+ ((st & PD_SAMPLE_IDENTIFIER) != 0));
+
+	if (o + 8 > size)
+		return 0;
+
+	return rd64(rec + size - o);
+}
+
+static int perfdata_collect(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	(void)ctx;
+
+	size_t k = pd->nevent;
+
+	if (MEM_RESIZE(pd->event, pd->nevent, k + 1))
+		return -1;
+
+	pd->event[k].time = perfdata_record_time(pd, rec, size);
+	pd->event[k].offs = rec - pd->base;
+
+	return 0;
+}
+
+static int perfdata_cmp_event(const void *va, const void *vb)
+{
+	const struct perfdata_event *a = va;
+	const struct perfdata_event *b = vb;
+
+	if (a->time != b->time)
+		return (a->time < b->time) ? -1 : 1;
+
+	if (a->offs != b->offs)
+		return (a->offs < b->offs) ? -1 : 1;
+
+	return 0;
+}
+
+static int perfdata_events(struct perfdata *pd)
+{
+	if (perfdata_pass(pd, NULL, PD_RECORD_MMAP, PD_RECORD_MMAP2,
+			perfdata_collect, 0)
+	||  perfdata_pass(pd, NULL, PD_RECORD_FORK, PD_RECORD_COMM,
+			perfdata_collect, 0)
+	||  perfdata_pass(pd, NULL, PD_RECORD_EXIT, PD_RECORD_EXIT,
+			perfdata_collect, 0))
+		return -1;
+
+	qsort(pd->event, pd->nevent, sizeof(struct perfdata_event),
+		perfdata_cmp_event);
+
+	return 0;
+}
+
+// ************************************************************************
+// Samples in time order. Records are written per-cpu buffer, a round at a
+// time (PERF_RECORD_FINISHED_ROUND): as perf's ordered_events do, samples
+// are held, and at the end of a round, those up to the latest time of the
+// previous round are passed on by time, since no later record can precede
+// them. Past PD_ROUND_MAX held samples, the older half is passed on.
+// Checkpoints tally samples as they come (see perfdata_spaces()).
+// ************************************************************************
+#define PD_ROUND_MAX		((size_t)1 << 22)
+
+static int perfdata_flush(struct perfdata *pd, struct prog *p, uint64_t time)
+{
+	size_t k;
+
+	if (pd->nround == 0)
+		return 0;
+
+	qsort(pd->round, pd->nround, sizeof(struct perfdata_event),
+		perfdata_cmp_event);
+
+	for (k = 0; (k < pd->nround) && (pd->round[k].time <= time); k++) {
+		const uint8_t *rec = pd->base + pd->round[k].offs;
+
+		if (perfdata_sample(pd, p, rec, rd16(rec + 6)))
+			return -1;
+	}
+
+	memmove(pd->round, pd->round + k,
+		(pd->nround - k) * sizeof(struct perfdata_event));
+	pd->nround -= k;
+
+	return 0;
+}
+
+static int perfdata_order(struct perfdata *pd, void *ctx,
+	const uint8_t *rec, size_t size)
+{
+	struct prog *p = ctx;
+	struct perfdata_sample s;
+
+	if (rd32(rec) == PD_RECORD_FINISHED_ROUND) {
+		if (pd->ck)
+			return 0;
+
+		if (perfdata_flush(pd, p, pd->round_flush))
+			return -1;
+
+		pd->round_flush = pd->round_max;
+		return 0;
+	}
+
+	// malformed samples are reported right away
+	if (pd->ck || perfdata_parse_sample(pd, rec, size, &s))
+		return perfdata_sample(pd, p, rec, size);
+
+	if (pd->nround == PD_ROUND_MAX) {
+		qsort(pd->round, pd->nround, sizeof(struct perfdata_event),
+			perfdata_cmp_event);
+
+		if (perfdata_flush(pd, p, pd->round[PD_ROUND_MAX / 2].time))
+			return -1;
+	}
+
+	size_t k = pd->nround;
+
+	if (MEM_RESIZE(pd->round, pd->nround, k + 1))
+		return -1;
+
+	pd->round[k].time = s.time;
+	pd->round[k].offs = rec - pd->base;
+
+	if (s.time > pd->round_max)
+		pd->round_max = s.time;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int perfdata_load(struct perfdata *pd, struct prog *p)
+{
+	perfdata_event_desc(pd);
+
+	for (size_t a = 0; a < pd->nattr; a++)
+		pd->attr[a].event = prog_event(p, pd->attr[a].name);
+
+	// mmaps and task events go between the samples, by time
+	if (perfdata_events(pd))
+		return -1;
+
+	if (pd->ck && perfdata_spaces(pd, p, (uint64_t)-1))
+		return -1;
+
+	if (p->filter && p->filter->ncomms) {
+		if (perfdata_pass(pd, p, PD_RECORD_COMM, PD_RECORD_COMM,
+				perfdata_comm, 0))
+			return -1;
+
+		qsort(pd->comm_tid, pd->ncomm_tid, sizeof(uint64_t),
+			perfdata_cmp_u64);
+	}
+
+	if (pd->ck && pd->ck->complete)
+		return 0;
+
+	if (perfdata_pass(pd, p, PD_RECORD_SAMPLE, PD_RECORD_FINISHED_ROUND,
+			perfdata_order, 1))
+		return -1;
+
+	return perfdata_flush(pd, p, (uint64_t)-1);
+}
@@ -0,0 +1,157 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef PERFDATA_H
+#define PERFDATA_H
+#include <stddef.h>
+#include <stdint.h>
+#include "prog.h"
+
+struct checkpoint;
+
+// perf_event_attr.sample_type
+#define PD_SAMPLE_IP		(1 << 0)
+#define PD_SAMPLE_TID		(1 << 1)
+#define PD_SAMPLE_TIME		(1 << 2)
+#define PD_SAMPLE_ADDR		(1 << 3)
+#define PD_SAMPLE_READ		(1 << 4)
+#define PD_SAMPLE_CALLCHAIN	(1 << 5)
+#define PD_SAMPLE_ID		(1 << 6)
+#define PD_SAMPLE_CPU		(1 << 7)
+#define PD_SAMPLE_PERIOD	(1 << 8)
+#define PD_SAMPLE_STREAM_ID	(1 << 9)
+#define PD_SAMPLE_RAW		(1 << 10)
+#define PD_SAMPLE_BRANCH_STACK	(1 << 11)
+#define PD_SAMPLE_REGS_USER	(1 << 12)
+#define PD_SAMPLE_STACK_USER	(1 << 13)
+#define PD_SAMPLE_WEIGHT	(1 << 14)
+#define PD_SAMPLE_DATA_SRC	(1 << 15)
+#define PD_SAMPLE_IDENTIFIER	(1 << 16)
+#define PD_SAMPLE_WEIGHT_STRUCT	(1 << 24)
+
+// ************************************************************************
+//
+// ************************************************************************
+struct perfdata_attr {
+	char name[64];
+	uint32_t type;
+	uint64_t config;
+	uint64_t sample_period;
+	int freq;
+	uint64_t sample_type;
+	uint64_t read_format;
+	uint64_t branch_sample_type;
+	uint64_t sample_regs_user;
+	uint64_t sample_regs_intr;
+	uint32_t sample_stack_user;
+	int sample_id_all;
+	
+	// prog event index, -1 if ignored
+	int event;
+};
+
+struct perfdata_id {
+	uint64_t id;
+	size_t attr;
+};
+
+struct perfdata_branch {
+	uint64_t from, to;
+	uint64_t flags;
+};
+
+struct perfdata_sample {
+	size_t attr;
+	uint32_t pid, tid;
+	uint32_t cpu;
+	uint16_t misc;
+	uint64_t ip;
+	uint64_t time;
+	uint64_t period;
+
+	uint64_t nchain;
+	const uint8_t *chain;
+
+	uint64_t nbr;
+	const uint8_t *br;
+
+	// perf mem fields, 0 if not recorded
+	uint64_t addr;
+	uint64_t weight;
+	uint64_t data_src;
+};
+
+// record, by time (0 if not recorded)
+struct perfdata_event {
+	uint64_t time;
+	uint64_t offs;
+};
+
+struct perfdata {
+	char *path;
+
+	uint8_t *base;
+	size_t size;
+
+	struct perfdata_attr *attr;
+	size_t nattr;
+
+	struct perfdata_id *id;
+	size_t nid;
+
+	uint64_t data_offset, data_size;
+	uint64_t features;
+	
+	// decoded branch stack and call chain of the current sample
+	struct pbranch *branch;
+	size_t nbranch;
+	uint64_t *chain;
+	size_t nchain;
+	
+	// mmap and task events, by time, and the first not yet applied
+	struct perfdata_event *event;
+	size_t nevent;
+	size_t event_next;
+
+	// samples held until the end of their round, by time, and the time
+	// up to which the next round end passes them on (see perfdata_order())
+	struct perfdata_event *round;
+	size_t nround;
+	uint64_t round_flush, round_max;
+
+	// threads that had a comm selected by the filter (sorted)
+	uint64_t *comm_tid;
+	size_t ncomm_tid;
+
+	// checkpoints (NULL: none): samples are tallied instead of resolved,
+	// from the saved record offset on (see checkpoint.h)
+	struct checkpoint *ck;
+
+	// stats
+	size_t records, samples, ignored;
+};
+
+int  perfdata_open(struct perfdata *pd, char *path);
+void perfdata_close(struct perfdata *pd);
+
+int  perfdata_time_range(struct perfdata *pd, uint64_t *t0, uint64_t *t1);
+int  perfdata_sample_count(struct perfdata *pd, uint64_t *n);
+int  perfdata_load(struct perfdata *pd, struct prog *p);
+
+// sample_type bits recorded by every event
+uint64_t perfdata_sample_type(struct perfdata *pd);
+
+#endif
@@ -16,7 +16,9 @@
 */
 #define _GNU_SOURCE
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
@@ -26,11 +28,22 @@
 
 int pipe_in(char **argv)
 {
-	// pipe
+	return pipe_in_fd(argv, -1);
+}
+
+int pipe_in_fd(char **argv, int fd_in)
+{
+	return pipe_in_child(argv, fd_in, NULL);
+}
+
+int pipe_in_child(char **argv, int fd_in, pid_t *child_pid)
+{
+	// pipe (close-on-exec, so that concurrently forked children do not
+	// hold each other's write ends open)
 	int fd[2];
 	
-	if (pipe(fd)) {
-		ERROR("pipe(): %s\n", strerror(errno));
+	if (pipe2(fd, O_CLOEXEC)) {
+		ERROR("pipe2(): %s\n", strerror(errno));
 		return -1;
 	}
 	
@@ -47,6 +60,9 @@ int pipe_in(char **argv)
 		// close pipe's write end
 		close(fd[1]);
 		
+		if (child_pid)
+			*child_pid = child;
+		
 		return fd[0];
 	}
 	
@@ -55,12 +71,109 @@ int pipe_in(char **argv)
 	
 	if (dup2(fd[1], 1) != 1) {
 		ERROR("dup2(): %s\n", strerror(errno));
-		exit(1);
+		_exit(1);
+	}
+	
+	if ((fd_in >= 0) && (dup2(fd_in, 0) != 0)) {
+		ERROR("dup2(): %s\n", strerror(errno));
+		_exit(1);
 	}
 	
 	execvp(argv[0], argv);
 	
 	ERROR("execvp('%s'): %s\n", argv[0], strerror(errno));
-	exit(1);
+	_exit(1);
+}
+
+int pipe_wait(pid_t child, const char *name)
+{
+	int status;
+	
+	while (waitpid(child, &status, 0) < 0) {
+		if (errno == EINTR)
+			continue;
+		
+		ERROR("waitpid(): %s\n", strerror(errno));
+		return -1;
+	}
+	
+	if (WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+		return 0;
+	
+	if (WIFSIGNALED(status))
+		ERROR("%s: killed by signal %d\n", name, WTERMSIG(status));
+	else
+		ERROR("%s: exit status %d\n", name, WEXITSTATUS(status));
+	
+	return -1;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int pipe_write(int fd, const char *data, size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(fd, data, n);
+		
+		if ((w < 0) && (errno == EINTR))
+			continue;
+		
+		if (w <= 0)
+			return -1;
+		
+		data += w;
+		n -= w;
+	}
+	
+	return 0;
+}
+
+int pipe_feed(int fd_in, const char *head, size_t n)
+{
+	int fd[2];
+	
+	if (pipe2(fd, O_CLOEXEC)) {
+		ERROR("pipe2(): %s\n", strerror(errno));
+		return -1;
+	}
+	
+	pid_t child = fork();
+	
+	if (child == (pid_t)-1) {
+		ERROR("fork(): %s\n", strerror(errno));
+		return -1;
+	}
+	
+	// parent
+	if (child != 0) {
+		close(fd[1]);
+		
+		return fd[0];
+	}
+	
+	// child: copy head, then fd_in
+	close(fd[0]);
+	
+	char buff[65536];
+	ssize_t r = 0;
+	
+	if (pipe_write(fd[1], head, n))
+		_exit(1);
+	
+	while (1) {
+		r = read(fd_in, buff, sizeof(buff));
+		
+		if ((r < 0) && (errno == EINTR))
+			continue;
+		
+		if (r <= 0)
+			break;
+		
+		if (pipe_write(fd[1], buff, r))
+			_exit(1);
+	}
+	
+	_exit(r < 0);
 }
 
@@ -16,9 +16,23 @@
 */
 #ifndef PIPE_H
 #define PIPE_H
+#include <sys/types.h>
 
 
+// read end of a pipe from the stdout of argv
 int pipe_in(char **argv);
 
+// same, argv reading its stdin from fd_in
+int pipe_in_fd(char **argv, int fd_in);
+
+// same, with the pid of argv in *child, for pipe_wait()
+int pipe_in_child(char **argv, int fd_in, pid_t *child);
+
+// waits for child (run as name): -1 unless it exited with status 0
+int pipe_wait(pid_t child, const char *name);
+
+// read end of a pipe delivering head[0..n), then the rest of fd_in
+int pipe_feed(int fd_in, const char *head, size_t n);
+
 
 #endif
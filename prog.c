@@ -14,70 +14,338 @@
     You should have received a copy of the GNU Affero General Public License
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
+#define _GNU_SOURCE
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include "message.h"
 #include "mem.h"
+#include "jit.h"
 #include "dso.h"
+#include "diag.h"
+#include "tally.h"
 #include "prog.h"
 
 
 // ************************************************************************
 // 
 // ************************************************************************
-void prog_init(struct prog *p)
+int prog_init(struct prog *p)
 {
 	MEM_INIT(p->dso, p->ndso);
+	MEM_INIT(p->path, p->npath);
+	p->path_last = -1;
+	MEM_INIT(p->load, p->nload);
+	p->loading = 0;
+	p->waiting = 0;
+	
+	MEM_INIT(p->bwait, p->nbwait);
+	MEM_INIT(p->cwait, p->ncwait);
+	MEM_INIT(p->fwait, p->nfwait);
+	MEM_INIT(p->locate, p->nlocate);
+	MEM_INIT(p->gather, p->ngather);
+	MEM_INIT(p->gather_slot, p->ngather_slot);
+	p->space = 0;
+	p->bwait0 = 0;
+	p->cwait0 = 0;
 	MEM_INIT(p->pmap, p->npmap);
+	MEM_INIT(p->task, p->ntask);
+	p->task_last = 0;
+	MEM_INIT(p->newer, p->nnewer);
+	
+	p->filter = NULL;
 	
 	obstack_init(&p->strings);
 	
+	MEM_INIT(p->end, p->nend);
+	MEM_INIT(p->order, p->norder);
+	
+	callgraph_init(&p->cg);
+	MEM_INIT(p->frame, p->nframe);
+	
+	p->kernel = NULL;
+	p->kernel_wait = NULL;
+	
+	p->bucket = 0;
+	p->time0 = PROG_TIME_NONE;
+	
 	p->insn = 0;
+	
+	p->event[0] = "cycles";
+	p->nevent = 1;
+	p->event_overflow = 0;
+	
+	for (int e = 0; e < PROG_EVENTS; e++) {
+		p->event_samples[e] = 0;
+		p->event_period[e] = 0;
+	}
+	
 	p->samples = 0;
 	p->unspec = 0;
 	p->orphans = 0;
 	p->branch_samples = 0;
 	p->branch_unspec = 0;
 	p->branch_orphans = 0;
+	
+	int r = 0;
+	r |= map_init(&p->path_id);
+	r |= map_init(&p->build_id);
+	r |= map_init(&p->wait_sym);
+	r |= loader_init(&p->loader);
+	
+	return r;
 }
 
 void prog_clear(struct prog *p)
 {
+	loader_clear(&p->loader);
+	
+	for (size_t d = 0; d < p->nload; d++) {
+		if (p->load[d].dso) {
+			dso_clear(p->load[d].dso);
+			free(p->load[d].dso);
+		}
+		
+		MEM_CLEAR(p->load[d].wait, p->load[d].nwait);
+	}
+	
 	for (size_t d = 0; d < p->ndso; d++)
 		dso_clear(&p->dso[d]);
 	
 	MEM_CLEAR(p->dso, p->ndso);
+	MEM_CLEAR(p->load, p->nload);
+	MEM_CLEAR(p->bwait, p->nbwait);
+	MEM_CLEAR(p->cwait, p->ncwait);
+	MEM_CLEAR(p->fwait, p->nfwait);
+	MEM_CLEAR(p->locate, p->nlocate);
+	MEM_CLEAR(p->gather, p->ngather);
+	MEM_CLEAR(p->gather_slot, p->ngather_slot);
+	map_clear(&p->wait_sym);
+	MEM_CLEAR(p->path, p->npath);
+	p->path_last = -1;
+	map_clear(&p->path_id);
+	map_clear(&p->build_id);
+	prog_unmap(p);
 	MEM_CLEAR(p->pmap, p->npmap);
+	MEM_CLEAR(p->task, p->ntask);
+	MEM_CLEAR(p->newer, p->nnewer);
 	
 	obstack_clear(&p->strings);
+	
+	MEM_CLEAR(p->end, p->nend);
+	MEM_CLEAR(p->order, p->norder);
+	
+	callgraph_clear(&p->cg);
+	MEM_CLEAR(p->frame, p->nframe);
+	
+	if (p->kernel_wait) {
+		tally_clear(p->kernel_wait);
+		free(p->kernel_wait);
+		p->kernel_wait = NULL;
+	}
 }
 
 // ************************************************************************
-// 
+// Dso paths are interned as they are first seen (in mmaps, samples or
+// branches), so that each is hashed once per string rather than compared
+// to every dso; readers that know the path id of an address (from its
+// mapping) pass it on instead of the string.
 // ************************************************************************
+static char *prog_path_key(struct prog *p, char *dso_path, char *key)
+{
+	size_t n = sizeof(p->dso->path);
+	
+	// dso paths are truncated, and so are keys
+	if (strnlen(dso_path, n) < n)
+		return dso_path;
+	
+	memcpy(key, dso_path, n - 1);
+	key[n - 1] = 0;
+	
+	return key;
+}
+
+int prog_intern(struct prog *p, char *dso_path)
+{
+	char key[sizeof(p->dso->path)];
+	char *store;
+	uint64_t k;
+	int found;
+	
+	dso_path = prog_path_key(p, dso_path, key);
+	
+	// readers mostly give the same path over and over
+	if ((p->path_last >= 0)
+	&&  (strcmp(p->path[p->path_last].path, dso_path) == 0))
+		return p->path_last;
+	
+	if (map_tool(&p->path_id, dso_path, p->npath, &store, &k, &found,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+	
+	if (!found) {
+		k = p->npath;
+		
+		if (MEM_RESIZE(p->path, p->npath, k + 1))
+			return -1;
+		
+		p->path[k].path = store;
+		p->path[k].dso = -1;
+	}
+	
+	p->path_last = k;
+	
+	return k;
+}
+
 int prog_lookup(struct prog *p, char *dso_path)
 {
-	for (size_t i = 0; i < p->ndso; i++) {
-		if (strncmp(p->dso[i].path, dso_path,
-				sizeof(p->dso[i].path) - 1) == 0)
-			return i;
+	char key[sizeof(p->dso->path)];
+	uint64_t k;
+	int found;
+	
+	dso_path = prog_path_key(p, dso_path, key);
+	
+	map_tool(&p->path_id, dso_path, 0, NULL, &k, &found, MAP_LOOKUP);
+	
+	return (found) ? p->path[k].dso : -1;
+}
+
+// ************************************************************************
+// JIT code: the jitdump of pid, as mmapped by the process to tell perf
+// ************************************************************************
+static char *prog_jitdump(struct prog *p, uint64_t pid)
+{
+	for (size_t t = p->npmap; t > 0; t--) {
+		if (jit_dump_of(p->pmap[t - 1].path, pid))
+			return p->pmap[t - 1].path;
+	}
+	
+	return NULL;
+}
+
+// module of a kernel dso, KERNEL_NONE if not one
+static size_t prog_kernel_module(struct prog *p, char *dso_path)
+{
+	if ((p->kernel == NULL) || (p->kernel->loaded <= 0))
+		return KERNEL_NONE;
+	
+	return kernel_module(p->kernel, dso_path);
+}
+
+// ************************************************************************
+// Background loads: the dso gets a stand-in (without insns) until it is
+// loaded, see prog_sync()
+// ************************************************************************
+static int prog_loading(struct prog *p, int id)
+{
+	return p->load[id].dso != NULL;
+}
+
+static int prog_background(struct prog *p, int id)
+{
+	struct dso *dso = malloc(sizeof(struct dso));
+	
+	if ((dso == NULL) || dso_init(dso, p->dso[id].path)) {
+		free(dso);
+		return -1;
+	}
+	
+	dso->jitdump = p->dso[id].jitdump;
+	dso->quiet = 1;
+	
+	if (loader_start(&p->loader, dso, id)) {
+		dso_clear(dso);
+		free(dso);
+		return -1;
 	}
 	
-	return -1;
+	p->load[id].dso = dso;
+	p->loading++;
+	
+	return 0;
 }
 
 // ************************************************************************
 // 
 // ************************************************************************
-int prog_load(struct prog *p, char *dso_path)
+// dso of the same binary as path k, by build-id, -1 if none yet (that
+// path k is then to be registered with, in hex)
+static int prog_alias(struct prog *p, int k, char *hex)
+{
+	uint64_t id;
+	int found;
+	
+	if (dso_build_id(p->path[k].path, hex))
+		return -1;
+	
+	map_tool(&p->build_id, hex, 0, NULL, &id, &found, MAP_LOOKUP);
+	
+	if (!found)
+		return -1;
+	
+	MESSAGE("    %s: same build-id as %s\n", p->path[k].path,
+		p->dso[id].path);
+	
+	p->path[k].dso = id;
+	
+	return id;
+}
+
+int prog_load(struct prog *p, char *dso_path, int disassemble)
 {
 	int id = p->ndso;
+	int k = prog_intern(p, dso_path);
+	
+	if (k < 0)
+		return -1;
+	
+	// dsos not disassembled are told apart by path only
+	char hex[2 * DSO_BUILD_ID + 1] = "";
+	
+	if (disassemble && (prog_kernel_module(p, dso_path) == KERNEL_NONE)) {
+		int alias = prog_alias(p, k, hex);
+		
+		if (alias >= 0)
+			return alias;
+	}
+	
+	if (MEM_RESIZE(p->load, p->nload, id + 1))
+		return -1;
+	
+	p->load[id].dso = NULL;
+	MEM_INIT(p->load[id].wait, p->load[id].nwait);
 	
 	if (MEM_RESIZE(p->dso, p->ndso, id + 1))
 		return -1;
-
-	dso_init(&p->dso[id], dso_path);
 	
-	if (dso_load(&p->dso[id])) {
+	p->path[k].dso = id;
+	
+	// on failure, the dso is still initialized and cleared with the rest
+	if (dso_init(&p->dso[id], dso_path))
+		return -1;
+	
+	if (hex[0] && map_tool(&p->build_id, hex, id, NULL, NULL, NULL,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+	
+	uint64_t pid;
+	
+	if (jit_map_pid(dso_path, &pid) == 0)
+		p->dso[id].jitdump = prog_jitdump(p, pid);
+	
+	size_t m = prog_kernel_module(p, dso_path);
+	
+	if (!disassemble) {
+		DEBUG("\t=== %s: filtered out, not disassembled\n", dso_path);
+	} else if (m != KERNEL_NONE) {
+		// before prog_kernel(), see there
+		if (p->kernel->ready
+		&&  dso_load_kernel(&p->dso[id], p->kernel, m))
+			ERROR("Warning: could not load '%s'\n", dso_path);
+	} else if (dso_loadable(&p->dso[id]) && !prog_background(p, id)) {
+		return id;
+	} else if (dso_load(&p->dso[id])) {
 		ERROR("Warning: could not disassemble '%s'\n", dso_path);
 	}
 	
@@ -90,231 +358,1519 @@ int prog_load(struct prog *p, char *dso_path)
 }
 
 // ************************************************************************
-// 
+// Processes: fork shares the parent's mappings, exec starts over with
+// none, and exit retires the process.
 // ************************************************************************
-int prog_mmap(struct prog *p, uint64_t pid, uint64_t start, uint64_t length,
-	char *dso_path, uint64_t offset)
+static size_t prog_task_pos(struct prog *p, uint64_t pid)
 {
-	char *path = obstack_dup(&p->strings, dso_path);
+	size_t lo = 0, hi = p->ntask;
 	
-	if (path == NULL)
-		return -1;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		
+		if (p->task[mid].pid < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 	
-	int t = p->npmap;
+	return lo;
+}
+
+static struct ptask *prog_task(struct prog *p, uint64_t pid)
+{
+	size_t k = p->task_last;
 	
-	if (MEM_RESIZE(p->pmap, p->npmap, t + 1))
+	if ((k < p->ntask) && (p->task[k].pid == pid))
+		return &p->task[k];
+	
+	k = prog_task_pos(p, pid);
+	
+	if ((k == p->ntask) || (p->task[k].pid != pid))
+		return NULL;
+	
+	p->task_last = k;
+	
+	return &p->task[k];
+}
+
+static int prog_task_set(struct prog *p, uint64_t pid, size_t map)
+{
+	struct ptask *t = prog_task(p, pid);
+	
+	p->space++;
+	
+	if (t) {
+		t->map = map;
+		return 0;
+	}
+	
+	size_t k = prog_task_pos(p, pid);
+	size_t n = p->ntask;
+	
+	if (MEM_RESIZE(p->task, p->ntask, n + 1))
 		return -1;
 	
-	struct pmmap *m = &p->pmap[t];
+	memmove(&p->task[k + 1], &p->task[k], (n - k) * sizeof(struct ptask));
 	
-	m->pid = pid;
-	m->start = start;
-	m->length = length;
-	m->path = path;
-	m->offset = offset;
+	p->task[k].pid = pid;
+	p->task[k].map = map;
+	MEM_INIT(p->task[k].seg, p->task[k].nseg);
+	p->task[k].seg_map = PMAP_NONE;
+	p->task[k].seg_last = 0;
+	p->task_last = k;
 	
 	return 0;
 }
 
-// ************************************************************************
-// 
-// ************************************************************************
-int prog_translate(struct prog *p, uint64_t pid, uint64_t ip,
-	char **dso_r, uint64_t *foffs_r)
+int prog_fork(struct prog *p, uint64_t ppid, uint64_t pid)
 {
-	struct pmmap *m = p->pmap;
-	size_t n = p->npmap;
+	// new thread
+	if (pid == ppid)
+		return 0;
 	
-	for (size_t t = 0; t < n; t++) {
-		if (pid != m[t].pid) {
-			//DEBUG("\t\t\t%s: pid mismatch\n", m[t].path);
-			continue;
-		}
-		
-		if ((ip < m[t].start) || (ip >= m[t].start + m[t].length)) {
-			//DEBUG("\t\t\t%s: range mismatch\n", m[t].path);
-			continue;
-		}
-		
-		if (dso_r)
-			*dso_r = m[t].path;
-		
-		if (foffs_r)
-			*foffs_r = ip - m[t].start + m[t].offset;
-		
+	struct ptask *parent = prog_task(p, ppid);
+	
+	if (parent == NULL) {
+		prog_exit(p, pid);
 		return 0;
 	}
 	
-	return -1;
+	return prog_task_set(p, pid, parent->map);
+}
+
+void prog_exec(struct prog *p, uint64_t pid)
+{
+	prog_exit(p, pid);
+}
+
+void prog_exit(struct prog *p, uint64_t pid)
+{
+	struct ptask *t = prog_task(p, pid);
+	
+	if (t == NULL)
+		return;
+	
+	size_t k = t - p->task;
+	
+	MEM_CLEAR(t->seg, t->nseg);
+	p->space++;
+	
+	memmove(&p->task[k], &p->task[k + 1],
+		(p->ntask - k - 1) * sizeof(struct ptask));
+	
+	p->ntask--;
+}
+
+void prog_unmap(struct prog *p)
+{
+	for (size_t k = 0; k < p->ntask; k++)
+		MEM_CLEAR(p->task[k].seg, p->task[k].nseg);
+	
+	p->npmap = 0;
+	p->ntask = 0;
+	p->task_last = 0;
+	p->space++;
 }
 
 // ************************************************************************
 // 
 // ************************************************************************
-static int prog_require(struct prog *p, char *dso_path)
+int prog_mmap(struct prog *p, uint64_t pid, uint64_t start, uint64_t length,
+	char *dso_path, uint64_t offset)
 {
-	int id = prog_lookup(p, dso_path);
+	// anonymous memory is named after the perf map of the process, like
+	// perf does for JIT code, with addresses as file offsets
+	char map[32];
 	
-	if (id < 0) {
-		id = prog_load(p, dso_path);
+	// the kernel map only locates kallsyms (kernel samples are
+	// resolved by name)
+	if (kernel_map(dso_path)) {
+		if (p->kernel)
+			kernel_reloc(p->kernel, dso_path, offset);
 		
-		if (id < 0)
-			return -1;
+		return 0;
 	}
 	
-	return id;
+	if (jit_anon(dso_path)) {
+		snprintf(map, sizeof(map), "/tmp/perf-%lu.map", pid);
+		dso_path = map;
+		offset = start;
+	}
+	
+	int k = prog_intern(p, dso_path);
+	
+	if (k < 0)
+		return -1;
+	
+	size_t t = p->npmap;
+	
+	if (MEM_RESIZE(p->pmap, p->npmap, t + 1))
+		return -1;
+	
+	struct pmmap *m = &p->pmap[t];
+	struct ptask *task = prog_task(p, pid);
+	
+	m->pid = pid;
+	m->start = start;
+	m->length = length;
+	m->path = p->path[k].path;
+	m->path_id = k;
+	m->offset = offset;
+	m->prev = (task) ? task->map : PMAP_NONE;
+	
+	if (task) {
+		task->map = t;
+		p->space++;
+		return 0;
+	}
+	
+	return prog_task_set(p, pid, t);
 }
 
 // ************************************************************************
-// 
+// Address space index: mapping after mapping, oldest first, each one
+// replaces whatever it overlaps, splitting the segments it partly covers
+// (the newest mapping over an address wins, as when walking the list).
+// Once built, only the mappings added since are applied; if the list of
+// the process is not an extension of the indexed one (fork, exec), the
+// index is built again.
 // ************************************************************************
-int prog_sample(struct prog *p, uint64_t pid, uint64_t ip,
-	char *dso_path, char *sym, uint64_t offs)
+static int prog_index_add(struct ptask *task, struct pmmap *m, size_t t)
 {
-	// lookup dso
-	int id = prog_require(p, dso_path);
+	uint64_t start = m->start;
+	uint64_t end = m->start + m->length;
 	
-	if (id < 0)
-		return -1;
+	if (end <= start)
+		return 0;
 	
-	// count hit
-	p->samples++;
-
-	if (p->dso[id].insn == 0) {
-		dso_hit_dso(&p->dso[id]);
+	// segments [i, j) overlap the mapping
+	size_t i = 0, j = task->nseg;
+	
+	while (i < j) {
+		size_t mid = (i + j) / 2;
 		
-		p->unspec++;
-		return 0;
+		if (task->seg[mid].end <= start)
+			i = mid + 1;
+		else
+			j = mid;
 	}
 	
-	// translate
-	char *dso_check;
-	uint64_t foffs;
+	for (j = i; (j < task->nseg) && (task->seg[j].start < end); j++)
+		;
 	
-	if (prog_translate(p, pid, ip, &dso_check, &foffs)) {
-		DEBUG("\t=== no mmap for pid=%ld ip=0x%lx (%s: %s+0x%lx)\n",
-			pid, ip, dso_path, (sym) ? sym : "[unknown]", offs);
-		
-		if (dso_hit_sym(&p->dso[id], sym, offs))
-			p->orphans++;
-		
-		return 0;
+	struct pseg left = { 0, 0, PMAP_NONE };
+	struct pseg right = { 0, 0, PMAP_NONE };
+	
+	if ((i < j) && (task->seg[i].start < start)) {
+		left = task->seg[i];
+		left.end = start;
 	}
 	
-	if (strcmp(dso_path, dso_check) != 0) {
-		DEBUG("\t==== sample at 0x%lx reports dso %s, "
-			"but falls in %s range\n",
-			ip, dso_path, dso_check);
-
-		if (dso_hit_sym(&p->dso[id], sym, offs))
-			p->orphans++;
-		
-		return 0;
+	if ((i < j) && (task->seg[j - 1].end > end)) {
+		right = task->seg[j - 1];
+		right.start = end;
 	}
 	
-	// register sample
-	if (dso_hit_foffs(&p->dso[id], foffs, sym, offs))
-		p->orphans++;
+	size_t n = task->nseg;
+	size_t k = i + (left.map != PMAP_NONE) + 1 + (right.map != PMAP_NONE);
+	
+	if ((k > j) && MEM_RESIZE(task->seg, task->nseg, n + k - j))
+		return -1;
+	
+	memmove(&task->seg[k], &task->seg[j], (n - j) * sizeof(struct pseg));
+	
+	if (k < j)
+		task->nseg = n + k - j;
+	
+	if (left.map != PMAP_NONE)
+		task->seg[i++] = left;
+	
+	task->seg[i].start = start;
+	task->seg[i].end = end;
+	task->seg[i].map = t;
+	
+	if (right.map != PMAP_NONE)
+		task->seg[i + 1] = right;
 	
 	return 0;
 }
 
-
-// ************************************************************************
-// 
-// ************************************************************************
-int prog_branch(struct prog *p, uint64_t pid,
-	uint64_t pre_ip, char *pre_dso,
-	uint64_t src_ip, char *src_dso,
-	uint64_t dst_ip, char *dst_dso,
-	int miss, uint64_t cycles)
+static int prog_index(struct prog *p, struct ptask *task)
 {
-	// lookup dso
-	int pre_id = prog_require(p, pre_dso);
-	int src_id = prog_require(p, src_dso);
-	int dst_id = prog_require(p, dst_dso);
+	if (task->seg_map == task->map)
+		return 0;
+	
+	size_t n = 0;
+	size_t t;
+	
+	for (t = task->map; (t != PMAP_NONE) && (t != task->seg_map);
+	     t = p->pmap[t].prev)
+		n++;
+	
+	if (t != task->seg_map) {
+		task->nseg = 0;
+		task->seg_last = 0;
+	}
 	
-	if ((pre_id < 0) || (src_id < 0) || (dst_id < 0))
+	if (MEM_RESIZE(p->newer, p->nnewer, n))
 		return -1;
 	
-	p->branch_samples++;
+	t = task->map;
 	
-	// translate src
-	char *src_dso_check;
-	uint64_t src_foffs;
+	for (size_t k = n; k > 0; k--) {
+		p->newer[k - 1] = t;
+		t = p->pmap[t].prev;
+	}
 	
-	if (p->dso[src_id].insn == 0) {
-		src_foffs = (uint64_t)-1;
-	} else if (prog_translate(p, pid, src_ip, &src_dso_check, &src_foffs)) {
-		DEBUG("\t=== no mmap for pid=%ld ip=0x%lx (%s)\n",
-			pid, src_ip, src_dso);
+	for (size_t k = 0; k < n; k++) {
+		t = p->newer[k];
 		
-		src_foffs = (uint64_t)-1;
-	} else if (strcmp(src_dso, src_dso_check) != 0) {
-		DEBUG("\t==== branch from 0x%lx reports dso %s, "
-			"but falls in %s range\n",
-			src_ip, src_dso, src_dso_check);
+		if (prog_index_add(task, &p->pmap[t], t)) {
+			task->nseg = 0;
+			task->seg_map = PMAP_NONE;
+			return -1;
+		}
 	}
 	
-	// early exit if no src
-	if (src_foffs == (uint64_t)-1) {
-		p->branch_unspec++;
-		return 0;
-	}
+	task->seg_map = task->map;
+	
+	return 0;
+}
+
+// segment of the address space of pid spanning ip, NULL if none
+static struct pseg *prog_segment(struct prog *p, uint64_t pid, uint64_t ip)
+{
+	struct ptask *task = prog_task(p, pid);
+	
+	if ((task == NULL) || prog_index(p, task))
+		return NULL;
 	
-	// translate dst
-	char *dst_dso_check;
-	uint64_t dst_foffs;
+	size_t k = task->seg_last;
 	
-	if (p->dso[dst_id].insn == 0) {
-		dst_foffs = (uint64_t)-1;
-	} else if (prog_translate(p, pid, dst_ip, &dst_dso_check, &dst_foffs)) {
-		DEBUG("\t=== no mmap for pid=%ld ip=0x%lx (%s)\n",
-			pid, dst_ip, dst_dso);
+	if ((k < task->nseg)
+	&&  (ip >= task->seg[k].start) && (ip < task->seg[k].end))
+		return &task->seg[k];
+	
+	size_t lo = 0, hi = task->nseg;
+	
+	// first segment ending after ip
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
 		
-		dst_foffs = (uint64_t)-1;
-	} else if (strcmp(dst_dso, dst_dso_check) != 0) {
-		DEBUG("\t==== branch  to  0x%lx reports dso %s, "
-			"but falls in %s range\n",
-			dst_ip, dst_dso, dst_dso_check);
+		if (task->seg[mid].end <= ip)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 	
-	// ignoring no-dst branches hides interrupts
-	// (Is this desirable? If so, is it a good approach?)
-	if (dst_foffs == (uint64_t)-1) {
-		p->branch_unspec++;
-		return 0;
-	}
+	if ((lo == task->nseg) || (ip < task->seg[lo].start))
+		return NULL;
+	
+	task->seg_last = lo;
+	
+	return &task->seg[lo];
+}
 
-	// translate pre
-	char *pre_dso_check;
-	uint64_t pre_foffs;
-	
-	if (p->dso[pre_id].insn == 0) {
-		pre_foffs = (uint64_t)-1;
-	} else if (prog_translate(p, pid, pre_ip, &pre_dso_check, &pre_foffs)) {
-		DEBUG("\t=== no mmap for pid=%ld ip=0x%lx (%s)\n",
-			pid, pre_ip, pre_dso);
-		
-		pre_foffs = (uint64_t)-1;
-	} else if (strcmp(pre_dso, pre_dso_check) != 0) {
-		DEBUG("\t==== branch prev 0x%lx reports dso %s, "
-			"but falls in %s range\n",
-			pre_ip, pre_dso, pre_dso_check);
-	}
-	
-	// register branch
-	if (dso_branch(
-			&p->dso[pre_id], pre_foffs,
-			&p->dso[src_id], src_foffs,
-			&p->dso[dst_id], dst_foffs,
-			miss, cycles))
-		p->branch_orphans++;
+static struct pmmap *prog_mapping(struct prog *p, uint64_t pid, uint64_t ip)
+{
+	struct pseg *s = prog_segment(p, pid, ip);
 	
-	return 0;
+	if (s == NULL)
+		return NULL;
+	
+	return &p->pmap[s->map];
 }
 
+int prog_translate(struct prog *p, uint64_t pid, uint64_t ip,
+	char **dso_r, uint64_t *foffs_r)
+{
+	struct pmmap *m = prog_mapping(p, pid, ip);
+	
+	if (m == NULL)
+		return -1;
+	
+	if (dso_r)
+		*dso_r = m->path;
+	
+	if (foffs_r)
+		*foffs_r = ip - m->start + m->offset;
+	
+	return 0;
+}
 
+int prog_translate_path(struct prog *p, uint64_t pid, uint64_t ip,
+	int *path_r, uint64_t *foffs_r)
+{
+	struct pmmap *m = prog_mapping(p, pid, ip);
+	
+	if (m == NULL)
+		return -1;
+	
+	if (path_r)
+		*path_r = m->path_id;
+	
+	if (foffs_r)
+		*foffs_r = ip - m->start + m->offset;
+	
+	return 0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int prog_require_path(struct prog *p, int k)
+{
+	if (p->path[k].dso >= 0)
+		return p->path[k].dso;
+	
+	char *dso_path = p->path[k].path;
+	
+	return prog_load(p, dso_path, filter_dso(p->filter, dso_path));
+}
+
+static int prog_require(struct prog *p, char *dso_path)
+{
+	int k = prog_intern(p, dso_path);
+	
+	if (k < 0)
+		return -1;
+	
+	return prog_require_path(p, k);
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int prog_event_primary(const char *primary, const char *name)
+{
+	size_t len = strlen(primary);
+	
+	if (strncmp(primary, name, len) != 0)
+		return 0;
+	
+	// "cycles" also matches "cycles:u", "cycles:ppp", ...
+	return (name[len] == 0) || (name[len] == ':');
+}
+
+int prog_event(struct prog *p, char *name)
+{
+	if (prog_event_primary(p->event[0], name))
+		return 0;
+	
+	for (size_t e = 1; e < p->nevent; e++) {
+		if (strcmp(p->event[e], name) == 0)
+			return e;
+	}
+	
+	if (p->nevent >= PROG_EVENTS) {
+		if (!p->event_overflow)
+			ERROR("Warning: more than %d events, ignoring '%s'\n",
+				PROG_EVENTS, name);
+		
+		p->event_overflow = 1;
+		return -1;
+	}
+	
+	char *store = obstack_dup(&p->strings, name);
+	
+	if (store == NULL)
+		return -1;
+	
+	p->event[p->nevent] = store;
+	
+	return p->nevent++;
+}
+
+// ************************************************************************
+// Timeline buckets. The origin is set by the reader beforehand whenever
+// the trace time range is known (always, when slicing); otherwise it is
+// the first sample, in time order. Earlier samples (perf.data records are
+// only ordered per cpu) fall in the first bucket, later ones in the last
+// one that fits in the sparse keys.
+// ************************************************************************
+#define PROG_BUCKET_MAX		0xfffffffe
+
+uint64_t prog_bucket(struct prog *p, uint64_t time)
+{
+	if (p->bucket == 0)
+		return DSO_BUCKET_NONE;
+	
+	if (p->time0 == PROG_TIME_NONE)
+		p->time0 = time;
+	
+	if (time <= p->time0)
+		return 0;
+	
+	uint64_t b = (time - p->time0) / p->bucket;
+	
+	return (b < PROG_BUCKET_MAX) ? b : PROG_BUCKET_MAX;
+}
+
+// ************************************************************************
+// What waits for background loads, and its replay. Samples are replayed
+// per dso, and branches and call chains each in their order, so that the
+// result is the same as if every dso had been loaded right away.
+// ************************************************************************
+static void prog_hit(struct prog *p, int id, struct pwait *w)
+{
+	struct dso *dso = &p->dso[id];
+	const struct dso_mem *mem = (w->has_mem) ? &w->mem : NULL;
+	uint64_t nn = (w->ev == 0) ? w->n : 0;
+	int r;
+	
+	if (dso->insn == 0) {
+		dso_hit_dso(dso, w->ev, w->n, w->period);
+		
+		p->unspec += nn;
+		return;
+	}
+	
+	if (w->foffs == PROG_FOFFS_SYM)
+		r = dso_hit_sym(dso, w->sym, w->offs, w->ev, w->n, w->period,
+			w->tid, w->cpu, w->bucket, mem, w->calls);
+	else
+		r = dso_hit_foffs(dso, w->foffs, w->sym, w->offs, w->ev, w->n,
+			w->period, w->tid, w->cpu, w->bucket, mem, w->calls);
+	
+	if (r)
+		p->orphans += nn;
+}
+
+static int prog_wait(struct prog *p, int id, struct pwait *w)
+{
+	struct pload *l = &p->load[id];
+	size_t k = l->nwait;
+	
+	// symbols come from the reader's buffers
+	if (w->sym && map_tool(&p->wait_sym, w->sym, 0, &w->sym, NULL, NULL,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+	
+	if (MEM_RESIZE(l->wait, l->nwait, k + 1))
+		return -1;
+	
+	l->wait[k] = *w;
+	p->waiting++;
+	
+	return 0;
+}
+
+// insn at foffs, as dso_locate(); replayed branches mostly repeat the
+// same addresses, which are looked up in a cache first
+static size_t prog_locate(struct prog *p, int id, uint64_t foffs)
+{
+	if (foffs == (uint64_t)-1)
+		return DSO_INSN_NONE;
+	
+	if (p->nlocate == 0) {
+		if (MEM_RESIZE(p->locate, p->nlocate, PROG_LOCATE))
+			return dso_locate(&p->dso[id], foffs, 0);
+		
+		for (size_t k = 0; k < PROG_LOCATE; k++)
+			p->locate[k].id = -1;
+	}
+	
+	uint64_t h = (foffs + id) * 0x9e3779b97f4a7c15;
+	struct plocate *c = &p->locate[h >> (64 - PROG_LOCATE_BITS)];
+	
+	if ((c->id != id) || (c->foffs != foffs)) {
+		c->id = id;
+		c->foffs = foffs;
+		c->insn = dso_locate(&p->dso[id], foffs, 0);
+	}
+	
+	return c->insn;
+}
+
+static void prog_branch_hit(struct prog *p, struct pbwait *b)
+{
+	struct dso *dso[3];
+	uint64_t foffs[3];
+	
+	// as in prog_branch(): dsos without insns leave their ends unknown
+	for (int j = 0; j < 3; j++) {
+		dso[j] = &p->dso[b->id[j]];
+		foffs[j] = (dso[j]->insn == 0) ? (uint64_t)-1 : b->foffs[j];
+	}
+	
+	if ((foffs[1] == (uint64_t)-1) || (foffs[2] == (uint64_t)-1)) {
+		p->branch_unspec += b->n;
+		return;
+	}
+	
+	// as in dso_branch()
+	size_t i[3] = { DSO_INSN_NONE, DSO_INSN_NONE, DSO_INSN_NONE };
+	
+	i[1] = prog_locate(p, b->id[1], foffs[1]);
+	
+	if ((i[1] != DSO_INSN_NONE) && (i[1] != DSO_INSN_ORPHAN)) {
+		if (dso[2] == dso[1])
+			i[2] = prog_locate(p, b->id[2], foffs[2]);
+		
+		if (dso[0] == dso[1])
+			i[0] = prog_locate(p, b->id[0], foffs[0]);
+	}
+	
+	if (dso_branch_insn(dso[0], i[0], dso[1], i[1], dso[2], i[2],
+			b->miss, b->cycles * b->calls, b->n))
+		p->branch_orphans += b->n;
+}
+
+// same as the last branch waiting (loops repeat them in a row)
+static int prog_branch_same(struct prog *p, struct pbwait *b)
+{
+	if (p->nbwait == p->bwait0)
+		return 0;
+	
+	struct pbwait *last = &p->bwait[p->nbwait - 1];
+	
+	for (int j = 0; j < 3; j++) {
+		if ((last->id[j] != b->id[j]) || (last->foffs[j] != b->foffs[j]))
+			return 0;
+	}
+	
+	return (last->miss == b->miss) && (last->cycles == b->cycles);
+}
+
+static int prog_branch_wait(struct prog *p, struct pbwait *b)
+{
+	size_t k = p->nbwait;
+	
+	if (prog_branch_same(p, b)) {
+		p->bwait[k - 1].n += b->n;
+		p->bwait[k - 1].calls += b->calls;
+		return 0;
+	}
+	
+	if (MEM_RESIZE(p->bwait, p->nbwait, k + 1))
+		return -1;
+	
+	p->bwait[k] = *b;
+	
+	return 0;
+}
+
+static int prog_branch_ready(struct prog *p, struct pbwait *b)
+{
+	for (int j = 0; j < 3; j++) {
+		if (prog_loading(p, b->id[j]))
+			return 0;
+	}
+	
+	return 1;
+}
+
+// frames located, as in prog_callchain()
+static int prog_chain(struct prog *p, struct pfwait *fw, size_t nfw,
+	uint64_t n)
+{
+	if (MEM_RESIZE(p->frame, p->nframe, nfw))
+		return -1;
+	
+	size_t nf = 0;
+	
+	for (size_t k = 0; k < nfw; k++) {
+		struct cg_frame f = { CG_UNKNOWN, CG_UNKNOWN };
+		int id = fw[k].dso;
+		
+		if (id >= 0) {
+			size_t i = dso_locate_within(&p->dso[id], fw[k].foffs);
+			
+			f.dso = id;
+			f.insn = (i < p->dso[id].ninsn) ? i : CG_UNKNOWN;
+		}
+		
+		if ((nf > 0) && (f.insn == CG_UNKNOWN)
+		&&  (p->frame[nf - 1].dso == f.dso)
+		&&  (p->frame[nf - 1].insn == CG_UNKNOWN))
+			continue;
+		
+		p->frame[nf++] = f;
+	}
+	
+	if (nf == 0)
+		return 0;
+	
+	return callgraph_add(&p->cg, p->frame, nf, n);
+}
+
+static int prog_chain_ready(struct prog *p, struct pcwait *c)
+{
+	for (size_t k = 0; k < c->nf; k++) {
+		int id = p->fwait[c->f0 + k].dso;
+		
+		if ((id >= 0) && prog_loading(p, id))
+			return 0;
+	}
+	
+	return 1;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static void prog_install(struct prog *p, size_t id, struct dso *dso, int r)
+{
+	struct pload *l = &p->load[id];
+	
+	dso_clear(&p->dso[id]);
+	p->dso[id] = *dso;
+	p->dso[id].quiet = 0;
+	
+	free(dso);
+	l->dso = NULL;
+	
+	dso = &p->dso[id];
+	
+	MESSAGE("    %s:\n      insn: %9zd\n", dso->path, dso->ninsn);
+	
+	if (r)
+		ERROR("Warning: could not disassemble '%s'\n", dso->path);
+	
+	p->insn += dso->ninsn;
+	
+	for (size_t k = 0; k < l->nwait; k++)
+		prog_hit(p, id, &l->wait[k]);
+	
+	p->waiting -= l->nwait;
+	MEM_CLEAR(l->wait, l->nwait);
+}
+
+static int prog_flush(struct prog *p)
+{
+	while ((p->bwait0 < p->nbwait)
+	&&     prog_branch_ready(p, &p->bwait[p->bwait0]))
+		prog_branch_hit(p, &p->bwait[p->bwait0++]);
+	
+	if (p->bwait0 == p->nbwait) {
+		p->nbwait = 0;
+		p->bwait0 = 0;
+	}
+	
+	while ((p->cwait0 < p->ncwait)
+	&&     prog_chain_ready(p, &p->cwait[p->cwait0])) {
+		struct pcwait *c = &p->cwait[p->cwait0++];
+		
+		if (prog_chain(p, &p->fwait[c->f0], c->nf, c->n))
+			return -1;
+	}
+	
+	if (p->cwait0 == p->ncwait) {
+		p->ncwait = 0;
+		p->cwait0 = 0;
+		p->nfwait = 0;
+	}
+	
+	return 0;
+}
+
+// takes the loads done (waiting for all of them if wait, or if too much
+// waits for them), and replays what they let through
+static int prog_collect(struct prog *p, int wait)
+{
+	size_t done = 0;
+	
+	if (p->waiting + p->nbwait + p->nfwait > PROG_WAIT_MAX)
+		wait = 1;
+	
+	while (p->loading > 0) {
+		struct dso *dso;
+		size_t id;
+		int r;
+		
+		if (!loader_done(&p->loader, wait, &dso, &id, &r))
+			break;
+		
+		prog_install(p, id, dso, r);
+		p->loading--;
+		done++;
+	}
+	
+	if (done == 0)
+		return 0;
+	
+	return prog_flush(p);
+}
+
+// ************************************************************************
+// Samples gathered by raw ip (see struct pgather). Counts add up, so that
+// the result is the same as counting each sample as it comes, except that
+// samples with memory data are counted right away (their cache lines are
+// kept in order), and so are those in kernel dsos.
+// ************************************************************************
+// file offset of a sample of dso id, PROG_FOFFS_SYM to locate it by
+// symbol; *miss is what did not translate (-1: nothing), in the range of
+// path *check
+static uint64_t prog_sample_foffs(struct prog *p, int id, uint64_t pid,
+	uint64_t ip, int *miss, int *check)
+{
+	uint64_t foffs;
+	
+	*miss = -1;
+	
+	if (prog_translate_path(p, pid, ip, check, &foffs)) {
+		*miss = DIAG_SAMPLE_NO_MMAP;
+		return PROG_FOFFS_SYM;
+	}
+	
+	if (p->path[*check].dso != id) {
+		*miss = DIAG_SAMPLE_MISMATCH;
+		return PROG_FOFFS_SYM;
+	}
+	
+	return foffs;
+}
+
+// n samples alike
+static void prog_sample_miss(struct prog *p, int miss, int check,
+	uint64_t pid, uint64_t ip, char *dso_path, char *sym, uint64_t offs,
+	uint64_t n)
+{
+	if (miss == DIAG_SAMPLE_NO_MMAP)
+		diag_n(DIAG_SAMPLE_NO_MMAP, n, "pid=%ld ip=0x%lx (%s: %s+0x%lx)",
+			pid, ip, dso_path, (sym) ? sym : "[unknown]", offs);
+	else if (miss == DIAG_SAMPLE_MISMATCH)
+		diag_n(DIAG_SAMPLE_MISMATCH, n,
+			"sample at 0x%lx reports dso %s, "
+			"but falls in %s range",
+			ip, dso_path, p->path[check].path);
+}
+
+// counts a translated sample of dso id, live if the dso has (or will
+// have) insns
+static int prog_count(struct prog *p, int id, int live, struct pwait *w)
+{
+	// count hit
+	p->event_samples[w->ev] += w->n;
+	p->event_period[w->ev] += w->period;
+	
+	// other events are only accounted for per dso, insn, etc.
+	uint64_t nn = (w->ev == 0) ? w->n : 0;
+	
+	p->samples += nn;
+	
+	if (!live) {
+		dso_hit_dso(&p->dso[id], w->ev, w->n, w->period);
+		
+		p->unspec += nn;
+		return 0;
+	}
+	
+	// register sample, once the dso is there
+	if (prog_loading(p, id))
+		return prog_wait(p, id, w);
+	
+	prog_hit(p, id, w);
+	
+	return 0;
+}
+
+// counts the samples gathered, and starts over
+static int prog_resolve(struct prog *p)
+{
+	int r = 0;
+	
+	for (size_t e = 0; e < p->ngather; e++) {
+		struct pgather *g = &p->gather[e];
+		struct ppath *path = &p->path[g->path];
+		struct pwait w;
+		
+		p->gather_slot[g->slot] = 0;
+		
+		w.foffs = g->foffs;
+		w.sym = g->sym;
+		w.offs = g->offs;
+		w.ev = g->ev;
+		w.n = g->n;
+		w.period = g->period;
+		w.tid = g->tid;
+		w.cpu = g->cpu;
+		w.bucket = g->bucket;
+		w.has_mem = 0;
+		w.calls = g->calls;
+		
+		if (g->live)
+			prog_sample_miss(p, g->miss, g->check, g->pid, g->ip,
+				path->path, g->sym, g->offs, g->calls);
+		
+		r |= prog_count(p, path->dso, g->live, &w);
+	}
+	
+	p->ngather = 0;
+	
+	return r;
+}
+
+// 1 if the sample is not to be gathered: its ip was sampled with
+// another symbol
+static int prog_gather(struct prog *p, uint64_t pid, uint64_t tid,
+	uint64_t cpu, uint64_t bucket, uint64_t ip, int k,
+	char *sym, uint64_t offs, int ev, uint64_t n, uint64_t period)
+{
+	if (prog_require_path(p, k) < 0)
+		return -1;
+	
+	int id = p->path[k].dso;
+	int live = (p->dso[id].insn != 0) || prog_loading(p, id);
+	
+	if ((p->ngather == PROG_GATHER) && prog_resolve(p))
+		return -1;
+	
+	size_t nslot = 2 * PROG_GATHER;
+	
+	if (p->ngather_slot == 0) {
+		if (MEM_RESIZE(p->gather_slot, p->ngather_slot, nslot))
+			return -1;
+		
+		memset(p->gather_slot, 0, nslot * sizeof(size_t));
+	}
+	
+	uint64_t h = ip;
+	
+	h = (h ^ pid) * 0x9e3779b97f4a7c15;
+	h = (h ^ (tid << 24) ^ cpu) * 0x9e3779b97f4a7c15;
+	h = (h ^ (bucket << 32) ^ p->space) * 0x9e3779b97f4a7c15;
+	h = (h ^ ((uint64_t)k << 8) ^ (uint64_t)ev) * 0x9e3779b97f4a7c15;
+	
+	size_t s = h >> (64 - PROG_GATHER_BITS - 1);
+	struct pgather *g;
+	
+	for (; p->gather_slot[s]; s = (s + 1) & (nslot - 1)) {
+		g = &p->gather[p->gather_slot[s] - 1];
+		
+		if ((g->ip != ip) || (g->pid != pid) || (g->tid != tid)
+		||  (g->cpu != cpu) || (g->bucket != bucket)
+		||  (g->space != p->space) || (g->path != k)
+		||  (g->ev != ev) || (g->live != live))
+			continue;
+		
+		// an ip has the one symbol, as a rule
+		if (live && ((g->offs != offs) || (!g->sym != !sym)
+		||  (sym && strcmp(g->sym, sym))))
+			return 1;
+		
+		g->calls++;
+		g->n += n;
+		g->period += period;
+		
+		return 0;
+	}
+	
+	size_t e = p->ngather;
+	
+	if (MEM_RESIZE(p->gather, p->ngather, e + 1))
+		return -1;
+	
+	g = &p->gather[e];
+	
+	g->pid = pid;
+	g->tid = tid;
+	g->cpu = cpu;
+	g->bucket = bucket;
+	g->ip = ip;
+	g->space = p->space;
+	g->path = k;
+	g->ev = ev;
+	g->live = live;
+	g->sym = NULL;
+	g->offs = offs;
+	g->calls = 1;
+	g->n = n;
+	g->period = period;
+	g->slot = s;
+	
+	if (live) {
+		// symbols come from the reader's buffers
+		if (sym && map_tool(&p->wait_sym, sym, 0, &g->sym, NULL, NULL,
+				MAP_INSERT | MAP_STORE)) {
+			p->ngather = e;
+			return -1;
+		}
+		
+		g->foffs = prog_sample_foffs(p, id, pid, ip,
+			&g->miss, &g->check);
+	}
+	
+	p->gather_slot[s] = e + 1;
+	
+	return 0;
+}
+
+int prog_sync(struct prog *p)
+{
+	if (prog_resolve(p) || prog_collect(p, 1))
+		return -1;
+	
+	return prog_flush(p);
+}
+
+// ************************************************************************
+// Kernel samples are attributed by kallsyms (perf may not know module
+// names), and wait until prog_kernel() tells which symbols to disassemble:
+// 1 if the sample waits, 0 if it is to be counted now, in dso *kdso (left
+// NULL if not found in kallsyms)
+// ************************************************************************
+static int prog_kernel_sample(struct prog *p, uint64_t pid, uint64_t tid,
+	uint64_t cpu, uint64_t bucket, uint64_t ip, char **kdso,
+	int ev, uint64_t n, uint64_t period, const struct dso_mem *mem)
+{
+	struct kernel *k = p->kernel;
+	
+	if ((k == NULL) || kernel_load(k))
+		return 0;
+	
+	size_t i = kernel_at(k, ip);
+	
+	if (i == KERNEL_NONE)
+		return 0;
+	
+	char *dso_path = k->module[k->sym[i].module].name;
+	
+	if (k->ready) {
+		*kdso = dso_path;
+		return 0;
+	}
+	
+	if (p->kernel_wait == NULL) {
+		p->kernel_wait = malloc(sizeof(struct tally));
+		
+		if ((p->kernel_wait == NULL) || tally_init(p->kernel_wait)) {
+			ERROR("kernel samples: out of memory\n");
+			free(p->kernel_wait);
+			p->kernel_wait = NULL;
+			return -1;
+		}
+		
+		p->kernel_wait->primary = p->event[0];
+	}
+	
+	if (tally_sample(p->kernel_wait, pid, tid, cpu, bucket, ip,
+			dso_path, NULL, 0, p->event[ev], n, period, mem))
+		return -1;
+	
+	k->sym[i].samples += n;
+	
+	if (ev == 0)
+		k->sym[i].hits += n;
+	
+	return 1;
+}
+
+int prog_kernel(struct prog *p)
+{
+	struct kernel *k = p->kernel;
+	
+	if ((k == NULL) || k->ready)
+		return 0;
+	
+	// kernel dsos may get insns
+	if (prog_resolve(p))
+		return -1;
+	
+	k->ready = 1;
+	
+	if (p->kernel_wait == NULL)
+		return 0;
+	
+	kernel_hot(k);
+	
+	// kernel dsos already required (e.g. by branches) are loaded now
+	for (size_t d = 0; d < p->ndso; d++) {
+		struct dso *dso = &p->dso[d];
+		size_t m = prog_kernel_module(p, dso->path);
+		
+		if ((m == KERNEL_NONE) || !filter_dso(p->filter, dso->path))
+			continue;
+		
+		if (dso_load_kernel(dso, k, m))
+			ERROR("Warning: could not load '%s'\n", dso->path);
+		
+		p->insn += dso->ninsn;
+	}
+	
+	struct tally *w = p->kernel_wait;
+	int r = tally_replay(w, p);
+	
+	tally_clear(w);
+	free(w);
+	p->kernel_wait = NULL;
+	
+	return r;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int prog_sample(struct prog *p, uint64_t pid, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, uint64_t ip, char *dso_path, int path, char *sym,
+	uint64_t offs, int ev, uint64_t n, uint64_t period,
+	const struct dso_mem *mem)
+{
+	if (ev < 0)
+		return 0;
+	
+	if (p->loading && prog_collect(p, 0))
+		return -1;
+	
+	char *kdso = NULL;
+	
+	if ((int64_t)ip < 0) {
+		int r = prog_kernel_sample(p, pid, tid, cpu, bucket, ip,
+			&kdso, ev, n, period, mem);
+		
+		if (r)
+			return (r < 0) ? -1 : 0;
+		
+		if (kdso) {
+			dso_path = kdso;
+			path = -1;
+		}
+	}
+	
+	if ((path < 0) && ((path = prog_intern(p, dso_path)) < 0))
+		return -1;
+	
+	// gathered by ip, unless in a kernel dso (at its addresses) or with
+	// memory data
+	if ((kdso == NULL) && (mem == NULL)) {
+		int r = prog_gather(p, pid, tid, cpu, bucket, ip, path,
+			sym, offs, ev, n, period);
+		
+		if (r <= 0)
+			return r;
+	}
+	
+	// lookup dso
+	int id = prog_require_path(p, path);
+	
+	if (id < 0)
+		return -1;
+	
+	int live = (p->dso[id].insn != 0) || prog_loading(p, id);
+	struct pwait w;
+	
+	w.foffs = PROG_FOFFS_SYM;
+	w.sym = sym;
+	w.offs = offs;
+	w.ev = ev;
+	w.n = n;
+	w.period = period;
+	w.tid = tid;
+	w.cpu = cpu;
+	w.bucket = bucket;
+	w.has_mem = (mem != NULL);
+	w.calls = 1;
+	
+	if (mem)
+		w.mem = *mem;
+	
+	// translate; kernel dsos are at their addresses, and samples out of
+	// the mappings of their dso are located by symbol
+	if (kdso) {
+		w.foffs = ip;
+	} else if (live) {
+		int miss, check;
+		
+		w.foffs = prog_sample_foffs(p, id, pid, ip, &miss, &check);
+		prog_sample_miss(p, miss, check, pid, ip, dso_path, sym,
+			offs, 1);
+	}
+	
+	return prog_count(p, id, live, &w);
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+// file offset of a branch end, -1 if unknown
+static uint64_t prog_branch_end(struct prog *p, uint64_t pid, int id,
+	uint64_t ip, char *dso_path, char *what)
+{
+	int path_check;
+	uint64_t foffs;
+	
+	if ((p->dso[id].insn == 0) && !prog_loading(p, id))
+		return (uint64_t)-1;
+	
+	if (prog_translate_path(p, pid, ip, &path_check, &foffs)) {
+		diag(DIAG_BRANCH_NO_MMAP, "pid=%ld ip=0x%lx (%s)",
+			pid, ip, dso_path);
+		
+		return (uint64_t)-1;
+	}
+	
+	if (p->path[path_check].dso != id) {
+		diag(DIAG_BRANCH_MISMATCH, "branch %s 0x%lx reports dso %s, "
+			"but falls in %s range",
+			what, ip, dso_path, p->path[path_check].path);
+	}
+	
+	return foffs;
+}
+
+int prog_branch(struct prog *p, uint64_t pid,
+	uint64_t pre_ip, int pre_path,
+	uint64_t src_ip, int src_path,
+	uint64_t dst_ip, int dst_path,
+	int miss, uint64_t cycles, uint64_t n)
+{
+	if (p->loading && prog_collect(p, 0))
+		return -1;
+	
+	// lookup dso
+	struct pbwait b;
+	char *pre_dso = p->path[pre_path].path;
+	char *src_dso = p->path[src_path].path;
+	char *dst_dso = p->path[dst_path].path;
+	
+	b.id[0] = prog_require_path(p, pre_path);
+	b.id[1] = prog_require_path(p, src_path);
+	b.id[2] = prog_require_path(p, dst_path);
+	
+	if ((b.id[0] < 0) || (b.id[1] < 0) || (b.id[2] < 0))
+		return -1;
+	
+	p->branch_samples += n;
+	
+	// translate src, early exit if none
+	b.foffs[1] = prog_branch_end(p, pid, b.id[1], src_ip, src_dso, "from");
+	
+	if (b.foffs[1] == (uint64_t)-1) {
+		p->branch_unspec += n;
+		return 0;
+	}
+	
+	// translate dst; ignoring no-dst branches hides interrupts
+	// (Is this desirable? If so, is it a good approach?)
+	b.foffs[2] = prog_branch_end(p, pid, b.id[2], dst_ip, dst_dso, " to ");
+	
+	if (b.foffs[2] == (uint64_t)-1) {
+		p->branch_unspec += n;
+		return 0;
+	}
+
+	// translate pre
+	b.foffs[0] = prog_branch_end(p, pid, b.id[0], pre_ip, pre_dso, "prev");
+	
+	// register branch, after those that wait
+	b.miss = miss;
+	b.cycles = cycles;
+	b.n = n;
+	b.calls = 1;
+	
+	if ((p->nbwait > 0) || !prog_branch_ready(p, &b))
+		return prog_branch_wait(p, &b);
+	
+	prog_branch_hit(p, &b);
+	
+	return 0;
+}
+
+
+// ************************************************************************
+// Branch stacks. Consecutive entries mostly fall in the same DSO and
+// mapping, and loops repeat the same addresses: the DSO of the previous
+// endpoint and the address range known to resolve to its mapping are
+// reused, and all file offsets of a DSO are located in one sorted pass.
+// The result is the same as that of prog_branch() on each pair of
+// entries, oldest first.
 // ************************************************************************
-// 
-// ************************************************************************
+struct ptcache {
+	uint64_t pid;
+	uint64_t lo, hi;
+	size_t t;
+	int valid;
+};
+
+// like prog_translate(), also returning [lo, hi), the range of addresses
+// around ip that resolve to the same (newest matching) mapping
+static int prog_translate_range(struct prog *p, uint64_t pid, uint64_t ip,
+	struct ptcache *c)
+{
+	struct pseg *s = prog_segment(p, pid, ip);
+	
+	if (s == NULL)
+		return -1;
+	
+	c->pid = pid;
+	c->lo = s->start;
+	c->hi = s->end;
+	c->t = s->map;
+	c->valid = 1;
+	return 0;
+}
+
+static void prog_end(struct prog *p, uint64_t pid, struct pend *e,
+	struct ptcache *c, char *what)
+{
+	e->foffs = (uint64_t)-1;
+	e->insn = DSO_INSN_NONE;
+	
+	if ((p->dso[e->id].insn == 0) && !prog_loading(p, e->id))
+		return;
+	
+	if ((!c->valid) || (c->pid != pid)
+	||  (e->ip < c->lo) || (e->ip >= c->hi)) {
+		if (prog_translate_range(p, pid, e->ip, c)) {
+			diag(DIAG_BRANCH_NO_MMAP, "pid=%ld ip=0x%lx (%s)",
+				pid, e->ip, e->path);
+			return;
+		}
+	}
+	
+	struct pmmap *m = &p->pmap[c->t];
+	
+	if (p->path[m->path_id].dso != e->id) {
+		diag(DIAG_BRANCH_MISMATCH, "branch %s 0x%lx reports dso %s, "
+			"but falls in %s range",
+			what, e->ip, e->path, m->path);
+	}
+	
+	e->foffs = e->ip - m->start + m->offset;
+}
+
+static int prog_end_loading(struct prog *p, struct pend **o, size_t no)
+{
+	for (size_t i = 0; i < no; i++) {
+		if (prog_loading(p, o[i]->id))
+			return 1;
+	}
+	
+	return 0;
+}
+
+// the branches, resolved, wait in order (see prog_branch_wait())
+static int prog_branch_batch_wait(struct prog *p, struct pbranch *br,
+	size_t nbr, uint64_t n)
+{
+	struct pend *e = p->end;
+	
+	for (size_t k = nbr - 1; k-- > 0; ) {
+		struct pbwait b;
+		size_t w[3] = { 2 * k + 3, 2 * k, 2 * k + 1 };
+		
+		for (int j = 0; j < 3; j++) {
+			b.id[j] = e[w[j]].id;
+			b.foffs[j] = e[w[j]].foffs;
+		}
+		
+		b.miss = br[k].miss;
+		b.cycles = br[k].cycles;
+		b.n = n;
+		b.calls = 1;
+		
+		if (prog_branch_wait(p, &b))
+			return -1;
+		
+		p->branch_samples += n;
+	}
+	
+	return 0;
+}
+
+static int prog_end_cmp(const void *a, const void *b)
+{
+	const struct pend *ea = *(struct pend * const *)a;
+	const struct pend *eb = *(struct pend * const *)b;
+	
+	if (ea->id != eb->id)
+		return (ea->id < eb->id) ? -1 : 1;
+	
+	if (ea->foffs != eb->foffs)
+		return (ea->foffs < eb->foffs) ? -1 : 1;
+	
+	return 0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int prog_branch_batch(struct prog *p, uint64_t pid,
+	struct pbranch *br, size_t nbr, uint64_t n)
+{
+	// the oldest entry only provides the start of the next span
+	if (nbr < 2)
+		return 0;
+	
+	if (p->loading && prog_collect(p, 0))
+		return -1;
+	
+	// endpoints: 2k is the source of br[k], 2k + 1 its destination
+	if (MEM_RESIZE(p->end, p->nend, 2 * nbr))
+		return -1;
+	
+	if (MEM_RESIZE(p->order, p->norder, 2 * nbr))
+		return -1;
+	
+	struct pend *e = p->end;
+	
+	for (size_t k = 0; k < nbr; k++) {
+		e[2 * k].ip = br[k].src_ip;
+		e[2 * k].path = br[k].src_dso;
+		e[2 * k].path_id = br[k].src_path;
+		e[2 * k + 1].ip = br[k].dst_ip;
+		e[2 * k + 1].path = br[k].dst_dso;
+		e[2 * k + 1].path_id = br[k].dst_path;
+	}
+	
+	// lookup dsos, in the order of prog_branch(): pre, src, dst
+	char *last_path = NULL;
+	int last_id = -1;
+	
+	for (size_t k = nbr - 1; k-- > 0; ) {
+		size_t w[3] = { 2 * k + 3, 2 * k, 2 * k + 1 };
+		
+		for (int j = (k == nbr - 2) ? 0 : 1; j < 3; j++) {
+			struct pend *ej = &e[w[j]];
+			
+			// by path id if the reader had it, otherwise by path,
+			// mostly the same as the last one
+			if (ej->path_id >= 0) {
+				ej->id = prog_require_path(p, ej->path_id);
+				
+				if (ej->id < 0)
+					return -1;
+				continue;
+			}
+			
+			if ((last_path == NULL)
+			||  ((ej->path != last_path)
+			  && (strcmp(ej->path, last_path) != 0))) {
+				last_id = prog_require(p, ej->path);
+				last_path = ej->path;
+				
+				if (last_id < 0)
+					return -1;
+			}
+			
+			ej->id = last_id;
+		}
+	}
+	
+	// translate, then sort by (dso, file offset)
+	struct pend **o = p->order;
+	struct ptcache c;
+	size_t no = 0;
+	
+	c.valid = 0;
+	
+	for (size_t k = nbr - 1; k-- > 0; ) {
+		if (k == nbr - 2) {
+			prog_end(p, pid, &e[2 * k + 3], &c, " to ");
+			o[no++] = &e[2 * k + 3];
+		}
+		
+		prog_end(p, pid, &e[2 * k], &c, "from");
+		prog_end(p, pid, &e[2 * k + 1], &c, " to ");
+		o[no++] = &e[2 * k];
+		o[no++] = &e[2 * k + 1];
+	}
+	
+	if ((p->nbwait > 0) || prog_end_loading(p, o, no))
+		return prog_branch_batch_wait(p, br, nbr, n);
+	
+	qsort(o, no, sizeof(*o), prog_end_cmp);
+	
+	// locate, each offset once, searching forward within a dso
+	size_t i0 = 0;
+	
+	for (size_t i = 0; i < no; i++) {
+		if (i > 0) {
+			if (prog_end_cmp(&o[i - 1], &o[i]) == 0) {
+				o[i]->insn = o[i - 1]->insn;
+				continue;
+			}
+			
+			if (o[i - 1]->id != o[i]->id)
+				i0 = 0;
+		}
+		
+		o[i]->insn = dso_locate(&p->dso[o[i]->id], o[i]->foffs, i0);
+		
+		if (o[i]->insn < DSO_INSN_ORPHAN)
+			i0 = o[i]->insn;
+	}
+	
+	// register branches, oldest first
+	for (size_t k = nbr - 1; k-- > 0; ) {
+		struct pend *pre = &e[2 * k + 3];
+		struct pend *src = &e[2 * k];
+		struct pend *dst = &e[2 * k + 1];
+		
+		p->branch_samples += n;
+		
+		// as in prog_branch(), without both ends the branch is unknown
+		if ((src->foffs == (uint64_t)-1)
+		||  (dst->foffs == (uint64_t)-1)) {
+			p->branch_unspec += n;
+			continue;
+		}
+		
+		if (dso_branch_insn(
+				&p->dso[pre->id], pre->insn,
+				&p->dso[src->id], src->insn,
+				&p->dso[dst->id], dst->insn,
+				br[k].miss, br[k].cycles, n))
+			p->branch_orphans += n;
+	}
+	
+	return 0;
+}
+
+// ************************************************************************
+// Callers are located from their return address minus one, which lies
+// within the call insn. Frames that cannot be located keep their dso if
+// known; runs of unknown frames are merged.
+// ************************************************************************
+int prog_callchain(struct prog *p, uint64_t pid,
+	const uint64_t *ip, size_t nip, uint64_t n)
+{
+	if (p->loading && prog_collect(p, 0))
+		return -1;
+	
+	// frames go after those that wait, if any
+	size_t f0 = p->nfwait;
+	int wait = (p->ncwait > 0);
+	
+	if (MEM_RESIZE(p->fwait, p->nfwait, f0 + nip))
+		return -1;
+	
+	struct pfwait *fw = &p->fwait[f0];
+	
+	for (size_t k = 0; k < nip; k++) {
+		uint64_t a = (k == 0) ? ip[k] : ip[k] - 1;
+		int path;
+		
+		fw[k].dso = -1;
+		fw[k].foffs = 0;
+		
+		if (prog_translate_path(p, pid, a, &path, &fw[k].foffs) == 0) {
+			fw[k].dso = prog_require_path(p, path);
+			
+			if (fw[k].dso < 0)
+				return -1;
+			
+			wait |= prog_loading(p, fw[k].dso);
+		}
+	}
+	
+	if (wait) {
+		size_t c = p->ncwait;
+		
+		if (MEM_RESIZE(p->cwait, p->ncwait, c + 1))
+			return -1;
+		
+		p->cwait[c].f0 = f0;
+		p->cwait[c].nf = nip;
+		p->cwait[c].n = n;
+		
+		return 0;
+	}
+	
+	int r = prog_chain(p, fw, nip, n);
+	
+	p->nfwait = f0;
+	
+	return r;
+}
@@ -17,52 +17,340 @@
 #ifndef PROG_H
 #define PROG_H
 #include <stddef.h>
+#include "map.h"
 #include "dso.h"
+#include "filter.h"
+#include "callgraph.h"
+#include "kernel.h"
+#include "loader.h"
 
+struct tally;
 
+
+#define PMAP_NONE		((size_t)-1)
+
+// mappings form persistent lists, newest first: a forked process shares
+// its parent's list, and only its own later mmaps are added in front of
+// it (copy on write, without copying)
 struct pmmap {
 	uint64_t pid;
 	uint64_t start;
 	uint64_t length;
 	char *path;
+	int path_id;
 	uint64_t offset;
+	
+	// previous mapping of the same address space
+	size_t prev;
+};
+
+// address range [start, end) where mapping map is the newest one
+struct pseg {
+	uint64_t start, end;
+	size_t map;
+};
+
+// live process, and the newest mapping of its address space; its
+// mappings are indexed once looked up: the segments of the address space
+// as of mapping seg_map (PMAP_NONE: none), sorted, the last one found
+// being seg_last
+struct ptask {
+	uint64_t pid;
+	size_t map;
+	
+	struct pseg *seg;
+	size_t nseg;
+	size_t seg_map;
+	size_t seg_last;
+};
+
+// one branch stack entry, as recorded: the most recent entry first; the
+// dsos are also given as path ids by readers that have them (-1 if not,
+// see prog_intern())
+struct pbranch {
+	uint64_t src_ip, dst_ip;
+	char *src_dso, *dst_dso;
+	int src_path, dst_path;
+	int miss;
+	uint64_t cycles;
+};
+
+// branch endpoint, resolved by prog_branch_batch()
+struct pend {
+	uint64_t ip;
+	char *path;
+	int path_id;
+	int id;
+	uint64_t foffs;
+	size_t insn;
+};
+
+#define PROG_EVENTS		DSO_EVENTS
+
+// timeline bucket width to be set from the trace time range
+#define PROG_BUCKET_AUTO	((uint64_t)-1)
+#define PROG_TIME_NONE		((uint64_t)-1)
+
+// dso path seen (in mmaps, samples or branches), and its dso once
+// required (-1: not yet)
+struct ppath {
+	char *path;
+	int dso;
+};
+
+// dsos are disassembled in the background (see loader.h) while the trace
+// is read: the samples of a dso being loaded wait for it, already
+// translated, and so do, in order, the branches and call chains that
+// involve one (or follow one that waits)
+#define PROG_FOFFS_SYM		((uint64_t)-1)
+
+// sample, by file offset, or by symbol if foffs is PROG_FOFFS_SYM; calls
+// is how many were gathered into it (see struct pgather)
+struct pwait {
+	uint64_t foffs;
+	char *sym;
+	uint64_t offs;
+	int ev;
+	uint64_t n, period;
+	uint64_t tid, cpu, bucket;
+	struct dso_mem mem;
+	int has_mem;
+	uint64_t calls;
+};
+
+// past PROG_WAIT_MAX samples, branches and call chain frames waiting, the
+// reader itself waits for the loads (see prog_collect())
+#define PROG_WAIT_MAX		((size_t)1 << 20)
+
+// dso being loaded (NULL if none), and its samples
+struct pload {
+	struct dso *dso;
+	struct pwait *wait;
+	size_t nwait;
+};
+
+// branch: dsos and file offsets of the previous branch end, of its source
+// and of its destination; calls is how many identical branches in a row
+// it stands for
+struct pbwait {
+	int id[3];
+	uint64_t foffs[3];
+	int miss;
+	uint64_t cycles, n, calls;
+};
+
+// call chain: frames [f0, f0 + nf), each a dso (-1 if unknown) and a
+// file offset
+struct pfwait {
+	int dso;
+	uint64_t foffs;
+};
+
+struct pcwait {
+	size_t f0, nf;
+	uint64_t n;
+};
+
+// insn located at a file offset of dso id (-1: none), see prog_locate()
+#define PROG_LOCATE_BITS	12
+#define PROG_LOCATE		((size_t)1 << PROG_LOCATE_BITS)
+
+struct plocate {
+	int id;
+	uint64_t foffs;
+	size_t insn;
+};
+
+// samples are gathered by raw ip before they are counted: hot code is
+// sampled at the same few ips over and over, and each (pid, tid, cpu,
+// bucket, ip, path, event), in a given state of the address spaces, is
+// only translated once, and located and counted once for all its samples,
+// when PROG_GATHER are gathered, and before prog_kernel() or prog_sync();
+// calls is how many samples were given (see diag_n())
+#define PROG_GATHER_BITS	16
+#define PROG_GATHER		((size_t)1 << PROG_GATHER_BITS)
+
+struct pgather {
+	uint64_t pid, tid, cpu, bucket, ip, space;
+	int path, ev;
+	
+	// whether the dso has (or will have) insns; if so, the file offset,
+	// and what did not translate (-1: nothing, else a DIAG_SAMPLE_*, in
+	// the range of path check)
+	int live;
+	uint64_t foffs;
+	int miss, check;
+	
+	char *sym;
+	uint64_t offs;
+	uint64_t calls, n, period;
+	
+	// hash slot
+	size_t slot;
 };
 
 struct prog {
 	struct dso *dso;
 	size_t ndso;
 	
+	// interned dso paths: a dense path id each; paths with the same
+	// build-id (the same binary, e.g. in several containers) share the
+	// dso of the first one, by build-id; path_last is the last interned
+	// (-1: none)
+	struct map path_id;
+	struct ppath *path;
+	size_t npath;
+	int path_last;
+	struct map build_id;
+	
+	// background loads, per dso, how many are under way, and how many
+	// samples wait for them
+	struct loader loader;
+	struct pload *load;
+	size_t nload;
+	size_t loading;
+	size_t waiting;
+	
+	// what waits for them: symbols of the samples, then branches and
+	// call chains, from the first not replayed yet (bwait0, cwait0)
+	struct map wait_sym;
+	struct pbwait *bwait;
+	size_t nbwait, bwait0;
+	struct pcwait *cwait;
+	size_t ncwait, cwait0;
+	struct pfwait *fwait;
+	size_t nfwait;
+	struct plocate *locate;
+	size_t nlocate;
+	
+	// samples gathered, in order, and their hash slots (entry + 1, 0 if
+	// empty), twice as many as PROG_GATHER; space counts the changes to
+	// the address spaces
+	struct pgather *gather;
+	size_t ngather;
+	size_t *gather_slot;
+	size_t ngather_slot;
+	uint64_t space;
+	
+	// dsos excluded by the filter are not disassembled (NULL: none)
+	struct filter *filter;
+	
+	// every mmap seen, in trace order
 	struct pmmap *pmap;
 	size_t npmap;
 	
+	// live processes, sorted by pid; task_last is the last one found
+	struct ptask *task;
+	size_t ntask;
+	size_t task_last;
+	
+	// mappings newer than a task's index, see prog_index()
+	size_t *newer;
+	size_t nnewer;
+	
 	struct obstack strings;
+	
+	// prog_branch_batch() scratch
+	struct pend *end;
+	size_t nend;
+	struct pend **order;
+	size_t norder;
+	
+	// call chains of the samples of event 0
+	struct callgraph cg;
+	struct cg_frame *frame;
+	size_t nframe;
+	
+	// kernel symbols (NULL: kernel samples stay unspecified), and the
+	// kernel samples that wait for prog_kernel()
+	struct kernel *kernel;
+	struct tally *kernel_wait;
+	
+	// timeline: samples of event 0 are counted in buckets of bucket ns
+	// (0: none) from time0 (PROG_TIME_NONE: from the first sample)
+	uint64_t bucket;
+	uint64_t time0;
 
 	size_t insn;
 	
+	// sampled events; event 0 is the one counted as samples, and
+	// matches its name with any ':modifier' suffix
+	char *event[PROG_EVENTS];
+	size_t nevent;
+	uint64_t event_samples[PROG_EVENTS];
+	uint64_t event_period[PROG_EVENTS];
+	int event_overflow;
+	
 	uint64_t samples, unspec, orphans;
 	uint64_t branch_samples, branch_unspec, branch_orphans;
 };
 
-void prog_init(struct prog *p);
+int  prog_init(struct prog *p);
 void prog_clear(struct prog *p);
 
 
+// path id of a dso path (truncated as dso paths are), -1 on error
+int prog_intern(struct prog *p, char *dso_path);
+
 int prog_lookup(struct prog *p, char *dso_path);
-int prog_load(struct prog *p, char *dso_path);
+
+// new dso, disassembled in the background if it can be; or the dso of
+// another path with the same build-id
+int prog_load(struct prog *p, char *dso_path, int disassemble);
+
+// resolves the samples gathered, waits for the background loads, and
+// replays what waited for them; to be called at the end of the trace, or
+// before a live snapshot
+int prog_sync(struct prog *p);
 
 int prog_mmap(struct prog *p, uint64_t pid, uint64_t start, uint64_t length,
 	char *dso_path, uint64_t offset);
 int prog_translate(struct prog *p, uint64_t pid, uint64_t ip,
 	char **dso_r, uint64_t *foffs_r);
 
-int prog_sample(struct prog *p, uint64_t pid, uint64_t ip,
-	char *dso_path, char *sym, uint64_t offs);
+// same, with the path id of the mapping's dso
+int prog_translate_path(struct prog *p, uint64_t pid, uint64_t ip,
+	int *path_r, uint64_t *foffs_r);
+
+// task events (perf script --show-task-events)
+int  prog_fork(struct prog *p, uint64_t ppid, uint64_t pid);
+void prog_exec(struct prog *p, uint64_t pid);
+void prog_exit(struct prog *p, uint64_t pid);
+
+// forget all mappings and processes
+void prog_unmap(struct prog *p);
+
+// kernel samples are only counted once the hot kernel code is known,
+// from the samples so far; to be called at the end of the trace (not in
+// live mode, where kernel samples are left unresolved)
+int prog_kernel(struct prog *p);
 
+int prog_event(struct prog *p, char *name);
+int prog_event_primary(const char *primary, const char *name);
+
+// timeline bucket of a sample time, DSO_BUCKET_NONE without a timeline
+uint64_t prog_bucket(struct prog *p, uint64_t time);
+
+// n samples of event ev, period being their total; tid and cpu may be
+// DSO_TASK_NONE, bucket DSO_BUCKET_NONE, and mem NULL (see dso_hit_foffs());
+// path is the path id of dso_path, -1 if the reader does not have it
+int prog_sample(struct prog *p, uint64_t pid, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, uint64_t ip, char *dso_path, int path, char *sym,
+	uint64_t offs, int ev, uint64_t n, uint64_t period,
+	const struct dso_mem *mem);
+
+// n branches alike, their dsos given as path ids
 int prog_branch(struct prog *p, uint64_t pid,
-	uint64_t pre_ip, char *pre_dso,
-	uint64_t src_ip, char *src_dso,
-	uint64_t dst_ip, char *dst_dso,
-	int miss, uint64_t cycles);
+	uint64_t pre_ip, int pre_path,
+	uint64_t src_ip, int src_path,
+	uint64_t dst_ip, int dst_path,
+	int miss, uint64_t cycles, uint64_t n);
+int prog_branch_batch(struct prog *p, uint64_t pid,
+	struct pbranch *br, size_t nbr, uint64_t n);
+
+// n samples of the chain of return addresses ip[], the sampled ip first
+int prog_callchain(struct prog *p, uint64_t pid,
+	const uint64_t *ip, size_t nip, uint64_t n);
 
 
 #endif
@@ -0,0 +1,181 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include "message.h"
+#include "mem.h"
+#include "reader.h"
+
+// ************************************************************************
+// 
+// ************************************************************************
+int reader_open(struct reader *r, int fd)
+{
+	r->fd = fd;
+	r->eof = 0;
+	r->begin = 0;
+	r->scan = 0;
+	r->end = 0;
+	
+	MEM_INIT(r->buff, r->size);
+	
+	if (MEM_RESIZE(r->buff, r->size, READER_SIZE))
+		return -1;
+	
+	memset(r->buff, 0, 1 + TOKEN_PAD);
+	
+	return 0;
+}
+
+void reader_close(struct reader *r)
+{
+	MEM_CLEAR(r->buff, r->size);
+	
+	close(r->fd);
+	r->fd = -1;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int reader_fill(struct reader *r)
+{
+	// move the partial line to the front
+	if (r->begin > 0) {
+		size_t n = r->end - r->begin;
+		
+		memmove(r->buff, r->buff + r->begin, n);
+		r->scan -= r->begin;
+		r->end = n;
+		r->begin = 0;
+	}
+	
+	// keep one byte for the terminating NUL of a last, unterminated line,
+	// and the padding after it
+	if (r->end + 1 + TOKEN_PAD >= r->size) {
+		if (MEM_RESIZE(r->buff, r->size, 2 * r->size))
+			return -1;
+	}
+	
+	while (1) {
+		ssize_t n = read(r->fd, r->buff + r->end,
+			r->size - r->end - 1 - TOKEN_PAD);
+		
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			ERROR("read(): %s\n", strerror(errno));
+			return -1;
+		}
+		
+		if (n == 0)
+			r->eof = 1;
+		
+		r->end += n;
+		memset(r->buff + r->end, 0, 1 + TOKEN_PAD);
+		return 0;
+	}
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int reader_peek(struct reader *r, size_t n, char **data, size_t *len)
+{
+	while ((r->end - r->begin < n) && !r->eof) {
+		if (reader_fill(r))
+			return -1;
+	}
+	
+	*data = r->buff + r->begin;
+	*len = r->end - r->begin;
+	
+	return 0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int reader_wait(struct reader *r, int timeout)
+{
+	while (!r->eof) {
+		if (memchr(r->buff + r->scan, '\n', r->end - r->scan))
+			return 1;
+		
+		r->scan = r->end;
+		
+		struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+		int n = poll(&pfd, 1, timeout);
+		
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		
+		if (n < 0) {
+			ERROR("poll(): %s\n", strerror(errno));
+			return -1;
+		}
+		
+		if (n == 0)
+			return 0;
+		
+		if (reader_fill(r))
+			return -1;
+	}
+	
+	return 1;
+}
+
+// ************************************************************************
+// Returns 1 and a line, 0 at the end of the stream, or -1 on error.
+// ************************************************************************
+int reader_line(struct reader *r, char **line, size_t *len)
+{
+	while (1) {
+		char *s = r->buff + r->begin;
+		char *nl = memchr(r->buff + r->scan, '\n', r->end - r->scan);
+		
+		if (nl) {
+			*nl = 0;
+			*line = s;
+			*len = nl - s;
+			
+			r->begin = nl + 1 - r->buff;
+			r->scan = r->begin;
+			return 1;
+		}
+		
+		r->scan = r->end;
+		
+		if (r->eof) {
+			if (r->begin == r->end)
+				return 0;
+			
+			r->buff[r->end] = 0;
+			*line = s;
+			*len = r->end - r->begin;
+			
+			r->begin = r->end;
+			return 1;
+		}
+		
+		if (reader_fill(r))
+			return -1;
+	}
+}
@@ -0,0 +1,56 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef READER_H
+#define READER_H
+#include <stddef.h>
+#include "token.h"
+
+// ************************************************************************
+// Line reader over a file descriptor. Data is read() in large blocks into
+// a single buffer, and lines are handed out in place, NUL-terminated
+// (instead of the '\n'), with their length, and followed by at least
+// TOKEN_PAD bytes (for hexparse_padded() and decparse_padded()). A line is
+// valid until the next call to reader_line(). The buffer grows to fit
+// lines longer than itself.
+// ************************************************************************
+#define READER_SIZE	((size_t)1 << 20)
+
+struct reader {
+	int fd;
+	int eof;
+	
+	char *buff;
+	size_t size;
+	
+	// unconsumed data is [begin, end), and has no '\n' before scan
+	size_t begin, scan, end;
+};
+
+int  reader_open(struct reader *r, int fd);
+void reader_close(struct reader *r);
+
+int  reader_line(struct reader *r, char **line, size_t *len);
+
+// 1 once reader_line() would not block, 0 if that takes more than timeout
+// ms (-1: no limit), -1 on error
+int  reader_wait(struct reader *r, int timeout);
+
+// buffer at least n bytes (unless the stream is shorter), without
+// consuming them: *data, *len are the unconsumed data
+int  reader_peek(struct reader *r, size_t n, char **data, size_t *len);
+
+#endif
@@ -1,7 +1,10 @@
-.PHONY: all
+.PHONY: all check
 
 all: $(EXEC)
 
+check: $(CHECKS)
+	@for c in $(CHECKS); do ./$$c || exit 1; done
+
 $(OBJS): $(BUILDDIR)/%.o : %.c Makefile rules.mk
 	@mkdir -p $(@D)
 	$(CC) $(CFLAGS) -c -o $(@) $(<)
@@ -11,7 +14,16 @@ $(DEPS): $(DEPSDIR)/%.d : %.c Makefile rules.mk
 	-$(CC) $(CFLAGS) -MM -MP -MG -MT "$(@) $(<:%.c=$(BUILDDIR)/%.o)" $(<) > $(@)
 
 $(EXEC): $(OBJS)
-	$(CC) $(CFLAGS) -o $(@) $(^)
+	$(CC) $(CFLAGS) -o $(@) $(^) $(LDLIBS)
+
+$(BUILDDIR)/token_check: test/token_check.c token.c token.h
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) -o $(@) $(<)
+
+$(BUILDDIR)/perfdata_check: test/perfdata_check.c \
+		$(filter-out $(BUILDDIR)/main.o,$(OBJS))
+	@mkdir -p $(@D)
+	$(CC) $(CFLAGS) -o $(@) $(^) $(LDLIBS)
 
 $(GENHBIN): %: %.c
 	$(CC) $(CFLAGS) -o $(@) $(<)
@@ -20,7 +20,9 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include "message.h"
+#include "mem.h"
 #include "pipe.h"
 #include "prog.h"
 #include "meta.h"
@@ -44,6 +46,22 @@ int sout_open(struct sout *f, char *path)
 	return 0;
 }
 
+// written to a buffer, available in *text and *size after sout_close()
+int sout_memory(struct sout *f, char **text, size_t *size)
+{
+	f->file = open_memstream(text, size);
+
+	if (!f->file) {
+		ERROR("open_memstream(): %s\n", strerror(errno));
+		return -1;
+	}
+	
+	f->written = 0;
+	f->flags = SOUT_CLOSE;
+	
+	return 0;
+}
+
 void sout_stdout(struct sout *f)
 {
 	f->file = stdout;
@@ -177,7 +195,62 @@ int serialize_const(struct sout *f)
 // ************************************************************************
 // 
 // ************************************************************************
-static void serialize_insn(struct sout *f, struct dso *dso)
+static int serialize_has_ev(uint64_t **col, size_t i, size_t nevent)
+{
+	for (size_t e = 0; e < nevent; e++) {
+		if (col[e] && col[e][i])
+			return 1;
+	}
+	
+	return 0;
+}
+
+// per-event period totals, in prog.event order
+static void serialize_ev(struct sout *f, uint64_t **col, size_t i,
+	size_t nevent)
+{
+	ser(f, " ev: [");
+	for (size_t e = 0; e < nevent; e++)
+		ser(f, " %ld,", (col[e]) ? col[e][i] : 0);
+	ser(f, " ],");
+}
+
+// data accesses: samples, latency weight, samples by memory level (in
+// DSO_MEM_* order), and cache lines [ address, samples ], most touched first
+static void serialize_mem(struct sout *f, struct insn_mem *im)
+{
+	int order[DSO_MEM_LINES];
+	int n = 0;
+	
+	for (int k = 0; (k < DSO_MEM_LINES) && im->line_count[k]; k++) {
+		int j = n++;
+		
+		while ((j > 0) && (im->line_count[order[j - 1]]
+				< im->line_count[k])) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		
+		order[j] = k;
+	}
+	
+	ser(f, "       mem: { samples: %ld, weight: %ld,",
+		im->samples, im->weight);
+	ser(f, " level: [");
+	for (int l = 0; l < DSO_MEM_LEVELS; l++)
+		ser(f, " %ld,", im->level[l]);
+	ser(f, " ], line: [");
+	for (int j = 0; j < n; j++)
+		ser(f, " [ 0x%lx, %ld ],",
+			im->line[order[j]] * DSO_MEM_LINE,
+			im->line_count[order[j]]);
+	ser(f, " ] },\n");
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static void serialize_insn(struct sout *f, struct dso *dso, size_t nevent)
 {
 	ser(f, "   ninsn: %zd,\n", dso->ninsn);
 	ser(f, "   block: [\n");
@@ -217,10 +290,18 @@ static void serialize_insn(struct sout *f, struct dso *dso)
 		ser(f, "       disasm: \"%s\",\n", escape(in->disasm));
 		ser(f, "       target_insn: %ld,", in->target_insn);
 		ser(f, " hits: %ld,", in->hits);
+		if (serialize_has_ev(dso->insn_ev, i, nevent))
+			serialize_ev(f, dso->insn_ev, i, nevent);
 		ser(f, " flags: 0x%lx,\n", in->flags);
 		ser(f, "       branches: %ld,", in->branches);
 		ser(f, " misses: %ld,", in->misses);
 		ser(f, " throughs: %ld,\n", in->throughs);
+		
+		struct insn_mem *im = dso_mem(dso, i);
+		
+		if (im)
+			serialize_mem(f, im);
+		
 		ser(f, "       span: [\n");
 		for (int j = 0; j < INSN_SPANS; j++) {
 			if (in->span[j].cycles == 0)
@@ -249,8 +330,11 @@ static void serialize_insn(struct sout *f, struct dso *dso)
 // ************************************************************************
 // 
 // ************************************************************************
-static void serialize_sym(struct sout *f, struct symbol *sym)
+static void serialize_sym(struct sout *f, struct dso *dso, size_t i,
+	size_t nevent)
 {
+	struct symbol *sym = &dso->sym[i];
+	
 	ser(f, "    {");
 	ser(f, " name: \"%s\",", escape(sym->name));
 	ser(f, " foffs: 0x%lx,", sym->foffs);
@@ -258,16 +342,22 @@ static void serialize_sym(struct sout *f, struct symbol *sym)
 	ser(f, " insn: %ld,", sym->insn);
 	ser(f, " hits: %ld,", sym->hits);
 	ser(f, " multiple: %d,", sym->multiple);
+	serialize_ev(f, dso->sym_ev, i, nevent);
 	ser(f, " },\n");
 }
 
 // ************************************************************************
 // 
 // ************************************************************************
-static void serialize_func(struct sout *f, struct source_func *func)
+static void serialize_func(struct sout *f, struct dso *dso, size_t i,
+	size_t nevent)
 {
-	ser(f, "    { hits: %ld, name: \"%s\" },\n",
+	struct source_func *func = &dso->func[i];
+	
+	ser(f, "    { hits: %ld, name: \"%s\",",
 		func->hits, escape(func->name));
+	serialize_ev(f, dso->func_ev, i, nevent);
+	ser(f, " },\n");
 }
 
 // ************************************************************************
@@ -331,11 +421,17 @@ static int serialize_file_contents(struct sout *outf, char *path)
 // ************************************************************************
 // 
 // ************************************************************************
-static void serialize_file(struct sout *f, struct source_file *file)
+static void serialize_file(struct sout *f, struct dso *dso, size_t i,
+	size_t nevent)
 {
+	struct source_file *file = &dso->file[i];
+	
 	ser(f, "    {\n");
 	ser(f, "     name: \"%s\",\n", escape(file->name));
 	ser(f, "     hits: %ld,\n", file->hits);
+	ser(f, "    ");
+	serialize_ev(f, dso->file_ev, i, nevent);
+	ser(f, "\n");
 	ser(f, "     flags: 0x%lx,\n", file->flags);
 	ser(f, "     line: [\n");
 	ser(f, "      null,\n");
@@ -349,24 +445,28 @@ static void serialize_file(struct sout *f, struct source_file *file)
 // ************************************************************************
 // 
 // ************************************************************************
-static void serialize_dso(struct sout *f, struct dso *dso)
+static void serialize_dso(struct sout *f, struct dso *dso, size_t nevent)
 {
 	ser(f, "  {\n");
 	ser(f, "   path: \"%s\",\n", escape(dso->path));
-	serialize_insn(f, dso);
+	serialize_insn(f, dso, nevent);
 	ser(f, "   sym: [\n");
 	for (size_t i = 0; i < dso->nsym; i++)
-		serialize_sym(f, &dso->sym[i]);
+		serialize_sym(f, dso, i, nevent);
 	ser(f, "   ],\n");
 	ser(f, "   func: [\n");
 	for (size_t i = 0; i < dso->nfunc; i++)
-		serialize_func(f, &dso->func[i]);
+		serialize_func(f, dso, i, nevent);
 	ser(f, "   ],\n");
 	ser(f, "   file: [\n");
 	for (size_t i = 0; i < dso->nfile; i++)
-		serialize_file(f, &dso->file[i]);
+		serialize_file(f, dso, i, nevent);
 	ser(f, "   ],\n");
 	ser(f, "   samples: %ld,\n", dso->samples);
+	ser(f, "   period: [");
+	for (size_t e = 0; e < nevent; e++)
+		ser(f, " %ld,", dso->period[e]);
+	ser(f, " ],\n");
 	ser(f, "   unspec: %ld,\n", dso->unspec);
 	ser(f, "   orphans: %ld,\n", dso->orphans);
 	ser(f, "  },\n");
@@ -389,13 +489,83 @@ static void serialize_pmap(struct sout *f, struct pmmap *m)
 // ************************************************************************
 // 
 // ************************************************************************
-int serialize_prog(struct sout *f, struct prog *p)
+void scache_init(struct scache *c)
+{
+	MEM_INIT(c->dso, c->ndso);
+}
+
+void scache_clear(struct scache *c)
+{
+	for (size_t t = 0; t < c->ndso; t++)
+		free(c->dso[t].text);
+	
+	MEM_CLEAR(c->dso, c->ndso);
+}
+
+static int serialize_dso_cached(struct sout *f, struct prog *p, size_t t,
+	struct scache *c, uint64_t gen)
+{
+	if (t >= c->ndso) {
+		size_t n0 = c->ndso;
+		
+		if (MEM_RESIZE(c->dso, c->ndso, t + 1))
+			return -1;
+		
+		for (size_t k = n0; k <= t; k++) {
+			c->dso[k].gen = 0;
+			c->dso[k].nevent = 0;
+			c->dso[k].text = NULL;
+			c->dso[k].size = 0;
+		}
+	}
+	
+	struct scache_dso *cd = &c->dso[t];
+	
+	if ((cd->text == NULL) || (cd->gen != gen)
+	||  (cd->nevent != p->nevent)) {
+		struct sout mf;
+		
+		free(cd->text);
+		cd->text = NULL;
+		
+		if (sout_memory(&mf, &cd->text, &cd->size))
+			return -1;
+		
+		serialize_dso(&mf, &p->dso[t], p->nevent);
+		
+		int r = sout_error(&mf);
+		r |= sout_close(&mf);
+		
+		if (r) {
+			free(cd->text);
+			cd->text = NULL;
+			return -1;
+		}
+		
+		cd->gen = gen;
+		cd->nevent = p->nevent;
+	}
+	
+	return sout_write(f, cd->text, cd->size);
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int serialize_prog(struct sout *f, struct prog *p,
+	struct scache *c, const uint64_t *gen)
 {
+	int r = 0;
+	
 	ser(f, "var prog = {\n");
 	
 	ser(f, " dso: [\n");
-	for (size_t t = 0; t < p->ndso; t++)
-		serialize_dso(f, &p->dso[t]);
+	for (size_t t = 0; t < p->ndso; t++) {
+		if (c)
+			r |= serialize_dso_cached(f, p, t, c, gen[t]);
+		else
+			serialize_dso(f, &p->dso[t], p->nevent);
+	}
 	ser(f, " ],\n");
 
 	ser(f, " pmap: [\n");
@@ -410,24 +580,106 @@ int serialize_prog(struct sout *f, struct prog *p)
 	ser(f, " branch_samples: %ld,\n", p->branch_samples);
 	ser(f, " branch_unspec: %ld,\n", p->branch_unspec);
 	ser(f, " branch_orphans: %ld,\n", p->branch_orphans);
+	ser(f, " event: [\n");
+	for (size_t e = 0; e < p->nevent; e++)
+		ser(f, "  { name: \"%s\", samples: %ld, period: %ld },\n",
+			escape(p->event[e]), p->event_samples[e],
+			p->event_period[e]);
+	ser(f, " ],\n");
 	ser(f, "};\n");
 	
-	return sout_error(f);
+	return r | sout_error(f);
 }
 
 // ************************************************************************
 // 
 // ************************************************************************
-static void serialize_hot(struct sout *f, struct hotspot *hot)
+static void serialize_meta_ev(struct sout *f, uint64_t *ev, size_t nevent)
+{
+	ser(f, " ev: [");
+	for (size_t e = 0; e < nevent; e++)
+		ser(f, " %ld,", ev[e]);
+	ser(f, " ],");
+}
+
+// inclusive count, and [ dso, insn, sym, foffs, count ] per call site
+static void serialize_callers(struct sout *f, uint64_t incl,
+	struct caller *c)
+{
+	ser(f, "\n    incl: %ld, callers: [", incl);
+	for (int k = 0; (k < META_CALLERS) && c[k].count; k++)
+		ser(f, " [ %ld, %ld, %ld, 0x%lx, %ld ],", c[k].dso,
+			c[k].insn, c[k].sym, c[k].foffs, c[k].count);
+	ser(f, " ],");
+}
+
+static void serialize_spread(struct sout *f, char *name, struct spread *sp)
+{
+	ser(f, "\n    %s: [ %ld,", name, sp->n);
+	for (int k = 0; (k < META_SHARES) && sp->top[k].count; k++)
+		ser(f, " [ %ld, %ld ],", sp->top[k].id, sp->top[k].count);
+	ser(f, " ],");
+}
+
+// non-empty buckets, delta-encoded: [ bucket gap, count, ... ]
+static void serialize_ticks(struct sout *f, struct meta *m,
+	size_t tick0, size_t ntick)
 {
-	ser(f, "  { dso: %ld, i0: %ld, i1: %ld, ic: %ld, hits: %ld },\n",
+	uint64_t b = 0;
+	
+	ser(f, "\n    time: [");
+	for (size_t k = tick0; k < tick0 + ntick; k++) {
+		ser(f, " %ld, %ld,", m->tick[k].bucket - b, m->tick[k].count);
+		b = m->tick[k].bucket;
+	}
+	ser(f, " ],");
+}
+
+static void serialize_hot(struct sout *f, struct meta *m, struct hotspot *hot)
+{
+	ser(f, "  { dso: %ld, i0: %ld, i1: %ld, ic: %ld, hits: %ld,",
 		hot->dso, hot->i0, hot->i1, hot->ic, hot->hits);
+	if (m->sample_rate < 1.0)
+		ser(f, " est: %ld, err: %ld,", hot->est, hot->err);
+	serialize_meta_ev(f, hot->ev, m->nevent);
+	if (m->callgraph)
+		serialize_callers(f, hot->incl, hot->caller);
+	if (m->tid)
+		serialize_spread(f, "tid", &hot->tid);
+	if (m->cpu)
+		serialize_spread(f, "cpu", &hot->cpu);
+	if (m->bucket)
+		serialize_ticks(f, m, hot->tick0, hot->ntick);
+	ser(f, " },\n");
 }
 
-static void serialize_topref(struct sout *f, struct topref *tr)
+// symbols also have their call graph and timeline
+static void serialize_topref(struct sout *f, struct meta *m, struct topref *tr,
+	int sym)
 {
-	ser(f, "  { dso: %ld, idx: %ld, hits: %ld },\n",
+	ser(f, "  { dso: %ld, idx: %ld, hits: %ld,",
 		tr->dso, tr->idx, tr->hits);
+	serialize_meta_ev(f, tr->ev, m->nevent);
+	if (sym && m->callgraph)
+		serialize_callers(f, tr->incl, tr->caller);
+	if (sym && m->bucket)
+		serialize_ticks(f, m, tr->tick0, tr->ntick);
+	ser(f, " },\n");
+}
+
+// any sample, of any event (or in call chains)
+static int serialize_topref_any(struct topref *tr, size_t nevent,
+	int callgraph)
+{
+	if (tr->hits || (callgraph && tr->incl))
+		return 1;
+	
+	for (size_t e = 0; e < nevent; e++) {
+		if (tr->ev[e])
+			return 1;
+	}
+	
+	return 0;
 }
 
 // ************************************************************************
@@ -437,24 +689,30 @@ int serialize_meta(struct sout *f, struct meta *m)
 {
 	ser(f, "var meta = {\n");
 	
+	ser(f, " rate: %.9g,\n", m->sample_rate);
+	
+	ser(f, " callgraph: %d,\n", m->callgraph);
+	ser(f, " tid: %d,\n", m->tid);
+	ser(f, " cpu: %d,\n", m->cpu);
+	ser(f, " bucket: %.9g,\n", m->bucket / 1e6);
+	ser(f, " nbucket: %ld,\n", m->nbucket);
+	
 	ser(f, " hot: [\n");
 	for (size_t t = 0; t < m->nhot; t++)
-		serialize_hot(f, &m->hot[t]);
+		serialize_hot(f, m, &m->hot[t]);
 	ser(f, " ],\n");
 	
 	ser(f, " sym: [\n");
 	for (size_t t = 0; t < m->nsym; t++) {
-		if (m->sym[t].hits == 0)
-			break;
-		serialize_topref(f, &m->sym[t]);
+		if (serialize_topref_any(&m->sym[t], m->nevent, m->callgraph))
+			serialize_topref(f, m, &m->sym[t], 1);
 	}
 	ser(f, " ],\n");
 	
 	ser(f, " func: [\n");
 	for (size_t t = 0; t < m->nfunc; t++) {
-		if (m->func[t].hits == 0)
-			break;
-		serialize_topref(f, &m->func[t]);
+		if (serialize_topref_any(&m->func[t], m->nevent, 0))
+			serialize_topref(f, m, &m->func[t], 0);
 	}
 	ser(f, " ],\n");
 
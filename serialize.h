@@ -18,6 +18,7 @@
 #define SERIALIZE_H
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "prog.h"
 #include "meta.h"
 
@@ -30,6 +31,7 @@ struct sout {
 };
 
 int sout_open(struct sout *f, char *path);
+int sout_memory(struct sout *f, char **text, size_t *size);
 void sout_stdout(struct sout *f);
 int sout_close(struct sout *f);
 
@@ -42,8 +44,28 @@ int vser(struct sout *f, const char *format, va_list ap);
 __attribute__ ((format (printf, 2, 3)))
 int ser(struct sout *f, const char *format, ...);
 
+// ************************************************************************
+// Serialized dsos, kept across the snapshots of live mode. A dso is
+// written again only when its meta generation has changed.
+// ************************************************************************
+struct scache_dso {
+	uint64_t gen;
+	size_t nevent;
+	char *text;
+	size_t size;
+};
+
+struct scache {
+	struct scache_dso *dso;
+	size_t ndso;
+};
+
+void scache_init(struct scache *c);
+void scache_clear(struct scache *c);
+
 int serialize_const(struct sout *f);
-int serialize_prog(struct sout *f, struct prog *p);
+int serialize_prog(struct sout *f, struct prog *p,
+	struct scache *c, const uint64_t *gen);
 int serialize_meta(struct sout *f, struct meta *m);
 
 #endif
@@ -0,0 +1,117 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "message.h"
+#include "sparse.h"
+
+// ************************************************************************
+// 
+// ************************************************************************
+#define SPARSE_SLOTS_MIN	64
+
+void sparse_init(struct sparse *s)
+{
+	s->slot = NULL;
+	s->nslot = 0;
+	s->n = 0;
+}
+
+void sparse_clear(struct sparse *s)
+{
+	free(s->slot);
+	sparse_init(s);
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static inline size_t sparse_hash(uint64_t key, size_t mask)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccd;
+	key ^= key >> 33;
+	
+	return key & mask;
+}
+
+static int sparse_rehash(struct sparse *s)
+{
+	size_t n = (s->nslot) ? 2 * s->nslot : SPARSE_SLOTS_MIN;
+	struct sparse_slot *slot = calloc(n, sizeof(struct sparse_slot));
+	
+	if (slot == NULL) {
+		ERROR("calloc(%zd slots): %s\n", n, strerror(errno));
+		return -1;
+	}
+	
+	for (size_t k = 0; k < s->nslot; k++) {
+		if (s->slot[k].count == 0)
+			continue;
+		
+		size_t j = sparse_hash(s->slot[k].key, n - 1);
+		
+		while (slot[j].count)
+			j = (j + 1) & (n - 1);
+		
+		slot[j] = s->slot[k];
+	}
+	
+	free(s->slot);
+	s->slot = slot;
+	s->nslot = n;
+	
+	return 0;
+}
+
+int sparse_add(struct sparse *s, uint64_t key, uint64_t n)
+{
+	if (2 * (s->n + 1) > s->nslot) {
+		if (sparse_rehash(s))
+			return -1;
+	}
+	
+	size_t mask = s->nslot - 1;
+	size_t j = sparse_hash(key, mask);
+	
+	while (s->slot[j].count && (s->slot[j].key != key))
+		j = (j + 1) & mask;
+	
+	if (s->slot[j].count == 0) {
+		s->slot[j].key = key;
+		s->n++;
+	}
+	
+	s->slot[j].count += n;
+	
+	return 0;
+}
+
+uint64_t sparse_get(const struct sparse *s, uint64_t key)
+{
+	if (s->n == 0)
+		return 0;
+	
+	size_t mask = s->nslot - 1;
+	size_t j = sparse_hash(key, mask);
+	
+	while (s->slot[j].count && (s->slot[j].key != key))
+		j = (j + 1) & mask;
+	
+	return s->slot[j].count;
+}
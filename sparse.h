@@ -0,0 +1,47 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SPARSE_H
+#define SPARSE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// ************************************************************************
+// Sparse counts, keyed by integers: an open addressing hash table that
+// grows with the number of distinct keys. Slots with a zero count are
+// empty; iterate over slot[0 .. nslot - 1], skipping those.
+// ************************************************************************
+struct sparse_slot {
+	uint64_t key;
+	uint64_t count;
+};
+
+struct sparse {
+	struct sparse_slot *slot;
+	size_t nslot;
+	size_t n;
+};
+
+void sparse_init(struct sparse *s);
+void sparse_clear(struct sparse *s);
+
+// add n (> 0) to the count of key
+int  sparse_add(struct sparse *s, uint64_t key, uint64_t n);
+
+// count of key, 0 if none
+uint64_t sparse_get(const struct sparse *s, uint64_t key);
+
+#endif
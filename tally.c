@@ -0,0 +1,669 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "message.h"
+#include "mem.h"
+#include "map.h"
+#include "prog.h"
+#include "tally.h"
+
+// ************************************************************************
+//
+// ************************************************************************
+int tally_init(struct tally *t)
+{
+	t->primary = "cycles";
+	t->prog = NULL;
+	
+	MEM_INIT(t->path, t->npath);
+	MEM_INIT(t->sample, t->nsample);
+	MEM_INIT(t->branch, t->nbranch);
+	MEM_INIT(t->mmap, t->nmmap);
+	MEM_INIT(t->chain, t->nchain);
+	MEM_INIT(t->chain_ip, t->nchain_ip);
+	MEM_INIT(t->key, t->nkey);
+
+	int r = 0;
+	r |= map_init(&t->strings);
+	r |= map_init(&t->path_id);
+	r |= map_init(&t->sample_id);
+	r |= map_init(&t->branch_id);
+	r |= map_init(&t->chain_id);
+
+	return r;
+}
+
+void tally_clear(struct tally *t)
+{
+	MEM_CLEAR(t->path, t->npath);
+	MEM_CLEAR(t->sample, t->nsample);
+	MEM_CLEAR(t->branch, t->nbranch);
+	MEM_CLEAR(t->mmap, t->nmmap);
+	MEM_CLEAR(t->chain, t->nchain);
+	MEM_CLEAR(t->chain_ip, t->nchain_ip);
+	MEM_CLEAR(t->key, t->nkey);
+
+	map_clear(&t->strings);
+	map_clear(&t->path_id);
+	map_clear(&t->sample_id);
+	map_clear(&t->branch_id);
+	map_clear(&t->chain_id);
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+static char *tally_string(struct tally *t, char *s)
+{
+	if (s == NULL)
+		return NULL;
+
+	char *store;
+
+	if (map_tool(&t->strings, s, 0, &store, NULL, NULL,
+			MAP_INSERT | MAP_STORE))
+		return NULL;
+
+	return store;
+}
+
+// path id of a dso path, -1 on error
+static int tally_path(struct tally *t, char *path)
+{
+	char *store;
+	uint64_t k;
+	int found;
+
+	if (map_tool(&t->path_id, path, t->npath, &store, &k, &found,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+
+	if (found)
+		return k;
+
+	k = t->npath;
+
+	if (MEM_RESIZE(t->path, t->npath, k + 1))
+		return -1;
+
+	t->path[k] = store;
+
+	return k;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int tally_mmap(struct tally *t, uint64_t time, uint64_t pid,
+	uint64_t start, uint64_t length, char *path, uint64_t offset)
+{
+	path = tally_string(t, path);
+
+	if (path == NULL)
+		return -1;
+
+	size_t k = t->nmmap;
+
+	if (MEM_RESIZE(t->mmap, t->nmmap, k + 1))
+		return -1;
+
+	struct tally_mmap *m = &t->mmap[k];
+
+	m->type = TALLY_MMAP;
+	m->time = time;
+	m->pid = pid;
+	m->start = start;
+	m->length = length;
+	m->path = path;
+	m->offset = offset;
+	m->ppid = 0;
+
+	return 0;
+}
+
+int tally_task(struct tally *t, int type, uint64_t time,
+	uint64_t ppid, uint64_t pid)
+{
+	size_t k = t->nmmap;
+
+	if (MEM_RESIZE(t->mmap, t->nmmap, k + 1))
+		return -1;
+
+	struct tally_mmap *m = &t->mmap[k];
+
+	m->type = type;
+	m->time = time;
+	m->pid = pid;
+	m->start = 0;
+	m->length = 0;
+	m->path = NULL;
+	m->offset = 0;
+	m->ppid = ppid;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int tally_sample(struct tally *t, uint64_t pid, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, uint64_t ip, char *dso, char *sym, uint64_t offs,
+	char *event, uint64_t count, uint64_t period,
+	const struct dso_mem *mem)
+{
+	int path = tally_path(t, dso);
+
+	event = tally_string(t, event);
+
+	if ((path < 0) || (event == NULL))
+		return -1;
+
+	if (sym) {
+		sym = tally_string(t, sym);
+
+		if (sym == NULL)
+			return -1;
+	}
+
+	// interned strings are compared by address
+	char key[256];
+
+	snprintf(key, sizeof(key), "%lx %lx %lx %lx %lx %d %p %lx %p",
+		pid, tid, cpu, bucket, ip, path, (void *)sym, offs,
+		(void *)event);
+
+	// and data accesses by cache line
+	if (mem) {
+		size_t len = strlen(key);
+
+		snprintf(key + len, sizeof(key) - len, " %lx %lx",
+			mem->addr / DSO_MEM_LINE, mem->data_src);
+	}
+
+	size_t k = t->nsample;
+	uint64_t k0;
+	int found;
+
+	if (map_tool(&t->sample_id, key, k, NULL, &k0, &found,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+
+	if (found) {
+		t->sample[k0].count += count;
+		t->sample[k0].period += period;
+
+		if (mem)
+			t->sample[k0].mem.weight += mem->weight;
+
+		return 0;
+	}
+
+	if (MEM_RESIZE(t->sample, t->nsample, k + 1))
+		return -1;
+
+	struct tally_sample *s = &t->sample[k];
+
+	s->pid = pid;
+	s->tid = tid;
+	s->cpu = cpu;
+	s->bucket = bucket;
+	s->ip = ip;
+	s->dso = path;
+	s->sym = sym;
+	s->offs = offs;
+	s->event = event;
+	s->count = count;
+	s->period = period;
+	s->has_mem = (mem != NULL);
+
+	if (mem) {
+		s->mem = *mem;
+		s->mem.addr -= mem->addr % DSO_MEM_LINE;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int tally_branch(struct tally *t, uint64_t pid,
+	uint64_t pre_ip, char *pre_dso,
+	uint64_t src_ip, char *src_dso,
+	uint64_t dst_ip, char *dst_dso,
+	int miss, uint64_t cycles)
+{
+	int pre = tally_path(t, pre_dso);
+	int src = tally_path(t, src_dso);
+	int dst = tally_path(t, dst_dso);
+
+	if ((pre < 0) || (src < 0) || (dst < 0))
+		return -1;
+
+	char key[192];
+
+	snprintf(key, sizeof(key), "%lx %lx %lx %lx %d %d %d %d",
+		pid, pre_ip, src_ip, dst_ip, pre, src, dst, miss != 0);
+
+	size_t k = t->nbranch;
+	uint64_t k0;
+	int found;
+
+	if (map_tool(&t->branch_id, key, k, NULL, &k0, &found,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+
+	if (found) {
+		t->branch[k0].count++;
+		t->branch[k0].cycles += cycles;
+		return 0;
+	}
+
+	if (MEM_RESIZE(t->branch, t->nbranch, k + 1))
+		return -1;
+
+	struct tally_branch *b = &t->branch[k];
+
+	b->pid = pid;
+	b->pre_ip = pre_ip;
+	b->src_ip = src_ip;
+	b->dst_ip = dst_ip;
+	b->pre_dso = pre;
+	b->src_dso = src;
+	b->dst_dso = dst;
+	b->miss = (miss != 0);
+	b->count = 1;
+	b->cycles = cycles;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int tally_chain(struct tally *t, uint64_t pid,
+	const uint64_t *ip, size_t nip)
+{
+	// "pid ip ip ...", at most 17 characters per number
+	if (MEM_RESIZE(t->key, t->nkey, 18 * (nip + 1) + 1))
+		return -1;
+
+	char *c = t->key;
+
+	c += sprintf(c, "%lx", pid);
+
+	for (size_t j = 0; j < nip; j++)
+		c += sprintf(c, " %lx", ip[j]);
+
+	size_t k = t->nchain;
+	uint64_t k0;
+	int found;
+
+	if (map_tool(&t->chain_id, t->key, k, NULL, &k0, &found,
+			MAP_INSERT | MAP_STORE))
+		return -1;
+
+	if (found) {
+		t->chain[k0].count++;
+		return 0;
+	}
+
+	size_t i0 = t->nchain_ip;
+
+	if (MEM_RESIZE(t->chain, t->nchain, k + 1)
+	||  MEM_RESIZE(t->chain_ip, t->nchain_ip, i0 + nip))
+		return -1;
+
+	memcpy(t->chain_ip + i0, ip, nip * sizeof(uint64_t));
+
+	t->chain[k].pid = pid;
+	t->chain[k].ip0 = i0;
+	t->chain[k].nip = nip;
+	t->chain[k].count = 1;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int tally_spaces(struct tally *t, struct prog *p, uint64_t w0, uint64_t w1)
+{
+	for (size_t i = 0; i < t->nmmap; i++) {
+		struct tally_mmap *m = &t->mmap[i];
+		int r = 0;
+
+		if ((m->time < w0) || (m->time >= w1))
+			continue;
+
+		if (m->type == TALLY_FORK)
+			r = prog_fork(p, m->ppid, m->pid);
+		else if (m->type == TALLY_EXEC)
+			prog_exec(p, m->pid);
+		else
+			r = prog_mmap(p, m->pid, m->start, m->length,
+				m->path, m->offset);
+
+		if (r)
+			return -1;
+	}
+
+	return 0;
+}
+
+int tally_replay(struct tally *t, struct prog *p)
+{
+	// path ids of the prog, by path id of the tally
+	int *id = malloc((t->npath + 1) * sizeof(int));
+
+	if (id == NULL)
+		return -1;
+
+	for (size_t k = 0; k < t->npath; k++) {
+		id[k] = prog_intern(p, t->path[k]);
+
+		if (id[k] < 0) {
+			free(id);
+			return -1;
+		}
+	}
+
+	int r = 0;
+
+	for (size_t k = 0; (r == 0) && (k < t->nsample); k++) {
+		struct tally_sample *s = &t->sample[k];
+
+		r = prog_sample(p, s->pid, s->tid, s->cpu, s->bucket,
+			s->ip, t->path[s->dso], id[s->dso], s->sym, s->offs,
+			prog_event(p, s->event), s->count, s->period,
+			(s->has_mem) ? &s->mem : NULL);
+	}
+
+	for (size_t k = 0; (r == 0) && (k < t->nbranch); k++) {
+		struct tally_branch *b = &t->branch[k];
+
+		r = prog_branch(p, b->pid,
+			b->pre_ip, id[b->pre_dso],
+			b->src_ip, id[b->src_dso],
+			b->dst_ip, id[b->dst_dso],
+			b->miss, b->cycles, b->count);
+	}
+
+	free(id);
+
+	if (r)
+		return -1;
+
+	for (size_t k = 0; k < t->nchain; k++) {
+		struct tally_chain *c = &t->chain[k];
+
+		if (prog_callchain(p, c->pid, t->chain_ip + c->ip0, c->nip,
+				c->count))
+			return -1;
+	}
+
+	return 0;
+}
+
+// ************************************************************************
+// Saved tallies: counts, then mmaps, samples, branches and chains, as
+// 64-bit words; strings are a length (TALLY_NULL: none) and their bytes
+// ************************************************************************
+#define TALLY_NULL		((uint64_t)-1)
+
+struct tally_in {
+	const uint8_t *b, *end;
+	int bad;
+};
+
+static int tally_put(uint8_t **buf, size_t *len, const void *src, size_t n)
+{
+	size_t k = *len;
+
+	if (MEM_RESIZE(*buf, *len, k + n))
+		return -1;
+
+	memcpy(*buf + k, src, n);
+
+	return 0;
+}
+
+static int tally_put64(uint8_t **buf, size_t *len, uint64_t v)
+{
+	return tally_put(buf, len, &v, sizeof(v));
+}
+
+static int tally_put_str(uint8_t **buf, size_t *len, const char *s)
+{
+	if (s == NULL)
+		return tally_put64(buf, len, TALLY_NULL);
+
+	size_t n = strlen(s);
+
+	return tally_put64(buf, len, n) || tally_put(buf, len, s, n);
+}
+
+static uint64_t tally_get64(struct tally_in *in)
+{
+	uint64_t v;
+
+	if (in->end - in->b < (ptrdiff_t)sizeof(v)) {
+		in->bad = 1;
+		return 0;
+	}
+
+	memcpy(&v, in->b, sizeof(v));
+	in->b += sizeof(v);
+
+	return v;
+}
+
+// interned, NULL if none (or on error, in->bad being set)
+static char *tally_get_str(struct tally *t, struct tally_in *in)
+{
+	uint64_t n = tally_get64(in);
+
+	if (in->bad || (n == TALLY_NULL))
+		return NULL;
+
+	if ((uint64_t)(in->end - in->b) < n) {
+		in->bad = 1;
+		return NULL;
+	}
+
+	if (MEM_RESIZE(t->key, t->nkey, n + 1)) {
+		in->bad = 1;
+		return NULL;
+	}
+
+	memcpy(t->key, in->b, n);
+	t->key[n] = 0;
+	in->b += n;
+
+	char *s = tally_string(t, t->key);
+
+	if (s == NULL)
+		in->bad = 1;
+
+	return s;
+}
+
+static int tally_get_path(struct tally *t, struct tally_in *in)
+{
+	char *s = tally_get_str(t, in);
+	int k = (s) ? tally_path(t, s) : -1;
+
+	if (k < 0)
+		in->bad = 1;
+
+	return k;
+}
+
+// ************************************************************************
+int tally_save(struct tally *t, uint8_t **buf, size_t *len)
+{
+	int r = 0;
+
+	r |= tally_put64(buf, len, t->nmmap);
+	r |= tally_put64(buf, len, t->nsample);
+	r |= tally_put64(buf, len, t->nbranch);
+	r |= tally_put64(buf, len, t->nchain);
+
+	for (size_t k = 0; (r == 0) && (k < t->nmmap); k++) {
+		struct tally_mmap *m = &t->mmap[k];
+		uint64_t w[] = { m->type, m->time, m->pid, m->start,
+			m->length, m->offset, m->ppid };
+
+		r |= tally_put(buf, len, w, sizeof(w));
+		r |= tally_put_str(buf, len, m->path);
+	}
+
+	for (size_t k = 0; (r == 0) && (k < t->nsample); k++) {
+		struct tally_sample *s = &t->sample[k];
+		uint64_t w[] = { s->pid, s->tid, s->cpu, s->bucket, s->ip,
+			s->offs, s->count, s->period, s->has_mem,
+			s->mem.addr, s->mem.data_src, s->mem.weight };
+
+		if (!s->has_mem)
+			w[9] = w[10] = w[11] = 0;
+
+		r |= tally_put(buf, len, w, sizeof(w));
+		r |= tally_put_str(buf, len, t->path[s->dso]);
+		r |= tally_put_str(buf, len, s->sym);
+		r |= tally_put_str(buf, len, s->event);
+	}
+
+	for (size_t k = 0; (r == 0) && (k < t->nbranch); k++) {
+		struct tally_branch *b = &t->branch[k];
+		uint64_t w[] = { b->pid, b->pre_ip, b->src_ip, b->dst_ip,
+			b->miss, b->count, b->cycles };
+
+		r |= tally_put(buf, len, w, sizeof(w));
+		r |= tally_put_str(buf, len, t->path[b->pre_dso]);
+		r |= tally_put_str(buf, len, t->path[b->src_dso]);
+		r |= tally_put_str(buf, len, t->path[b->dst_dso]);
+	}
+
+	for (size_t k = 0; (r == 0) && (k < t->nchain); k++) {
+		struct tally_chain *c = &t->chain[k];
+		uint64_t w[] = { c->pid, c->nip, c->count };
+
+		r |= tally_put(buf, len, w, sizeof(w));
+		r |= tally_put(buf, len, t->chain_ip + c->ip0,
+			c->nip * sizeof(uint64_t));
+	}
+
+	return r ? -1 : 0;
+}
+
+// ************************************************************************
+int tally_load(struct tally *t, const uint8_t *b, size_t len)
+{
+	struct tally_in in = { b, b + len, 0 };
+
+	uint64_t nmmap = tally_get64(&in);
+	uint64_t nsample = tally_get64(&in);
+	uint64_t nbranch = tally_get64(&in);
+	uint64_t nchain = tally_get64(&in);
+
+	// each entry takes a few words at least
+	if (in.bad || (nmmap > len) || (nsample > len) || (nbranch > len)
+	||  (nchain > len))
+		return -1;
+
+	if (MEM_RESIZE(t->mmap, t->nmmap, nmmap)
+	||  MEM_RESIZE(t->sample, t->nsample, nsample)
+	||  MEM_RESIZE(t->branch, t->nbranch, nbranch)
+	||  MEM_RESIZE(t->chain, t->nchain, nchain))
+		return -1;
+
+	for (size_t k = 0; !in.bad && (k < nmmap); k++) {
+		struct tally_mmap *m = &t->mmap[k];
+
+		m->type = tally_get64(&in);
+		m->time = tally_get64(&in);
+		m->pid = tally_get64(&in);
+		m->start = tally_get64(&in);
+		m->length = tally_get64(&in);
+		m->offset = tally_get64(&in);
+		m->ppid = tally_get64(&in);
+		m->path = tally_get_str(t, &in);
+
+		if ((m->type == TALLY_MMAP) && (m->path == NULL))
+			in.bad = 1;
+	}
+
+	for (size_t k = 0; !in.bad && (k < nsample); k++) {
+		struct tally_sample *s = &t->sample[k];
+
+		s->pid = tally_get64(&in);
+		s->tid = tally_get64(&in);
+		s->cpu = tally_get64(&in);
+		s->bucket = tally_get64(&in);
+		s->ip = tally_get64(&in);
+		s->offs = tally_get64(&in);
+		s->count = tally_get64(&in);
+		s->period = tally_get64(&in);
+		s->has_mem = (tally_get64(&in) != 0);
+		s->mem.addr = tally_get64(&in);
+		s->mem.data_src = tally_get64(&in);
+		s->mem.weight = tally_get64(&in);
+		s->dso = tally_get_path(t, &in);
+		s->sym = tally_get_str(t, &in);
+		s->event = tally_get_str(t, &in);
+
+		if (s->event == NULL)
+			in.bad = 1;
+	}
+
+	for (size_t k = 0; !in.bad && (k < nbranch); k++) {
+		struct tally_branch *br = &t->branch[k];
+
+		br->pid = tally_get64(&in);
+		br->pre_ip = tally_get64(&in);
+		br->src_ip = tally_get64(&in);
+		br->dst_ip = tally_get64(&in);
+		br->miss = (tally_get64(&in) != 0);
+		br->count = tally_get64(&in);
+		br->cycles = tally_get64(&in);
+		br->pre_dso = tally_get_path(t, &in);
+		br->src_dso = tally_get_path(t, &in);
+		br->dst_dso = tally_get_path(t, &in);
+	}
+
+	for (size_t k = 0; !in.bad && (k < nchain); k++) {
+		struct tally_chain *c = &t->chain[k];
+
+		c->pid = tally_get64(&in);
+		c->nip = tally_get64(&in);
+		c->count = tally_get64(&in);
+		c->ip0 = t->nchain_ip;
+
+		if (in.bad || (c->nip > (uint64_t)(in.end - in.b) / 8)
+		||  MEM_RESIZE(t->chain_ip, t->nchain_ip, c->ip0 + c->nip)) {
+			in.bad = 1;
+			break;
+		}
+
+		memcpy(t->chain_ip + c->ip0, in.b, c->nip * sizeof(uint64_t));
+		in.b += c->nip * sizeof(uint64_t);
+	}
+
+	return (in.bad || (in.b != in.end)) ? -1 : 0;
+}
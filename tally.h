@@ -0,0 +1,144 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef TALLY_H
+#define TALLY_H
+#include <stddef.h>
+#include <stdint.h>
+#include "map.h"
+#include "prog.h"
+
+// ************************************************************************
+// Aggregated, not yet resolved, trace events. Identical samples and
+// branches are merged (with counts), so that they can be replayed into a
+// struct prog later, once per distinct event.
+// ************************************************************************
+#define TALLY_MMAP		0
+#define TALLY_FORK		1
+#define TALLY_EXEC		2
+
+// mmaps and task events, in trace order
+struct tally_mmap {
+	int type;
+	uint64_t time;
+	uint64_t pid;
+	uint64_t start, length;
+	char *path;
+	uint64_t offset;
+	
+	// fork
+	uint64_t ppid;
+};
+
+// dsos are path ids of the tally (see struct tally)
+struct tally_sample {
+	uint64_t pid, tid, cpu;
+	uint64_t bucket;
+	uint64_t ip;
+	int dso;
+	char *sym;
+	uint64_t offs;
+	char *event;
+	uint64_t count, period;
+	
+	// data access, merged by cache line (weight being the total)
+	int has_mem;
+	struct dso_mem mem;
+};
+
+struct tally_chain {
+	uint64_t pid;
+	size_t ip0, nip;
+	uint64_t count;
+};
+
+struct tally_branch {
+	uint64_t pid;
+	uint64_t pre_ip, src_ip, dst_ip;
+	int pre_dso, src_dso, dst_dso;
+	int miss;
+	uint64_t count, cycles;
+};
+
+struct tally {
+	// name of the primary event, whose samples also carry branches
+	char *primary;
+	
+	// timeline buckets, from prog_bucket() (NULL: none); the origin must
+	// be set, so that the prog is only read
+	struct prog *prog;
+	
+	struct map strings;
+
+	// dso paths of the samples and branches, by id; mapped to the path
+	// ids of the prog at replay
+	struct map path_id;
+	char **path;
+	size_t npath;
+
+	struct map sample_id;
+	struct tally_sample *sample;
+	size_t nsample;
+
+	struct map branch_id;
+	struct tally_branch *branch;
+	size_t nbranch;
+
+	// call chains, their ips in chain_ip[ip0 .. ip0 + nip - 1]
+	struct map chain_id;
+	struct tally_chain *chain;
+	size_t nchain;
+	uint64_t *chain_ip;
+	size_t nchain_ip;
+	char *key;
+	size_t nkey;
+
+	struct tally_mmap *mmap;
+	size_t nmmap;
+};
+
+int  tally_init(struct tally *t);
+void tally_clear(struct tally *t);
+
+int tally_mmap(struct tally *t, uint64_t time, uint64_t pid,
+	uint64_t start, uint64_t length, char *path, uint64_t offset);
+int tally_task(struct tally *t, int type, uint64_t time,
+	uint64_t ppid, uint64_t pid);
+int tally_sample(struct tally *t, uint64_t pid, uint64_t tid, uint64_t cpu,
+	uint64_t bucket, uint64_t ip, char *dso, char *sym, uint64_t offs,
+	char *event, uint64_t count, uint64_t period,
+	const struct dso_mem *mem);
+int tally_branch(struct tally *t, uint64_t pid,
+	uint64_t pre_ip, char *pre_dso,
+	uint64_t src_ip, char *src_dso,
+	uint64_t dst_ip, char *dst_dso,
+	int miss, uint64_t cycles);
+
+int tally_chain(struct tally *t, uint64_t pid,
+	const uint64_t *ip, size_t nip);
+
+// mmaps and task events of times in [w0, w1), in trace order
+int tally_spaces(struct tally *t, struct prog *p, uint64_t w0, uint64_t w1);
+
+int tally_replay(struct tally *t, struct prog *p);
+
+// saved tally (see checkpoint.h): events with their strings inline, in
+// native byte order, appended to buf; tally_load() reads one back into an
+// empty tally, only to be replayed (saved events are not merged again)
+int tally_save(struct tally *t, uint8_t **buf, size_t *len);
+int tally_load(struct tally *t, const uint8_t *b, size_t len);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../perfdata.h"
+#include "../prog.h"
+
+// ************************************************************************
+// Native reader, on a perf.data written here: two cpu buffers of a round,
+// written one after the other, around the exit of a process. The last
+// sample of the process, in the buffer written last, is earlier than the
+// exit, and must still see the process mappings.
+// ************************************************************************
+#define CHECK_DSO	"/nonexistent/hperf-check"
+#define CHECK_PID	100
+#define CHECK_OTHER	200
+
+static uint8_t check_buf[4096];
+static size_t check_len;
+
+static void put32(uint32_t v)
+{
+	memcpy(check_buf + check_len, &v, 4);
+	check_len += 4;
+}
+
+static void put64(uint64_t v)
+{
+	memcpy(check_buf + check_len, &v, 8);
+	check_len += 8;
+}
+
+// type, misc 0 and size
+static void check_header(uint32_t type, uint16_t size)
+{
+	put32(type);
+	put32((uint32_t)size << 16);
+}
+
+// pid and tid, then time (sample_id_all, with TID | TIME)
+static void check_trailer(uint32_t pid, uint64_t time)
+{
+	put32(pid);
+	put32(pid);
+	put64(time);
+}
+
+static void check_mmap(uint32_t pid, uint64_t start, uint64_t time)
+{
+	char name[32] = CHECK_DSO;
+
+	check_header(1, 40 + sizeof(name) + 16);
+	put32(pid);
+	put32(pid);
+	put64(start);
+	put64(0x1000);
+	put64(0);
+	memcpy(check_buf + check_len, name, sizeof(name));
+	check_len += sizeof(name);
+	check_trailer(pid, time);
+}
+
+static void check_exit(uint32_t pid, uint64_t time)
+{
+	check_header(4, 8 + 24 + 16);
+	put32(pid);
+	put32(1);
+	put32(pid);
+	put32(1);
+	put64(time);
+	check_trailer(pid, time);
+}
+
+static void check_sample(uint32_t pid, uint64_t ip, uint64_t time)
+{
+	check_header(9, 8 + 24);
+	put64(ip);
+	put32(pid);
+	put32(pid);
+	put64(time);
+}
+
+static void check_round(void)
+{
+	check_header(68, 8);
+}
+
+// header, one attr (cycles: IP | TID | TIME, sample_id_all), then data
+static int check_write(int fd)
+{
+	size_t attr = 104, data = attr + 80;
+
+	check_len = 0;
+	memcpy(check_buf, "PERFILE2", 8);
+	check_len = 8;
+	put64(104);
+	put64(80);
+	put64(attr);
+	put64(80);
+	put64(data);
+	put64(0);
+	put64(0);
+	put64(0);
+	put64(0);
+	put64(0);
+	put64(0);
+	put64(0);
+
+	put32(0);
+	put32(64);
+	put64(0);
+	put64(4000);
+	put64(1 | 2 | 4);
+	put64(0);
+	put64((uint64_t)1 << 18);
+	put64(0);
+	put64(0);
+	put64(attr);
+	put64(0);
+
+	check_mmap(CHECK_PID, 0x400000, 1);
+
+	// cpu 1, then cpu 0
+	check_exit(CHECK_PID, 40);
+	check_sample(CHECK_OTHER, 0x1000, 50);
+	check_sample(CHECK_PID, 0x400100, 30);
+	check_round();
+
+	check_sample(CHECK_OTHER, 0x1000, 60);
+	check_round();
+
+	uint64_t size = check_len - data;
+	memcpy(check_buf + 48, &size, 8);
+
+	return write(fd, check_buf, check_len) != (ssize_t)check_len;
+}
+
+static uint64_t check_samples(struct prog *p, const char *path)
+{
+	for (size_t k = 0; k < p->npath; k++)
+		if (strcmp(p->path[k].path, path) == 0)
+			return p->dso[p->path[k].dso].samples;
+
+	return 0;
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int main(void)
+{
+	char path[] = "/tmp/hperf-check-XXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+
+	int r = check_write(fd);
+	close(fd);
+
+	struct perfdata pd;
+	struct prog p;
+
+	r |= prog_init(&p);
+
+	if ((r == 0) && (perfdata_open(&pd, path) == 0)) {
+		r = perfdata_load(&pd, &p) || prog_sync(&p);
+		perfdata_close(&pd);
+	} else {
+		r = 1;
+	}
+
+	unlink(path);
+
+	uint64_t mapped = (r == 0) ? check_samples(&p, CHECK_DSO) : 0;
+
+	prog_clear(&p);
+
+	if (mapped != 1) {
+		fprintf(stderr, "perfdata: %lu samples before the exit, "
+			"expected 1\n", mapped);
+		return 1;
+	}
+
+	printf("perfdata: round order ok\n");
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+    This file is part of HPerf.
+    Copyright (C) 2020  Laurent Poirrier
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// the block decoders are static
+#include "../token.c"
+
+// ************************************************************************
+// Differential test of the numeric field decoders: each block variant,
+// and hexparse_padded() / decparse_padded(), against the scalar loops, on
+// random fields at random offsets, and on fields whose padding ends at a
+// page followed by an unmapped one.
+// ************************************************************************
+#define CHECK_FIELDS	2000000
+#define CHECK_LEN	24
+
+static uint64_t check_state = 0x9e3779b97f4a7c15ull;
+static uint64_t check_failed = 0;
+
+static uint64_t check_rand(void)
+{
+	check_state ^= check_state << 13;
+	check_state ^= check_state >> 7;
+	check_state ^= check_state << 17;
+
+	return check_state;
+}
+
+// digits (hex or decimal), then a non-digit, then anything
+static void check_field(char *s, int hex)
+{
+	static const char hexd[] = "0123456789abcdefABCDEF";
+	static const char stop[] = "\0 \t:/.)x@`gG[]";
+	int n = check_rand() % (CHECK_LEN - 3);
+	int k;
+
+	for (k = 0; k < n; k++)
+		s[k] = (hex) ? hexd[check_rand() % 22]
+			: (char)('0' + check_rand() % 10);
+
+	if (check_rand() & 1)
+		s[k++] = stop[check_rand() % (sizeof(stop) - 1)];
+	else
+		s[k++] = (char)(0x80 | check_rand());
+
+	for (; k < CHECK_LEN + TOKEN_PAD; k++)
+		s[k] = (char)check_rand();
+}
+
+static void check(const char *what, char *s, uint64_t v0, char *e0,
+	uint64_t v1, char *e1)
+{
+	if ((v0 == v1) && (e0 == e1))
+		return;
+
+	if (check_failed++ < 10)
+		fprintf(stderr, "%s: '%.*s': %lx (%td), expected %lx (%td)\n",
+			what, (int)(e0 - s), s, v1, e1 - s, v0, e0 - s);
+}
+
+// a block decoder, in place: up to 16 digits, as the scalar loop decodes
+// them
+static void check_block(const char *what, char *s, int hex,
+	int (*block)(char *, uint64_t *))
+{
+	char b[CHECK_LEN + TOKEN_PAD];
+	uint64_t v;
+	char *e;
+	int n = block(s, &v);
+
+	memcpy(b, s, TOKEN_PAD);
+	b[TOKEN_PAD] = 0;
+
+	uint64_t w = (hex) ? hexparse_scalar(b, 0, &e)
+		: decparse_scalar(b, 0, &e);
+
+	check(what, s, w, s + (e - b), v, s + n);
+}
+
+static void check_padded(const char *what, char *s, int hex)
+{
+	uint64_t v0, v1;
+	char *e0, *e1;
+
+	if (hex) {
+		v0 = hexparse(s, &e0);
+		v1 = hexparse_padded(s, &e1);
+	} else {
+		v0 = decparse(s, &e0);
+		v1 = decparse_padded(s, &e1);
+	}
+
+	check(what, s, v0, e0, v1, e1);
+}
+
+// ************************************************************************
+//
+// ************************************************************************
+int main(void)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *map = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if ((map == MAP_FAILED) || mprotect(map + page, page, PROT_NONE)) {
+		perror("mmap");
+		return 1;
+	}
+
+	// a field (cut to fit) and its padding, up to the unmapped page
+	char *end = map + page - TOKEN_PAD;
+	char buf[64 + CHECK_LEN + TOKEN_PAD];
+
+	for (int k = 0; k < CHECK_FIELDS; k++) {
+		int hex = k & 1;
+		char *s = buf + check_rand() % 64;
+
+		check_field(s, hex);
+		memcpy(end, s, TOKEN_PAD);
+		end[TOKEN_PAD - 1] = 0;
+
+		for (int j = 0; j < 2; j++) {
+			char *f = (j) ? end : s;
+
+			check_padded("padded", f, hex);
+
+#ifdef TOKEN_SWAR
+			check_block("swar", f, hex,
+				(hex) ? hexparse_swar : decparse_swar);
+#endif
+#ifdef TOKEN_SSSE3
+			if (!__builtin_cpu_supports("ssse3"))
+				continue;
+
+			check_block("ssse3", f, hex,
+				(hex) ? hexparse_ssse3 : decparse_ssse3);
+#endif
+		}
+	}
+
+	munmap(map, 2 * page);
+
+	if (check_failed) {
+		fprintf(stderr, "token: %lu of %d fields failed\n",
+			check_failed, 2 * CHECK_FIELDS);
+		return 1;
+	}
+
+	printf("token: %d fields ok\n", 2 * CHECK_FIELDS);
+
+	return 0;
+}
@@ -17,6 +17,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "token.h"
 
 
@@ -24,7 +25,7 @@
 // ************************************************************************
 // 
 // ************************************************************************
-int tokenize(char *s, size_t sz, int max, int *n, char **tokens)
+int tokenize(char *s, size_t len, int max, int *n, char **tokens)
 {
 	size_t offs = 0;
 	int k = 0;
@@ -40,7 +41,7 @@ int tokenize(char *s, size_t sz, int max, int *n, char **tokens)
 			offs++;
 		}
 		
-		if (s[offs] == 0)
+		if (offs >= len)
 			break;
 		
 		if (k >= max) {
@@ -58,16 +59,13 @@ int tokenize(char *s, size_t sz, int max, int *n, char **tokens)
 		
 		k++;
 		
+		if (offs >= len)
+			break;
+		
 		s[offs] = 0;
 		offs++;
 	}
 	
-	if (offs == sz - 1) {
-		//ERROR("Line too long:\n%s\n", s);
-		*n = k;
-		return -1;
-	}
-	
 	*n = k;
 	return 0;
 }
@@ -131,12 +129,17 @@ int match(char *s, char ind, char *p, ...)
 
 
 // ************************************************************************
-// 
+// Numeric fields. hexparse() and decparse() parse as many digits as there
+// are at s (possibly none), and return the value modulo 2^64. In padded
+// buffers (see token.h), up to 16 (SSSE3) or 8 (SWAR) digits are validated
+// and decoded at once; the bytes read past the end of the field are
+// ignored. The scalar loops are the reference (see test/token_check.c).
 // ************************************************************************
-uint64_t hexparse(char *s, char **stop)
+#define TOKEN_LO	0x0101010101010101ull
+#define TOKEN_HI	0x8080808080808080ull
+
+static uint64_t hexparse_scalar(char *s, uint64_t r, char **stop)
 {
-	uint64_t r = 0;
-	
 	while (1) {
 		char c = *s;
 		
@@ -159,13 +162,8 @@ uint64_t hexparse(char *s, char **stop)
 	return r;
 }
 
-// ************************************************************************
-// 
-// ************************************************************************
-uint64_t decparse(char *s, char **stop)
+static uint64_t decparse_scalar(char *s, uint64_t r, char **stop)
 {
-	uint64_t r = 0;
-	
 	while (1) {
 		char c = *s;
 		
@@ -184,3 +182,272 @@ uint64_t decparse(char *s, char **stop)
 	return r;
 }
 
+// ************************************************************************
+// SWAR: 8 bytes in a little-endian word, s[0] in the low byte. For ASCII
+// bytes, (x + 0x80 - c) has its high bit set iff x >= c.
+// ************************************************************************
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define TOKEN_SWAR
+
+static const uint64_t token_pow10[9] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+static inline uint64_t token_ge(uint64_t t, unsigned char c)
+{
+	return (t + TOKEN_LO * (0x80 - c)) & TOKEN_HI;
+}
+
+// number of leading bytes with their high bit set in the mask
+static inline int token_count(uint64_t mask)
+{
+	uint64_t bad = ~mask & TOKEN_HI;
+	
+	return bad ? (__builtin_ctzll(bad) >> 3) : 8;
+}
+
+static int hexparse_swar8(char *s, uint64_t *value)
+{
+	uint64_t w;
+	
+	memcpy(&w, s, 8);
+	
+	uint64_t t = w & ~TOKEN_HI;
+	uint64_t l = t | (TOKEN_LO * 0x20);
+	uint64_t digit = token_ge(t, '0') & ~token_ge(t, '9' + 1);
+	uint64_t alpha = token_ge(l, 'a') & ~token_ge(l, 'f' + 1);
+	int n = token_count((digit | alpha) & ~w);
+	
+	*value = 0;
+	
+	if (n == 0)
+		return 0;
+	
+	uint64_t v = (t & (TOKEN_LO * 0x0f)) + (alpha >> 7) * 9;
+	
+	// drop the bytes past the digits, put the last digit in the low
+	// byte, then merge nibbles pairwise
+	v = __builtin_bswap64(v << (8 * (8 - n)));
+	v = (v | (v >> 4)) & 0x00ff00ff00ff00ffull;
+	v = (v | (v >> 8)) & 0x0000ffff0000ffffull;
+	v = (v | (v >> 16)) & 0x00000000ffffffffull;
+	
+	*value = v;
+	return n;
+}
+
+static int decparse_swar8(char *s, uint64_t *value)
+{
+	uint64_t w;
+	
+	memcpy(&w, s, 8);
+	
+	uint64_t t = w & ~TOKEN_HI;
+	uint64_t digit = token_ge(t, '0') & ~token_ge(t, '9' + 1);
+	int n = token_count(digit & ~w);
+	
+	*value = 0;
+	
+	if (n == 0)
+		return 0;
+	
+	// drop the bytes past the digits (as leading zeros), then merge
+	// digits pairwise
+	uint64_t v = (t & (TOKEN_LO * 0x0f)) << (8 * (8 - n));
+	
+	v = (v * 2561) >> 8;
+	v = ((v & 0x00ff00ff00ff00ffull) * 6553601) >> 16;
+	v = ((v & 0x0000ffff0000ffffull) * 42949672960001ull) >> 32;
+	
+	*value = v;
+	return n;
+}
+
+static int hexparse_swar(char *s, uint64_t *value)
+{
+	int n = hexparse_swar8(s, value);
+	
+	if (n < 8)
+		return n;
+	
+	uint64_t v;
+	int n1 = hexparse_swar8(s + 8, &v);
+	
+	*value = (*value << (4 * n1)) | v;
+	return n + n1;
+}
+
+static int decparse_swar(char *s, uint64_t *value)
+{
+	int n = decparse_swar8(s, value);
+	
+	if (n < 8)
+		return n;
+	
+	uint64_t v;
+	int n1 = decparse_swar8(s + 8, &v);
+	
+	*value = *value * token_pow10[n1] + v;
+	return n + n1;
+}
+
+#endif
+
+// ************************************************************************
+// SSSE3: 16 bytes. The digits are reversed and right-aligned with pshufb
+// (indices n-1-j, negative past the digits, which selects zero), then
+// merged pairwise with multiply-adds.
+// ************************************************************************
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TOKEN_SSSE3
+
+__attribute__((target("ssse3")))
+static inline __m128i token_reverse(__m128i v, int n)
+{
+	__m128i iota = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i idx = _mm_sub_epi8(_mm_set1_epi8(n - 1), iota);
+	
+	return _mm_shuffle_epi8(v, idx);
+}
+
+__attribute__((target("ssse3")))
+static int hexparse_ssse3(char *s, uint64_t *value)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)s);
+	__m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	
+	__m128i digit = _mm_and_si128(
+		_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+		_mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+	__m128i alpha = _mm_and_si128(
+		_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+		_mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), l));
+	
+	unsigned valid = _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+	int n = __builtin_ctz(~valid | 0x10000);
+	
+	*value = 0;
+	
+	if (n == 0)
+		return 0;
+	
+	v = _mm_add_epi8(_mm_and_si128(v, _mm_set1_epi8(0x0f)),
+		_mm_and_si128(alpha, _mm_set1_epi8(9)));
+	v = token_reverse(v, n);
+	v = _mm_maddubs_epi16(v, _mm_set1_epi16(0x1001));
+	v = _mm_packus_epi16(v, v);
+	
+	*value = (uint64_t)_mm_cvtsi128_si64(v);
+	return n;
+}
+
+__attribute__((target("ssse3")))
+static int decparse_ssse3(char *s, uint64_t *value)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)s);
+	
+	__m128i digit = _mm_and_si128(
+		_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+		_mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+	
+	unsigned valid = _mm_movemask_epi8(digit);
+	int n = __builtin_ctz(~valid | 0x10000);
+	
+	*value = 0;
+	
+	if (n == 0)
+		return 0;
+	
+	v = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	v = token_reverse(v, n);
+	v = _mm_maddubs_epi16(v, _mm_set1_epi16(0x0a01));
+	v = _mm_madd_epi16(v, _mm_set1_epi32(0x00640001));
+	v = _mm_packs_epi32(v, v);
+	v = _mm_madd_epi16(v, _mm_set1_epi32(0x27100001));
+	
+	uint64_t lo = (uint32_t)_mm_cvtsi128_si32(v);
+	uint64_t hi = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+	
+	*value = hi * 100000000 + lo;
+	return n;
+}
+
+#endif
+
+// ************************************************************************
+// Up to 16 digits at once, or -1 when no block variant applies
+// ************************************************************************
+static inline int hexparse_block(char *s, uint64_t *value)
+{
+#ifdef TOKEN_SSSE3
+	if (__builtin_cpu_supports("ssse3"))
+		return hexparse_ssse3(s, value);
+#endif
+#ifdef TOKEN_SWAR
+	return hexparse_swar(s, value);
+#else
+	return -1;
+#endif
+}
+
+static inline int decparse_block(char *s, uint64_t *value)
+{
+#ifdef TOKEN_SSSE3
+	if (__builtin_cpu_supports("ssse3"))
+		return decparse_ssse3(s, value);
+#endif
+#ifdef TOKEN_SWAR
+	return decparse_swar(s, value);
+#else
+	return -1;
+#endif
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+uint64_t hexparse(char *s, char **stop)
+{
+	return hexparse_scalar(s, 0, stop);
+}
+
+uint64_t decparse(char *s, char **stop)
+{
+	return decparse_scalar(s, 0, stop);
+}
+
+uint64_t hexparse_padded(char *s, char **stop)
+{
+	uint64_t r;
+	int n = hexparse_block(s, &r);
+	
+	if (n < 0)
+		return hexparse_scalar(s, 0, stop);
+	
+	if (n == 16)
+		return hexparse_scalar(s + n, r, stop);
+	
+	if (stop)
+		*stop = s + n;
+	
+	return r;
+}
+
+uint64_t decparse_padded(char *s, char **stop)
+{
+	uint64_t r;
+	int n = decparse_block(s, &r);
+	
+	if (n < 0)
+		return decparse_scalar(s, 0, stop);
+	
+	if (n == 16)
+		return decparse_scalar(s + n, r, stop);
+	
+	if (stop)
+		*stop = s + n;
+	
+	return r;
+}
@@ -19,11 +19,18 @@
 #include <string.h>
 #include <stdint.h>
 
-int tokenize(char *s, size_t sz, int max, int *n, char **tokens);
+int tokenize(char *s, size_t len, int max, int *n, char **tokens);
 
 int match(char *s, char indicator, char *pattern, ...);
 
 uint64_t hexparse(char *s, char **stop);
 uint64_t decparse(char *s, char **stop);
 
+// same, decoding up to 16 digits at once: TOKEN_PAD bytes from s must be
+// readable (and initialized), as in the lines of reader.h
+#define TOKEN_PAD	16
+
+uint64_t hexparse_padded(char *s, char **stop);
+uint64_t decparse_padded(char *s, char **stop);
+
 #endif
@@ -15,31 +15,168 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #define _GNU_SOURCE
+#include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
 #include "message.h"
+#include "mem.h"
 #include "pipe.h"
+#include "reader.h"
 #include "token.h"
+#include "diag.h"
 #include "prog.h"
+#include "tally.h"
+#include "perfdata.h"
+#include "checkpoint.h"
 #include "trace.h"
 
 // ************************************************************************
 // 
 // ************************************************************************
-struct trace {
-	size_t error, read, samples;
+#define TRACE_TOKENS		64
+#define TRACE_BRANCHES		(TRACE_TOKENS - 8)
+
+#define TRACE_LINE_NONE		0
+#define TRACE_LINE_MMAP		1
+#define TRACE_LINE_SAMPLE	2
+#define TRACE_LINE_FORK		3
+#define TRACE_LINE_EXEC		4
+#define TRACE_LINE_EXIT		5
+
+struct trace_line {
+	int type;
+	char *comm;
+	uint64_t pid;
+	uint64_t time;
+	
+	// DSO_TASK_NONE if not printed
+	uint64_t tid, cpu;
+	
+	// mmap
+	uint64_t start, length, offset;
+	char *path;
+	
+	// fork
+	uint64_t ppid;
+	
+	// sample
+	char *event;
+	uint64_t period;
+	uint64_t ip;
+	char *dso, *sym;
+	uint64_t offs;
+	
+	// perf mem fields, if printed
+	int has_mem;
+	struct dso_mem mem;
+	
+	int nbr;
+	struct pbranch br[TRACE_BRANCHES];
+	
+	// return addresses, the sampled ip first
+	const uint64_t *chain;
+	size_t nchain;
 };
 
+typedef int (*trace_fn)(void *ctx, struct trace_line *l);
+
 // ************************************************************************
 // 
 // ************************************************************************
-static void trace_dump(int n, char **token)
+void trace_init(struct trace *t)
 {
-	for (int i = 0; i < n; i++) {
-		ERROR("\t%2d: {%s}\n", i, token[i]);
-	}
+	t->path = "perf.data";
+	t->native = 1;
+	t->jobs = 1;
+	t->filter = NULL;
+	t->script = NULL;
+	
+	t->live = 0;
+	t->snapshot = NULL;
+	t->snapshot_ctx = NULL;
+	t->due = 0;
+	
+	t->checkpoint = NULL;
+	t->resume = 0;
+	t->ck = NULL;
+	
+	t->lines = 0;
+	t->parsed = 0;
+}
+
+// ************************************************************************
+// Single pass scanner for the lines of trace_script(). String fields are
+// only delimited while scanning; their terminating NULs are written once
+// the whole line has been accepted, so that a rejected line is intact.
+// ************************************************************************
+#define TRACE_CUTS		(2 * TRACE_BRANCHES + 6)
+
+struct trace_scan {
+	char *c;
+	
+	char *cut[TRACE_CUTS];
+	int ncut;
+};
+
+static inline int trace_blank(char c)
+{
+	return (c == ' ') || (c == '\t');
+}
+
+// skip blanks, then one word: returns its start, and leaves c at its end
+static inline char *trace_word(struct trace_scan *sc)
+{
+	char *c = sc->c;
+	
+	while (trace_blank(*c))
+		c++;
+	
+	char *w = c;
+	
+	while ((*c != 0) && !trace_blank(*c))
+		c++;
+	
+	sc->c = c;
+	
+	return w;
+}
+
+static inline void trace_cut(struct trace_scan *sc, char *c)
+{
+	sc->cut[sc->ncut++] = c;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int trace_parse_time(char *s, char *end, uint64_t *ns)
+{
+	char *e;
+	
+	uint64_t sec = decparse_padded(s, &e);
+	
+	if ((e == s) || (*e != '.'))
+		return -1;
+	
+	char *f = e + 1;
+	uint64_t frac = decparse_padded(f, &e);
+	
+	if ((e == f) || (e - f > 9) || (e[0] != ':') || (e + 1 != end))
+		return -1;
+	
+	for (int d = e - f; d < 9; d++)
+		frac *= 10;
+	
+	*ns = sec * 1000000000 + frac;
+	
+	return 0;
 }
 
 // ************************************************************************
@@ -56,291 +193,1569 @@ comm pid time: PERF_RECORD_MMAP2 pid/tid: [0xADDRESS(0xSIZE)
   @ 0/FILE-OFFSET? maj:min inode inode_gen]: prot /path
   6      7           [8]    [9]     [10]     [11]   12
 
+ The scan resumes at [4].
 */
-static int trace_parse_mmap(struct prog *p, int n, char **token)
+static int trace_parse_mmap(struct trace_line *l, struct trace_scan *sc,
+	int v)
 {
-	if  (n < 10)
-		return -1;
-	
-	if ((token[6][0] != '@') || (token[6][1] != 0))
-		return -1;
-	
-	int v;
-	
-	if (strcmp(token[3], "PERF_RECORD_MMAP2") == 0) {
-		if (n < 13)
-			return -1;
-		v = 2;
-	} else if (strcmp(token[3], "PERF_RECORD_MMAP") == 0) {
-		v = 1;
-	} else {
-		return -1;
-	}
+	char *w, *e;
 	
-	char *e;
-	
-	uint64_t pid = decparse(token[1], &e);
+	// pid/tid
+	w = trace_word(sc);
 	
-	if (*e != 0)
+	if (w == sc->c)
 		return -1;
 	
-	char *w = token[5];
+	// [0xADDRESS(0xSIZE)
+	w = trace_word(sc);
 	
 	if ((w[0] != '[') || (w[1] != '0') || (w[2] != 'x'))
 		return -1;
 	
-	uint64_t start = hexparse(w + 3, &e);
+	uint64_t start = hexparse_padded(w + 3, &e);
 	
 	w = e;
 	
 	if ((w[0] != '(') || (w[1] != '0') || (w[2] != 'x'))
 		return -1;
 
-	uint64_t length = hexparse(w + 3, &e);
+	uint64_t length = hexparse_padded(w + 3, &e);
 	
 	if (*e != ')')
 		return -1;
 	
+	// @
+	w = trace_word(sc);
+	
+	if ((w[0] != '@') || (w + 1 != sc->c))
+		return -1;
+	
+	// offset
 	uint64_t offset;
-	w = token[7];
+	w = trace_word(sc);
 	
-	if ((w[0] == '0') && (w[1] == 'x')) {
-		w += 2;
-		offset = hexparse(w, &e);
-	} else {
-		offset = decparse(w, &e);
-	}
+	if ((w[0] == '0') && (w[1] == 'x'))
+		offset = hexparse_padded(w + 2, &e);
+	else
+		offset = decparse_padded(w, &e);
 	
 	if (v == 1) {
-		if (*e != ']')
+		if ((e == w) || (*e != ']'))
 			return -1;
-		
-		w = token[9];
-	} else if (v == 2) {
-		if (*e != 0)
+	} else {
+		if ((e == w) || (e != sc->c))
 			return -1;
-
-		w = token[12];
+		
+		// maj:min inode inode_gen]:
+		for (int k = 0; k < 3; k++) {
+			w = trace_word(sc);
+			
+			if (w == sc->c)
+				return -1;
+		}
 	}
 	
-	char *path = w;
+	// prot, path
+	w = trace_word(sc);
 	
-	if (pid == 0)
-		return 0;
+	if (w == sc->c)
+		return -1;
 	
-	//DEBUG("mmap%d: pid %ld, addr 0x%lx, size 0x%lx, "
-	//	"file %s, offset 0x%lx\n",
-	//	v, pid, start, length, path, offset);
+	char *path = trace_word(sc);
 	
-	if (prog_mmap(p, pid, start, length, path, offset))
+	if (path == sc->c)
 		return -1;
 	
+	trace_cut(sc, sc->c);
+	
+	l->type = TRACE_LINE_MMAP;
+	l->start = start;
+	l->length = length;
+	l->path = path;
+	l->offset = offset;
+	
 	return 0;
 }
 
 // ************************************************************************
 /*
- [0]  1   [2]    3       4       5     6         7
-comm pid time: cycles 'cycles:' ip sym+symoffs (dso)
-ip(dso) / ip(dso) / Mis|Predicted / X|- / A|- / cycles
-                       (8+k)
+ [0]  1   [2]                    3
+comm pid time: PERF_RECORD_FORK(pid:tid):(ppid:ptid)
+comm pid time: PERF_RECORD_EXIT(pid:tid):(ppid:ptid)
+comm pid time: PERF_RECORD_COMM exec: comm:pid/tid
+
+ Only process forks and exits, and execs, are kept.
 */
-static int trace_parse_sample(struct prog *p, int n, char **token)
+static char *trace_parse_pair(char *c, uint64_t *a, uint64_t *b)
 {
-	if (n < 8)
-		return -1;
+	char *e;
 	
-	if (strcmp(token[4], "cycles:") != 0)
-		return -1;
+	if (*c != '(')
+		return NULL;
 	
-	char *e;
+	*a = decparse_padded(c + 1, &e);
+	
+	if ((e == c + 1) || (*e != ':'))
+		return NULL;
+	
+	c = e + 1;
+	*b = decparse_padded(c, &e);
+	
+	if ((e == c) || (*e != ')'))
+		return NULL;
 	
-	uint64_t pid = decparse(token[1], &e);
+	return e + 1;
+}
+
+static int trace_parse_task(struct trace_line *l, char *c, char *end,
+	int type)
+{
+	uint64_t pid, tid, ppid, ptid;
+	
+	c = trace_parse_pair(c, &pid, &tid);
 	
-	if (*e != 0)
+	if ((c == NULL) || (*c != ':'))
 		return -1;
 	
-	uint64_t addr = hexparse(token[5], &e);
+	c = trace_parse_pair(c + 1, &ppid, &ptid);
 	
-	if (*e != 0)
+	if ((c == NULL) || (c != end))
 		return -1;
 	
-	char *sym, *hoffs;
-	uint64_t offs = 0;
+	// threads share the address space of their process
+	if ((type == TRACE_LINE_FORK) ? (pid == ppid) : (pid != tid)) {
+		l->type = TRACE_LINE_NONE;
+		return 0;
+	}
 	
-	if (match(token[6], '?', "?+0x?", &sym, &hoffs)) {
-		sym = NULL;
-	} else {
-		offs = hexparse(hoffs, &e);
+	l->type = type;
+	l->pid = pid;
+	l->ppid = ppid;
+	
+	return 0;
+}
+
+static int trace_parse_comm(struct trace_line *l, struct trace_scan *sc)
+{
+	char *w = trace_word(sc);
+	
+	l->type = TRACE_LINE_NONE;
+	
+	if ((sc->c - w != 5) || (memcmp(w, "exec:", 5) != 0))
+		return 0;
+	
+	// the comm may contain blanks: pid/tid is in the last word
+	char *last = NULL, *end = NULL;
+	
+	while (1) {
+		w = trace_word(sc);
 		
-		if (*e != 0)
-			return -1;
+		if (w == sc->c)
+			break;
+		
+		last = w;
+		end = sc->c;
 	}
 	
-	char *dso;
+	char *colon = (last) ? memrchr(last, ':', end - last) : NULL;
 	
-	if (match(token[7], '?', "(?)", &dso))
+	if (colon == NULL)
 		return -1;
 	
-	//MESSAGE("%s: %s + %s = 0x%lx\n", dso, sym, hoffs, addr);
+	char *e;
+	uint64_t pid = decparse_padded(colon + 1, &e);
 	
-	if (prog_sample(p, pid, addr, dso, sym, offs))
+	if ((e == colon + 1) || (*e != '/'))
 		return -1;
 	
-	char *pre_dso = NULL;
-	uint64_t pre_addr = (uint64_t)-1;
+	l->type = TRACE_LINE_EXEC;
+	l->pid = pid;
 	
-	for (int k = n - 1; k >= 8; k--) {
-		char *src_as, *src_dso, *dst_as, *dst_dso;
-		char *ps, *cs;
-		
-		if (match(token[k], '?', "0x?(?)/0x?(?)/?/?/?/?",
-				&src_as, &src_dso, &dst_as, &dst_dso,
-				&ps, NULL, NULL, &cs))
+	return 0;
+}
+
+// ************************************************************************
+/*
+ [0]  1   [2]    3       4     5     6         7
+comm pid time: period event: ip sym+symoffs (dso)
+ip(dso) / ip(dso) / Mis|Predicted / X|- / A|- / cycles
+                       (8+k)
+
+ The scan resumes after 3, the period word, which perf omits for
+ fixed-period recordings. Data accesses (perf mem) print before the ip:
+
+  addr data_src |OP op|LVL level|SNP snoop|TLB tlb|LCK lock|BLK blk weight
+
+ with any field missing if not recorded, and the decoding of data_src
+ running until the weight (a decimal word).
+*/
+#define TRACE_MEM_WORDS		32
+
+static int trace_parse_mem(struct trace_line *l, char **w, char **end,
+	int n)
+{
+	char *e;
+	int dec = n;
+	
+	l->has_mem = (n > 0);
+	l->mem.addr = 0;
+	l->mem.data_src = 0;
+	l->mem.weight = 0;
+	
+	for (int k = 0; k < n; k++) {
+		if (w[k][0] == '|') {
+			dec = k;
+			break;
+		}
+	}
+	
+	// addr, and data_src or weight, without a decoding
+	if (dec == n) {
+		if (n == 0)
+			return 0;
+		if (n > 2)
 			return -1;
 		
-		uint64_t src_addr = hexparse(src_as, &e);
+		l->mem.addr = hexparse_padded(w[0], &e);
 		
-		if (*e != 0)
+		if (e != end[0])
 			return -1;
 		
-		uint64_t dst_addr = hexparse(dst_as, &e);
+		if (n == 2) {
+			l->mem.weight = decparse_padded(w[1], &e);
+			
+			if (e != end[1])
+				return -1;
+		}
+		
+		return 0;
+	}
+	
+	// data_src before its decoding, after the addr
+	if ((dec < 1) || (dec > 2))
+		return -1;
+	
+	l->mem.data_src = hexparse_padded(w[dec - 1], &e);
+	
+	if (e != end[dec - 1])
+		return -1;
+	
+	if (dec == 2) {
+		l->mem.addr = hexparse_padded(w[0], &e);
+		
+		if (e != end[0])
+			return -1;
+	}
+	
+	// weight after it, if a number
+	if (n - 1 > dec) {
+		uint64_t weight = decparse_padded(w[n - 1], &e);
 		
-		if (*e != 0)
+		if (e == end[n - 1])
+			l->mem.weight = weight;
+	}
+	
+	return 0;
+}
+
+static int trace_parse_branch(struct pbranch *br,
+	struct trace_scan *sc, char *w, char *end)
+{
+	char *c = w;
+	
+	for (int k = 0; k < 2; k++) {
+		// 0xADDRESS(dso)
+		if ((c[0] != '0') || (c[1] != 'x'))
 			return -1;
 		
-		int miss;
+		char *e;
+		uint64_t ip = hexparse_padded(c + 2, &e);
 		
-		if ((ps[0] == 'P') && (ps[1] == 0))
-			miss = 0;
-		else if ((ps[0] == 'M') && (ps[1] == 0))
-			miss = 1;
-		else
+		if (*e != '(')
 			return -1;
 		
-		uint64_t cycles = decparse(cs, &e);
+		char *dso = e + 1;
+		
+		c = memchr(dso, ')', end - dso);
 		
-		if (*e != 0)
+		if ((c == NULL) || (c[1] != '/'))
 			return -1;
 		
-		// so as to not introduce a bias, we discard the first
-		// branch from the stack
-		if (pre_dso) {
-			if (prog_branch(p, pid,
-					pre_addr, pre_dso,
-					src_addr, src_dso,
-					dst_addr, dst_dso,
-					miss, cycles))
-				return -1;
+		trace_cut(sc, c);
+		c += 2;
+		
+		if (k == 0) {
+			br->src_ip = ip;
+			br->src_dso = dso;
+			br->src_path = -1;
+		} else {
+			br->dst_ip = ip;
+			br->dst_dso = dso;
+			br->dst_path = -1;
 		}
+	}
+	
+	// P|M/X|-/A|-/
+	if ((c[0] == 'P') && (c[1] == '/'))
+		br->miss = 0;
+	else if ((c[0] == 'M') && (c[1] == '/'))
+		br->miss = 1;
+	else
+		return -1;
+	
+	c += 2;
+	
+	for (int k = 0; k < 2; k++) {
+		c = memchr(c, '/', end - c);
+		
+		if (c == NULL)
+			return -1;
 		
-		pre_dso = dst_dso;
-		pre_addr = dst_addr;
+		c++;
 	}
+	
+	// cycles
+	char *e;
+	
+	br->cycles = decparse_padded(c, &e);
+	
+	if (e != end)
+		return -1;
+	
 	return 0;
 }
 
-// ************************************************************************
-// 
-// ************************************************************************
-static int trace_parse_line(struct prog *p, char *buff, size_t size)
+static int trace_parse_sample(struct trace_line *l, struct trace_scan *sc,
+	char *w)
 {
-	// tokenize
-	char *token[64];
-	int n;
+	char *e;
 	
-	if (tokenize(buff, size, 64, &n, token)) {
-		ERROR("Unable to tokenize:\n");
-		trace_dump(n, token);
-		return -1;
+	// period, absent if it was not recorded (fixed period, -c)
+	uint64_t period = decparse_padded(w, &e);
+	
+	if ((e == w) || (e != sc->c)) {
+		period = 1;
+	} else {
+		w = trace_word(sc);
 	}
 	
-	// parse sample
-	if (trace_parse_sample(p, n, token) == 0)
-		return 0;
+	// event:
+	if ((sc->c - w < 2) || (sc->c[-1] != ':'))
+		return -1;
 	
-	// parse mmap
-	if (trace_parse_mmap(p, n, token) == 0)
-		return 0;
+	char *event = w;
 	
-	ERROR("Unable to parse:\n");
-	trace_dump(n, token);
-	return -1;
-}
-
-
-// ************************************************************************
-// 
-// ************************************************************************
-int trace_load(struct prog *p, char *path)
-{
-	char *argv[8];
-	int k = 0;
+	trace_cut(sc, sc->c - 1);
 	
-	argv[k++] = "perf";
-	argv[k++] = "script";
+	// words up to (dso): perf mem fields, ip, sym
+	char *mw[TRACE_MEM_WORDS + 2];
+	char *me[TRACE_MEM_WORDS + 2];
+	int n = 0;
 	
-	if (path) {
-		argv[k++] = "-i";
-		argv[k++] = path;
+	while (1) {
+		w = trace_word(sc);
+		
+		if (w == sc->c)
+			return -1;
+		
+		if ((w[0] == '(') && (sc->c[-1] == ')') && (n >= 2))
+			break;
+		
+		if (n >= TRACE_MEM_WORDS + 2)
+			return -1;
+		
+		mw[n] = w;
+		me[n] = sc->c;
+		n++;
 	}
 	
-	argv[k++] = "--show-mmap-events";
-	argv[k++] = "-F";
-	argv[k++] = "comm,pid,time,period,event,ip,sym,symoff,dso,brstack";
-	argv[k++] = NULL;
-
-	int fd = pipe_in(argv);
+	char *dso = w;
+	char *dso_end = sc->c;
 	
-	if (fd < 0)
+	if (trace_parse_mem(l, mw, me, n - 2))
 		return -1;
 	
-	FILE *f = fdopen(fd, "r");
+	// ip
+	w = mw[n - 2];
 	
-	if (!f) {
-		ERROR("fdopen(pipefd): %s\n", strerror(errno));
-		close(fd);
+	uint64_t ip = hexparse_padded(w, &e);
+	
+	if ((e == w) || (e != me[n - 2]))
 		return -1;
+	
+	// sym+0xoffs, where anything else means no symbol
+	w = mw[n - 1];
+	
+	char *sym = NULL;
+	uint64_t offs = 0;
+	char *plus = memchr(w, '+', me[n - 1] - w);
+	
+	if (plus && (plus[1] == '0') && (plus[2] == 'x')) {
+		offs = hexparse_padded(plus + 3, &e);
+		
+		if (e != me[n - 1])
+			return -1;
+		
+		sym = w;
+		trace_cut(sc, plus);
 	}
 	
-	MESSAGE("%s:\n", path);
-	size_t lines = 0;
-	size_t parsed = 0;
+	// (dso)
+	char *close = memchr(dso, ')', dso_end - dso);
 	
-	char buff[16384];
-	int r = 0;
+	if (close + 1 != dso_end)
+		return -1;
+	
+	trace_cut(sc, close);
 	
+	l->type = TRACE_LINE_SAMPLE;
+	l->event = event;
+	l->period = period;
+	l->ip = ip;
+	l->dso = dso + 1;
+	l->sym = sym;
+	l->offs = offs;
+	l->nbr = 0;
+	
+	// brstack
 	while (1) {
-		if ((parsed > 0) && ((parsed & 0xffff) == 0))
-			MESSAGE("  [samples: %6zd k]\n", parsed >> 10);
+		w = trace_word(sc);
 		
-		if (fgets(buff, sizeof(buff), f) != buff) {
-			if (ferror(f)) {
-				ERROR("fgets(): %s\n", strerror(errno));
-				r = -1;
-			}
-			
+		if (w == sc->c)
 			break;
-		}
 		
-		lines++;
+		if (l->nbr >= TRACE_BRANCHES)
+			return -1;
+		
+		if (trace_parse_branch(&l->br[l->nbr], sc, w, sc->c))
+			return -1;
 		
-		if (trace_parse_line(p, buff, sizeof(buff)) == 0)
-			parsed++;
+		l->nbr++;
 	}
 	
-	MESSAGE("  samples: parsed: %9zd, ignored: %9zd\n",
-		parsed, lines - parsed);
-	MESSAGE("             hits: %9ld,  unspec: %9ld, orphans: %9ld\n",
-		p->samples - p->unspec - p->orphans,
-		p->unspec, p->orphans);
-	MESSAGE(" branches:   hits: %9zd,  unspec: %9zd, orphans: %9zd\n",
-		p->branch_samples - p->branch_unspec - p->branch_orphans,
-		p->branch_unspec, p->branch_orphans);
-	MESSAGE("     insn:         %9zd\n", p->insn);
+	return 0;
+}
+
+// pid or tid, -1 (perf's none, as for kernel maps) included
+static uint64_t trace_parse_id(char *w, char **e)
+{
+	if ((w[0] == '-') && (w[1] == '1')) {
+		*e = w + 2;
+		return (uint64_t)-1;
+	}
+	
+	return decparse_padded(w, e);
+}
+
+// ************************************************************************
+// Lines start with 'comm pid time:' in the layouts above, or with
+// 'comm pid/tid [cpu] time:' as trace_script() has perf print them.
+// ************************************************************************
+static int trace_parse_line(struct trace_line *l, char *buff)
+{
+	struct trace_scan sc;
+	char *w, *e;
+	
+	sc.c = buff;
+	sc.ncut = 0;
+	
+	// comm
+	w = trace_word(&sc);
+	
+	if (w == sc.c) {
+		l->type = TRACE_LINE_NONE;
+		return 0;
+	}
+	
+	l->comm = w;
+	trace_cut(&sc, sc.c);
+	
+	// pid, or pid/tid
+	w = trace_word(&sc);
+	
+	uint64_t pid = trace_parse_id(w, &e);
 	
-	fclose(f);
+	if (e == w)
+		goto fail;
+	
+	l->tid = DSO_TASK_NONE;
+	
+	if (*e == '/') {
+		char *t = e + 1;
+		
+		l->tid = trace_parse_id(t, &e);
+		
+		if (e == t)
+			goto fail;
+	}
+	
+	if (e != sc.c)
+		goto fail;
+	
+	// [cpu], if printed
+	w = trace_word(&sc);
+	l->cpu = DSO_TASK_NONE;
+	
+	if (w[0] == '[') {
+		l->cpu = decparse_padded(w + 1, &e);
+		
+		if ((e == w + 1) || (e[0] != ']') || (e + 1 != sc.c))
+			goto fail;
+		
+		w = trace_word(&sc);
+	}
+	
+	// time, if recorded
+	if (trace_parse_time(w, sc.c, &l->time) == 0)
+		w = trace_word(&sc);
+	else
+		l->time = 0;
+	
+	l->pid = pid;
+	
+	// event, or period
+	
+	int r;
+	
+	if ((sc.c - w == 16) && (memcmp(w, "PERF_RECORD_MMAP", 16) == 0))
+		r = trace_parse_mmap(l, &sc, 1);
+	else if ((sc.c - w == 17) && (memcmp(w, "PERF_RECORD_MMAP2", 17) == 0))
+		r = trace_parse_mmap(l, &sc, 2);
+	else if ((sc.c - w > 16) && (memcmp(w, "PERF_RECORD_FORK(", 17) == 0))
+		r = trace_parse_task(l, w + 16, sc.c, TRACE_LINE_FORK);
+	else if ((sc.c - w > 16) && (memcmp(w, "PERF_RECORD_EXIT(", 17) == 0))
+		r = trace_parse_task(l, w + 16, sc.c, TRACE_LINE_EXIT);
+	else if ((sc.c - w == 16) && (memcmp(w, "PERF_RECORD_COMM", 16) == 0))
+		r = trace_parse_comm(l, &sc);
+	else if ((sc.c - w > 12) && (memcmp(w, "PERF_RECORD_", 12) == 0)) {
+		l->type = TRACE_LINE_NONE;
+		r = 0;
+	} else
+		r = trace_parse_sample(l, &sc, w);
+	
+	if (r)
+		goto fail;
+	
+	for (int k = 0; k < sc.ncut; k++)
+		*sc.cut[k] = 0;
+	
+	// pid 0 (the kernel, swapper) and -1 are resolved by name; the
+	// kernel map still locates kallsyms
+	if ((l->type != TRACE_LINE_SAMPLE)
+			&& ((l->pid == 0) || (l->pid == (uint64_t)-1))
+			&& !((l->type == TRACE_LINE_MMAP) && kernel_map(l->path)))
+		l->type = TRACE_LINE_NONE;
+	
+	return 0;
+	
+fail:
+	ERROR("Unable to parse:\n\t%s\n", buff);
+	return -1;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int trace_apply(void *ctx, struct trace_line *l)
+{
+	struct prog *p = ctx;
+	
+	switch (l->type) {
+	case TRACE_LINE_MMAP:
+		return prog_mmap(p, l->pid, l->start, l->length,
+			l->path, l->offset);
+	case TRACE_LINE_FORK:
+		return prog_fork(p, l->ppid, l->pid);
+	case TRACE_LINE_EXEC:
+		prog_exec(p, l->pid);
+		return 0;
+	case TRACE_LINE_EXIT:
+		prog_exit(p, l->pid);
+		return 0;
+	case TRACE_LINE_SAMPLE:
+		break;
+	default:
+		return 0;
+	}
+	
+	int ev = prog_event(p, l->event);
+	
+	// dso paths are interned as the line comes, and passed on as path
+	// ids (see prog_intern())
+	int path = prog_intern(p, l->dso);
+	
+	if (path < 0)
+		return -1;
+	
+	if (prog_sample(p, l->pid, l->tid, l->cpu, prog_bucket(p, l->time),
+			l->ip, l->dso, path, l->sym, l->offs,
+			ev, 1, l->period, (l->has_mem) ? &l->mem : NULL))
+		return -1;
+	
+	// branch stacks are only taken from the primary event
+	if (ev != 0)
+		return 0;
+	
+	for (int k = 0; k < l->nbr; k++) {
+		struct pbranch *br = &l->br[k];
+		
+		br->src_path = prog_intern(p, br->src_dso);
+		br->dst_path = prog_intern(p, br->dst_dso);
+		
+		if ((br->src_path < 0) || (br->dst_path < 0))
+			return -1;
+	}
+	
+	// so as to not introduce a bias, the first (oldest) branch from
+	// the stack is discarded
+	if (prog_branch_batch(p, l->pid, l->br, l->nbr, 1))
+		return -1;
+	
+	if (l->nchain && prog_callchain(p, l->pid, l->chain, l->nchain, 1))
+		return -1;
+	
+	return 0;
+}
+
+// ************************************************************************
+static int trace_tally(void *ctx, struct trace_line *l)
+{
+	struct tally *ta = ctx;
+	
+	if (l->type == TRACE_LINE_MMAP)
+		return tally_mmap(ta, l->time, l->pid, l->start, l->length,
+			l->path, l->offset);
+	
+	// samples are merged across time: the processes that exit within
+	// the slice are kept until the end
+	if (l->type == TRACE_LINE_FORK)
+		return tally_task(ta, TALLY_FORK, l->time, l->ppid, l->pid);
+	
+	if (l->type == TRACE_LINE_EXEC)
+		return tally_task(ta, TALLY_EXEC, l->time, 0, l->pid);
+	
+	if (l->type != TRACE_LINE_SAMPLE)
+		return 0;
+	
+	uint64_t bucket = (ta->prog)
+		? prog_bucket(ta->prog, l->time) : DSO_BUCKET_NONE;
+	
+	if (tally_sample(ta, l->pid, l->tid, l->cpu, bucket,
+			l->ip, l->dso, l->sym, l->offs,
+			l->event, 1, l->period, (l->has_mem) ? &l->mem : NULL))
+		return -1;
+	
+	if (!prog_event_primary(ta->primary, l->event))
+		return 0;
+	
+	if (l->nchain && tally_chain(ta, l->pid, l->chain, l->nchain))
+		return -1;
+	
+	char *pre_dso = NULL;
+	uint64_t pre_addr = (uint64_t)-1;
+	
+	for (int k = l->nbr - 1; k >= 0; k--) {
+		struct pbranch *br = &l->br[k];
+		
+		if (pre_dso) {
+			if (tally_branch(ta, l->pid,
+					pre_addr, pre_dso,
+					br->src_ip, br->src_dso,
+					br->dst_ip, br->dst_dso,
+					br->miss, br->cycles))
+				return -1;
+		}
+		
+		pre_dso = br->dst_dso;
+		pre_addr = br->dst_ip;
+	}
+	
+	return 0;
+}
+
+// ************************************************************************
+// Replayed scripts were not filtered by perf; --tid is only applied to
+// lines that carry one (-F tid)
+// ************************************************************************
+static int trace_select(struct filter *f, struct trace_line *l)
+{
+	if (l->type == TRACE_LINE_MMAP)
+		return filter_pid(f, l->pid) || kernel_map(l->path);
+	
+	// a selected process may be forked from one that is not
+	if (l->type != TRACE_LINE_SAMPLE)
+		return 1;
+	
+	if ((l->tid != DSO_TASK_NONE) && !filter_task(f, l->pid, l->tid))
+		return 0;
+	
+	return filter_pid(f, l->pid) && filter_time(f, l->time)
+		&& filter_comm(f, l->comm) && filter_dso(f, l->dso);
+}
+
+// ************************************************************************
+// Live mode. Before each line, the clock is looked at, and the input is
+// waited for until the next snapshot is due at most: snapshots are taken
+// every period, whether data flows or not; a failed one ends the load.
+// ************************************************************************
+static uint64_t trace_clock(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int trace_live(struct trace *t, struct reader *rd)
+{
+	while (1) {
+		uint64_t now = trace_clock();
+		
+		if (now >= t->due) {
+			if (t->snapshot(t->snapshot_ctx))
+				return -1;
+			
+			t->due = trace_clock() + t->live * 1000000000;
+			continue;
+		}
+		
+		// in ms, rounded up
+		uint64_t wait = (t->due - now + 999999) / 1000000;
+		int r = reader_wait(rd, (wait < INT_MAX) ? (int)wait : INT_MAX);
+		
+		if (r != 0)
+			return (r < 0) ? -1 : 0;
+	}
+}
+
+// ************************************************************************
+// Samples with a call chain (perf record -g) span several lines: the
+// header, ending with the event (or with perf mem fields), then lines
+// indented by a tab, one per frame, possibly a line for the brstack, and a
+// blank line. They are joined back into the one-line format (header,
+// sampled frame, brstack), with the return addresses kept aside.
+// ************************************************************************
+struct trace_record {
+	int open;
+	
+	char *line;
+	size_t nline;
+	
+	uint64_t *ip;
+	size_t nip;
+};
+
+static int trace_record_header(const char *buff, size_t len)
+{
+	while ((len > 0) && trace_blank(buff[len - 1]))
+		len--;
+	
+	if ((len == 0) || (buff[0] == '\t'))
+		return 0;
+	
+	if (buff[len - 1] == ':')
+		return 1;
+	
+	// perf mem fields end the header, if no (dso) follows them
+	if (memmem(buff, len, " |OP ", 5) == NULL)
+		return 0;
+	
+	for (size_t k = 0; k + 1 < len; k++) {
+		if ((buff[k] != '(') || ((k > 0) && !trace_blank(buff[k - 1])))
+			continue;
+		
+		size_t j = k;
+		
+		while ((j < len) && !trace_blank(buff[j]))
+			j++;
+		
+		if (buff[j - 1] == ')')
+			return 0;
+	}
+	
+	return 1;
+}
+
+static int trace_record_more(const char *buff)
+{
+	if (buff[0] == '\t')
+		return 1;
+	
+	while (trace_blank(*buff))
+		buff++;
+	
+	return (buff[0] == '0') && (buff[1] == 'x');
+}
+
+static int trace_record_append(struct trace_record *rec,
+	const char *s, size_t len)
+{
+	size_t k = (rec->nline > 0) ? rec->nline - 1 : 0;
+	
+	// padded, as the lines of the reader
+	if (MEM_RESIZE(rec->line, rec->nline, k + len + 2 + TOKEN_PAD))
+		return -1;
+	
+	rec->line[k] = ' ';
+	memcpy(rec->line + k + 1, s, len);
+	memset(rec->line + k + len + 1, 0, 1 + TOKEN_PAD);
+	rec->nline = k + len + 2;
+	
+	return 0;
+}
+
+static int trace_record_open(struct trace_record *rec,
+	const char *buff, size_t len)
+{
+	rec->open = 1;
+	rec->nline = 0;
+	rec->nip = 0;
+	
+	return trace_record_append(rec, buff, len);
+}
+
+static int trace_record_add(struct trace_record *rec, char *buff, size_t len)
+{
+	char *s = buff;
+	
+	while (trace_blank(*s))
+		s++;
+	
+	len -= s - buff;
+	
+	// brstack
+	if ((s[0] == '0') && (s[1] == 'x'))
+		return trace_record_append(rec, s, len);
+	
+	// frame: ip sym+offs (dso)
+	char *e;
+	uint64_t ip = hexparse_padded(s, &e);
+	
+	if ((e == s) || !trace_blank(*e))
+		return 0;
+	
+	size_t k = rec->nip;
+	
+	if (MEM_RESIZE(rec->ip, rec->nip, k + 1))
+		return -1;
+	
+	rec->ip[k] = ip;
+	
+	return (k == 0) ? trace_record_append(rec, s, len) : 0;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static void trace_dispatch(struct trace *t, struct trace_line *l, char *buff,
+	struct filter *select, trace_fn fn, void *ctx)
+{
+	t->lines++;
+	
+	if (trace_parse_line(l, buff))
+		return;
+	
+	if (select && !trace_select(select, l))
+		return;
+	
+	if ((l->type == TRACE_LINE_SAMPLE)
+	&&  !filter_sample(t->filter, l->pid, l->time, l->ip))
+		return;
+	
+	if (fn(ctx, l) == 0)
+		t->parsed++;
+}
+
+static int trace_read(struct trace *t, struct reader *rd, int progress,
+	struct filter *select, trace_fn fn, void *ctx)
+{
+	struct trace_line l;
+	struct trace_record rec;
+	int r;
+	
+	rec.open = 0;
+	MEM_INIT(rec.line, rec.nline);
+	MEM_INIT(rec.ip, rec.nip);
+	
+	// lines read, and saved at checkpoints, between records; those read
+	// before the last checkpoint are skipped
+	struct checkpoint *ck = t->ck;
+	uint64_t line = 0;
+	
+	while (1) {
+		if (progress
+		&&  (t->parsed > 0) && ((t->parsed & 0xffff) == 0))
+			MESSAGE("  [samples: %6zd k]\n", t->parsed >> 10);
+		
+		if (t->live && trace_live(t, rd)) {
+			r = -1;
+			break;
+		}
+		
+		if (ck && !rec.open && (line >= ck->pos) && checkpoint_due(ck)
+		&&  checkpoint_save(ck, line, t->lines, t->parsed, 0)) {
+			r = -1;
+			break;
+		}
+		
+		char *buff;
+		size_t len;
+		
+		r = reader_line(rd, &buff, &len);
+		
+		if (r <= 0)
+			break;
+		
+		if (ck && (line++ < ck->pos))
+			continue;
+		
+		if (rec.open) {
+			if (trace_record_more(buff)) {
+				r = trace_record_add(&rec, buff, len);
+				
+				if (r)
+					break;
+				continue;
+			}
+			
+			rec.open = 0;
+			l.chain = rec.ip;
+			l.nchain = rec.nip;
+			trace_dispatch(t, &l, rec.line, select, fn, ctx);
+		}
+		
+		if (len == 0)
+			continue;
+		
+		if (trace_record_header(buff, len)) {
+			r = trace_record_open(&rec, buff, len);
+			
+			if (r)
+				break;
+			continue;
+		}
+		
+		l.chain = NULL;
+		l.nchain = 0;
+		trace_dispatch(t, &l, buff, select, fn, ctx);
+	}
+	
+	if ((r == 0) && ck && (line < ck->pos)) {
+		ERROR("Input ended before the checkpoint position (line %lu)\n",
+			ck->pos);
+		r = -1;
+	}
+	
+	if ((r == 0) && rec.open) {
+		l.chain = rec.ip;
+		l.nchain = rec.nip;
+		trace_dispatch(t, &l, rec.line, select, fn, ctx);
+	}
+	
+	MEM_CLEAR(rec.line, rec.nline);
+	MEM_CLEAR(rec.ip, rec.nip);
+	
+	reader_close(rd);
+	
+	return r;
+}
+
+// ************************************************************************
+// perf script fails on a -F field that an event did not record: those that
+// are optional are only asked for if every event has them (all of them if
+// perf.data cannot be read here)
+// ************************************************************************
+static void trace_fields(struct trace *t, char *buff, size_t size)
+{
+	struct perfdata pd;
+	uint64_t type = (uint64_t)-1;
+	
+	if (perfdata_open(&pd, t->path) == 0) {
+		type = perfdata_sample_type(&pd);
+		perfdata_close(&pd);
+	}
+	
+	snprintf(buff, size, "comm,pid,tid%s%s%s,event,ip,sym,symoff,dso"
+		"%s%s%s%s",
+		(type & PD_SAMPLE_CPU) ? ",cpu" : "",
+		(type & PD_SAMPLE_TIME) ? ",time" : "",
+		(type & PD_SAMPLE_PERIOD) ? ",period" : "",
+		(type & PD_SAMPLE_BRANCH_STACK) ? ",brstack" : "",
+		(type & PD_SAMPLE_ADDR) ? ",addr" : "",
+		(type & PD_SAMPLE_DATA_SRC) ? ",data_src" : "",
+		(type & (PD_SAMPLE_WEIGHT | PD_SAMPLE_WEIGHT_STRUCT))
+			? ",weight" : "");
+}
+
+static int trace_script(struct trace *t, char *range,
+	trace_fn fn, void *ctx)
+{
+	char *argv[24];
+	int k = 0;
+	
+	argv[k++] = "perf";
+	argv[k++] = "script";
+	
+	if (t->path) {
+		argv[k++] = "-i";
+		argv[k++] = t->path;
+	}
+	
+	// slice ranges already lie within the --time filter
+	struct filter *f = t->filter;
+	char *time = range;
+	
+	if ((time == NULL) && f && f->time)
+		time = f->time;
+	
+	if (time) {
+		argv[k++] = "--time";
+		argv[k++] = time;
+	}
+	
+	if (f && f->pid) {
+		argv[k++] = "--pid";
+		argv[k++] = f->pid;
+	}
+	
+	if (f && f->tid) {
+		argv[k++] = "--tid";
+		argv[k++] = f->tid;
+	}
+	
+	if (f && f->comm) {
+		argv[k++] = "--comms";
+		argv[k++] = f->comm;
+	}
+	
+	if (f && f->dsos) {
+		argv[k++] = "--dsos";
+		argv[k++] = f->dsos;
+	}
+	
+	char fields[128];
+	
+	trace_fields(t, fields, sizeof(fields));
+	
+	argv[k++] = "--show-mmap-events";
+	argv[k++] = "--show-task-events";
+	argv[k++] = "-F";
+	argv[k++] = fields;
+	argv[k++] = NULL;
+
+	int fd = pipe_in(argv);
+	
+	if (fd < 0)
+		return -1;
+	
+	struct reader rd;
+	
+	if (reader_open(&rd, fd)) {
+		close(fd);
+		return -1;
+	}
+	
+	return trace_read(t, &rd, range == NULL, NULL, fn, ctx);
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+struct slice {
+	struct trace t;
+	
+	// window [t0, t1], in ns; the first and last slices are open
+	uint64_t t0, t1;
+	char range[64];
+	
+	struct tally tally;
+	pthread_t thread;
+	int r;
+};
+
+static void *trace_slice_run(void *arg)
+{
+	struct slice *s = arg;
+	
+	s->r = trace_script(&s->t, s->range, trace_tally, &s->tally);
+	
+	return NULL;
+}
+
+// ************************************************************************
+static int trace_slice_view(struct prog *p, struct slice *s, int k)
+{
+	prog_unmap(p);
+	
+	// mmaps and task events are taken from the slice whose window they
+	// fall in (perf script may or may not filter them by time); the
+	// current slice contributes everything it has seen from its window
+	// start on
+	for (int j = 0; j <= k; j++) {
+		uint64_t w0 = (j == 0) ? 0 : s[j].t0;
+		uint64_t w1 = (j == k) ? (uint64_t)-1 : s[j + 1].t0;
+		
+		if (tally_spaces(&s[j].tally, p, w0, w1))
+			return -1;
+	}
+	
+	return 0;
+}
+
+// ************************************************************************
+static int trace_load_sliced(struct trace *t, struct prog *p)
+{
+	struct perfdata pd;
+	uint64_t t0, t1;
+	
+	if (perfdata_open(&pd, t->path))
+		return 1;
+	
+	int r = perfdata_time_range(&pd, &t0, &t1);
+	
+	perfdata_close(&pd);
+	
+	// within a --time filter, the first and last slices are bounded too
+	struct filter *f = t->filter;
+	int bounded = (f && f->time);
+	
+	if (bounded) {
+		if (t0 < f->t0)
+			t0 = f->t0;
+		if (t1 > f->t1)
+			t1 = f->t1;
+	}
+	
+	if (r || (t1 <= t0))
+		return 1;
+	
+	int n = t->jobs;
+	struct slice *s = calloc(n, sizeof(struct slice));
+	
+	if (s == NULL) {
+		ERROR("calloc(%d slices): %s\n", n, strerror(errno));
+		return -1;
+	}
+	
+	uint64_t step = (t1 - t0) / n + 1;
+	
+	for (int k = 0; k < n; k++) {
+		s[k].t = *t;
+		s[k].t.lines = 0;
+		s[k].t.parsed = 0;
+		s[k].t0 = t0 + k * step;
+		s[k].t1 = s[k].t0 + step - 1;
+		
+		if (s[k].t1 > t1)
+			s[k].t1 = t1;
+		
+		// perf script --time bounds are inclusive
+		char lo[32] = "";
+		char hi[32] = "";
+		
+		if ((k > 0) || bounded)
+			snprintf(lo, sizeof(lo), "%lu.%09lu",
+				s[k].t0 / 1000000000, s[k].t0 % 1000000000);
+		if ((k < n - 1) || bounded)
+			snprintf(hi, sizeof(hi), "%lu.%09lu",
+				s[k].t1 / 1000000000, s[k].t1 % 1000000000);
+		
+		snprintf(s[k].range, sizeof(s[k].range), "%s,%s", lo, hi);
+		
+		s[k].r = tally_init(&s[k].tally);
+		s[k].tally.primary = p->event[0];
+		s[k].tally.prog = p;
+	}
+	
+	MESSAGE("  %d slices of %lu ms\n", n, step / 1000000);
+	
+	int started = 0;
+	
+	for (int k = 0; k < n; k++) {
+		if (s[k].r)
+			break;
+		
+		if (pthread_create(&s[k].thread, NULL,
+				trace_slice_run, &s[k])) {
+			ERROR("pthread_create(): %s\n", strerror(errno));
+			break;
+		}
+		
+		started++;
+	}
+	
+	r = (started < n) ? -1 : 0;
+	
+	for (int k = 0; k < started; k++) {
+		pthread_join(s[k].thread, NULL);
+		
+		r |= s[k].r;
+		t->lines += s[k].t.lines;
+		t->parsed += s[k].t.parsed;
+	}
+	
+	// merge, each slice with its own view of the address spaces
+	for (int k = 0; (r == 0) && (k < n); k++) {
+		MESSAGE("  [slice %d: %zd samples, %zd branches]\n", k,
+			s[k].tally.nsample, s[k].tally.nbranch);
+		
+		r |= trace_slice_view(p, s, k);
+		r |= tally_replay(&s[k].tally, p);
+	}
+	
+	if (r == 0)
+		r = trace_slice_view(p, s, n - 1);
+	
+	for (int k = 0; k < n; k++)
+		tally_clear(&s[k].tally);
+	
+	free(s);
+	
+	return r;
+}
+
+// ************************************************************************
+static int trace_load_script(struct trace *t, struct prog *p)
+{
+	if (t->jobs > 1) {
+		int r = trace_load_sliced(t, p);
+		
+		if (r <= 0)
+			return r;
+		
+		MESSAGE("  note: no time range, not slicing\n");
+	}
+	
+	return trace_script(t, NULL, trace_apply, p);
+}
+
+// ************************************************************************
+// Replay of saved perf script output, possibly compressed (recognized by
+// its magic number, and piped through the matching decompressor)
+// ************************************************************************
+#define TRACE_MAGIC		6
+
+static char **trace_decompressor(const char *head, size_t n)
+{
+	static char *gzip[] = { "gzip", "-dc", NULL };
+	static char *zstd[] = { "zstd", "-dcq", NULL };
+	static char *xz[] = { "xz", "-dc", NULL };
+	static char *bzip2[] = { "bzip2", "-dc", NULL };
+	
+	if ((n >= 2) && (memcmp(head, "\x1f\x8b", 2) == 0))
+		return gzip;
+	if ((n >= 4) && (memcmp(head, "\x28\xb5\x2f\xfd", 4) == 0))
+		return zstd;
+	if ((n >= 6) && (memcmp(head, "\xfd" "7zXZ\0", 6) == 0))
+		return xz;
+	if ((n >= 3) && (memcmp(head, "BZh", 3) == 0))
+		return bzip2;
+	
+	return NULL;
+}
+
+static int trace_load_replay(struct trace *t, struct prog *p)
+{
+	int fd = 0;
+	
+	if (strcmp(t->script, "-") != 0)
+		fd = open(t->script, O_RDONLY | O_CLOEXEC);
+	
+	if (fd < 0) {
+		ERROR("%s: %s\n", t->script, strerror(errno));
+		return -1;
+	}
+	
+	struct reader rd;
+	
+	if (reader_open(&rd, fd)) {
+		close(fd);
+		return -1;
+	}
+	
+	char *head;
+	size_t n;
+	
+	if (reader_peek(&rd, TRACE_MAGIC, &head, &n)) {
+		reader_close(&rd);
+		return -1;
+	}
+	
+	char **argv = trace_decompressor(head, n);
+	pid_t child = -1;
+	
+	if (argv) {
+		MESSAGE("  note: decompressing with %s\n", argv[0]);
+		
+		// the decompressor reads the whole stream: from the start of
+		// a file, or, from a pipe, the bytes already read first
+		int in = fd;
+		
+		if (lseek(fd, 0, SEEK_SET) != 0)
+			in = pipe_feed(fd, head, n);
+		
+		int out = (in < 0) ? -1 : pipe_in_child(argv, in, &child);
+		
+		if ((in >= 0) && (in != fd))
+			close(in);
+		
+		reader_close(&rd);
+		
+		if (out < 0)
+			return -1;
+		
+		if (reader_open(&rd, out)) {
+			close(out);
+			return -1;
+		}
+	}
+	
+	// with checkpoints, events are tallied
+	int r = (t->ck)
+		? trace_read(t, &rd, 1, t->filter, trace_tally, &t->ck->tally)
+		: trace_read(t, &rd, 1, t->filter, trace_apply, p);
+	
+	// a truncated or corrupt file just ends the stream: the exit status
+	// of the decompressor tells
+	if ((child > 0) && pipe_wait(child, argv[0]))
+		r = -1;
+	
+	return r;
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+static int trace_load_native(struct trace *t, struct prog *p)
+{
+	struct perfdata pd;
+	
+	if (perfdata_open(&pd, t->path)) {
+		MESSAGE("  note: falling back to perf script\n");
+		return 1;
+	}
+	
+	// resumed: the stats go on from the checkpoint
+	pd.ck = t->ck;
+	pd.records = t->lines;
+	pd.samples = t->parsed;
+	
+	int r = perfdata_load(&pd, p);
+	
+	t->lines = pd.records;
+	t->parsed = pd.samples;
+	
+	perfdata_close(&pd);
+	
+	return r;
+}
+
+// ************************************************************************
+// Checkpoints (see checkpoint.h): the input and the options that change
+// what is tallied identify the load to resume. Loads are not sliced.
+// ************************************************************************
+#define TRACE_ID		8192
+
+static void trace_id(struct trace *t, struct prog *p, char *id)
+{
+	struct filter *f = t->filter;
+	char *input = (t->script) ? t->script : t->path;
+	struct stat st;
+	
+	if ((strcmp(input, "-") == 0) || stat(input, &st)) {
+		st.st_size = 0;
+		st.st_mtime = 0;
+	}
+	
+	snprintf(id, TRACE_ID, "%s %s %lu %lu %s %lu %lu %lu",
+		(t->script) ? "replay" : (t->native) ? "native" : "script",
+		input, (uint64_t)st.st_size, (uint64_t)st.st_mtime,
+		p->event[0], p->bucket, (f) ? f->keep : 0,
+		(f) ? f->max : 0);
+	
+	if (f == NULL)
+		return;
+	
+	char *opt[] = { f->pid, f->tid, f->comm, f->time, f->dsos };
+	
+	for (size_t k = 0; k < sizeof(opt) / sizeof(opt[0]); k++) {
+		size_t n = strlen(id);
+		
+		snprintf(id + n, TRACE_ID - n, " %s", (opt[k]) ? opt[k] : "-");
+	}
+}
+
+static int trace_load_checkpoint(struct trace *t, struct prog *p)
+{
+	struct checkpoint ck;
+	char id[TRACE_ID];
+	
+	if (t->jobs > 1)
+		MESSAGE("  note: checkpoints, not slicing\n");
+	
+	trace_id(t, p, id);
+	
+	if (checkpoint_open(&ck, t->checkpoint, t->resume, id, p))
+		return -1;
+	
+	t->ck = &ck;
+	t->lines = ck.lines;
+	t->parsed = ck.parsed;
+	
+	// the native reader maps the address spaces again even if the
+	// input was read entirely (they are not saved)
+	int r = 1;
+	
+	if (t->script)
+		r = (ck.complete) ? 0 : trace_load_replay(t, p);
+	else if (t->native)
+		r = trace_load_native(t, p);
+	
+	if (r > 0)
+		r = (ck.complete) ? 0
+			: trace_script(t, NULL, trace_tally, &ck.tally);
+	
+	if ((r == 0) && !ck.complete)
+		r = checkpoint_save(&ck, ck.pos, t->lines, t->parsed, 1);
+	
+	if (r == 0)
+		r = checkpoint_replay(&ck);
+	
+	checkpoint_close(&ck);
+	t->ck = NULL;
+	
+	return r;
+}
+
+// ************************************************************************
+// --max-samples: the sample rate follows from the sample count of perf.data
+// ************************************************************************
+static int trace_rate(struct trace *t)
+{
+	struct filter *f = t->filter;
+	struct perfdata pd;
+	uint64_t n;
+	
+	if (t->script || perfdata_open(&pd, t->path)) {
+		MESSAGE("  note: no sample count, not limiting samples\n");
+		return 0;
+	}
+	
+	int r = perfdata_sample_count(&pd, &n);
+	
+	perfdata_close(&pd);
+	
+	if (r)
+		return -1;
+	
+	double rate = (double)f->max / n;
+	
+	if (rate < f->rate)
+		filter_rate(f, rate);
+	
+	return 0;
+}
+
+// ************************************************************************
+// Timeline: buckets start at the perf.data time range (within --time).
+// Automatic widths are whole ms, for about TRACE_BUCKETS buckets; without
+// a time range (replays, streams) they are TRACE_BUCKET_DEFAULT ms.
+// ************************************************************************
+#define TRACE_BUCKETS		100
+#define TRACE_BUCKET_DEFAULT	1000
+
+static void trace_origin(struct trace *t, struct prog *p)
+{
+	struct filter *f = t->filter;
+	struct perfdata pd;
+	uint64_t t0, t1;
+	
+	if (p->bucket == 0)
+		return;
+	
+	int r = (t->script || perfdata_open(&pd, t->path)) ? -1 : 0;
+	
+	if (r == 0) {
+		r = perfdata_time_range(&pd, &t0, &t1);
+		perfdata_close(&pd);
+	}
+	
+	if ((r == 0) && f && f->time) {
+		if (t0 < f->t0)
+			t0 = f->t0;
+		if (t1 > f->t1)
+			t1 = f->t1;
+	}
+	
+	if ((r == 0) && (t1 >= t0))
+		p->time0 = t0;
+	
+	if (p->bucket != PROG_BUCKET_AUTO)
+		return;
+	
+	if (p->time0 == PROG_TIME_NONE) {
+		p->bucket = TRACE_BUCKET_DEFAULT * 1000000;
+	} else {
+		uint64_t ms = (t1 - t0) / TRACE_BUCKETS / 1000000 + 1;
+		p->bucket = ms * 1000000;
+	}
+}
+
+// ************************************************************************
+// 
+// ************************************************************************
+int trace_load(struct trace *t, struct prog *p)
+{
+	MESSAGE("%s:\n", (t->script) ? t->script : t->path);
+	
+	int r = 1;
+	
+	if (t->filter && t->filter->max && trace_rate(t))
+		return -1;
+	
+	if (t->filter && (t->filter->rate < 1.0))
+		MESSAGE("  keeping %.3g%% of the samples\n",
+			100.0 * t->filter->rate);
+	
+	if (t->live) {
+		t->native = 0;
+		t->jobs = 1;
+		t->due = trace_clock() + t->live * 1000000000;
+	}
+	
+	trace_origin(t, p);
+	
+	if (p->bucket)
+		MESSAGE("  timeline: buckets of %lu ms\n", p->bucket / 1000000);
+	
+	if (t->checkpoint)
+		r = trace_load_checkpoint(t, p);
+	else if (t->script)
+		r = trace_load_replay(t, p);
+	else if (t->native && (t->jobs <= 1))
+		r = trace_load_native(t, p);
+	
+	if (r > 0)
+		r = trace_load_script(t, p);
+	
+	if (r == 0)
+		r = prog_kernel(p);
+	
+	if (r == 0)
+		r = prog_sync(p);
+	
+	MESSAGE("  samples: parsed: %9zd, ignored: %9zd\n",
+		t->parsed, t->lines - t->parsed);
+	MESSAGE("             hits: %9ld,  unspec: %9ld, orphans: %9ld\n",
+		p->samples - p->unspec - p->orphans,
+		p->unspec, p->orphans);
+	MESSAGE(" branches:   hits: %9zd,  unspec: %9zd, orphans: %9zd\n",
+		p->branch_samples - p->branch_unspec - p->branch_orphans,
+		p->branch_unspec, p->branch_orphans);
+	MESSAGE("     insn:         %9zd\n", p->insn);
 	
+	diag_report();
 	
 	return r;
 }
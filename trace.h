@@ -16,8 +16,41 @@
 */
 #ifndef TRACE_H
 #define TRACE_H
+#include <stddef.h>
+#include <stdint.h>
 #include "prog.h"
 
-int trace_load(struct prog *prog, char *path);
+struct checkpoint;
+
+struct trace {
+	// options
+	char *path;
+	int native;
+	int jobs;
+	struct filter *filter;
+	
+	// saved perf script output ('-': stdin), instead of running perf
+	char *script;
+	
+	// live mode: snapshot() is called every live seconds while the
+	// stream is read (no slicing, and perf script as the reader)
+	uint64_t live;
+	int (*snapshot)(void *ctx);
+	void *snapshot_ctx;
+	uint64_t due;
+	
+	// checkpoint file (NULL: none), saved to periodically, and resumed
+	// from if resume (see checkpoint.h)
+	char *checkpoint;
+	int resume;
+	struct checkpoint *ck;
+	
+	// stats
+	size_t lines, parsed;
+};
+
+void trace_init(struct trace *t);
+
+int trace_load(struct trace *t, struct prog *p);
 
 #endif